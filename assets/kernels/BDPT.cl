@@ -10,6 +10,7 @@
 #include "lights.cl"
 #include "cameras.cl"
 #include "image_samplers.cl"
+#include "ray_cones.cl"
 
 // The implementation is based on the content of the excellent book "Physically Based Rendering From Theory to Implementation Third Edition".
 
@@ -59,7 +60,7 @@ inline float convertVertexDensity(float pdf, __global const RTBDPTVertex* thisVe
 	return pdf * invDistSq;
 }
 
-float evalVertexPdfLight(const Scene* scene, __global const Vertex* thisVertex, __global const Vertex* v)
+float evalVertexPdfLight(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const Vertex* thisVertex, __global const Vertex* v)
 {
 	float3 w = v->interaction.p - thisVertex->interaction.p;
 	float lenSq = dot(w, w);
@@ -79,7 +80,7 @@ float evalVertexPdfLight(const Scene* scene, __global const Vertex* thisVertex,
 	{ 
 		float pdfPos;
 		float pdfDir;
-		evalLightPdfLe(thisVertex->lightIdx, scene, w, thisVertex->interaction.gn, &pdfPos, &pdfDir);
+		evalLightPdfLe(thisVertex->lightIdx, scene TEXTURE_IMAGE_ARGS, w, thisVertex->interaction.gn, &pdfPos, &pdfDir);
 		pdf = pdfDir * invDistSq;
 	}
 
@@ -89,10 +90,10 @@ float evalVertexPdfLight(const Scene* scene, __global const Vertex* thisVertex,
 	return pdf;
 }
 
-float evalVertexPdf(const Scene* scene, __global const Vertex* thisVertex, __global const Vertex* prevVertex, __global const Vertex* nextVertex)
+float evalVertexPdf(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const Vertex* thisVertex, __global const Vertex* prevVertex, __global const Vertex* nextVertex)
 {
 	if (thisVertex->type == RT_BDPT_LIGHT_VERTEX)
-		return evalVertexPdfLight(scene, thisVertex, nextVertex);
+		return evalVertexPdfLight(scene TEXTURE_IMAGE_ARGS, thisVertex, nextVertex);
 
 	// Compute directions for next and prev vertices
 	float3 wn = nextVertex->interaction.p - thisVertex->interaction.p;
@@ -124,7 +125,7 @@ float evalVertexPdf(const Scene* scene, __global const Vertex* thisVertex, __glo
 			wp /= sqrt(lenSq);
 		}
 		RTInteraction inter = thisVertex->interaction;
-		pdf = evaluateMaterialPdf(scene, thisVertex->materialIdx, wp, wn, &inter, BSDF_ALL);
+		pdf = evaluateMaterialPdf(scene TEXTURE_IMAGE_ARGS, thisVertex->materialIdx, wp, wn, &inter, BSDF_ALL);
 	}
 
 	// Convert solid angle density to per unit area density.
@@ -132,7 +133,7 @@ float evalVertexPdf(const Scene* scene, __global const Vertex* thisVertex, __glo
 }
 
 
-float evalVertexPdfLightOrigin(const Scene* scene, __global const Vertex* thisVertex, float3 nextVertexPos)
+float evalVertexPdfLightOrigin(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const Vertex* thisVertex, float3 nextVertexPos)
 { 
 	float3 w = nextVertexPos - thisVertex->interaction.p;
 	float lenSq = dot(w, w);
@@ -143,13 +144,15 @@ float evalVertexPdfLightOrigin(const Scene* scene, __global const Vertex* thisVe
 
 	if (isVertexInfiniteLight(thisVertex))
 	{ 
-		return 0.0f;
+		// Only environment lights have a non-delta directional distribution
+		__global const RTLight* light = scene->lights + thisVertex->lightIdx;
+		return light->type == RT_ENVIRONMENT_LIGHT ? light->choicePdf * evalEnvironmentLightPdf(light, scene TEXTURE_IMAGE_ARGS, -w) : 0.0f;
 	}
 
 	float pdfPos;
 	float pdfDir;
 
-	evalLightPdfLe(thisVertex->lightIdx, scene, w, thisVertex->interaction.gn, &pdfPos, &pdfDir);
+	evalLightPdfLe(thisVertex->lightIdx, scene TEXTURE_IMAGE_ARGS, w, thisVertex->interaction.gn, &pdfPos, &pdfDir);
 	return pdfPos * scene->lights[thisVertex->lightIdx].choicePdf;
 }
 
@@ -169,6 +172,8 @@ inline RTBDPTVertex createCameraVertex(float3 p, float3 throughput)
 	v.lightIdx = RT_INVALID_ID;
 	v.pdfRev = 0.0f;
 	v.pdfFwd = 0.0f;
+	v.coneWidth = 0.0f;
+	v.coneSpreadAngle = 0.0f;
 
 	return v;
 }
@@ -187,6 +192,9 @@ inline RTBDPTVertex createLightVertex(int lightIdx, float3 p, float3 lightNormal
 	v.lightIdx = lightIdx;
 	v.pdfRev = 0.0f;
 	v.pdfFwd = pdfFwd;
+	// The emission is not bounded by a cone, light subpaths start with a ray
+	v.coneWidth = 0.0f;
+	v.coneSpreadAngle = 0.0f;
 
 	if ((lightFlags & RT_LIGHT_FLAG_DELTA_DIRECTION) != 0)
 		v.flags = RT_BDPT_VERTEX_FLAG_DELTA_LIGHT | RT_BDPT_VERTEX_FLAG_INFINITE_LIGHT;
@@ -196,6 +204,9 @@ inline RTBDPTVertex createLightVertex(int lightIdx, float3 p, float3 lightNormal
 
 		if ((lightFlags & RT_LIGHT_FLAG_DELTA_POSITION) != 0)
 			v.flags |= RT_BDPT_VERTEX_FLAG_DELTA_LIGHT;
+
+		if ((lightFlags & RT_LIGHT_FLAG_INFINITE) != 0)
+			v.flags |= RT_BDPT_VERTEX_FLAG_INFINITE_LIGHT;
 	}
 
 	return v;
@@ -212,7 +223,7 @@ inline void setSurfaceVertex(__global Vertex* thisVertex, RTInteraction interact
 	thisVertex->pdfFwd = convertVertexDensity(pdfFwd, prevVertex, thisVertex);
 }
 
-inline float3 evalVertex_f(const Scene* scene, __global const Vertex* thisVertex, __global const Vertex* nextVertex, TransportMode mode)
+inline float3 evalVertex_f(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const Vertex* thisVertex, __global const Vertex* nextVertex, TransportMode mode)
 { 
 	float3 wi = nextVertex->interaction.p - thisVertex->interaction.p;
 	float lenSq = dot(wi, wi);
@@ -225,7 +236,7 @@ inline float3 evalVertex_f(const Scene* scene, __global const Vertex* thisVertex
 	if (thisVertex->type == RT_BDPT_SURFACE_VERTEX)
 	{ 
 		RTInteraction si = thisVertex->interaction;
-		float3 f = evaluateMaterial(scene, thisVertex->materialIdx, si.wo, wi, &si, mode);
+		float3 f = evaluateMaterial(scene TEXTURE_IMAGE_ARGS, thisVertex->materialIdx, si.wo, wi, &si, mode);
 
 		return f * computeShadingNormalCorrection(&si, si.wo, wi, mode);
 	}
@@ -237,6 +248,66 @@ inline float3 evalVertex_f(const Scene* scene, __global const Vertex* thisVertex
 // ************************************ End vertex defines
 
 
+inline void initCameraSubpath(const Scene* scene TEXTURE_IMAGE_PARAMS, int2 gid, int image_width, int image_height, int bufferIdx, int maxDepth,
+							  __global RTBDPTVertex* restrict cameraVertices,
+							  __global RTRay* restrict cameraRays,
+							  __global float3* restrict cameraThroughputs,
+							  __global float* restrict cameraFwdPdfs,
+							  __global int* restrict cameraVertexCounts)
+{
+	const int cameraVertexIdx = bufferIdx * (maxDepth + 2);
+	__global const RTPinholeCamera* camera = scene->camera;
+
+	cameraVertexCounts[bufferIdx] = 1;
+
+	// Set camera ray
+	const float2 r = (float2)(1.0f / image_width, 1.0f / image_height);
+	const float2 uv = (float2)(gid.x * r.x, gid.y * r.y);
+	setRay(cameraRays + bufferIdx, camera->pos, RT_MAX_TRACE_DISTANCE, lerpDirection(camera->r00, camera->r10, camera->r11, camera->r01, uv.x, uv.y));
+
+	// Set initial camera vertex
+	cameraVertices[cameraVertexIdx] = createCameraVertex(camera->pos, (float3)(1.0f));
+	cameraVertices[cameraVertexIdx].coneSpreadAngle = camera->pixelSpreadAngle;
+	cameraThroughputs[bufferIdx] = cameraVertices[cameraVertexIdx].throughput;
+	float pdfPos;
+	float pdfDir;
+	evalPinholeCameraPdfWe(camera, camera->pos, cameraRays[bufferIdx].d.xyz, &pdfPos, &pdfDir); 
+	cameraFwdPdfs[bufferIdx] = pdfDir;
+}
+
+inline void initLightSubpath(const Scene* scene TEXTURE_IMAGE_PARAMS, Sampler* sampler, int pathIdx, int maxDepth,
+							 __global RTBDPTVertex* restrict lightVertices,
+							 __global RTRay* restrict lightRays,
+							 __global float3* restrict lightThroughputs,
+							 __global float* restrict lightFwdPdfs,
+							 __global int* restrict lightVertexCounts)
+{
+	const int lightVertexIdx = pathIdx * (maxDepth + 1);
+
+	lightVertexCounts[pathIdx] = 1;
+
+	// Set light ray
+	float lightPdf;
+	int chosenLightIdx = sampleLightIdx(scene TEXTURE_IMAGE_ARGS, getSample1D(sampler), &lightPdf);
+	float2 u1 = getSample2D(sampler);
+	float2 u2 = getSample2D(sampler);
+	float3 rayOrigin;
+	float3 rayDirection;
+	float3 lightNormal;
+	float pdfPos;
+	float pdfDir;
+	float3 Le = sampleLightLe(chosenLightIdx, scene TEXTURE_IMAGE_ARGS, u1, u2, &rayOrigin, &rayDirection, &lightNormal, &pdfPos, &pdfDir);
+	setRay(lightRays + pathIdx, rayOrigin, RT_MAX_TRACE_DISTANCE, rayDirection);
+
+	// Set light vertex
+	lightVertices[lightVertexIdx] = createLightVertex(chosenLightIdx, rayOrigin, lightNormal, Le, pdfPos * lightPdf, scene->lights[chosenLightIdx].flags);
+	lightVertices[lightVertexIdx].pdfPos = pdfPos;
+
+	float pdf = lightPdf * pdfPos * pdfDir;
+	lightThroughputs[pathIdx] = isNearZero(pdf) ? (float3)(0.0f) : Le * absDot(lightNormal, rayDirection) / pdf;
+	lightFwdPdfs[pathIdx] = pdfDir;
+}
+
 __kernel void GenerateStartVertices(
 									SCENE_PARAMS,
 									IMAGE_PARAMS,
@@ -261,10 +332,6 @@ __kernel void GenerateStartVertices(
 		return;
 
 	const int bufferIdx = gid.x + gid.y * image_width;
-	const int cameraVertexIdx = bufferIdx * (maxDepth + 2);
-	const int lightVertexIdx = bufferIdx * (maxDepth + 1);
-
-	__global const RTPinholeCamera* camera = scene_camera;
 
 	const int radianceBufferIdx = bufferIdx * 3;
 	finalRadianceBuffer[radianceBufferIdx] = 0.0f;
@@ -274,43 +341,98 @@ __kernel void GenerateStartVertices(
 	MAKE_SCENE(scene);
 	MAKE_SAMPLER(sampler, bufferIdx, 0);
 
-	cameraVertexCounts[bufferIdx] = 1;
-	lightVertexCounts[bufferIdx] = 1;
+	initCameraSubpath(&scene TEXTURE_IMAGE_ARGS, gid, image_width, image_height, bufferIdx, maxDepth, cameraVertices, cameraRays, cameraThroughputs, cameraFwdPdfs, cameraVertexCounts);
+	initLightSubpath(&scene TEXTURE_IMAGE_ARGS, &sampler, bufferIdx, maxDepth, lightVertices, lightRays, lightThroughputs, lightFwdPdfs, lightVertexCounts);
+}
 
-	// ***** Handle Camera *****
-	// Set camera ray
-	const float2 r = (float2)(1.0f / image_width, 1.0f / image_height);
-	const float2 uv = (float2)(gid.x * r.x, gid.y * r.y);
-	setRay(cameraRays + bufferIdx, camera->pos, RT_MAX_TRACE_DISTANCE, lerpDirection(camera->r00, camera->r10, camera->r11, camera->r01, uv.x, uv.y));
+// ************************************ Light vertex cache
+// The light vertex cache variant traces numLightPaths light subpaths per frame independently of the image resolution.
+// Light subpath generation kernels (GenerateLightStartVertices, GenerateSecondaryVertices, BuildLightVertexCache)
+// are launched on a numLightPaths x 1 grid, i.e. with image_width = numLightPaths and image_height = 1.
+// All connectible light vertices (except the vertices on the lights) are collected in a cache. Each camera vertex is
+// connected to numCacheConnections randomly chosen cached vertices.
+
+__kernel void GenerateCameraStartVertices(SCENE_PARAMS,
+										  IMAGE_PARAMS,
+										  int integrator_frameNum,
+										  int maxDepth,
+										  __global RTBDPTVertex* restrict cameraVertices,
+										  __global RTRay* restrict cameraRays,
+										  __global float3* restrict cameraThroughputs,
+										  __global float* restrict cameraFwdPdfs,
+										  __global int* restrict cameraVertexCounts,
+										  __global float* restrict finalRadianceBuffer)
+{
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
 
-	// Set initial camera vertex
-	cameraVertices[cameraVertexIdx] = createCameraVertex(camera->pos, (float3)(1.0f));
-	cameraThroughputs[bufferIdx] = cameraVertices[cameraVertexIdx].throughput;
-	float pdfPos;
-	float pdfDir;
-	evalPinholeCameraPdfWe(camera, camera->pos, cameraRays[bufferIdx].d.xyz, &pdfPos, &pdfDir); 
-	cameraFwdPdfs[bufferIdx] = pdfDir;
+	if (gid.x >= image_width || gid.y >= image_height)
+		return;
 
-	// ***** Handle Light *****
-	// Set light ray
-	int chosenLightIdx = ((uint)floor(getSample1D(&sampler) * scene.numLights)) % scene.numLights;
-	float lightPdf = scene.lights[chosenLightIdx].choicePdf;
-	float2 u1 = getSample2D(&sampler);
-	float2 u2 = getSample2D(&sampler);
-	float3 rayOrigin;
-	float3 rayDirection;
-	float3 lightNormal;
-	float3 Le = sampleLightLe(chosenLightIdx, &scene, u1, u2, &rayOrigin, &rayDirection, &lightNormal, &pdfPos, &pdfDir);
-	setRay(lightRays + bufferIdx, rayOrigin, RT_MAX_TRACE_DISTANCE, rayDirection);
+	const int bufferIdx = gid.x + gid.y * image_width;
 
-	// Set light vertex
-	lightVertices[lightVertexIdx] = createLightVertex(chosenLightIdx, rayOrigin, lightNormal, Le, pdfPos * lightPdf, scene.lights[chosenLightIdx].flags);
-	lightVertices[lightVertexIdx].pdfPos = pdfPos;
+	const int radianceBufferIdx = bufferIdx * 3;
+	finalRadianceBuffer[radianceBufferIdx] = 0.0f;
+	finalRadianceBuffer[radianceBufferIdx + 1] = 0.0f;
+	finalRadianceBuffer[radianceBufferIdx + 2] = 0.0f;
+
+	MAKE_SCENE(scene);
+	initCameraSubpath(&scene TEXTURE_IMAGE_ARGS, gid, image_width, image_height, bufferIdx, maxDepth, cameraVertices, cameraRays, cameraThroughputs, cameraFwdPdfs, cameraVertexCounts);
+}
+
+__kernel void GenerateLightStartVertices(SCENE_PARAMS,
+										 IMAGE_PARAMS,
+										 int integrator_frameNum,
+										 int maxDepth,
+										 __global RTBDPTVertex* restrict lightVertices,
+										 __global RTRay* restrict lightRays,
+										 __global float3* restrict lightThroughputs,
+										 __global float* restrict lightFwdPdfs,
+										 __global int* restrict lightVertexCounts,
+										 __global int* restrict lightVertexCacheSize)
+{
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
+
+	if (gid.x >= image_width || gid.y >= image_height)
+		return;
+
+	const int pathIdx = gid.x + gid.y * image_width;
 
-	lightThroughputs[bufferIdx] = Le * absDot(lightNormal, rayDirection) / (lightPdf * pdfPos * pdfDir);
-	lightFwdPdfs[bufferIdx] = pdfDir;
+	// The cache is filled in BuildLightVertexCache after the subpaths are traced
+	if (pathIdx == 0)
+		*lightVertexCacheSize = 0;
+
+	MAKE_SCENE(scene);
+	MAKE_SAMPLER(sampler, pathIdx, 0);
+
+	initLightSubpath(&scene TEXTURE_IMAGE_ARGS, &sampler, pathIdx, maxDepth, lightVertices, lightRays, lightThroughputs, lightFwdPdfs, lightVertexCounts);
 }
 
+__kernel void BuildLightVertexCache(IMAGE_PARAMS,
+									int maxDepth,
+									__global const RTBDPTVertex* restrict lightVertices,
+									__global const int* restrict lightVertexCounts,
+									__global int* restrict lightVertexCache,
+									volatile __global int* lightVertexCacheSize)
+{
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
+
+	if (gid.x >= image_width || gid.y >= image_height)
+		return;
+
+	const int pathIdx = gid.x + gid.y * image_width;
+	const int lightVertexStartIdx = pathIdx * (maxDepth + 1);
+	const int lightVertexCount = lightVertexCounts[pathIdx];
+
+	// Vertices on the light (s = 1) are sampled explicitly for every camera vertex
+	for (int i = 1; i < lightVertexCount; ++i)
+	{
+		if (isVertexConnectible(lightVertices + lightVertexStartIdx + i))
+			lightVertexCache[atomic_inc(lightVertexCacheSize)] = lightVertexStartIdx + i;
+	}
+}
+
+// ************************************ End light vertex cache
+
 /**
 * Note: If isCameraPath = true then TransportMode is Radiance otherwise Importance.
 */
@@ -353,6 +475,17 @@ __kernel void GenerateSecondaryVertices(SCENE_PARAMS,
 	// Handle case where ray didn't hit anything or is inactive
     if (isRayInactive(rays + bufferIdx) || shapeIdx == RT_INVALID_ID || primitiveIdx == RT_INVALID_ID || scene.shapes[shapeIdx].materialId == RT_INVALID_ID)
 	{ 
+		// Camera rays escaping the scene end on the environment light. The vertex is only used for s = 0 strategies.
+		if (isCameraPath && isRayActive(rays + bufferIdx) && shapeIdx == RT_INVALID_ID && scene.environmentLightIdx != RT_INVALID_ID)
+		{ 
+			float3 d = rays[bufferIdx].d.xyz;
+			__global Vertex* curVertex = vertices + vertexIdx;
+			*curVertex = createLightVertex(scene.environmentLightIdx, rays[bufferIdx].o.xyz + d, -d, throughputs[bufferIdx], fwdPdfs[bufferIdx], RT_LIGHT_FLAG_INFINITE);
+			curVertex->flags = RT_BDPT_VERTEX_FLAG_INFINITE_LIGHT;
+			curVertex->interaction.wo = -d;
+			vertexCounts[bufferIdx]++;
+		}
+
 		setRayInactive(rays + bufferIdx);
 		return;
 	}
@@ -362,17 +495,28 @@ __kernel void GenerateSecondaryVertices(SCENE_PARAMS,
 		vertexCounts[bufferIdx]++;
 
 		// Initialize RTInteraction:
-		RTInteraction si = computeSurfaceInteraction(&scene, &isect);
+		RTInteraction si = computeSurfaceInteraction(&scene TEXTURE_IMAGE_ARGS, &isect);
 		si.wo = -rays[bufferIdx].d.xyz;
 		const bool isBackfacing = dot(si.gn, si.wo) < 0.0f;
 		si.traceErrorOffset = isBackfacing ? -RT_TRACE_OFFSET : RT_TRACE_OFFSET;
 		int materialIdx = scene.shapes[shapeIdx].materialId;
-		applyNormalMapping(&scene, materialIdx, &si);
 
-		// Create vertex:
 		__global Vertex* curVertex = vertices + vertexIdx;
 		__global Vertex* prevVertex = vertices + vertexIdx - 1;
 
+		// Primary camera hits are read from the base mip level because the jittered camera rays already filter them
+		float uvToWorldScale;
+		float curvature;
+		computeRayConeTriangleInfo(&scene TEXTURE_IMAGE_ARGS, &isect, &uvToWorldScale, &curvature);
+		RTRayCone cone = makeRayCone(prevVertex->coneWidth, prevVertex->coneSpreadAngle);
+		propagateRayCone(&cone, isect.uvwt.w);
+		if (!isCameraPath || curDepth > 1)
+			setRayConeTextureFootprint(&cone, uvToWorldScale, &si);
+
+		applyNormalMapping(&scene TEXTURE_IMAGE_ARGS, materialIdx, &si);
+
+		// Create vertex:
+
 		TransportMode transportMode = isCameraPath ? TRANSPORT_MODE_RADIANCE : TRANSPORT_MODE_IMPORTANCE;
 
 		float pdfFwd = fwdPdfs[bufferIdx];
@@ -389,13 +533,13 @@ __kernel void GenerateSecondaryVertices(SCENE_PARAMS,
 				curVertex->pdfFwd *= absDot(rays[bufferIdx].d.xyz, si.gn);
 			}
 
-			prevVertex->pdfFwd = 0.0f;
+			prevVertex->pdfFwd = evalVertexPdfLightOrigin(&scene TEXTURE_IMAGE_ARGS, prevVertex, si.p);
 		}
 
 		// No need to compute the next bounce if maxDepth was reached
 		if (curDepth == (maxDepth + isCameraPath))
 		{
-			if (hasMaterialNonDeltaComponents(&scene, materialIdx, &si))
+			if (hasMaterialNonDeltaComponents(&scene TEXTURE_IMAGE_ARGS, materialIdx, &si))
 				curVertex->flags |= RT_BDPT_VERTEX_FLAG_CONNECTIBLE;
 
 			setRayInactive(rays + bufferIdx);
@@ -409,7 +553,7 @@ __kernel void GenerateSecondaryVertices(SCENE_PARAMS,
 		BxDFType sampledType;
 		int numNonDeltaTypes;
 		float2 bsdfSample = getSample2D(&sampler);
-		float3 f = sampleMaterial(&scene, materialIdx, &si, bsdfSample, transportMode, BSDF_ALL, wo, &wi, &pdfFwd, &numNonDeltaTypes, &sampledType);
+		float3 f = sampleMaterial(&scene TEXTURE_IMAGE_ARGS, materialIdx, &si, bsdfSample, transportMode, BSDF_ALL, wo, &wi, &pdfFwd, &numNonDeltaTypes, &sampledType);
 		curVertex->interaction = si;
 		
 		if (numNonDeltaTypes > 0)
@@ -424,6 +568,10 @@ __kernel void GenerateSecondaryVertices(SCENE_PARAMS,
 
 		// Update throughput
 		throughputs[bufferIdx] *= f * absDot(wi, si.sn) / pdfFwd;
+
+		spreadRayCone(&cone, &scene TEXTURE_IMAGE_ARGS, materialIdx, &si, curvature, sampledType);
+		curVertex->coneWidth = cone.width;
+		curVertex->coneSpreadAngle = cone.spreadAngle;
 		float pdfRev;
 
 		// If a specular bsdf was sampled store this information in vertex and adjust pdfs for delta distribution.
@@ -436,7 +584,7 @@ __kernel void GenerateSecondaryVertices(SCENE_PARAMS,
 		else
 		{ 
 			// Compute reverse pdf by swapping wo, wi
-			pdfRev = evaluateMaterialPdf(&scene, materialIdx, wi, wo, &si, BSDF_ALL);
+			pdfRev = evaluateMaterialPdf(&scene TEXTURE_IMAGE_ARGS, materialIdx, wi, wo, &si, BSDF_ALL);
 		}
 
 		// Set ray for next bounce
@@ -457,6 +605,141 @@ __kernel void GenerateSecondaryVertices(SCENE_PARAMS,
 	}
 }
 
+/**
+* Connects a light subpath vertex to a point sampled on the camera (t = 1). The pixel the contribution belongs to
+* is stored in the sampled camera vertex. Returns the unweighted contribution and sets the visibility ray.
+*/
+float3 prepareCameraConnection(const Scene* scene TEXTURE_IMAGE_PARAMS, int image_width, int image_height, __global const Vertex* lightVertex,
+							   __global Vertex* sampled, __global RTRay* connectionRay)
+{
+	if (!isVertexConnectible(lightVertex))
+	{
+		setRayInactive(connectionRay);
+		return (float3)(0.0f);
+	}
+
+	RTInteraction lightInter = lightVertex->interaction;
+	float3 wi;
+	float pdf;
+	float2 normalizedImagePos;
+	float3 importance = samplePinholeCameraWi(scene->camera, &lightInter, &wi, &pdf, &normalizedImagePos);
+
+	if (pdf <= 0.0f || isBlack(importance))
+	{
+		setRayInactive(connectionRay);
+		return (float3)(0.0f);
+	}
+
+	*sampled = createCameraVertex(scene->camera->pos, importance / pdf);
+
+	// Store the new buffer idx in sampled vertex. It will be used in the next pass to write to the correct pixel.
+	int2 imgPos = (int2)((int)(floor(normalizedImagePos.x * image_width + 0.5f)), (int)(floor(normalizedImagePos.y * image_height + 0.5f)));
+
+	imgPos.x = clamp(imgPos.x, 0, image_width - 1);
+	imgPos.y = clamp(imgPos.y, 0, image_height - 1);
+
+	sampled->radianceBufferIdx = imgPos.x + imgPos.y * image_width;
+	float3 L = lightVertex->throughput * sampled->throughput * evalVertex_f(scene TEXTURE_IMAGE_ARGS, lightVertex, sampled, TRANSPORT_MODE_IMPORTANCE);
+	if (isVertexOnSurface(lightVertex))
+		L *= absDot(wi, lightInter.sn);
+
+	// Set visibility ray
+	float3 rayOrigin = lightInter.p + lightInter.gn * lightVertex->interaction.traceErrorOffset;
+	float dist = distance(rayOrigin, scene->camera->pos);
+	setRay(connectionRay, rayOrigin, dist, (scene->camera->pos - rayOrigin) / dist);
+
+	return L;
+}
+
+/**
+* Connects a camera subpath vertex to a point sampled on a light (s = 1). The sampled light vertex is written to sampled.
+* Returns the unweighted contribution and sets the visibility ray.
+*/
+float3 prepareLightConnection(const Scene* scene TEXTURE_IMAGE_PARAMS, Sampler* sampler, __global const Vertex* cameraVertex, 
+							  __global Vertex* sampled, __global RTRay* connectionRay)
+{
+	if (!isVertexConnectible(cameraVertex))
+	{
+		setRayInactive(connectionRay);
+		return (float3)(0.0f);
+	}
+
+	float3 wi;
+	float pdf;
+
+	// The light BVH choice only affects the contribution estimate. MIS weights use the shading point independent
+	// light origin density of the light subpath which keeps them consistent across strategies.
+	float lightPdf;
+	RTInteraction camInter = cameraVertex->interaction;
+	int chosenLightIdx = sampleLightBVH(scene TEXTURE_IMAGE_ARGS, camInter.p, camInter.sn, getSample1D(sampler), &lightPdf);
+	float2 u = getSample2D(sampler);
+
+	if (chosenLightIdx == RT_INVALID_ID)
+	{
+		setRayInactive(connectionRay);
+		return (float3)(0.0f);
+	}
+
+	float3 lightNormal;
+	float3 lightPosition;
+	float3 Li = sampleLightLi(chosenLightIdx, scene TEXTURE_IMAGE_ARGS, &camInter, u, &lightPosition, &lightNormal, &wi, &pdf, connectionRay);
+
+	if (isNearZero(pdf) || isBlack(Li))
+	{
+		setRayInactive(connectionRay);
+		return (float3)(0.0f);
+	}
+
+	*sampled = createLightVertex(chosenLightIdx, lightPosition, lightNormal, Li / (lightPdf * pdf), 0.0f, scene->lights[chosenLightIdx].flags);
+	sampled->pdfFwd = evalVertexPdfLightOrigin(scene TEXTURE_IMAGE_ARGS, sampled, cameraVertex->interaction.p);
+
+	float3 f = evaluateMaterial(scene TEXTURE_IMAGE_ARGS, cameraVertex->materialIdx, camInter.wo, wi, &camInter, TRANSPORT_MODE_RADIANCE);
+	// Shading normal correction isn't necessary here because in the radiance transport mode it is just multiplied by 1.
+	float3 L = cameraVertex->throughput * sampled->throughput * f;
+	if (isVertexOnSurface(cameraVertex))
+		L *= absDot(wi, camInter.sn);
+
+	return L;
+}
+
+/**
+* Connects a camera subpath vertex to a light subpath vertex (s > 1, t > 1).
+* Returns the unweighted contribution without visibility and sets the visibility ray.
+*/
+float3 prepareVertexConnection(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const Vertex* cameraVertex, __global const Vertex* lightVertex, __global RTRay* connectionRay)
+{
+	float3 L = (float3)(0.0f);
+
+	if (!isVertexConnectible(cameraVertex) || !isVertexConnectible(lightVertex))
+	{
+		setRayInactive(connectionRay);
+		return L;
+	}
+
+	float3 lvf = evalVertex_f(scene TEXTURE_IMAGE_ARGS, lightVertex, cameraVertex, TRANSPORT_MODE_IMPORTANCE);
+	float3 cvf = evalVertex_f(scene TEXTURE_IMAGE_ARGS, cameraVertex, lightVertex, TRANSPORT_MODE_RADIANCE);
+
+	float3 lp = lightVertex->interaction.p + lightVertex->interaction.gn * lightVertex->interaction.traceErrorOffset;
+	float3 cp = cameraVertex->interaction.p + cameraVertex->interaction.gn * cameraVertex->interaction.traceErrorOffset;
+	float3 w = cp - lp;
+	float sqDist = dot(w, w);
+	float dist = sqrt(sqDist);
+	w /= dist;
+
+	if (isNotNearZero(sqDist))
+	{ 
+		float g = absDot(cameraVertex->interaction.sn, w) * absDot(lightVertex->interaction.sn, w) / sqDist;
+		L = lightVertex->throughput * cameraVertex->throughput * lvf * cvf * g;
+	}
+
+	if (isNotBlack(L))
+		setRay(connectionRay, lp, dist, w);
+	else
+		setRayInactive(connectionRay);
+
+	return L;
+}
+
 __kernel void PrepareConnections(SCENE_PARAMS,
 							IMAGE_PARAMS,
 							int integrator_frameNum,
@@ -518,121 +801,21 @@ __kernel void PrepareConnections(SCENE_PARAMS,
 			}
 			else if (t == 1)
 			{ 
-				// Connect a sampled camera point to light subpath
+				// Note: Min value for s must be 2 here since t == 1
 				__global Vertex* lightVertex = lightVertices + lightVertexStartIdx + s - 1;
-
-				if (isVertexConnectible(lightVertex))
-				{
-					RTInteraction lightInter = lightVertex->interaction;
-					float3 wi;
-					float pdf;
-					float2 normalizedImagePos = (float2)((float)(gid.x) / image_width, (float)(gid.y) / image_height);
-					float3 importance = samplePinholeCameraWi(scene_camera, &lightInter, &wi, &pdf, &normalizedImagePos);
-					if (pdf > 0.0f && isNotBlack(importance))
-					{
-						// Note: Min value for s must be 2 here since t == 1
-						const int sampledCameraVertexIdx = bufferIdx * maxDepth + s - 2;
-						__global Vertex* sampled = sampledCameraVertices + sampledCameraVertexIdx;
-
-						*sampled = createCameraVertex(scene_camera->pos, importance / pdf);
-
-						// Store the new buffer idx in sampled vertex. It will be used in the next pass to write to the correct pixel.
-						int2 imgPos = (int2)((int)(floor(normalizedImagePos.x * image_width + 0.5f)), (int)(floor(normalizedImagePos.y * image_height + 0.5f)));
-
-						imgPos.x = clamp(imgPos.x, 0, image_width - 1);
-						imgPos.y = clamp(imgPos.y, 0, image_height - 1);
-
-						sampled->radianceBufferIdx = imgPos.x + imgPos.y * image_width;
-						radianceBuffer[curConnectionRayIdx].xyz = lightVertex->throughput * sampled->throughput * evalVertex_f(&scene, lightVertex, sampled, TRANSPORT_MODE_IMPORTANCE); 
-						if (isVertexOnSurface(lightVertex))
-							radianceBuffer[curConnectionRayIdx] *= absDot(wi, lightInter.sn);
-						
-						// Set visibility ray						
-						float3 rayOrigin = lightInter.p + lightInter.gn * lightVertex->interaction.traceErrorOffset;
-						float dist = distance(rayOrigin, scene_camera->pos);
-						setRay(connectionRays + curConnectionRayIdx, rayOrigin, dist, (scene_camera->pos - rayOrigin) / dist);
-					}
-					else
-					{
-						setRayInactive(connectionRays + curConnectionRayIdx);
-					}
-				}
-				else
-				{
-					setRayInactive(connectionRays + curConnectionRayIdx);
-				}
+				__global Vertex* sampled = sampledCameraVertices + bufferIdx * maxDepth + s - 2;
+				radianceBuffer[curConnectionRayIdx].xyz = prepareCameraConnection(&scene TEXTURE_IMAGE_ARGS, image_width, image_height, lightVertex, sampled, connectionRays + curConnectionRayIdx);
 			}
 			else if (s == 1)
 			{
-				// Connect a sampled light point to camera subpath
-				if (isVertexConnectible(cameraVertex))
-				{
-					float3 wi;
-					float pdf;
-
-					int chosenLightIdx = min((int)floor(getSample1D(&sampler) * scene.numLights), scene.numLights - 1);
-					float lightPdf = scene.lights[chosenLightIdx].choicePdf;
-					RTInteraction camInter = cameraVertex->interaction;
-					float3 lightNormal;
-					float3 lightPosition;
-					float3 Li = sampleLightLi(chosenLightIdx, &scene, &camInter, getSample2D(&sampler), &lightPosition, &lightNormal, &wi, &pdf, connectionRays + curConnectionRayIdx);
-
-					if (isNotNearZero(pdf) && isNotBlack(Li))
-					{ 
-						// Note: Since s == 1, the min value for t must be 2
-						const int sampledLightVertexIdx = bufferIdx * maxDepth + t - 2;
-						__global Vertex* sampled = sampledLightVertices + sampledLightVertexIdx;
-						float pdfFwd = evalVertexPdfLightOrigin(&scene, sampled, cameraVertex->interaction.p);
-						*sampled = createLightVertex(chosenLightIdx, lightPosition, lightNormal, Li / (lightPdf * pdf), pdfFwd, scene.lights[chosenLightIdx].flags);
-
-						float3 f = evaluateMaterial(&scene, cameraVertex->materialIdx, camInter.wo, wi, &camInter, TRANSPORT_MODE_RADIANCE);
-						// Shading normal correction isn't necessary here because in the radiance transport mode it is just multiplied by 1.
-						//f *= computeShadingNormalCorrection(&cameraVertex->interaction, cameraVertex->interaction.wo, wi, TRANSPORT_MODE_RADIANCE);
-						radianceBuffer[curConnectionRayIdx].xyz = cameraVertex->throughput * sampled->throughput * f;
-						if (isVertexOnSurface(cameraVertex))
-							radianceBuffer[curConnectionRayIdx].xyz *= absDot(wi, camInter.sn);
-					}
-					else
-					{ 
-						setRayInactive(connectionRays + curConnectionRayIdx);
-					}
-				}
+				// Note: Since s == 1, the min value for t must be 2
+				__global Vertex* sampled = sampledLightVertices + bufferIdx * maxDepth + t - 2;
+				radianceBuffer[curConnectionRayIdx].xyz = prepareLightConnection(&scene TEXTURE_IMAGE_ARGS, &sampler, cameraVertex, sampled, connectionRays + curConnectionRayIdx);
 			}
 			else
 			{
 				__global Vertex* lightVertex = lightVertices + lightVertexStartIdx + s - 1;
-				
-				if (isVertexConnectible(cameraVertex) && isVertexConnectible(lightVertex))
-				{ 
-					float3 lvf = evalVertex_f(&scene, lightVertex, cameraVertex, TRANSPORT_MODE_IMPORTANCE);
-					float3 cvf = evalVertex_f(&scene, cameraVertex, lightVertex, TRANSPORT_MODE_RADIANCE);
-
-					float3 lp = lightVertex->interaction.p + lightVertex->interaction.gn * lightVertex->interaction.traceErrorOffset;
-					float3 cp = cameraVertex->interaction.p + cameraVertex->interaction.gn * cameraVertex->interaction.traceErrorOffset;
-					float3 w = cp - lp;
-					float sqDist = dot(w, w);
-					float dist = sqrt(sqDist);
-					w /= dist;
-
-					if (isNotNearZero(sqDist))
-					{ 
-						float g = absDot(cameraVertex->interaction.sn, w) * absDot(lightVertex->interaction.sn, w) / sqDist;
-						radianceBuffer[curConnectionRayIdx].xyz = lightVertex->throughput * cameraVertex->throughput * lvf * cvf * g;
-					}
-
-					if (isNotBlack(radianceBuffer[curConnectionRayIdx].xyz))
-					{ 
-						setRay(connectionRays + curConnectionRayIdx, lp, dist, w);
-					}
-					else
-					{ 
-						setRayInactive(connectionRays + curConnectionRayIdx);
-					}
-				}
-				else
-				{ 
-					setRayInactive(connectionRays + curConnectionRayIdx);
-				}
+				radianceBuffer[curConnectionRayIdx].xyz = prepareVertexConnection(&scene TEXTURE_IMAGE_ARGS, cameraVertex, lightVertex, connectionRays + curConnectionRayIdx);
 			}
 
 			++curConnectionRayIdx;
@@ -651,6 +834,137 @@ inline float remap0(float f)
 	return f == 0.0f ? 1.0f : f;
 }
 
+/**
+* Number of samples taken per camera path for each kind of strategy. In the regular BDPT every strategy is sampled once. 
+* The light vertex cache variant traces fewer light paths than there are pixels (lightTracing = numLightPaths / numPixels) 
+* and connects to randomly chosen cached vertices (connection = expected samples per strategy). 
+* Vertex merging (merging = numLightPaths) is disabled if merging is zero.
+*/
+typedef struct
+{
+	float lightTracing;
+	float connection;
+	float merging;
+	// Area of the merging disk
+	float mergeArea;
+} StrategySampleCounts;
+
+inline StrategySampleCounts makeBDPTSampleCounts()
+{
+	StrategySampleCounts counts;
+	counts.lightTracing = 1.0f;
+	counts.connection = 1.0f;
+	counts.merging = 0.0f;
+	counts.mergeArea = 0.0f;
+	return counts;
+}
+
+inline float getStrategySampleCount(int s, int t, const StrategySampleCounts* counts)
+{
+	if (t == 1)
+		return counts->lightTracing;
+
+	return s > 1 ? counts->connection : 1.0f;
+}
+
+/**
+* Computes the sum of the sample count weighted pdfs of all strategies that can generate the path of the strategy (s, t) divided by its pdf. 
+* cameraPath and lightPath point to the first vertex of the subpaths. If t == 1 or s == 1 the sampled vertex replaces the last camera or light vertex. 
+* The subpaths are not modified which allows multiple work items to connect to the same light subpath.
+*/
+float computeStrategyPdfRatioSum(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const Vertex* cameraPath, __global const Vertex* lightPath, __global const Vertex* sampled,
+								 int s, int t, const StrategySampleCounts* counts)
+{
+	__global const Vertex* pt = t == 1 ? sampled : cameraPath + t - 1;
+	__global const Vertex* qs = s == 0 ? 0 : (s == 1 ? sampled : lightPath + s - 1);
+	__global const Vertex* ptPrev = t > 1 ? cameraPath + t - 2 : 0;
+	__global const Vertex* qsPrev = s > 1 ? lightPath + s - 2 : 0;
+
+	// Reverse pdfs of the connection vertices and their predecessors for the current strategy
+	float ptPdfRev = s > 0 ? evalVertexPdf(scene TEXTURE_IMAGE_ARGS, qs, qsPrev, pt) : evalVertexPdfLightOrigin(scene TEXTURE_IMAGE_ARGS, pt, ptPrev->interaction.p);
+	float ptPrevPdfRev = 0.0f;
+	float qsPdfRev = 0.0f;
+	float qsPrevPdfRev = 0.0f;
+
+	if (ptPrev)
+		ptPrevPdfRev = s > 0 ? evalVertexPdf(scene TEXTURE_IMAGE_ARGS, pt, qs, ptPrev) : evalVertexPdfLight(scene TEXTURE_IMAGE_ARGS, pt, ptPrev);
+
+	if (qs)
+		qsPdfRev = evalVertexPdf(scene TEXTURE_IMAGE_ARGS, pt, ptPrev, qs);
+
+	if (qsPrev)
+		qsPrevPdfRev = evalVertexPdf(scene TEXTURE_IMAGE_ARGS, qs, pt, qsPrev);
+
+	const float mergeWeight = counts->merging * counts->mergeArea;
+	float sum = getStrategySampleCount(s, t, counts);
+
+	// Consider connection strategies along camera subpath. The connection vertices are treated as non-delta.
+	// Merging at a vertex replaces its area density with the merge area, merging requires at least two light vertices.
+	float ri = 1.0f;
+	for (int i = t - 1; i > 0; --i)
+	{
+		__global const Vertex* v = cameraPath + i;
+		float pdfRev = i == t - 1 ? ptPdfRev : (i == t - 2 ? ptPrevPdfRev : v->pdfRev);
+		bool isDelta = i != t - 1 && isVertexDelta(v);
+
+		if (!isDelta && s + t - i >= 2)
+			sum += mergeWeight * ri * pdfRev;
+
+		ri *= remap0(pdfRev) / remap0(v->pdfFwd);
+
+		if (!isDelta && !isVertexDelta(v - 1))
+			sum += ri * getStrategySampleCount(s + t - i, i, counts);
+	}
+
+	// Consider connection strategies along light subpath
+	ri = 1.0f;
+	for (int i = s - 1; i >= 0; --i)
+	{
+		__global const Vertex* v = i == s - 1 ? qs : lightPath + i;
+		float pdfRev = i == s - 1 ? qsPdfRev : (i == s - 2 ? qsPrevPdfRev : v->pdfRev);
+		bool isDelta = i != s - 1 && isVertexDelta(v);
+
+		if (!isDelta && i > 0 && t + s - i >= 2)
+			sum += mergeWeight * ri * pdfRev;
+
+		ri *= remap0(pdfRev) / remap0(v->pdfFwd);
+
+		bool isDeltaLightVertex = i > 0 ? isVertexDelta(lightPath + i - 1) : isVertexDeltaLight(s == 1 ? qs : lightPath);
+		if (!isDelta && !isDeltaLightVertex)
+			sum += ri * getStrategySampleCount(i, t + s - i, counts);
+	}
+
+	return sum;
+}
+
+/**
+* Computes the balance heuristic weight of the connection strategy (s, t). See computeStrategyPdfRatioSum for the parameters.
+*/
+float computeMISWeight(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const Vertex* cameraPath, __global const Vertex* lightPath, __global const Vertex* sampled,
+					   int s, int t, const StrategySampleCounts* counts)
+{
+	if ((s + t) == 2)
+		return 1.0f;
+
+	return getStrategySampleCount(s, t, counts) / computeStrategyPdfRatioSum(scene TEXTURE_IMAGE_ARGS, cameraPath, lightPath, sampled, s, t, counts);
+}
+
+/**
+* Computes the balance heuristic weight of merging the last camera vertex (t > 1) with the last light vertex (s > 1). 
+* The weight is computed relative to the connection of the last camera vertex with light vertex s - 1.
+*/
+float computeMergeMISWeight(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const Vertex* cameraPath, __global const Vertex* lightPath, 
+							int s, int t, const StrategySampleCounts* counts)
+{
+	__global const Vertex* pt = cameraPath + t - 1;
+	__global const Vertex* qsPrev = lightPath + s - 2;
+
+	float pdf = evalVertexPdf(scene TEXTURE_IMAGE_ARGS, qsPrev, s > 2 ? qsPrev - 1 : 0, pt);
+	float sum = computeStrategyPdfRatioSum(scene TEXTURE_IMAGE_ARGS, cameraPath, lightPath, lightPath, s - 1, t, counts);
+
+	return counts->merging * counts->mergeArea * pdf / sum;
+}
+
 void atomicAdd_f(volatile __global float *addr, float val)
 {
 	union {
@@ -725,7 +1039,7 @@ __kernel void ConnectVertices(SCENE_PARAMS,
 				if (isVertexLight(cameraVertex))
 				{ 
 					// wo is prevVertex->p() - curVertex->p();
-					float3 Le = evalLightLe(scene.lights + cameraVertex->lightIdx, cameraVertex->interaction.gn, cameraVertex->interaction.wo);
+					float3 Le = evalLightLe(&scene TEXTURE_IMAGE_ARGS, scene.lights + cameraVertex->lightIdx, cameraVertex->interaction.gn, cameraVertex->interaction.wo);
 					tempRadianceBuffer[curConnectionRayIdx].xyz = Le * cameraVertex->throughput;
 				}
 			}
@@ -737,142 +1051,18 @@ __kernel void ConnectVertices(SCENE_PARAMS,
 			}
 
 			// Compute MIS weight
-			float misWeight = 1.0f;
+			float misWeight = 0.0f;
 
+			if (isNotBlack(tempRadianceBuffer[curConnectionRayIdx].xyz))
 			{
-				if (isBlack(tempRadianceBuffer[curConnectionRayIdx].xyz))
-					misWeight = 0.0f;
-				else if ((s + t) == 2)
-					misWeight = 1.0f;
-				else
-				{ 
-					float sumRi = 0.0f;
-
-					__global Vertex* qs = s > 0 ? (lightVertices + lightVertexStartIdx + s - 1) : 0;
-					__global Vertex* pt = t > 0 ? (cameraVertices + camVertexStartIdx + t - 1) : 0;
-					__global Vertex* qsPrev = s > 1 ? (lightVertices + lightVertexStartIdx + s - 2) : 0;
-					__global Vertex* ptPrev = t > 1 ? (cameraVertices + camVertexStartIdx + t - 2) : 0;
-
-					// Vertices need to be temporarily updated for the current t,s combination
-					Vertex vBackup;
-					if (s == 1)
-					{ 
-						const int sampledLightVertexIdx = bufferIdx * maxDepth + t - 2;
-						__global Vertex* sampled = sampledLightVertices + sampledLightVertexIdx;
-
-						vBackup = *qs;
-						*qs = *sampled;
-					}
-					else if (t == 1)
-					{ 
-						const int sampledCameraVertexIdx = bufferIdx * maxDepth + s - 2;
-						__global Vertex* sampled = sampledCameraVertices + sampledCameraVertexIdx;
-
-						vBackup = *pt;
-						*pt = *sampled;
-					}
-
-					int qsFlagsBackup;
-					int ptFlagsBackup;
-					float ptPdfRevBackup;
-					float qsPdfRevBackup;
-					float ptPrevPdfRevBackup;
-					float qsPrevPdfRevBackup;
-
-					if (pt)
-					{ 
-						ptFlagsBackup = pt->flags;
-						// Remove delta flag
-						pt->flags &= ~RT_BDPT_VERTEX_FLAG_DELTA;
-					}
-
-					if (qs)
-					{ 
-						qsFlagsBackup = qs->flags;
-						qs->flags &= ~RT_BDPT_VERTEX_FLAG_DELTA;
-					}
-
-					if (pt)
-					{ 
-						ptPdfRevBackup = pt->pdfRev;
-						pt->pdfRev = s > 0 ? evalVertexPdf(&scene, qs, qsPrev, pt) : evalVertexPdfLightOrigin(&scene, pt, ptPrev->interaction.p);
-					}
-
-					if (ptPrev)
-					{ 
-						ptPrevPdfRevBackup = ptPrev->pdfRev;
-						ptPrev->pdfRev = s > 0 ? evalVertexPdf(&scene, pt, qs, ptPrev) : evalVertexPdfLight(&scene, pt, ptPrev);
-					}
-
-					if (qs)
-					{ 
-						qsPdfRevBackup = qs->pdfRev;
-						qs->pdfRev = evalVertexPdf(&scene, pt, ptPrev, qs);
-					}
-
-					if (qsPrev)
-					{ 
-						qsPrevPdfRevBackup = qsPrev->pdfRev;
-						qsPrev->pdfRev = evalVertexPdf(&scene, qs, pt, qsPrev);
-					}
-
-					// Consider connection strategies along camera subpath
-					float ri = 1.0f;
-					for (int i = t - 1; i > 0; --i)
-					{
-						int idx = camVertexStartIdx + i;
-						ri *= remap0(cameraVertices[idx].pdfRev) / remap0(cameraVertices[idx].pdfFwd);
-						if (!isVertexDelta(cameraVertices + idx) && !isVertexDelta(cameraVertices + idx - 1))
-							sumRi += ri;
-					}
-
-					// Consider connection strategies along light subpath
-					ri = 1.0f;
-					for (int i = s - 1; i >= 0; --i)
-					{
-						int idx = lightVertexStartIdx + i;
-						ri *= remap0(lightVertices[idx].pdfRev) / remap0(lightVertices[idx].pdfFwd);
-						bool isDeltaLightVertex = i > 0 ? (isVertexDelta(lightVertices + idx - 1)) : isVertexDeltaLight(lightVertices + lightVertexStartIdx); 
-						if (!isVertexDelta(lightVertices + idx) && !isDeltaLightVertex)
-							sumRi += ri;
-					}
-
-					// Restore vertex data
-					{ 
-						if (pt)
-						{ 
-							pt->flags = ptFlagsBackup;
-							pt->pdfRev = ptPdfRevBackup;
-						}
-
-						if (qs)
-						{ 
-							qs->flags = qsFlagsBackup;
-							qs->pdfRev = qsPdfRevBackup;
-						}
-
-						if (ptPrev)
-						{ 
-							ptPrev->pdfRev = ptPrevPdfRevBackup;
-						}
-
-						if (qsPrev)
-						{ 
-							qsPrev->pdfRev = qsPrevPdfRevBackup;
-						}
-
-						if (s == 1)
-						{ 
-							*qs = vBackup;
-						}
-						else if (t == 1)
-						{
-							*pt = vBackup;
-						}
-					}
-
-					misWeight = 1.0f / (1.0f + sumRi);
-				}
+				__global const Vertex* sampled = 0;
+				if (s == 1)
+					sampled = sampledLightVertices + bufferIdx * maxDepth + t - 2;
+				else if (t == 1)
+					sampled = sampledCameraVertices + bufferIdx * maxDepth + s - 2;
+
+				StrategySampleCounts counts = makeBDPTSampleCounts();
+				misWeight = computeMISWeight(&scene TEXTURE_IMAGE_ARGS, cameraVertices + camVertexStartIdx, lightVertices + lightVertexStartIdx, sampled, s, t, &counts);
 			}
 
 #ifdef SHOW_REGULAR_PATH_TRACER_RESULTS
@@ -912,6 +1102,435 @@ __kernel void ConnectVertices(SCENE_PARAMS,
 	}
 }
 
+// ************************************ Light vertex cache connections
+
+/**
+* The expected number of samples per camera vertex for each connection strategy s > 1 is based on the probability
+* numLightPaths / cacheSize of choosing a cached vertex of a specific depth if all light subpaths have the same length.
+* Vertex merging is disabled if mergeRadius is zero.
+*/
+inline StrategySampleCounts makeLightVertexCacheSampleCounts(int numPixels, int numLightPaths, int numCacheConnections, int cacheSize, float mergeRadius)
+{
+	StrategySampleCounts counts;
+	counts.lightTracing = (float)(numLightPaths) / numPixels;
+	counts.connection = cacheSize > 0 ? (float)(numCacheConnections) * numLightPaths / cacheSize : 0.0f;
+	counts.merging = mergeRadius > 0.0f ? (float)(numLightPaths) : 0.0f;
+	counts.mergeArea = PI * mergeRadius * mergeRadius;
+	return counts;
+}
+
+/**
+* Connects all light subpath vertices (s > 1) to the camera (t = 1). Launched on the light path grid.
+* The connections of a light subpath are stored at pathIdx * maxDepth + s - 2.
+*/
+__kernel void PrepareLightTracingConnections(SCENE_PARAMS,
+											 IMAGE_PARAMS,
+											 int integrator_frameNum,
+											 int maxDepth,
+											 int numLightPaths,
+											 __global const RTBDPTVertex* restrict lightVertices,
+											 __global const int* restrict lightVertexCounts,
+											 __global RTBDPTVertex* restrict sampledCameraVertices,
+											 __global RTRay* restrict connectionRays,
+											 __global float4* radianceBuffer)
+{
+	const int pathIdx = get_global_id(0);
+
+	if (pathIdx >= numLightPaths)
+		return;
+
+	const int lightVertexStartIdx = pathIdx * (maxDepth + 1);
+	const int lightVertexCount = lightVertexCounts[pathIdx];
+
+	MAKE_SCENE(scene);
+
+	for (int s = 2; s <= maxDepth + 1; ++s)
+	{
+		const int connectionIdx = pathIdx * maxDepth + s - 2;
+		radianceBuffer[connectionIdx].xyz = (float3)(0.0f);
+
+		if (s > lightVertexCount)
+		{
+			setRayInactive(connectionRays + connectionIdx);
+			continue;
+		}
+
+		radianceBuffer[connectionIdx].xyz = prepareCameraConnection(&scene TEXTURE_IMAGE_ARGS, image_width, image_height, lightVertices + lightVertexStartIdx + s - 1, 
+																	sampledCameraVertices + connectionIdx, connectionRays + connectionIdx);
+	}
+}
+
+__kernel void ConnectLightTracingVertices(SCENE_PARAMS,
+										  IMAGE_PARAMS,
+										  int integrator_frameNum,
+										  int maxDepth,
+										  int numLightPaths,
+										  int numCacheConnections,
+										  float mergeRadius,
+										  __global const RTBDPTVertex* restrict lightVertices,
+										  __global const int* restrict lightVertexCounts,
+										  __global const RTBDPTVertex* restrict sampledCameraVertices,
+										  __global const int* restrict lightVertexCacheSize,
+										  __global RTRay* restrict connectionRays,
+										  __global const int* connectionVisibilities,
+										  __global const float4* tempRadianceBuffer,
+										  __global float* finalRadianceBuffer)
+{
+	const int pathIdx = get_global_id(0);
+
+	if (pathIdx >= numLightPaths)
+		return;
+
+	const int lightVertexStartIdx = pathIdx * (maxDepth + 1);
+	const int lightVertexCount = lightVertexCounts[pathIdx];
+	const StrategySampleCounts counts = makeLightVertexCacheSampleCounts(image_width * image_height, numLightPaths, numCacheConnections, 
+																		 *lightVertexCacheSize, mergeRadius);
+
+	MAKE_SCENE(scene);
+
+	for (int s = 2; s <= lightVertexCount; ++s)
+	{
+		const int connectionIdx = pathIdx * maxDepth + s - 2;
+
+		if (!isRayActive(connectionRays + connectionIdx) || connectionVisibilities[connectionIdx] != -1)
+			continue;
+
+		float3 L = tempRadianceBuffer[connectionIdx].xyz;
+		if (isBlack(L))
+			continue;
+
+		__global const Vertex* sampled = sampledCameraVertices + connectionIdx;
+		L *= computeMISWeight(&scene TEXTURE_IMAGE_ARGS, 0, lightVertices + lightVertexStartIdx, sampled, s, 1, &counts) / counts.lightTracing;
+
+		const int radianceBufferIdx = sampled->radianceBufferIdx * 3;
+		atomicAdd_f(finalRadianceBuffer + radianceBufferIdx, L.x);
+		atomicAdd_f(finalRadianceBuffer + radianceBufferIdx + 1, L.y);
+		atomicAdd_f(finalRadianceBuffer + radianceBufferIdx + 2, L.z);
+	}
+}
+
+/**
+* For every camera vertex (t > 1) one light sample (s = 1) and numCacheConnections cached light vertices are connected.
+* The connections of a camera vertex are stored at (bufferIdx * maxDepth + t - 2) * (numCacheConnections + 1), the first one is the light sample.
+*/
+__kernel void PrepareCacheConnections(SCENE_PARAMS,
+									  IMAGE_PARAMS,
+									  int integrator_frameNum,
+									  int maxDepth,
+									  int numCacheConnections,
+									  __global const RTBDPTVertex* restrict cameraVertices,
+									  __global const int* restrict cameraVertexCounts,
+									  __global const RTBDPTVertex* restrict lightVertices,
+									  __global const int* restrict lightVertexCache,
+									  __global const int* restrict lightVertexCacheSize,
+									  __global RTBDPTVertex* restrict sampledLightVertices,
+									  __global int* restrict cacheConnectionVertices,
+									  __global RTRay* restrict connectionRays,
+									  __global float4* radianceBuffer)
+{
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
+
+	if (gid.x >= image_width || gid.y >= image_height)
+		return;
+
+	const int bufferIdx = gid.x + gid.y * image_width;
+	const int camVertexStartIdx = bufferIdx * (maxDepth + 2);
+	const int cameraVertexCount = cameraVertexCounts[bufferIdx];
+	const int cacheSize = *lightVertexCacheSize;
+
+	MAKE_SCENE(scene);
+	MAKE_SAMPLER(sampler, bufferIdx, 2 * maxDepth + 3);
+
+	for (int t = 2; t <= maxDepth + 1; ++t)
+	{
+		int connectionIdx = (bufferIdx * maxDepth + t - 2) * (numCacheConnections + 1);
+		__global const Vertex* cameraVertex = cameraVertices + camVertexStartIdx + t - 1;
+
+		for (int i = 0; i <= numCacheConnections; ++i)
+		{
+			radianceBuffer[connectionIdx + i].xyz = (float3)(0.0f);
+			cacheConnectionVertices[connectionIdx + i] = RT_INVALID_ID;
+		}
+
+		if (t > cameraVertexCount)
+		{
+			for (int i = 0; i <= numCacheConnections; ++i)
+				setRayInactive(connectionRays + connectionIdx + i);
+
+			continue;
+		}
+
+		// Connect a sampled light point to camera subpath
+		radianceBuffer[connectionIdx].xyz = prepareLightConnection(&scene TEXTURE_IMAGE_ARGS, &sampler, cameraVertex, 
+																   sampledLightVertices + bufferIdx * maxDepth + t - 2, connectionRays + connectionIdx);
+		++connectionIdx;
+
+		// Connect to randomly chosen cached light vertices
+		for (int i = 0; i < numCacheConnections; ++i, ++connectionIdx)
+		{
+			float u = getSample1D(&sampler);
+
+			if (cacheSize == 0)
+			{
+				setRayInactive(connectionRays + connectionIdx);
+				continue;
+			}
+
+			const int lightVertexIdx = lightVertexCache[min((int)(u * cacheSize), cacheSize - 1)];
+			const int s = lightVertexIdx % (maxDepth + 1) + 1;
+
+			if (t + s - 2 > maxDepth)
+			{
+				setRayInactive(connectionRays + connectionIdx);
+				continue;
+			}
+
+			cacheConnectionVertices[connectionIdx] = lightVertexIdx;
+			radianceBuffer[connectionIdx].xyz = prepareVertexConnection(&scene TEXTURE_IMAGE_ARGS, cameraVertex, lightVertices + lightVertexIdx, connectionRays + connectionIdx);
+		}
+	}
+}
+
+__kernel void ConnectCacheVertices(SCENE_PARAMS,
+								   IMAGE_PARAMS,
+								   int integrator_frameNum,
+								   int maxDepth,
+								   int numLightPaths,
+								   int numCacheConnections,
+								   float mergeRadius,
+								   __global const RTBDPTVertex* restrict cameraVertices,
+								   __global const int* restrict cameraVertexCounts,
+								   __global const RTBDPTVertex* restrict lightVertices,
+								   __global const RTBDPTVertex* restrict sampledLightVertices,
+								   __global const int* restrict cacheConnectionVertices,
+								   __global const int* restrict lightVertexCacheSize,
+								   __global RTRay* restrict connectionRays,
+								   __global const int* connectionVisibilities,
+								   __global const float4* tempRadianceBuffer,
+								   __global float* finalRadianceBuffer)
+{
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
+
+	if (gid.x >= image_width || gid.y >= image_height)
+		return;
+
+	const int bufferIdx = gid.x + gid.y * image_width;
+	const int maxLightVertices = maxDepth + 1;
+	__global const Vertex* cameraPath = cameraVertices + bufferIdx * (maxDepth + 2);
+	const int cameraVertexCount = cameraVertexCounts[bufferIdx];
+	const StrategySampleCounts counts = makeLightVertexCacheSampleCounts(image_width * image_height, numLightPaths, numCacheConnections, 
+																		 *lightVertexCacheSize, mergeRadius);
+
+	MAKE_SCENE(scene);
+
+	float3 L = (float3)(0.0f);
+
+	for (int t = 2; t <= cameraVertexCount; ++t)
+	{
+		__global const Vertex* cameraVertex = cameraPath + t - 1;
+
+		// The camera subpath hit a light (s = 0)
+		if (isVertexLight(cameraVertex))
+		{
+			float3 Le = evalLightLe(&scene TEXTURE_IMAGE_ARGS, scene.lights + cameraVertex->lightIdx, cameraVertex->interaction.gn, cameraVertex->interaction.wo) * cameraVertex->throughput;
+			if (isNotBlack(Le))
+				L += Le * computeMISWeight(&scene TEXTURE_IMAGE_ARGS, cameraPath, 0, 0, 0, t, &counts);
+		}
+
+		if (t > maxDepth + 1)
+			continue;
+
+		const int connectionIdx = (bufferIdx * maxDepth + t - 2) * (numCacheConnections + 1);
+
+		for (int i = 0; i <= numCacheConnections; ++i)
+		{
+			const int idx = connectionIdx + i;
+
+			if (!isRayActive(connectionRays + idx) || connectionVisibilities[idx] != -1)
+				continue;
+
+			float3 contribution = tempRadianceBuffer[idx].xyz;
+			if (isBlack(contribution))
+				continue;
+
+			if (i == 0)
+			{
+				__global const Vertex* sampled = sampledLightVertices + bufferIdx * maxDepth + t - 2;
+				L += contribution * computeMISWeight(&scene TEXTURE_IMAGE_ARGS, cameraPath, 0, sampled, 1, t, &counts);
+			}
+			else
+			{
+				const int lightVertexIdx = cacheConnectionVertices[idx];
+				const int s = lightVertexIdx % maxLightVertices + 1;
+				__global const Vertex* lightPath = lightVertices + lightVertexIdx - (s - 1);
+
+				L += contribution * computeMISWeight(&scene TEXTURE_IMAGE_ARGS, cameraPath, lightPath, 0, s, t, &counts) / counts.connection;
+			}
+		}
+	}
+
+	// Every pixel is processed by exactly one work item and light tracing contributions are added afterwards
+	const int radianceBufferIdx = bufferIdx * 3;
+	finalRadianceBuffer[radianceBufferIdx] += L.x;
+	finalRadianceBuffer[radianceBufferIdx + 1] += L.y;
+	finalRadianceBuffer[radianceBufferIdx + 2] += L.z;
+}
+
+// ************************************ End light vertex cache connections
+
+// ************************************ Vertex merging
+// Cached light vertices are stored in a hash grid with a cell size of twice the merge radius. Every hash grid entry
+// is the head of a linked list of cache entries. The grid is rebuilt every frame.
+
+inline int3 computeHashGridCell(float3 p, float cellSize)
+{
+	return convert_int3(floor(p / cellSize));
+}
+
+// Note: hashGridSize must be a power of two
+inline int computeHashGridIndex(int3 cell, int hashGridSize)
+{
+	uint h = ((uint)(cell.x) * 73856093u) ^ ((uint)(cell.y) * 19349663u) ^ ((uint)(cell.z) * 83492791u);
+	return (int)(h & (uint)(hashGridSize - 1));
+}
+
+__kernel void ClearHashGrid(int hashGridSize, __global int* restrict hashGridHeads)
+{
+	const int idx = get_global_id(0);
+
+	if (idx < hashGridSize)
+		hashGridHeads[idx] = RT_INVALID_ID;
+}
+
+__kernel void BuildHashGrid(int hashGridSize,
+							float cellSize,
+							__global const RTBDPTVertex* restrict lightVertices,
+							__global const int* restrict lightVertexCache,
+							__global const int* restrict lightVertexCacheSize,
+							volatile __global int* hashGridHeads,
+							__global int* restrict hashGridNext)
+{
+	const int cacheIdx = get_global_id(0);
+
+	if (cacheIdx >= *lightVertexCacheSize)
+		return;
+
+	float3 p = lightVertices[lightVertexCache[cacheIdx]].interaction.p;
+	int hashGridIdx = computeHashGridIndex(computeHashGridCell(p, cellSize), hashGridSize);
+	hashGridNext[cacheIdx] = atomic_xchg(hashGridHeads + hashGridIdx, cacheIdx);
+}
+
+/**
+* Merges every non-specular camera vertex with all cached light vertices within the merge radius.
+* Must be executed after ConnectCacheVertices.
+*/
+__kernel void MergeVertices(SCENE_PARAMS,
+							IMAGE_PARAMS,
+							int integrator_frameNum,
+							int maxDepth,
+							int numLightPaths,
+							int numCacheConnections,
+							float mergeRadius,
+							int hashGridSize,
+							__global const RTBDPTVertex* restrict cameraVertices,
+							__global const int* restrict cameraVertexCounts,
+							__global const RTBDPTVertex* restrict lightVertices,
+							__global const int* restrict lightVertexCache,
+							__global const int* restrict lightVertexCacheSize,
+							__global const int* restrict hashGridHeads,
+							__global const int* restrict hashGridNext,
+							__global float* finalRadianceBuffer)
+{
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
+
+	if (gid.x >= image_width || gid.y >= image_height)
+		return;
+
+	const int bufferIdx = gid.x + gid.y * image_width;
+	const int maxLightVertices = maxDepth + 1;
+	__global const Vertex* cameraPath = cameraVertices + bufferIdx * (maxDepth + 2);
+	const int cameraVertexCount = cameraVertexCounts[bufferIdx];
+	const StrategySampleCounts counts = makeLightVertexCacheSampleCounts(image_width * image_height, numLightPaths, numCacheConnections, 
+																		 *lightVertexCacheSize, mergeRadius);
+	const float cellSize = 2.0f * mergeRadius;
+	const float mergeRadiusSq = mergeRadius * mergeRadius;
+	const float normalization = 1.0f / (counts.merging * counts.mergeArea);
+
+	MAKE_SCENE(scene);
+
+	float3 L = (float3)(0.0f);
+
+	for (int t = 2; t <= cameraVertexCount; ++t)
+	{
+		__global const Vertex* cameraVertex = cameraPath + t - 1;
+
+		if (!isVertexConnectible(cameraVertex))
+			continue;
+
+		RTInteraction camInter = cameraVertex->interaction;
+		int3 minCell = computeHashGridCell(camInter.p - (float3)(mergeRadius), cellSize);
+		int3 maxCell = computeHashGridCell(camInter.p + (float3)(mergeRadius), cellSize);
+
+		// The cells are at most 2x2x2 because the cell size is the merge diameter. Cells that hash to the same bucket
+		// are visited once, otherwise the vertices of the bucket would be merged multiple times.
+		int buckets[8];
+		int numBuckets = 0;
+		for (int z = minCell.z; z <= maxCell.z; ++z)
+		{
+			for (int y = minCell.y; y <= maxCell.y; ++y)
+			{
+				for (int x = minCell.x; x <= maxCell.x; ++x)
+				{
+					int bucket = computeHashGridIndex((int3)(x, y, z), hashGridSize);
+					bool isDuplicate = false;
+					for (int i = 0; i < numBuckets; ++i)
+						isDuplicate |= buckets[i] == bucket;
+
+					if (!isDuplicate)
+						buckets[numBuckets++] = bucket;
+				}
+			}
+		}
+
+		for (int bucketIdx = 0; bucketIdx < numBuckets; ++bucketIdx)
+		{
+			int entry = hashGridHeads[buckets[bucketIdx]];
+
+			for (; entry != RT_INVALID_ID; entry = hashGridNext[entry])
+			{
+				const int lightVertexIdx = lightVertexCache[entry];
+				const int s = lightVertexIdx % maxLightVertices + 1;
+
+				// The merged path has s + t - 1 vertices
+				if (s + t - 3 > maxDepth)
+					continue;
+
+				__global const Vertex* lightVertex = lightVertices + lightVertexIdx;
+				float3 d = lightVertex->interaction.p - camInter.p;
+
+				// Only merge vertices on the same side of a surface
+				if (dot(d, d) > mergeRadiusSq || dot(lightVertex->interaction.gn, camInter.gn) <= 0.0f)
+					continue;
+
+				float3 f = evaluateMaterial(&scene TEXTURE_IMAGE_ARGS, cameraVertex->materialIdx, camInter.wo, lightVertex->interaction.wo, &camInter, TRANSPORT_MODE_RADIANCE);
+				if (isBlack(f))
+					continue;
+
+				__global const Vertex* lightPath = lightVertex - (s - 1);
+				float misWeight = computeMergeMISWeight(&scene TEXTURE_IMAGE_ARGS, cameraPath, lightPath, s, t, &counts);
+				L += cameraVertex->throughput * f * lightVertex->throughput * misWeight * normalization;
+			}
+		}
+	}
+
+	const int radianceBufferIdx = bufferIdx * 3;
+	finalRadianceBuffer[radianceBufferIdx] += L.x;
+	finalRadianceBuffer[radianceBufferIdx + 1] += L.y;
+	finalRadianceBuffer[radianceBufferIdx + 2] += L.z;
+}
+
+// ************************************ End vertex merging
+
 // Copy source buffer defined by float* to a destination buffer defined by float4*.
 __kernel void CopyBuffer(
 				int width,
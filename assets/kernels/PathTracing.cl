@@ -9,6 +9,9 @@
 #include "geometry.cl"
 #include "lights.cl"
 #include "image_samplers.cl"
+#include "reservoirs.cl"
+#include "cameras.cl"
+#include "ray_cones.cl"
 
 __kernel void GeneratePerspectiveRays(__global RTRay* trace_rays, 
 									  __global RTRayDifferentials* rayDifferentials,
@@ -53,7 +56,9 @@ __kernel void PathTracing(
 				SCENE_PARAMS,
 				IMAGE_PARAMS,
 				TRACE_PARAMS,
-				INTEGRATOR_PARAMS)
+				INTEGRATOR_PARAMS,
+				__global const RTReservoir* restir_reservoirs,
+				int restir_useReservoirs)
 {
 	int2 gid = (int2)(get_global_id(0), get_global_id(1));
 
@@ -72,11 +77,22 @@ __kernel void PathTracing(
     if (isRayActive(trace_rays + bufferIdx) && shapeIdx != -1 && primitiveIdx != -1 && scene.numLights > 0)
     {
         // Calculate lighting
-		RTInteraction si = computeSurfaceInteraction(&scene, &isect);
+		RTInteraction si = computeSurfaceInteraction(&scene TEXTURE_IMAGE_ARGS, &isect);
 		si.wo = -trace_rays[bufferIdx].d.xyz;
 		const bool isBackfacing = dot(si.gn, si.wo) < 0.0f;
 		si.traceErrorOffset = isBackfacing ? -RT_TRACE_OFFSET : RT_TRACE_OFFSET;
-		applyNormalMapping(&scene, scene_shapes[shapeIdx].materialId, &si);
+
+		// Primary hits are read from the base mip level because the jittered camera rays already filter them
+		float uvToWorldScale;
+		float curvature;
+		computeRayConeTriangleInfo(&scene TEXTURE_IMAGE_ARGS, &isect, &uvToWorldScale, &curvature);
+		RTRayCone cone = integrator_bounceIdx == 0 ? makeRayCone(0.0f, scene.camera->pixelSpreadAngle) :
+							makeRayCone(integrator_throughputBuffer[bufferIdx].coneWidth, integrator_throughputBuffer[bufferIdx].coneSpreadAngle);
+		propagateRayCone(&cone, isect.uvwt.w);
+		if (integrator_bounceIdx > 0)
+			setRayConeTextureFootprint(&cone, uvToWorldScale, &si);
+
+		applyNormalMapping(&scene TEXTURE_IMAGE_ARGS, scene_shapes[shapeIdx].materialId, &si);
 
 		if (integrator_bounceIdx == 0)
 		{ 
@@ -93,7 +109,7 @@ __kernel void PathTracing(
 		if (isEmitter && (integrator_bounceIdx == 0 || sampledSpecular))
 		{ 
 			int lightID = scene_shapes[shapeIdx].lightID;
-			float3 Le = evalLightLe(scene.lights + lightID, si.gn, si.wo);
+			float3 Le = evalLightLe(&scene TEXTURE_IMAGE_ARGS, scene.lights + lightID, si.gn, si.wo);
 			radiance.xyz += integrator_throughputBuffer[bufferIdx].throughput * Le;
 			setRayInactive(trace_shadowRays + bufferIdx);
 			setRayInactive(trace_rays + bufferIdx);
@@ -105,24 +121,54 @@ __kernel void PathTracing(
 			integrator_throughputBuffer[bufferIdx].ignoreOcclusion = 0;
 
 			// Compute estimate of direct lighting
+			if (integrator_bounceIdx == 0 && restir_useReservoirs)
+			{ 
+				// The light sample was chosen by the ReSTIR stage, its contribution weight replaces the inverse density
+				RTReservoir r = restir_reservoirs[bufferIdx];
+				int materialId = scene_shapes[shapeIdx].materialId;
+				float3 L = (float3)(0.0f);
+				setRayInactive(trace_shadowRays + bufferIdx);
+
+				if (r.lightIdx != RT_INVALID_ID && r.W > 0.0f && materialId != RT_INVALID_ID)
+				{ 
+					float3 wi;
+					float dist;
+					float3 Li = evalLightSampleLi(&scene TEXTURE_IMAGE_ARGS, r.lightIdx, r.lightPosition, r.lightNormal, &si, &wi, &dist);
+
+					if (isNotBlack(Li))
+					{ 
+						float3 bsdf = evaluateMaterial(&scene TEXTURE_IMAGE_ARGS, materialId, si.wo, wi, &si, TRANSPORT_MODE_RADIANCE);
+						L = Li * bsdf * absDot(wi, si.sn) * r.W;
+						setReservoirShadowRay(&scene TEXTURE_IMAGE_ARGS, &r, &si, wi, dist, trace_shadowRays + bufferIdx);
+					}
+				}
+
+				radiance.xyz += integrator_throughputBuffer[bufferIdx].throughput * L;
+			}
+			else
 			{
-				// Sample one light source
-				float lightPdf;
-				uint lightIdx = ((uint)floor(getSample1D(&sampler) * scene.numLights));
-				lightIdx %= scene.numLights;
+				// Sample one light source, the light BVH favors lights that are important for the shading point
+				float lightPdf = 0.0f;
+				float lightChoicePdf;
+				int lightIdx = sampleLightBVH(&scene TEXTURE_IMAGE_ARGS, si.p, si.sn, getSample1D(&sampler), &lightChoicePdf);
 				float3 wi;
 				float2 u = getSample2D(&sampler);
 
 				float3 unusedLightNormal;
 				float3 unusedLightPosition;
-				float3 Li = sampleLightLi(lightIdx, &scene, &si, u, &unusedLightPosition, &unusedLightNormal, &wi, &lightPdf, trace_shadowRays + bufferIdx);
-				lightPdf *= scene.lights[lightIdx].choicePdf;
+				float3 Li = (float3)(0.0f);
+				if (lightIdx != RT_INVALID_ID)
+					Li = sampleLightLi(lightIdx, &scene TEXTURE_IMAGE_ARGS, &si, u, &unusedLightPosition, &unusedLightNormal, &wi, &lightPdf, trace_shadowRays + bufferIdx);
+				else
+					setRayInactive(trace_shadowRays + bufferIdx);
+
+				lightPdf *= lightChoicePdf;
 				float3 L = (float3)(0.0f);
 
 				int materialId = scene_shapes[shapeIdx].materialId;
-				if (materialId != RT_INVALID_ID)
+				if (materialId != RT_INVALID_ID && isNotBlack(Li))
 				{
-					float3 bsdf = evaluateMaterial(&scene, materialId, si.wo, wi, &si, TRANSPORT_MODE_RADIANCE);
+					float3 bsdf = evaluateMaterial(&scene TEXTURE_IMAGE_ARGS, materialId, si.wo, wi, &si, TRANSPORT_MODE_RADIANCE);
 					bsdf *= absDot(wi, si.sn);
 
 					if (!isNearZero(lightPdf))
@@ -146,7 +192,7 @@ __kernel void PathTracing(
 					BxDFType sampledType;
 					int unused;
 					float3 wi;
-					float3 bsdfBounce = sampleMaterial(&scene, scene_shapes[shapeIdx].materialId, &si, bsdfSample, TRANSPORT_MODE_RADIANCE, BSDF_ALL, si.wo, &wi, &pdf, &unused, &sampledType);
+					float3 bsdfBounce = sampleMaterial(&scene TEXTURE_IMAGE_ARGS, scene_shapes[shapeIdx].materialId, &si, bsdfSample, TRANSPORT_MODE_RADIANCE, BSDF_ALL, si.wo, &wi, &pdf, &unused, &sampledType);
 
 					integrator_throughputBuffer[bufferIdx].prevBsdfFlags = sampledType;
 
@@ -161,6 +207,10 @@ __kernel void PathTracing(
 						float3 throughput = bsdfBounce * absDot(wi, si.sn);
 						integrator_throughputBuffer[bufferIdx].throughput *= throughput;
 
+						spreadRayCone(&cone, &scene TEXTURE_IMAGE_ARGS, scene_shapes[shapeIdx].materialId, &si, curvature, sampledType);
+						integrator_throughputBuffer[bufferIdx].coneWidth = cone.width;
+						integrator_throughputBuffer[bufferIdx].coneSpreadAngle = cone.spreadAngle;
+
 						// Set ray for next bounce
 						float traceErrorOffset = si.traceErrorOffset;
 						if ((sampledType & BSDF_TRANSMISSION) != 0 && dot(si.gn, wi) * sign(traceErrorOffset) < 0.0f)
@@ -175,6 +225,20 @@ __kernel void PathTracing(
 			}
 		}
     }
+	else if (isRayActive(trace_rays + bufferIdx) && shapeIdx == -1 && scene.environmentLightIdx != RT_INVALID_ID)
+	{ 
+		// Escaped rays see the environment if it wasn't already accounted for by light sampling at the previous vertex
+		const bool sampledSpecular = (BSDF_SPECULAR & integrator_throughputBuffer[bufferIdx].prevBsdfFlags) == BSDF_SPECULAR;
+		if (integrator_bounceIdx == 0 || sampledSpecular)
+		{ 
+			float3 throughput = integrator_bounceIdx == 0 ? (float3)(1.0f) : integrator_throughputBuffer[bufferIdx].throughput;
+			radiance.xyz += throughput * evalEnvironmentLightLe(scene.lights + scene.environmentLightIdx, &scene TEXTURE_IMAGE_ARGS, trace_rays[bufferIdx].d.xyz);
+		}
+
+		integrator_throughputBuffer[bufferIdx].ignoreOcclusion = 1;
+		setRayInactive(trace_shadowRays + bufferIdx);
+		setRayInactive(trace_rays + bufferIdx);
+	}
 	else
 	{
 		setRayInactive(trace_rays + bufferIdx);
@@ -216,4 +280,217 @@ __kernel void ShadowPass(
 		integrator_radianceBuffer[bufferIdx] += radiance;
 }
 
+/**
+* Reconstructs the primary hit of the pixel. Returns false if direct lighting at the hit isn't estimated with ReSTIR,
+* i.e. the ray escaped or hit an emitter or a surface without a material.
+*/
+bool computePrimaryInteraction(const Scene* scene TEXTURE_IMAGE_PARAMS, __global RTRay* ray, const RTIntersection* isect, RTInteraction* si)
+{ 
+	if (!isRayActive(ray) || isect->shapeid == -1 || isect->primid == -1)
+		return false;
+
+	const int shapeIdx = isect->shapeid;
+	const int materialId = scene->shapes[shapeIdx].materialId;
+	if (scene->shapes[shapeIdx].lightID != RT_INVALID_ID || materialId == RT_INVALID_ID)
+		return false;
+
+	*si = computeSurfaceInteraction(scene TEXTURE_IMAGE_ARGS, isect);
+	si->wo = -ray->d.xyz;
+	si->traceErrorOffset = dot(si->gn, si->wo) < 0.0f ? -RT_TRACE_OFFSET : RT_TRACE_OFFSET;
+	applyNormalMapping(scene TEXTURE_IMAGE_ARGS, materialId, si);
+	return true;
+}
+
+/**
+* Generates restir_numCandidates light samples with the light BVH at the primary hit and keeps one of them
+* with resampled importance sampling.
+*/
+__kernel void ReSTIRInitialSampling(
+				SCENE_PARAMS,
+				IMAGE_PARAMS,
+				TRACE_PARAMS,
+				int integrator_frameNum,
+				int restir_numCandidates,
+				__global RTReservoir* restir_reservoirs)
+{ 
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
+
+    if (gid.x >= image_width || gid.y >= image_height) return;
+
+	MAKE_SCENE(scene);
+
+    int bufferIdx = gid.y * image_width + gid.x;
+	RTIntersection isect = trace_isects[bufferIdx];
+	RTInteraction si;
+	RTReservoir r = makeEmptyReservoir();
+
+	if (scene.numLights > 0 && computePrimaryInteraction(&scene TEXTURE_IMAGE_ARGS, trace_rays + bufferIdx, &isect, &si))
+	{ 
+		MAKE_SAMPLER(sampler, bufferIdx, RT_RESTIR_SAMPLER_OFFSET);
+		const int materialId = scene_shapes[isect.shapeid].materialId;
+		r.shadingPosition = si.p;
+		r.shadingNormal = si.sn;
+
+		for (int i = 0; i < restir_numCandidates; ++i)
+		{ 
+			float choicePdf;
+			int lightIdx = sampleLightBVH(&scene TEXTURE_IMAGE_ARGS, si.p, si.sn, getSample1D(&sampler), &choicePdf);
+			float2 u = getSample2D(&sampler);
+			float uReservoir = getSample1D(&sampler);
+
+			float weight = 0.0f;
+			float targetPdf = 0.0f;
+			float3 lightPosition = (float3)(0.0f);
+			float3 lightNormal = (float3)(0.0f);
+
+			if (lightIdx != RT_INVALID_ID)
+			{ 
+				float3 wi;
+				float pdf = 0.0f;
+				float3 Li = sampleLightLi(lightIdx, &scene TEXTURE_IMAGE_ARGS, &si, u, &lightPosition, &lightNormal, &wi, &pdf, trace_shadowRays + bufferIdx);
+				__global const RTLight* light = scene.lights + lightIdx;
+
+				if (isLightInfinite(light))
+					lightPosition = wi;
+
+				float sourcePdf = choicePdf * pdf;
+
+				// Area light samples are stored in area measure
+				if (light->type == RT_DISK_AREA_LIGHT || light->type == RT_TRIANGLE_MESH_AREA_LIGHT)
+					sourcePdf *= absDot(lightNormal, wi) / distanceSquared(lightPosition, si.p);
+
+				if (isNotBlack(Li) && sourcePdf > 0.0f)
+				{ 
+					targetPdf = evalReservoirTargetPdf(&scene TEXTURE_IMAGE_ARGS, materialId, lightIdx, lightPosition, lightNormal, &si);
+					weight = targetPdf / sourcePdf;
+				}
+			}
+
+			updateReservoir(&r, lightIdx, lightPosition, lightNormal, targetPdf, weight, 1, uReservoir);
+		}
+
+		finalizeReservoir(&r);
+	}
+
+	restir_reservoirs[bufferIdx] = r;
+}
+
+/**
+* Combines the reservoir of the pixel with the reservoir of the previous frame at the reprojected primary hit.
+* The history is clamped to restir_maxHistory times the number of new candidates.
+*/
+__kernel void ReSTIRTemporalReuse(
+				SCENE_PARAMS,
+				IMAGE_PARAMS,
+				TRACE_PARAMS,
+				int integrator_frameNum,
+				int restir_maxHistory,
+				__global const RTPinholeCamera* restir_prevCamera,
+				__global const RTReservoir* restir_prevReservoirs,
+				__global RTReservoir* restir_reservoirs)
+{ 
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
+
+    if (gid.x >= image_width || gid.y >= image_height) return;
+
+	MAKE_SCENE(scene);
+
+    int bufferIdx = gid.y * image_width + gid.x;
+	RTReservoir r = restir_reservoirs[bufferIdx];
+	RTIntersection isect = trace_isects[bufferIdx];
+	RTInteraction si;
+
+	if (r.M == 0 || !computePrimaryInteraction(&scene TEXTURE_IMAGE_ARGS, trace_rays + bufferIdx, &isect, &si))
+		return;
+
+	// Reproject the primary hit into the image of the previous frame
+	float4 pClip = transformVector4(restir_prevCamera->worldToClip, (float4)(si.p, 1.0f));
+	if (pClip.w <= 0.0f)
+		return;
+
+	float2 normalizedImagePos = (pClip.xy / pClip.w + (float2)(1.0f)) * 0.5f;
+	int2 prevPos = (int2)((int)(floor(normalizedImagePos.x * image_width + 0.5f)), (int)(floor(normalizedImagePos.y * image_height + 0.5f)));
+	if (prevPos.x < 0 || prevPos.y < 0 || prevPos.x >= image_width || prevPos.y >= image_height)
+		return;
+
+	RTReservoir prev = restir_prevReservoirs[prevPos.y * image_width + prevPos.x];
+	if (!areReservoirsSimilar(&r, &prev, scene.camera->pos))
+		return;
+
+	prev.M = min(prev.M, restir_maxHistory * r.M);
+
+	MAKE_SAMPLER(sampler, bufferIdx, RT_RESTIR_SAMPLER_OFFSET + 1);
+	const int materialId = scene_shapes[isect.shapeid].materialId;
+	RTReservoir combined = makeEmptyReservoir();
+	combined.shadingPosition = r.shadingPosition;
+	combined.shadingNormal = r.shadingNormal;
+
+	combineReservoir(&combined, &r, r.targetPdf, getSample1D(&sampler));
+	float prevTargetPdf = evalReservoirTargetPdf(&scene TEXTURE_IMAGE_ARGS, materialId, prev.lightIdx, prev.lightPosition, prev.lightNormal, &si);
+	combineReservoir(&combined, &prev, prevTargetPdf, getSample1D(&sampler));
+	finalizeReservoir(&combined);
+
+	restir_reservoirs[bufferIdx] = combined;
+}
+
+/**
+* Combines the reservoir of the pixel with restir_numNeighbours reservoirs of random pixels within restir_radius.
+*/
+__kernel void ReSTIRSpatialReuse(
+				SCENE_PARAMS,
+				IMAGE_PARAMS,
+				TRACE_PARAMS,
+				int integrator_frameNum,
+				int restir_numNeighbours,
+				float restir_radius,
+				__global const RTReservoir* restir_inReservoirs,
+				__global RTReservoir* restir_outReservoirs)
+{ 
+	int2 gid = (int2)(get_global_id(0), get_global_id(1));
+
+    if (gid.x >= image_width || gid.y >= image_height) return;
+
+	MAKE_SCENE(scene);
+
+    int bufferIdx = gid.y * image_width + gid.x;
+	RTReservoir r = restir_inReservoirs[bufferIdx];
+	RTIntersection isect = trace_isects[bufferIdx];
+	RTInteraction si;
+
+	if (r.M == 0 || !computePrimaryInteraction(&scene TEXTURE_IMAGE_ARGS, trace_rays + bufferIdx, &isect, &si))
+	{ 
+		restir_outReservoirs[bufferIdx] = r;
+		return;
+	}
+
+	MAKE_SAMPLER(sampler, bufferIdx, RT_RESTIR_SAMPLER_OFFSET + 2);
+	const int materialId = scene_shapes[isect.shapeid].materialId;
+	RTReservoir combined = makeEmptyReservoir();
+	combined.shadingPosition = r.shadingPosition;
+	combined.shadingNormal = r.shadingNormal;
+
+	combineReservoir(&combined, &r, r.targetPdf, getSample1D(&sampler));
+
+	for (int i = 0; i < restir_numNeighbours; ++i)
+	{ 
+		float2 offset = concentricSampleDisc(getSample2D(&sampler)) * restir_radius;
+		float uReservoir = getSample1D(&sampler);
+		int2 neighbourPos = gid + (int2)((int)(round(offset.x)), (int)(round(offset.y)));
+
+		if (neighbourPos.x < 0 || neighbourPos.y < 0 || neighbourPos.x >= image_width || neighbourPos.y >= image_height || 
+			(neighbourPos.x == gid.x && neighbourPos.y == gid.y))
+			continue;
+
+		RTReservoir neighbour = restir_inReservoirs[neighbourPos.y * image_width + neighbourPos.x];
+		if (!areReservoirsSimilar(&r, &neighbour, scene.camera->pos))
+			continue;
+
+		float targetPdf = evalReservoirTargetPdf(&scene TEXTURE_IMAGE_ARGS, materialId, neighbour.lightIdx, neighbour.lightPosition, neighbour.lightNormal, &si);
+		combineReservoir(&combined, &neighbour, targetPdf, uReservoir);
+	}
+
+	finalizeReservoir(&combined);
+	restir_outReservoirs[bufferIdx] = combined;
+}
+
 #endif // PATH_TRACING_CL
\ No newline at end of file
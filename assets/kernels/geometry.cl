@@ -4,6 +4,7 @@
 #include <math.cl>
 #include <matrix.cl>
 #include <kernel_data.h>
+#include <vertices.cl>
 #include <materials.cl>
 
 void computeTrianglePartialDerivates(float2 uv0, float2 uv1, float2 uv2, float3 p0, float3 p1, float3 p2, float3 normal, float3* dpdu, float3* dpdv)
@@ -27,7 +28,7 @@ void computeTrianglePartialDerivates(float2 uv0, float2 uv1, float2 uv2, float3
 	}
 }
 
-void getRTShapeGeometryAttributes(const Scene* scene, int shapeIdx, int primIdx, float2 barycentrics, 
+void getRTShapeGeometryAttributes(const Scene* scene TEXTURE_IMAGE_PARAMS, int shapeIdx, int primIdx, float2 barycentrics, 
 				                  float3* outPos, float2* outUV, float3* outNormal, float3* outTangent, float3* outBinormal)
 {
 	RTShape shape = scene->shapes[shapeIdx];
@@ -36,25 +37,33 @@ void getRTShapeGeometryAttributes(const Scene* scene, int shapeIdx, int primIdx,
     unsigned int i1 = scene->indices[shape.startIdx + 3 * primIdx + 1];
     unsigned int i2 = scene->indices[shape.startIdx + 3 * primIdx + 2];
 
-	float3 p0 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i0]);
-	float3 p1 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i1]);
-	float3 p2 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i2]);
+	float3 p0 = getShapeVertexPosition(scene, &shape, i0);
+	float3 p1 = getShapeVertexPosition(scene, &shape, i1);
+	float3 p2 = getShapeVertexPosition(scene, &shape, i2);
 
-	float2 uv0 = scene->uvs[shape.startVertex +i0];
-	float2 uv1 = scene->uvs[shape.startVertex +i1];
-	float2 uv2 = scene->uvs[shape.startVertex +i2];
+	float2 uv0 = getVertexUV(scene, shape.startVertex + i0);
+	float2 uv1 = getVertexUV(scene, shape.startVertex + i1);
+	float2 uv2 = getVertexUV(scene, shape.startVertex + i2);
 
-	float3 n0 = transformVector3(shape.toWorldTransform, scene->normals[shape.startVertex +i0]);
-	float3 n1 = transformVector3(shape.toWorldTransform, scene->normals[shape.startVertex +i1]);
-	float3 n2 = transformVector3(shape.toWorldTransform, scene->normals[shape.startVertex +i2]);
+	float3 n0, n1, n2, t0, t1, t2, bn0, bn1, bn2;
+	getVertexTangentFrame(scene, shape.startVertex + i0, &n0, &t0, &bn0);
+	getVertexTangentFrame(scene, shape.startVertex + i1, &n1, &t1, &bn1);
+	getVertexTangentFrame(scene, shape.startVertex + i2, &n2, &t2, &bn2);
 
-	float3 t0 = transformVector3(shape.toWorldTransform, scene->tangents[shape.startVertex +i0]);
-	float3 t1 = transformVector3(shape.toWorldTransform, scene->tangents[shape.startVertex +i1]);
-	float3 t2 = transformVector3(shape.toWorldTransform, scene->tangents[shape.startVertex +i2]);
+	if ((shape.flags & RT_SHAPE_FLAG_WORLD_SPACE_VERTICES) == 0)
+	{
+		n0 = transformVector3(shape.toWorldTransform, n0);
+		n1 = transformVector3(shape.toWorldTransform, n1);
+		n2 = transformVector3(shape.toWorldTransform, n2);
+
+		t0 = transformVector3(shape.toWorldTransform, t0);
+		t1 = transformVector3(shape.toWorldTransform, t1);
+		t2 = transformVector3(shape.toWorldTransform, t2);
 
-	float3 bn0 = transformVector3(shape.toWorldTransform, scene->binormals[shape.startVertex +i0]);
-	float3 bn1 = transformVector3(shape.toWorldTransform, scene->binormals[shape.startVertex +i1]);
-	float3 bn2 = transformVector3(shape.toWorldTransform, scene->binormals[shape.startVertex +i2]);
+		bn0 = transformVector3(shape.toWorldTransform, bn0);
+		bn1 = transformVector3(shape.toWorldTransform, bn1);
+		bn2 = transformVector3(shape.toWorldTransform, bn2);
+	}
 
 	*outPos = p0 * (1.0f - barycentrics.x - barycentrics.y) + p1 * barycentrics.x + p2 * barycentrics.y;
 	*outUV = uv0 * (1.0f - barycentrics.x - barycentrics.y) + uv1 * barycentrics.x + uv2 * barycentrics.y;
@@ -63,7 +72,7 @@ void getRTShapeGeometryAttributes(const Scene* scene, int shapeIdx, int primIdx,
 	*outBinormal = normalize(bn0 * (1.0f - barycentrics.x - barycentrics.y) + bn1 * barycentrics.x + bn2 * barycentrics.y);
 }
 
-void getRTShapeUVs(const Scene* scene, int shapeIdx, int primIdx, float2* uv0, float2* uv1, float2* uv2)
+void getRTShapeUVs(const Scene* scene TEXTURE_IMAGE_PARAMS, int shapeIdx, int primIdx, float2* uv0, float2* uv1, float2* uv2)
 { 
 	RTShape shape = scene->shapes[shapeIdx];
 
@@ -71,12 +80,12 @@ void getRTShapeUVs(const Scene* scene, int shapeIdx, int primIdx, float2* uv0, f
     unsigned int i1 = scene->indices[shape.startIdx + 3 * primIdx + 1];
     unsigned int i2 = scene->indices[shape.startIdx + 3 * primIdx + 2];
 
-	*uv0 = scene->uvs[shape.startVertex +i0];
-	*uv1 = scene->uvs[shape.startVertex +i1];
-	*uv2 = scene->uvs[shape.startVertex +i2];
+	*uv0 = getVertexUV(scene, shape.startVertex + i0);
+	*uv1 = getVertexUV(scene, shape.startVertex + i1);
+	*uv2 = getVertexUV(scene, shape.startVertex + i2);
 }
 
-void getRTShapePositions(const Scene* scene, int shapeIdx, int primIdx, float3* p0, float3* p1, float3* p2)
+void getRTShapePositions(const Scene* scene TEXTURE_IMAGE_PARAMS, int shapeIdx, int primIdx, float3* p0, float3* p1, float3* p2)
 { 
 	RTShape shape = scene->shapes[shapeIdx];
 
@@ -84,12 +93,12 @@ void getRTShapePositions(const Scene* scene, int shapeIdx, int primIdx, float3*
     unsigned int i1 = scene->indices[shape.startIdx + 3 * primIdx + 1];
     unsigned int i2 = scene->indices[shape.startIdx + 3 * primIdx + 2];
 
-	*p0 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i0]);
-	*p1 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i1]);
-	*p2 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i2]);
+	*p0 = getShapeVertexPosition(scene, &shape, i0);
+	*p1 = getShapeVertexPosition(scene, &shape, i1);
+	*p2 = getShapeVertexPosition(scene, &shape, i2);
 }
 
-inline RTInteraction computeSurfaceInteractionWithDifferentials(const Scene* scene, const RTIntersection* isect, __global const RTRayDifferentials* rayDifferentials)
+inline RTInteraction computeSurfaceInteractionWithDifferentials(const Scene* scene TEXTURE_IMAGE_PARAMS, const RTIntersection* isect, __global const RTRayDifferentials* rayDifferentials)
 { 
 	RTInteraction si;
 
@@ -101,17 +110,17 @@ inline RTInteraction computeSurfaceInteractionWithDifferentials(const Scene* sce
     unsigned int i1 = scene->indices[shape.startIdx + 3 * primIdx + 1];
     unsigned int i2 = scene->indices[shape.startIdx + 3 * primIdx + 2];
 
-	float3 p0 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i0]);
-	float3 p1 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i1]);
-	float3 p2 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i2]);
+	float3 p0 = getShapeVertexPosition(scene, &shape, i0);
+	float3 p1 = getShapeVertexPosition(scene, &shape, i1);
+	float3 p2 = getShapeVertexPosition(scene, &shape, i2);
 
-	float2 uv0 = scene->uvs[shape.startVertex +i0];
-	float2 uv1 = scene->uvs[shape.startVertex +i1];
-	float2 uv2 = scene->uvs[shape.startVertex +i2];
+	float2 uv0 = getVertexUV(scene, shape.startVertex + i0);
+	float2 uv1 = getVertexUV(scene, shape.startVertex + i1);
+	float2 uv2 = getVertexUV(scene, shape.startVertex + i2);
 
-	float3 n0 = transformVector3(shape.toWorldInverseTranspose, scene->normals[shape.startVertex +i0]);
-	float3 n1 = transformVector3(shape.toWorldInverseTranspose, scene->normals[shape.startVertex +i1]);
-	float3 n2 = transformVector3(shape.toWorldInverseTranspose, scene->normals[shape.startVertex +i2]);
+	float3 n0 = getShapeVertexNormal(scene, &shape, i0);
+	float3 n1 = getShapeVertexNormal(scene, &shape, i1);
+	float3 n2 = getShapeVertexNormal(scene, &shape, i2);
 
 	si.p = p0 * (1.0f - barycentrics.x - barycentrics.y) + p1 * barycentrics.x + p2 * barycentrics.y;
 	si.uv = uv0 * (1.0f - barycentrics.x - barycentrics.y) + uv1 * barycentrics.x + uv2 * barycentrics.y;
@@ -174,7 +183,7 @@ inline RTInteraction computeSurfaceInteractionWithDifferentials(const Scene* sce
 	return si;
 }
 
-inline RTInteraction computeSurfaceInteraction(const Scene* scene, const RTIntersection* isect)
+inline RTInteraction computeSurfaceInteraction(const Scene* scene TEXTURE_IMAGE_PARAMS, const RTIntersection* isect)
 { 
 	RTInteraction si;
 
@@ -186,17 +195,17 @@ inline RTInteraction computeSurfaceInteraction(const Scene* scene, const RTInter
     unsigned int i1 = scene->indices[shape.startIdx + 3 * primIdx + 1];
     unsigned int i2 = scene->indices[shape.startIdx + 3 * primIdx + 2];
 
-	float3 p0 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i0]);
-	float3 p1 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i1]);
-	float3 p2 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex +i2]);
+	float3 p0 = getShapeVertexPosition(scene, &shape, i0);
+	float3 p1 = getShapeVertexPosition(scene, &shape, i1);
+	float3 p2 = getShapeVertexPosition(scene, &shape, i2);
 
-	float2 uv0 = scene->uvs[shape.startVertex +i0];
-	float2 uv1 = scene->uvs[shape.startVertex +i1];
-	float2 uv2 = scene->uvs[shape.startVertex +i2];
+	float2 uv0 = getVertexUV(scene, shape.startVertex + i0);
+	float2 uv1 = getVertexUV(scene, shape.startVertex + i1);
+	float2 uv2 = getVertexUV(scene, shape.startVertex + i2);
 
-	float3 n0 = transformVector3(shape.toWorldInverseTranspose, scene->normals[shape.startVertex +i0]);
-	float3 n1 = transformVector3(shape.toWorldInverseTranspose, scene->normals[shape.startVertex +i1]);
-	float3 n2 = transformVector3(shape.toWorldInverseTranspose, scene->normals[shape.startVertex +i2]);
+	float3 n0 = getShapeVertexNormal(scene, &shape, i0);
+	float3 n1 = getShapeVertexNormal(scene, &shape, i1);
+	float3 n2 = getShapeVertexNormal(scene, &shape, i2);
 
 	si.p = p0 * (1.0f - barycentrics.x - barycentrics.y) + p1 * barycentrics.x + p2 * barycentrics.y;
 	si.uv = uv0 * (1.0f - barycentrics.x - barycentrics.y) + uv1 * barycentrics.x + uv2 * barycentrics.y;
@@ -209,6 +218,12 @@ inline RTInteraction computeSurfaceInteraction(const Scene* scene, const RTInter
 	si.sdpdu = normalize(si.dpdu - dot(si.sn, si.dpdu) * si.sn);
 	si.sdpdv = normalize(si.dpdv - dot(si.sn, si.dpdv) * si.sn - dot(si.sdpdu, si.dpdv) * si.sdpdu);
 
+	// No footprint: textures are read from the base mip level unless a ray cone is applied (see ray_cones.cl)
+	si.dpdx = (float3)(0.0f);
+	si.dpdy = (float3)(0.0f);
+	si.duvdx = (float2)(0.0f);
+	si.duvdy = (float2)(0.0f);
+
 	si.shapeIdx = isect->shapeid;
 
 	return si;
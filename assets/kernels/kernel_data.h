@@ -12,6 +12,21 @@
 #define RT_MAX_TRACE_DISTANCE 1000.0f
 #define RT_MAX_ALLOWED_RADIANCE 1000
 
+// Layout of the sampler table buffer: Sobol lookup tables per dimension followed by a blue noise tile
+#define RT_SOBOL_TABLE_DIMENSIONS 1024
+#define RT_SOBOL_TABLE_SIZE 1024
+#define RT_BLUE_NOISE_SIZE 64
+#define RT_BLUE_NOISE_OFFSET (RT_SOBOL_TABLE_DIMENSIONS * RT_SOBOL_TABLE_SIZE)
+
+// Virtual textures: mip levels are split into tiles of RT_VT_TILE_SIZE^2 texels that are streamed into slots of
+// RT_VT_TILE_SLOT_SIZE bytes of the texture buffer, see RTVirtualTextures.h
+#define RT_VT_TILE_SIZE 64
+#define RT_VT_TILE_SLOT_SIZE (RT_VT_TILE_SIZE * RT_VT_TILE_SIZE * 4)
+#define RT_VT_TILE_NOT_RESIDENT 0xFFFFFFFF
+// Values of the feedback buffer per page table entry, 0 if the tile wasn't accessed
+#define RT_VT_FEEDBACK_USED 1
+#define RT_VT_FEEDBACK_REQUESTED 2
+
 #ifdef __cplusplus
 #include <radeon_rays.h>
 
@@ -36,7 +51,7 @@ typedef float4 rt_float4;
 typedef struct _RTShape
 {
 #ifdef __cplusplus
-	_RTShape() : materialId(RT_INVALID_ID), lightID(RT_INVALID_ID), area(1.0f) {}
+	_RTShape() : materialId(RT_INVALID_ID), lightID(RT_INVALID_ID), area(1.0f), flags(0) {}
 #endif
 
 	rt_mat4 toWorldTransform;
@@ -47,10 +62,31 @@ typedef struct _RTShape
 	int materialId;
 	int lightID;
 	float area;
+	rt_uint32 flags;
 
-	int pad[2];
+	int pad;
 } RTShape;
 
+enum RTShapeFlags
+{
+	// The vertices are baked to world space, the transforms of the shape are only used on the host
+	RT_SHAPE_FLAG_WORLD_SPACE_VERTICES = (1 << 0)
+};
+
+/**
+* Interleaved vertex of the device geometry (24 bytes): object space position, octahedral encoded normal and tangent
+* with the sign of the binormal and half precision UVs, see vertices.cl.
+*/
+typedef struct _RTVertex
+{
+	float px;
+	float py;
+	float pz;
+	rt_uint32 normal;
+	rt_uint32 tangent;
+	rt_uint32 uv;
+} RTVertex;
+
 enum RTFilterType
 {
 	RT_BOX_FILTER = 0,
@@ -117,7 +153,8 @@ enum RTLightType
 	RT_DIRECTIONAL_LIGHT,
 	RT_POINT_LIGHT,
 	RT_DISK_AREA_LIGHT,
-	RT_TRIANGLE_MESH_AREA_LIGHT
+	RT_TRIANGLE_MESH_AREA_LIGHT,
+	RT_ENVIRONMENT_LIGHT
 };
 
 enum RTLightFlags
@@ -148,15 +185,79 @@ typedef struct _RTLight
 	int shapeId;
 	int type;
 	int flags;
-	int pad[2];
+	// Offset of the light's alias tables in the shared light alias table buffer.
+	// Triangle mesh lights: one table over the triangles.
+	// Environment lights: marginal table over the rows followed by one conditional table per row.
+	int distributionOffset;
+	// Resolution of the lat-long map of environment lights
+	int envMapWidth;
+	int envMapHeight;
+	int pad[3];
 } RTLight;
 
+/**
+* Entry of an alias table (Vose's alias method) used for O(1) sampling of discrete distributions.
+* An index i is chosen uniformly and accepted with probability q, otherwise alias is chosen.
+* pdf is the discrete probability of choosing i.
+* Multiple tables can share one buffer at different offsets.
+*/
+typedef struct _RTAliasTableEntry
+{
+	float q;
+	int alias;
+	float pdf;
+	int pad;
+} RTAliasTableEntry;
+
+/**
+* Node of the light bounding volume hierarchy used to choose lights depending on the shading point.
+* Stores bounds, orientation cone and total power of the lights below the node.
+* cosThetaO bounds the spread of the light normals around axis, cosThetaE the spread of emission around a normal.
+* The first child of an interior node directly follows the node, childOrLightIdx is the index of the second child.
+* For leaves childOrLightIdx is the light index.
+*/
+typedef struct _RTLightBVHNode
+{
+	rt_float3 boundsMin;
+	rt_float3 boundsMax;
+	rt_float3 axis;
+	float power;
+	float cosThetaO;
+	float cosThetaE;
+	int childOrLightIdx;
+	int isLeaf;
+	int pad[3];
+} RTLightBVHNode;
+
+/**
+* Weighted reservoir of the ReSTIR direct lighting stage. Holds the light sample that survived resampling.
+* lightPosition is the point on the light for point and area lights and the direction towards the light for infinite lights.
+* shadingPosition and shadingNormal describe the primary hit of the owning pixel and are used to reject reuse across
+* geometric discontinuities. W is the unbiased contribution weight of the sample.
+*/
+typedef struct _RTReservoir
+{
+	rt_float3 lightPosition;
+	rt_float3 lightNormal;
+	rt_float3 shadingPosition;
+	rt_float3 shadingNormal;
+	int lightIdx;
+	int M;
+	float weightSum;
+	float W;
+	float targetPdf;
+	int pad[3];
+} RTReservoir;
+
 typedef struct _RTThroughput
 {
 	rt_float3 throughput;
 	int prevBsdfFlags;
 	int ignoreOcclusion;
-	int pad[2];
+
+	// Ray cone of the path used to select texture mip levels (see ray_cones.cl)
+	float coneWidth;
+	float coneSpreadAngle;
 } RTThroughput;
 
 typedef struct _RTInteraction
@@ -241,6 +342,11 @@ typedef struct _RTBDPTVertex
 
 	int radianceBufferIdx;
 
+	// Ray cone after scattering at this vertex used to select texture mip levels at the next vertex (see ray_cones.cl)
+	float coneWidth;
+	float coneSpreadAngle;
+	int pad[2];
+
 } RTBDPTVertex;
 
 typedef struct _RTPinholeCamera
@@ -260,7 +366,8 @@ typedef struct _RTPinholeCamera
 
 	float area;
 
-	int padding;
+	// Angle between the rays of neighbouring pixels
+	float pixelSpreadAngle;
 } RTPinholeCamera;
 
 typedef struct
@@ -279,16 +386,15 @@ struct RTDeviceScene
 {
 	CLWBuffer<RTShape> shapes;
 	CLWBuffer<uint32_t> indices;
-	CLWBuffer<RadeonRays::float3> positions;
-	CLWBuffer<RadeonRays::float2> uvs;
-	CLWBuffer<RadeonRays::float3> normals;
-	CLWBuffer<RadeonRays::float3> tangents;
-	CLWBuffer<RadeonRays::float3> binormals;
-	CLWBuffer<RadeonRays::float3> colors;
+	CLWBuffer<RTVertex> vertices;
 	CLWBuffer<RTTextureDesc2D> textures;
 	CLWBuffer<unsigned char> textureData;
-	CLWBuffer<uint32_t> sobolMatrices;
+	CLWBuffer<uint32_t> textureFeedback;
+	CLWBuffer<uint32_t> samplerTables;
 	CLWBuffer<RTLight> lights;
+	CLWBuffer<RTAliasTableEntry> lightAliasTable;
+	CLWBuffer<RadeonRays::float3> environmentMap;
+	CLWBuffer<RTLightBVHNode> lightBVH;
 	CLWBuffer<RTMaterial> materials;
 	CLWBuffer<RTPinholeCamera> camera;
 };
@@ -301,7 +407,12 @@ enum TextureFormat
 	TEX_FORMAT_R8,
 	TEX_FORMAT_RG8,
 	TEX_FORMAT_RGB8,
-	TEX_FORMAT_RGBA8
+	TEX_FORMAT_RGBA8,
+	// Block compressed formats
+	TEX_FORMAT_BC1,
+	TEX_FORMAT_BC3,
+	TEX_FORMAT_BC4,
+	TEX_FORMAT_BC5
 };
 
 #define TEX_BORDER_COLOR (float4)(0.0f, 0.0f, 0.0f, 0.0f);
@@ -314,6 +425,9 @@ enum TextureWrapping
 	TEX_WRAP_CLAMP_TO_BORDER
 };
 
+// Texture sizes are stored with 16 bits which limits the number of mip levels
+#define RT_MAX_TEXTURE_MIP_LEVELS 16
+
 typedef struct
 {
 	ushort width;
@@ -321,10 +435,42 @@ typedef struct
 	ushort numMipLevels;
 	ushort format;
 	ushort wrap;
-	ushort pad;
+	ushort texelStride; // In bytes, for block compressed formats the size of a 4x4 block
+	short imageBucket; // RT_INVALID_ID if the texture is stored in the texture buffer
+	ushort imageLayer;
 	uint memOffset; // Byte offset
+	// Byte offset of the page table entries of a virtual texture, RT_INVALID_ID if the texels are stored at memOffset
+	int pageTableOffset;
+	// Byte offsets of the mip levels relative to memOffset (or pageTableOffset for virtual textures),
+	// for image textures the texel origin (x | y << 16) in the layer
+	uint mipOffsets[RT_MAX_TEXTURE_MIP_LEVELS];
 } TextureDesc2D;
 
+// Textures can be stored in image arrays, see textures.cl. Images can't be members of Scene so they are passed
+// right after it with TEXTURE_IMAGE_PARAMS and TEXTURE_IMAGE_ARGS which expand to nothing without the build option.
+#ifndef RT_USE_TEXTURE_IMAGES
+#define RT_USE_TEXTURE_IMAGES 0
+#endif
+
+#define RT_MAX_TEXTURE_IMAGE_BUCKETS 8
+
+#if RT_USE_TEXTURE_IMAGES
+#define TEXTURE_IMAGE_PARAMS , read_only image2d_array_t textureImages0,\
+							   read_only image2d_array_t textureImages1,\
+							   read_only image2d_array_t textureImages2,\
+							   read_only image2d_array_t textureImages3,\
+							   read_only image2d_array_t textureImages4,\
+							   read_only image2d_array_t textureImages5,\
+							   read_only image2d_array_t textureImages6,\
+							   read_only image2d_array_t textureImages7
+
+#define TEXTURE_IMAGE_ARGS , textureImages0, textureImages1, textureImages2, textureImages3,\
+							 textureImages4, textureImages5, textureImages6, textureImages7
+#else
+#define TEXTURE_IMAGE_PARAMS
+#define TEXTURE_IMAGE_ARGS
+#endif
+
 #define TRACE_PARAMS __global RTRay* trace_shadowRays,\
 				     __global RTRay* trace_rays,\
 					 __global RTIntersection* trace_isects
@@ -337,19 +483,21 @@ typedef struct
 
 #define SCENE_PARAMS __global const RTShape* restrict scene_shapes,\
 					 __global const unsigned int* restrict scene_indices,\
-				     __global const float3* restrict scene_positions, \
-				     __global const float2* restrict scene_uvs, \
-				     __global const float3* restrict scene_normals, \
-				     __global const float3* restrict scene_tangents, \
-				     __global const float3* restrict scene_binormals, \
-				     __global const float3* restrict scene_colors, \
+				     __global const RTVertex* restrict scene_vertices, \
 					 __global const TextureDesc2D* scene_textures2D,\
 					 __global const uchar* scene_texData2D,\
-					 __global const uint* scene_sobolMatrices,\
+					 __global uint* scene_texFeedback,\
+					 __global const uint* scene_samplerTables,\
 					 __global const RTLight* scene_lights,\
 					 int scene_numLights,\
+					 __global const RTAliasTableEntry* scene_lightAliasTable,\
+					 __global const float3* scene_environmentMap,\
+					 int scene_environmentLightIdx,\
+					 __global const RTLightBVHNode* scene_lightBVH,\
+					 int scene_numInfiniteLights,\
 					 __global const RTMaterial* scene_materials,\
-					 __global const RTPinholeCamera* scene_camera
+					 __global const RTPinholeCamera* scene_camera\
+					 TEXTURE_IMAGE_PARAMS
 
 #define IMAGE_PARAMS int image_width,\
 				     int image_height
@@ -359,35 +507,39 @@ typedef struct _Scene
 {
 	__global const RTShape* restrict shapes;
 	__global const unsigned int* restrict indices;
-	__global const float3* restrict positions;
-	__global const float2* restrict uvs;
-	__global const float3* restrict normals;
-	__global const float3* restrict tangents;
-	__global const float3* restrict binormals;
-	__global const float3* restrict colors;
+	__global const RTVertex* restrict vertices;
 	__global const TextureDesc2D* textures2D;
 	__global const uchar* texData2D;
-	__global const uint* sobolMatrices;
+	// Residency feedback of the virtual textures per page table entry
+	__global uint* texFeedback;
+	__global const uint* samplerTables;
 	__global const RTLight* lights;
+	__global const RTAliasTableEntry* lightAliasTable;
+	__global const float3* environmentMap;
+	// The first numInfiniteLights nodes are leaves of the infinite lights followed by the root of the hierarchy
+	__global const RTLightBVHNode* lightBVH;
 	__global const RTMaterial* materials;
 	__global const RTPinholeCamera* camera;
 	int numLights;
+	int environmentLightIdx;
+	int numInfiniteLights;
 } Scene;
 
 #define MAKE_SCENE(scene) 	Scene scene;\
 	scene.shapes = scene_shapes;\
 	scene.indices = scene_indices;\
-	scene.positions = scene_positions;\
-	scene.uvs = scene_uvs;\
-	scene.normals = scene_normals;\
-	scene.tangents = scene_tangents;\
-	scene.binormals = scene_binormals;\
-	scene.colors = scene_colors;\
+	scene.vertices = scene_vertices;\
 	scene.textures2D = scene_textures2D;\
 	scene.texData2D = scene_texData2D;\
-	scene.sobolMatrices = scene_sobolMatrices;\
+	scene.texFeedback = scene_texFeedback;\
+	scene.samplerTables = scene_samplerTables;\
 	scene.lights = scene_lights;\
 	scene.numLights = scene_numLights;\
+	scene.lightAliasTable = scene_lightAliasTable;\
+	scene.environmentMap = scene_environmentMap;\
+	scene.environmentLightIdx = scene_environmentLightIdx;\
+	scene.lightBVH = scene_lightBVH;\
+	scene.numInfiniteLights = scene_numInfiniteLights;\
 	scene.materials = scene_materials;\
 	scene.camera = scene_camera;
 
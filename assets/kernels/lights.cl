@@ -8,6 +8,7 @@
 #include <samplers.cl>
 #include <math.cl>
 #include <kernel_data.h>
+#include <vertices.cl>
 
 #define RT_DIRECTIONAL_LIGHT_TRACE_DISTANCE 1000.0f
 
@@ -21,18 +22,266 @@ float3 computeTotalPower_PointLight(float3 intensity)
 	return 4.0f * PI * intensity;
 }
 
+/**
+* Chooses a light proportional to its power with the alias table built by the host.
+* @param choicePdf Discrete probability of choosing the returned light.
+*/
+inline int sampleLightIdx(const Scene* scene TEXTURE_IMAGE_PARAMS, float u, float* choicePdf)
+{ 
+	float unusedU;
+	return sampleAliasTable(scene->lightAliasTable, scene->numLights, u, choicePdf, &unusedU);
+}
+
+inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{ 
+	// cos(max(0, a - b))
+	return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+}
+
+inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{ 
+	// sin(max(0, a - b))
+	return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+}
+
+/**
+* Conservative estimate of the contribution of the lights below the node to a shading point p with normal n.
+* Based on the light BVH importance of PBR book 4th edition.
+*/
+float evalLightBVHNodeImportance(__global const RTLightBVHNode* node, float3 p, float3 n)
+{ 
+	float3 pc = 0.5f * (node->boundsMin + node->boundsMax);
+	float3 diagonal = node->boundsMax - node->boundsMin;
+	float d2 = distanceSquared(p, pc);
+	// Avoid the singularity for points close to or inside the bounds
+	d2 = max(d2, length(diagonal) * 0.5f);
+
+	float3 wi = normalize(p - pc);
+	float cosThetaW = dot(node->axis, wi);
+	float sinThetaW = safeSqrt(1.0f - cosThetaW * cosThetaW);
+
+	// Angle subtended by the bounding sphere of the bounds
+	float radiusSq = 0.25f * dot(diagonal, diagonal);
+	float cosThetaB = distanceSquared(p, pc) < radiusSq ? -1.0f : safeSqrt(1.0f - radiusSq / distanceSquared(p, pc));
+	float sinThetaB = safeSqrt(1.0f - cosThetaB * cosThetaB);
+
+	// Minimum angle between emission axis and the direction to p
+	float sinThetaO = safeSqrt(1.0f - node->cosThetaO * node->cosThetaO);
+	float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, node->cosThetaO);
+	float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, node->cosThetaO);
+	float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+	if (cosThetaP <= node->cosThetaE)
+		return 0.0f;
+
+	float importance = node->power * cosThetaP / d2;
+
+	// Account for the incident cosine at the shading point
+	if (isNotNearZero(dot(n, n)))
+	{ 
+		float cosThetaI = absDot(wi, n);
+		float sinThetaI = safeSqrt(1.0f - cosThetaI * cosThetaI);
+		importance *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	}
+
+	return max(importance, 0.0f);
+}
+
+/**
+* Chooses a light by stochastically traversing the light BVH. Infinite lights are chosen separately.
+* Returns RT_INVALID_ID if no light can contribute to p.
+* @param u Sample in [0,1)
+* @param choicePdf Discrete probability of choosing the returned light at p.
+*/
+int sampleLightBVH(const Scene* scene TEXTURE_IMAGE_PARAMS, float3 p, float3 n, float u, float* choicePdf)
+{ 
+	*choicePdf = 0.0f;
+	const bool hasBVH = scene->numLights > scene->numInfiniteLights;
+	const float pInfinite = (float)scene->numInfiniteLights / (scene->numInfiniteLights + (hasBVH ? 1 : 0));
+
+	if (u < pInfinite)
+	{ 
+		int i = min((int)(u / pInfinite * scene->numInfiniteLights), scene->numInfiniteLights - 1);
+		*choicePdf = pInfinite / scene->numInfiniteLights;
+		return scene->lightBVH[i].childOrLightIdx;
+	}
+
+	if (!hasBVH)
+		return RT_INVALID_ID;
+
+	u = min((u - pInfinite) / (1.0f - pInfinite), 0.99999994f);
+	const int rootIdx = scene->numInfiniteLights;
+	int nodeIdx = rootIdx;
+	float pdf = 1.0f - pInfinite;
+
+	while (true)
+	{ 
+		__global const RTLightBVHNode* node = scene->lightBVH + nodeIdx;
+
+		if (node->isLeaf)
+		{ 
+			if (nodeIdx > rootIdx || evalLightBVHNodeImportance(node, p, n) > 0.0f)
+			{ 
+				*choicePdf = pdf;
+				return node->childOrLightIdx;
+			}
+
+			return RT_INVALID_ID;
+		}
+
+		int c0 = nodeIdx + 1;
+		int c1 = node->childOrLightIdx;
+		float ci0 = evalLightBVHNodeImportance(scene->lightBVH + c0, p, n);
+		float ci1 = evalLightBVHNodeImportance(scene->lightBVH + c1, p, n);
+
+		if (ci0 <= 0.0f && ci1 <= 0.0f)
+			return RT_INVALID_ID;
+
+		// Choose a child proportional to its importance and remap u
+		float p0 = ci0 / (ci0 + ci1);
+		if (u < p0)
+		{ 
+			nodeIdx = c0;
+			u = min(u / p0, 0.99999994f);
+			pdf *= p0;
+		}
+		else
+		{ 
+			nodeIdx = c1;
+			u = min((u - p0) / (1.0f - p0), 0.99999994f);
+			pdf *= 1.0f - p0;
+		}
+	}
+}
+
+/**
+* Chooses a triangle of a triangle mesh light proportional to its world space area
+* and uniformly samples a point on it. The resulting density is 1 / light->area.
+* @param u Sample in [0,1]^2
+* @param pdfPos Area density of the sampled point.
+*/
+RTInteraction sampleTriangleMeshLight(__global const RTLight* light, const Scene* scene TEXTURE_IMAGE_PARAMS, float2 u, float* pdfPos)
+{ 
+	RTShape shape = scene->shapes[light->shapeId];
+	float triangleChoicePdf;
+	float uRemapped;
+	int triangleIdx = sampleAliasTable(scene->lightAliasTable + light->distributionOffset, shape.numTriangles, u.x, &triangleChoicePdf, &uRemapped);
+	u.x = uRemapped;
+
+	const uint i0 = scene->indices[shape.startIdx + 3 * triangleIdx];
+	const uint i1 = scene->indices[shape.startIdx + 3 * triangleIdx + 1];
+	const uint i2 = scene->indices[shape.startIdx + 3 * triangleIdx + 2];
+
+	const float3 p0 = getShapeVertexPosition(scene, &shape, i0);
+	const float3 p1 = getShapeVertexPosition(scene, &shape, i1);
+	const float3 p2 = getShapeVertexPosition(scene, &shape, i2);
+
+	RTInteraction shapeInter = sampleTriangle(p0, p1, p2, u, pdfPos);
+	*pdfPos *= triangleChoicePdf;
+	return shapeInter;
+}
+
+/**
+* Maps a world space direction to lat-long coordinates in [0,1]^2. The first row of the map corresponds to +y.
+*/
+inline float2 directionToLatLong(float3 w, float* sinTheta)
+{ 
+	float theta = acos(clamp(w.y, -1.0f, 1.0f));
+	float phi = atan2(w.z, w.x);
+	if (phi < 0.0f)
+		phi += 2.0f * PI;
+
+	*sinTheta = sin(theta);
+	return (float2)(phi / (2.0f * PI), theta / PI);
+}
+
+inline float3 latLongToDirection(float2 uv, float* sinTheta)
+{ 
+	float theta = uv.y * PI;
+	float phi = uv.x * 2.0f * PI;
+	*sinTheta = sin(theta);
+	return (float3)(*sinTheta * cos(phi), cos(theta), *sinTheta * sin(phi));
+}
+
+inline int2 latLongToTexel(__global const RTLight* light, float2 uv)
+{ 
+	return (int2)(clamp((int)(uv.x * light->envMapWidth), 0, light->envMapWidth - 1), 
+				  clamp((int)(uv.y * light->envMapHeight), 0, light->envMapHeight - 1));
+}
+
+/**
+* Radiance arriving from the environment in direction w.
+* The map is treated as piecewise constant to match the sampling density.
+*/
+float3 evalEnvironmentLightLe(__global const RTLight* light, const Scene* scene TEXTURE_IMAGE_PARAMS, float3 w)
+{ 
+	float sinTheta;
+	int2 texel = latLongToTexel(light, directionToLatLong(w, &sinTheta));
+	return light->intensity * scene->environmentMap[texel.y * light->envMapWidth + texel.x];
+}
+
+/**
+* Solid angle density of sampling direction w with sampleEnvironmentLight.
+*/
+float evalEnvironmentLightPdf(__global const RTLight* light, const Scene* scene TEXTURE_IMAGE_PARAMS, float3 w)
+{ 
+	float sinTheta;
+	float2 uv = directionToLatLong(w, &sinTheta);
+	if (isNearZero(sinTheta))
+		return 0.0f;
+
+	int2 texel = latLongToTexel(light, uv);
+	__global const RTAliasTableEntry* marginal = scene->lightAliasTable + light->distributionOffset;
+	__global const RTAliasTableEntry* conditional = marginal + light->envMapHeight + texel.y * light->envMapWidth;
+
+	// Density with respect to the lat-long parameterization converted to solid angle
+	float pdfUV = marginal[texel.y].pdf * conditional[texel.x].pdf * light->envMapWidth * light->envMapHeight;
+	return pdfUV / (2.0f * PI * PI * sinTheta);
+}
+
+/**
+* Samples a direction towards the environment proportional to the luminance of the map.
+* A row is chosen with the marginal table and a texel within the row with the conditional table of the row.
+* @param u Sample in [0,1]^2
+* @param pdf Solid angle density of the sampled direction.
+*/
+float3 sampleEnvironmentLight(__global const RTLight* light, const Scene* scene TEXTURE_IMAGE_PARAMS, float2 u, float* pdf)
+{ 
+	const int width = light->envMapWidth;
+	const int height = light->envMapHeight;
+	__global const RTAliasTableEntry* marginal = scene->lightAliasTable + light->distributionOffset;
+
+	float rowPdf;
+	float columnPdf;
+	float ux;
+	float uy;
+	int y = sampleAliasTable(marginal, height, u.y, &rowPdf, &uy);
+	int x = sampleAliasTable(marginal + height + y * width, width, u.x, &columnPdf, &ux);
+
+	float sinTheta;
+	float3 w = latLongToDirection((float2)((x + ux) / width, (y + uy) / height), &sinTheta);
+
+	*pdf = isNearZero(sinTheta) ? 0.0f : (rowPdf * columnPdf * width * height) / (2.0f * PI * PI * sinTheta);
+	return w;
+}
+
 inline float3 evalDiffuseAreaLightL(float3 intensity, const RTInteraction* interaction, float3 w)
 { 
 	return dot(interaction->gn, w) > 0.0f ? intensity : (float3)(0.0f);
 }
 
-float3 evalLightLe(__global const RTLight* light, float3 gn, float3 w)
+/**
+* @param w Direction from the light towards the receiver. For environment lights -w is the direction of the escaped ray.
+*/
+float3 evalLightLe(const Scene* scene TEXTURE_IMAGE_PARAMS, __global const RTLight* light, float3 gn, float3 w)
 { 
 	switch(light->type)
 	{ 
 		case RT_DISK_AREA_LIGHT:
 		case RT_TRIANGLE_MESH_AREA_LIGHT:
 			return dot(gn, w) >  0.0f ? light->intensity : (float3)(0.0f);
+		case RT_ENVIRONMENT_LIGHT:
+			return evalEnvironmentLightLe(light, scene TEXTURE_IMAGE_ARGS, -w);
 		default:
 			return (float3)(0.0f);
 	}
@@ -42,7 +291,7 @@ float3 evalLightLe(__global const RTLight* light, float3 gn, float3 w)
 * This implementation depends on the given light type.
 * @param u Sample in [0,1]^3
 */
-float3 sampleLightLi(int lightIdx, const Scene* scene, const RTInteraction* interaction, float2 u, float3* lightPosition, float3* lightNormal, float3* wi, float* pdf, __global RTRay* shadowRay)
+float3 sampleLightLi(int lightIdx, const Scene* scene TEXTURE_IMAGE_PARAMS, const RTInteraction* interaction, float2 u, float3* lightPosition, float3* lightNormal, float3* wi, float* pdf, __global RTRay* shadowRay)
 { 
 	__global const RTLight* light = scene->lights + lightIdx;
 
@@ -101,25 +350,9 @@ float3 sampleLightLi(int lightIdx, const Scene* scene, const RTInteraction* inte
 		}
 		case RT_TRIANGLE_MESH_AREA_LIGHT:
 		{
-			RTShape shape = scene->shapes[light->shapeId];
-			// Use u.x to choose a random triangle.
-			int triangleIdx = ((int)floor(u.x * shape.numTriangles)) % shape.numTriangles;
-
-			// Remap u.x for correct distribution.
-			u.x = u.x * shape.numTriangles - triangleIdx;
-
-			unsigned int i0 = scene->indices[shape.startIdx + 3 * triangleIdx];
-			unsigned int i1 = scene->indices[shape.startIdx + 3 * triangleIdx + 1];
-			unsigned int i2 = scene->indices[shape.startIdx + 3 * triangleIdx + 2];
-
-			float3 p0 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex + i0]);
-			float3 p1 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex + i1]);
-			float3 p2 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex + i2]);
-
-			RTInteraction shapeInter = sampleTriangle(p0, p1, p2, u.xy, pdf);
+			RTInteraction shapeInter = sampleTriangleMeshLight(light, scene TEXTURE_IMAGE_ARGS, u, pdf);
 			*lightNormal = shapeInter.gn;
 			*lightPosition = shapeInter.p;
-			*pdf = 1.0f / light->area;
 
 			float3 rayOrigin = interaction->p + interaction->gn * interaction->traceErrorOffset;
 			float3 rayTarget = shapeInter.p + shapeInter.gn * RT_TRACE_OFFSET;
@@ -140,12 +373,23 @@ float3 sampleLightLi(int lightIdx, const Scene* scene, const RTInteraction* inte
 			setRay(shadowRay, rayOrigin, distance(rayOrigin, rayTarget), *wi);
 			return evalDiffuseAreaLightL(light->intensity, &shapeInter, -*wi);
 		}
+		case RT_ENVIRONMENT_LIGHT:
+		{ 
+			*wi = sampleEnvironmentLight(light, scene TEXTURE_IMAGE_ARGS, u, pdf);
+			*lightNormal = (float3)(0.0f);
+			*lightPosition = interaction->p + *wi * light->radius * 2.0f;
+			if (isNearZero(*pdf))
+				return (float3)(0.0f);
+
+			setRay(shadowRay, interaction->p + interaction->gn * interaction->traceErrorOffset, RT_DIRECTIONAL_LIGHT_TRACE_DISTANCE, *wi);
+			return evalEnvironmentLightLe(light, scene TEXTURE_IMAGE_ARGS, *wi);
+		}
 		default:
 		return (float3)(0.0f);
 	}
 }
 
-float3 sampleLightLe(int lightIdx, const Scene* scene, float2 u1, float2 u2, float3* rayOrigin, float3* rayDirection, float3* lightNormal, float* pdfPos, float* pdfDir)
+float3 sampleLightLe(int lightIdx, const Scene* scene TEXTURE_IMAGE_PARAMS, float2 u1, float2 u2, float3* rayOrigin, float3* rayDirection, float3* lightNormal, float* pdfPos, float* pdfDir)
 { 
 	__global const RTLight* light = scene->lights + lightIdx;
 
@@ -189,23 +433,7 @@ float3 sampleLightLe(int lightIdx, const Scene* scene, float2 u1, float2 u2, flo
 		}
 		case RT_TRIANGLE_MESH_AREA_LIGHT:
 		{
-			RTShape shape = scene->shapes[light->shapeId];
-			// Use u1.x to choose a random triangle.
-			int triangleIdx = ((int)floor(u1.x * shape.numTriangles)) % shape.numTriangles;
-
-			// Remap u1.x for correct distribution.
-			u1.x = u1.x * shape.numTriangles - triangleIdx;
-
-			const uint i0 = scene->indices[shape.startIdx + 3 * triangleIdx];
-			const uint i1 = scene->indices[shape.startIdx + 3 * triangleIdx + 1];
-			const uint i2 = scene->indices[shape.startIdx + 3 * triangleIdx + 2];
-
-			const float3 p0 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex + i0]);
-			const float3 p1 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex + i1]);
-			const float3 p2 = transformPoint3(shape.toWorldTransform, scene->positions[shape.startVertex + i2]);
-
-			RTInteraction shapeInter = sampleTriangle(p0, p1, p2, u1, pdfPos);
-			*pdfPos = 1.0f / light->area;
+			RTInteraction shapeInter = sampleTriangleMeshLight(light, scene TEXTURE_IMAGE_ARGS, u1, pdfPos);
 			*lightNormal = shapeInter.gn;
 			float3 w = cosineSampleHemisphere(u2);
 			*pdfDir = cosineHemispherePdf(w.y);
@@ -218,12 +446,25 @@ float3 sampleLightLe(int lightIdx, const Scene* scene, float2 u1, float2 u2, flo
 
 			return light->intensity;
 		}
+		case RT_ENVIRONMENT_LIGHT:
+		{ 
+			// Note: The position of the light must be set to the world center and the radius to the radius of the world.
+			float3 wi = sampleEnvironmentLight(light, scene TEXTURE_IMAGE_ARGS, u1, pdfDir);
+			*rayDirection = -wi;
+			*lightNormal = *rayDirection;
+
+			// Sample a point on the disk perpendicular to the ray direction covering the world
+			RTInteraction shapeInter = sampleDisk(light->p + wi * light->radius, *rayDirection, light->radius, u2, pdfPos);
+			*rayOrigin = shapeInter.p;
+
+			return evalEnvironmentLightLe(light, scene TEXTURE_IMAGE_ARGS, wi);
+		}
 		default:
 		return (float3)(0.0f);
 	}
 }
 
-void evalLightPdfLe(int lightIdx, const Scene* scene, float3 rayDirection, float3 lightNormal, float* pdfPos, float* pdfDir)
+void evalLightPdfLe(int lightIdx, const Scene* scene TEXTURE_IMAGE_PARAMS, float3 rayDirection, float3 lightNormal, float* pdfPos, float* pdfDir)
 { 
 	__global const RTLight* light = scene->lights + lightIdx;
 
@@ -248,6 +489,12 @@ void evalLightPdfLe(int lightIdx, const Scene* scene, float3 rayDirection, float
 			*pdfDir = cosineHemispherePdf(dot(lightNormal, rayDirection));
 		}
 		break;
+		case RT_ENVIRONMENT_LIGHT:
+		{ 
+			*pdfPos = 1.0f / light->area;
+			*pdfDir = evalEnvironmentLightPdf(light, scene TEXTURE_IMAGE_ARGS, -rayDirection);
+		}
+		break;
 	}
 }
 
@@ -11,21 +11,21 @@
 
 #define USE_NORMAL_MAPPING
 
-void applyNormalMapping_internal(int texId, __global const TextureDesc2D* textures, __global const uchar* normalMapData, RTInteraction* si)
+void applyNormalMapping_internal(int texId, __global const TextureDesc2D* textures, __global const uchar* normalMapData, __global uint* texFeedback TEXTURE_IMAGE_PARAMS, RTInteraction* si)
 { 
 #ifdef USE_NORMAL_MAPPING
- 	float3 nm = 2.0f * readTexture2Df(texId, textures, normalMapData, si).xyz - 1.0f;
+ 	float3 nm = 2.0f * readTexture2Df(texId, textures, normalMapData, texFeedback TEXTURE_IMAGE_ARGS, si).xyz - 1.0f;
 	si->sn = normalize(si->sdpdu * nm.x + si->sdpdv * nm.y + si->sn * nm.z);
 	si->sdpdu = normalize(cross(si->sn, si->sdpdv));
 	si->sdpdv = normalize(cross(si->sdpdu, si->sn));
 #endif
 }
 
-inline void applyNormalMapping(const Scene* scene, int materialIdx, RTInteraction* si)
+inline void applyNormalMapping(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, RTInteraction* si)
 {
 	if (materialIdx != RT_INVALID_ID && scene->materials[materialIdx].uber_normalMapId != RT_INVALID_ID)
 	{ 
-		applyNormalMapping_internal(scene->materials[materialIdx].uber_normalMapId, scene->textures2D, scene->texData2D, si);
+		applyNormalMapping_internal(scene->materials[materialIdx].uber_normalMapId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si);
 	}
 }
 
@@ -73,92 +73,111 @@ typedef struct
 	float pad;
 } RTUberMaterialProperties;
 
-inline void getUberMaterialProperties(const Scene* scene, int materialIdx, const RTInteraction* si, RTUberMaterialProperties* properties)
+inline void getUberMaterialProperties(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, const RTInteraction* si, RTUberMaterialProperties* properties)
 { 
 	RTMaterial material = scene->materials[materialIdx];
 
-	float4 Kd_opacity = readTexture2Df_ifValid(material.uber_diffuseTexId, scene->textures2D, scene->texData2D, si, (float4)(1.0f, 1.0f, 1.0f, 1.0f));
+	float4 Kd_opacity = readTexture2Df_ifValid(material.uber_diffuseTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, (float4)(1.0f, 1.0f, 1.0f, 1.0f));
 	properties->Kd = Kd_opacity.xyz * material.uber_kd;
-	properties->Ks = readTexture2Df3_ifValid(material.uber_glossyTexId, scene->textures2D, scene->texData2D, si, (float3)(1.0f, 1.0f, 1.0f)) * material.uber_ks;
-	properties->Kr = readTexture2Df3_ifValid(material.uber_specReflectionTexId, scene->textures2D, scene->texData2D, si, (float3)(1.0f, 1.0f, 1.0f)) * material.uber_kr;
-	properties->Kt.xyz = readTexture2Df3_ifValid(material.uber_transmissionTexId, scene->textures2D, scene->texData2D, si, (float3)(1.0f, 1.0f, 1.0f)) * material.uber_kt.xyz;
+	properties->Ks = readTexture2Df3_ifValid(material.uber_glossyTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, (float3)(1.0f, 1.0f, 1.0f)) * material.uber_ks;
+	properties->Kr = readTexture2Df3_ifValid(material.uber_specReflectionTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, (float3)(1.0f, 1.0f, 1.0f)) * material.uber_kr;
+	properties->Kt.xyz = readTexture2Df3_ifValid(material.uber_transmissionTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, (float3)(1.0f, 1.0f, 1.0f)) * material.uber_kt.xyz;
 	properties->Kt.w = material.uber_kt.w;
-	properties->opacity = readTexture2Df3_ifValid(material.uber_opacityTexId, scene->textures2D, scene->texData2D, si, (float3)(1.0f, 1.0f, 1.0f)) * material.uber_opacity * Kd_opacity.w;
-	properties->roughness = readTexture2Df2_ifValid(material.uber_roughnessTexId, scene->textures2D, scene->texData2D, si, material.uber_roughness);
-	properties->eta = readTexture2Df1_ifValid(material.uber_iorTexId, scene->textures2D, scene->texData2D, si, material.uber_eta);
+	properties->opacity = readTexture2Df3_ifValid(material.uber_opacityTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, (float3)(1.0f, 1.0f, 1.0f)) * material.uber_opacity * Kd_opacity.w;
+	properties->roughness = readTexture2Df2_ifValid(material.uber_roughnessTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, material.uber_roughness);
+	properties->eta = readTexture2Df1_ifValid(material.uber_iorTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, material.uber_eta);
 
 	properties->roughness = (float2)(roughnessToAlpha(properties->roughness.x), roughnessToAlpha(properties->roughness.y));
 }
 
-float evaluateUberMaterialPdf(const Scene* scene, int materialIdx, float3 woWorld, float3 wiWorld, const RTInteraction* si, BxDFType type)
+float evaluateUberMaterialPdf(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, float3 woWorld, float3 wiWorld, const RTInteraction* si, BxDFType type)
 { 
 	RTUberMaterialProperties um;
-	getUberMaterialProperties(scene, materialIdx, si, &um);
+	getUberMaterialProperties(scene TEXTURE_IMAGE_ARGS, materialIdx, si, &um);
 	
 	return evaluateUberBSDF_Pdf(um.Kd, um.Ks, um.Kr, um.Kt, um.roughness, um.opacity, um.eta, si, woWorld, wiWorld, type);
 }
 
-float3 evaluateUberMaterial(const Scene* scene, int materialIdx, float3 woWorld, float3 wiWorld, const RTInteraction* si, TransportMode mode)
+float3 evaluateUberMaterial(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, float3 woWorld, float3 wiWorld, const RTInteraction* si, TransportMode mode)
 { 
 	RTUberMaterialProperties um;
-	getUberMaterialProperties(scene, materialIdx, si, &um);
+	getUberMaterialProperties(scene TEXTURE_IMAGE_ARGS, materialIdx, si, &um);
 
 	return evaluateUberBSDF(um.Kd, um.Ks, um.Kt, um.roughness, um.opacity, um.eta, si, woWorld, wiWorld, mode);
 }
 
-float3 sampleUberMaterial(const Scene* scene, int materialIdx, const RTInteraction* si, float2 u, TransportMode mode, 
+float3 sampleUberMaterial(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, const RTInteraction* si, float2 u, TransportMode mode, 
 						  BxDFType type, float3 woWorld, float3* wiWorld, float* pdf, int* numNonDeltaTypes, BxDFType* sampledType)
 {
 	RTUberMaterialProperties um;
-	getUberMaterialProperties(scene, materialIdx, si, &um);
+	getUberMaterialProperties(scene TEXTURE_IMAGE_ARGS, materialIdx, si, &um);
 
 	return sampleUberBSDF(um.Kd, um.Ks, um.Kr, um.Kt, um.roughness, um.opacity, um.eta, si, u, mode, type, woWorld, wiWorld, pdf, numNonDeltaTypes, sampledType);
 }
 
-float evaluateMaterialPdf(const Scene* scene, int materialIdx, float3 woWorld, float3 wiWorld, const RTInteraction* si, BxDFType type)
+float evaluateMaterialPdf(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, float3 woWorld, float3 wiWorld, const RTInteraction* si, BxDFType type)
 { 
 	switch (scene->materials[materialIdx].type)
 	{
 	case RT_UBER_MATERIAL:
 		{ 
-			return evaluateUberMaterialPdf(scene, materialIdx, woWorld, wiWorld, si, type);
+			return evaluateUberMaterialPdf(scene TEXTURE_IMAGE_ARGS, materialIdx, woWorld, wiWorld, si, type);
 		}
 	}
 
 	return 0.0f;
 }
 
-float3 evaluateMaterial(const Scene* scene, int materialIdx, float3 woWorld, float3 wiWorld, const RTInteraction* si, TransportMode mode)
+float3 evaluateMaterial(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, float3 woWorld, float3 wiWorld, const RTInteraction* si, TransportMode mode)
 { 
 	switch (scene->materials[materialIdx].type)
 	{
 	case RT_UBER_MATERIAL:
 		{ 
-			return evaluateUberMaterial(scene, materialIdx, woWorld, wiWorld, si, mode);
+			return evaluateUberMaterial(scene TEXTURE_IMAGE_ARGS, materialIdx, woWorld, wiWorld, si, mode);
 		}
 	}
 
 	return (float3)(0.0f, 0.0f, 0.0f);
 }
 
-float3 sampleMaterial(const Scene* scene, int materialIdx, const RTInteraction* si, float2 u, TransportMode mode, 
+float3 sampleMaterial(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, const RTInteraction* si, float2 u, TransportMode mode, 
 					  BxDFType type, float3 woWorld, float3* wiWorld, float* pdf, int* numNonDeltaTypes, BxDFType* sampledType)
 { 
 	switch (scene->materials[materialIdx].type)
 	{
 	case RT_UBER_MATERIAL:
 		{ 
-			return sampleUberMaterial(scene, materialIdx, si, u, mode, type, woWorld, wiWorld, pdf, numNonDeltaTypes, sampledType);
+			return sampleUberMaterial(scene TEXTURE_IMAGE_ARGS, materialIdx, si, u, mode, type, woWorld, wiWorld, pdf, numNonDeltaTypes, sampledType);
 		}
 	}
 
 	return (float3)(0.0f, 0.0f, 0.0f);
 }
 
+/**
+* Largest microfacet alpha of the material at si. Used to estimate the spread of sampled directions.
+*/
+inline float getMaterialRoughness(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, const RTInteraction* si)
+{
+	RTMaterial material = scene->materials[materialIdx];
+
+	switch (material.type)
+	{
+	case RT_UBER_MATERIAL:
+		{ 
+			float2 roughness = readTexture2Df2_ifValid(material.uber_roughnessTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, material.uber_roughness);
+			return fmax(roughnessToAlpha(roughness.x), roughnessToAlpha(roughness.y));
+		}
+	}
+
+	return 1.0f;
+}
+
 /**
 * It might be a good idea to cache this info per material. Especially the texture fetches.
 */
-inline bool hasMaterialNonDeltaComponents(const Scene* scene, int materialIdx, const RTInteraction* si)
+inline bool hasMaterialNonDeltaComponents(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, const RTInteraction* si)
 {
 	RTMaterial material = scene->materials[materialIdx];
 
@@ -166,9 +185,9 @@ inline bool hasMaterialNonDeltaComponents(const Scene* scene, int materialIdx, c
 	{
 	case RT_UBER_MATERIAL:
 		{ 
-			float3 Kd = readTexture2Df3_ifValid(material.uber_diffuseTexId, scene->textures2D, scene->texData2D, si, material.uber_kd);
-			float3 Ks = readTexture2Df3_ifValid(material.uber_glossyTexId, scene->textures2D, scene->texData2D, si, material.uber_ks);
-			float3 opacity = readTexture2Df3_ifValid(material.uber_opacityTexId, scene->textures2D, scene->texData2D, si, material.uber_opacity);
+			float3 Kd = readTexture2Df3_ifValid(material.uber_diffuseTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, material.uber_kd);
+			float3 Ks = readTexture2Df3_ifValid(material.uber_glossyTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, material.uber_ks);
+			float3 opacity = readTexture2Df3_ifValid(material.uber_opacityTexId, scene->textures2D, scene->texData2D, scene->texFeedback TEXTURE_IMAGE_ARGS, si, material.uber_opacity);
 			float3 kd = Kd * opacity;
 			float3 ks = Ks * opacity;
 			return (!isBlack(kd) || !isBlack(ks));
@@ -85,6 +85,11 @@ inline float distanceSquared(float3 p0, float3 p1)
 	return dot(p0-p1, p0-p1);
 }
 
+inline float safeSqrt(float v)
+{ 
+	return sqrt(max(v, 0.0f));
+}
+
 inline float3 lerpDirection(float3 d0, float3 d1, float3 d2, float3 d3, float t0, float t1)
 {
     return normalize(mix(mix(d0, d1, t0), mix(d3, d2, t0), t1));
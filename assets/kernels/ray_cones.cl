@@ -0,0 +1,114 @@
+#ifndef RAY_CONES_CL
+#define RAY_CONES_CL
+
+/** Texture level of detail for secondary bounces with ray cones based on
+* "Texture Level of Detail Strategies for Real-Time Ray Tracing" by Akenine-Moeller et al. in Ray Tracing Gems 2019.
+*
+* A path carries a cone described by its width at the last vertex and its spread angle. Camera paths start with the
+* spread angle of a pixel. At a hit the cone footprint is converted to uv derivatives with the texel density of the
+* triangle, these select the mip level in readTexture2Df. After scattering the spread angle grows with the curvature
+* of the surface and the roughness of the sampled lobe.
+*/
+
+#include <kernel_data.h>
+#include <vertices.cl>
+#include <math.cl>
+#include <matrix.cl>
+#include <bxdfs.cl>
+#include <materials.cl>
+
+// Keeps the footprint finite on rough or highly curved surfaces
+#define RT_RAY_CONE_MAX_SPREAD_ANGLE PI_DIV_2
+
+typedef struct
+{
+	float width;
+	float spreadAngle;
+} RTRayCone;
+
+inline RTRayCone makeRayCone(float width, float spreadAngle)
+{
+	RTRayCone cone;
+	cone.width = width;
+	cone.spreadAngle = spreadAngle;
+	return cone;
+}
+
+/**
+* Computes the square root of the ratio of the uv area to the world space area of the triangle hit by isect
+* and estimates the surface curvature from the change of the vertex normals along the triangle edges.
+*/
+void computeRayConeTriangleInfo(const Scene* scene TEXTURE_IMAGE_PARAMS, const RTIntersection* isect, float* uvToWorldScale, float* curvature)
+{
+	RTShape shape = scene->shapes[isect->shapeid];
+
+	int primIdx = isect->primid;
+	unsigned int i0 = scene->indices[shape.startIdx + 3 * primIdx];
+	unsigned int i1 = scene->indices[shape.startIdx + 3 * primIdx + 1];
+	unsigned int i2 = scene->indices[shape.startIdx + 3 * primIdx + 2];
+
+	float3 p0 = getShapeVertexPosition(scene, &shape, i0);
+	float3 p1 = getShapeVertexPosition(scene, &shape, i1);
+	float3 p2 = getShapeVertexPosition(scene, &shape, i2);
+
+	float2 uv0 = getVertexUV(scene, shape.startVertex + i0);
+	float2 uv1 = getVertexUV(scene, shape.startVertex + i1);
+	float2 uv2 = getVertexUV(scene, shape.startVertex + i2);
+
+	float3 n0 = normalize(getShapeVertexNormal(scene, &shape, i0));
+	float3 n1 = normalize(getShapeVertexNormal(scene, &shape, i1));
+	float3 n2 = normalize(getShapeVertexNormal(scene, &shape, i2));
+
+	// Both areas are doubled which cancels out in the ratio
+	float worldArea = length(cross(p1 - p0, p2 - p0));
+	float2 duv1 = uv1 - uv0;
+	float2 duv2 = uv2 - uv0;
+	float uvArea = fabs(duv1.x * duv2.y - duv1.y * duv2.x);
+	*uvToWorldScale = isNearZero(worldArea) ? 0.0f : sqrt(uvArea / worldArea);
+
+	float3 e01 = p1 - p0;
+	float3 e12 = p2 - p1;
+	float3 e20 = p0 - p2;
+	float k01 = fabs(dot(n1 - n0, e01)) / fmax(dot(e01, e01), EPSILON);
+	float k12 = fabs(dot(n2 - n1, e12)) / fmax(dot(e12, e12), EPSILON);
+	float k20 = fabs(dot(n0 - n2, e20)) / fmax(dot(e20, e20), EPSILON);
+	*curvature = (k01 + k12 + k20) * (1.0f / 3.0f);
+}
+
+/**
+* Moves the cone along the ray to the hit at hitDistance.
+*/
+inline void propagateRayCone(RTRayCone* cone, float hitDistance)
+{
+	cone->width += cone->spreadAngle * hitDistance;
+}
+
+/**
+* Sets the uv derivatives of si from the cone footprint. The footprint is stretched on surfaces seen at grazing angles.
+*/
+inline void setRayConeTextureFootprint(const RTRayCone* cone, float uvToWorldScale, RTInteraction* si)
+{
+	float cosTheta = fmax(absDot(si->wo, si->gn), 0.01f);
+	float footprint = cone->width / cosTheta * uvToWorldScale;
+	si->duvdx = (float2)(footprint, 0.0f);
+	si->duvdy = (float2)(0.0f, footprint);
+}
+
+/**
+* Widens the cone after scattering in sampledType at si. A curved surface spreads the cone by twice the change of the
+* normal over the cone width. The sampled lobe adds its angular extent: none for specular, an estimate from the
+* microfacet alpha for glossy and a quarter circle for diffuse scattering.
+*/
+void spreadRayCone(RTRayCone* cone, const Scene* scene TEXTURE_IMAGE_PARAMS, int materialIdx, const RTInteraction* si, float curvature, BxDFType sampledType)
+{
+	float lobeSpread = 0.0f;
+
+	if ((sampledType & BSDF_DIFFUSE) != 0)
+		lobeSpread = PI_DIV_4;
+	else if ((sampledType & BSDF_GLOSSY) != 0)
+		lobeSpread = atan(getMaterialRoughness(scene TEXTURE_IMAGE_ARGS, materialIdx, si));
+
+	cone->spreadAngle = fmin(cone->spreadAngle + 2.0f * curvature * cone->width + lobeSpread, RT_RAY_CONE_MAX_SPREAD_ANGLE);
+}
+
+#endif // RAY_CONES_CL
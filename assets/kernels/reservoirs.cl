@@ -0,0 +1,173 @@
+#ifndef RESERVOIRS_CL
+#define RESERVOIRS_CL
+
+/** Reservoir based spatiotemporal resampling of direct lighting (ReSTIR) based on
+* "Spatiotemporal reservoir resampling for real-time ray tracing with dynamic direct lighting" by Bitterli et al. 2020.
+*
+* Samples are stored as points on the lights (area measure) or directions for infinite lights (solid angle measure).
+* This way a sample can be evaluated at any shading point without a change of variables.
+*/
+
+#include <kernel_data.h>
+#include <math.cl>
+#include <colors.cl>
+#include <lights.cl>
+#include <materials.cl>
+
+// Offset of the sampler dimensions used by the ReSTIR kernels to decorrelate them from the path tracing bounces
+#define RT_RESTIR_SAMPLER_OFFSET 16
+
+inline RTReservoir makeEmptyReservoir()
+{
+	RTReservoir r;
+	r.lightPosition = (float3)(0.0f);
+	r.lightNormal = (float3)(0.0f);
+	r.shadingPosition = (float3)(0.0f);
+	r.shadingNormal = (float3)(0.0f);
+	r.lightIdx = RT_INVALID_ID;
+	r.M = 0;
+	r.weightSum = 0.0f;
+	r.W = 0.0f;
+	r.targetPdf = 0.0f;
+	return r;
+}
+
+inline bool isLightInfinite(__global const RTLight* light)
+{
+	return light->type == RT_DIRECTIONAL_LIGHT || light->type == RT_ENVIRONMENT_LIGHT;
+}
+
+/**
+* Unshadowed radiance arriving at si from the light sample. For area lights the geometry term at the light is included
+* because the sample is defined with respect to area.
+* @param wi Direction from si towards the light.
+* @param dist Distance to the light sample.
+*/
+float3 evalLightSampleLi(const Scene* scene TEXTURE_IMAGE_PARAMS, int lightIdx, float3 lightPosition, float3 lightNormal, const RTInteraction* si, float3* wi, float* dist)
+{
+	__global const RTLight* light = scene->lights + lightIdx;
+
+	switch(light->type)
+	{
+		case RT_DIRECTIONAL_LIGHT:
+		{
+			*wi = -light->d;
+			*dist = RT_DIRECTIONAL_LIGHT_TRACE_DISTANCE;
+			return light->intensity;
+		}
+		case RT_ENVIRONMENT_LIGHT:
+		{
+			*wi = lightPosition;
+			*dist = RT_DIRECTIONAL_LIGHT_TRACE_DISTANCE;
+			return evalEnvironmentLightLe(light, scene TEXTURE_IMAGE_ARGS, lightPosition);
+		}
+		case RT_POINT_LIGHT:
+		case RT_DISK_AREA_LIGHT:
+		case RT_TRIANGLE_MESH_AREA_LIGHT:
+		{
+			*wi = lightPosition - si->p;
+			float distSq = dot(*wi, *wi);
+			if (isNearZero(distSq))
+				return (float3)(0.0f);
+
+			*dist = sqrt(distSq);
+			*wi /= *dist;
+
+			if (light->type == RT_POINT_LIGHT)
+				return light->intensity / distSq;
+
+			float cosLight = dot(lightNormal, -*wi);
+			return cosLight > 0.0f ? light->intensity * cosLight / distSq : (float3)(0.0f);
+		}
+		default:
+			return (float3)(0.0f);
+	}
+}
+
+/**
+* Target function of the resampling: luminance of the unshadowed contribution of the light sample at si.
+*/
+float evalReservoirTargetPdf(const Scene* scene TEXTURE_IMAGE_PARAMS, int materialId, int lightIdx, float3 lightPosition, float3 lightNormal, const RTInteraction* si)
+{
+	if (lightIdx == RT_INVALID_ID || lightIdx >= scene->numLights)
+		return 0.0f;
+
+	float3 wi;
+	float dist;
+	float3 Li = evalLightSampleLi(scene TEXTURE_IMAGE_ARGS, lightIdx, lightPosition, lightNormal, si, &wi, &dist);
+	if (isBlack(Li))
+		return 0.0f;
+
+	float3 f = evaluateMaterial(scene TEXTURE_IMAGE_ARGS, materialId, si->wo, wi, si, TRANSPORT_MODE_RADIANCE) * absDot(wi, si->sn);
+	return max(computeLuminanceFromRGB(f * Li), 0.0f);
+}
+
+/**
+* Streams a candidate into the reservoir with the given resampling weight.
+* @param u Sample in [0,1)
+*/
+inline bool updateReservoir(RTReservoir* r, int lightIdx, float3 lightPosition, float3 lightNormal, float targetPdf, float weight, int M, float u)
+{
+	r->weightSum += weight;
+	r->M += M;
+
+	if (weight > 0.0f && u * r->weightSum < weight)
+	{
+		r->lightIdx = lightIdx;
+		r->lightPosition = lightPosition;
+		r->lightNormal = lightNormal;
+		r->targetPdf = targetPdf;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+* Merges another reservoir into r. targetPdf is the target function of the other reservoir's sample evaluated at the
+* shading point of r.
+*/
+inline bool combineReservoir(RTReservoir* r, const RTReservoir* other, float targetPdf, float u)
+{
+	return updateReservoir(r, other->lightIdx, other->lightPosition, other->lightNormal, targetPdf, targetPdf * other->W * other->M, other->M, u);
+}
+
+inline void finalizeReservoir(RTReservoir* r)
+{
+	r->W = (r->M > 0 && r->targetPdf > 0.0f) ? r->weightSum / (r->M * r->targetPdf) : 0.0f;
+}
+
+/**
+* Reuse is only allowed between pixels that see similar geometry.
+*/
+inline bool areReservoirsSimilar(const RTReservoir* r, const RTReservoir* other, float3 cameraPosition)
+{
+	if (other->M == 0)
+		return false;
+
+	float depth = distance(cameraPosition, r->shadingPosition);
+	float otherDepth = distance(cameraPosition, other->shadingPosition);
+	return dot(r->shadingNormal, other->shadingNormal) > 0.9f && fabs(depth - otherDepth) < 0.1f * depth;
+}
+
+/**
+* Sets the visibility ray from si towards the light sample of the reservoir.
+*/
+void setReservoirShadowRay(const Scene* scene TEXTURE_IMAGE_PARAMS, const RTReservoir* r, const RTInteraction* si, float3 wi, float dist, __global RTRay* shadowRay)
+{
+	float3 rayOrigin = si->p + si->gn * si->traceErrorOffset;
+	__global const RTLight* light = scene->lights + r->lightIdx;
+
+	if (isLightInfinite(light))
+	{
+		setRay(shadowRay, rayOrigin, dist, wi);
+	}
+	else
+	{
+		float3 rayTarget = r->lightPosition + r->lightNormal * RT_TRACE_OFFSET;
+		float rayDist = distance(rayOrigin, rayTarget);
+		setRay(shadowRay, rayOrigin, rayDist, (rayTarget - rayOrigin) / rayDist);
+	}
+}
+
+#endif // RESERVOIRS_CL
@@ -29,9 +29,10 @@
 #define WANG_HASH_RNG 2
 #define WANG_HASH_AND_LCG 3 // wang_hash(lcg(seed))
 #define IDENTITY_RNG 4 // Just returns the seed; not random
+#define PCG_HASH_RNG 5
 
 #define SEQUENCE_RNG XORSHIFT_RNG
-#define SEED_RNG WANG_HASH_RNG
+#define SEED_RNG PCG_HASH_RNG
 
 /**
 * Linear congruential generator.
@@ -65,6 +66,42 @@ uint wang_hash(uint seed)
     return seed;
 }
 
+/**
+* PCG-RXS-M-XS hash from "Hash Functions for GPU Rendering" by Jarzynski and Olano.
+* Has better statistical quality than the Wang hash at a similar cost.
+*/
+uint pcgHash(uint v)
+{
+	uint state = v * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+/**
+* Counter-based generator: Maps a 3D counter (e.g. pixel, sample index, dimension) to 3 random numbers
+* without any state, see "Hash Functions for GPU Rendering" by Jarzynski and Olano.
+*/
+uint3 pcg3d(uint3 v)
+{
+	v = v * 1664525u + 1013904223u;
+	v.x += v.y * v.z;
+	v.y += v.z * v.x;
+	v.z += v.x * v.y;
+	v ^= v >> 16u;
+	v.x += v.y * v.z;
+	v.y += v.z * v.x;
+	v.z += v.x * v.y;
+	return v;
+}
+
+/**
+* Maps the upper 24 bits to [0,1). Unlike a division by 0xffffffff the result is never 1.
+*/
+inline float uintToUnitFloat(uint v)
+{
+	return (v >> 8) * 0x1p-24f;
+}
+
 #if SEQUENCE_RNG == XORSHIFT_RNG
 uint randUInt(uint* seed)
 {
@@ -94,6 +131,11 @@ uint randSequenceSeed(uint seed)
 {
 	return wang_hash(seed);
 }
+#elif SEED_RNG == PCG_HASH_RNG
+uint randSequenceSeed(uint seed)
+{
+	return pcgHash(seed);
+}
 #elif SEED_RNG == IDENTITY_RNG
 uint randSequenceSeed(uint seed)
 {
@@ -1,7 +1,14 @@
 #ifndef SAMPLERS_CL
 #define SAMPLERS_CL
 
-/** Implementation of Sobol based on "Physically Based Rendering From Theory to Implementation Third Edition"
+/** Samplers of the integrators. The sampler is chosen with the RT_SAMPLER build option:
+* 
+* RT_SAMPLER_RANDOM: Counter-based PCG hash of pixel, sample index and dimension.
+* RT_SAMPLER_SOBOL: Sobol sequence with per pixel Owen scrambling based on 
+*	"Practical Hash-based Owen Scrambling" by Brent Burley. The sample index is the frame number.
+*	The generator matrices are evaluated with precomputed byte tables (see SamplerTables.h).
+* RT_SAMPLER_RANK1: Rank-1 lattice sequence (golden ratio for 1D, plastic number for 2D samples) dithered per pixel
+*	with a blue noise tile. The error is distributed as blue noise in screen space.
 *
 * Note: 1/2^32 = 0x1p-32f = (1.f / (1UL << 32)) = 1.f / 0x1p32f
 */
@@ -10,100 +17,121 @@
 #include <kernel_data.h>
 #include <rng.cl>
 
-#define NUM_SOBOL_DIMENSIONS 1024
-#define SOBOL_MATRIX_SIZE 52
-
 #define RT_SAMPLER_SOBOL 0
 #define RT_SAMPLER_RANDOM 1
-#define RT_SAMPLER RT_SAMPLER_RANDOM 
+#define RT_SAMPLER_RANK1 2
+
+#ifndef RT_SAMPLER
+#define RT_SAMPLER RT_SAMPLER_RANDOM
+#endif
+
+// Generators of the rank-1 sequences in 0.32 fixed point
+#define RT_RANK1_GOLDEN_RATIO 2654435769u
+#define RT_RANK1_PLASTIC_X 3242174889u
+#define RT_RANK1_PLASTIC_Y 2447445414u
 
 typedef struct
 { 
+	// Sample index for the Sobol and rank-1 samplers, pixel index for the random sampler
 	uint idx;
-	uint dimension; 
-	uint scramble; 
-	__global const uint* sobolMatrices;
+	uint dimension;
+	uint scramble;
+	uint pixelX;
+	uint pixelY;
+	__global const uint* tables;
 } Sampler;
 
-inline uint countTrailingZeros(uint v)
-{ 
-	return 32 - clz(v & -v);
-}
-
-inline uint multiplyGenerator(__global const uint* C, uint a)
+inline uint reverseBits(uint v)
 { 
-	uint v = 0;
-	for (int i = 0; a != 0; ++i, a >>=1)
-		if (a & 1)
-			v ^= C[i];
-
-	return v;
+	v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+	v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+	v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+	v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+	return (v >> 16) | (v << 16);
 }
 
-inline float sampleGeneratorMatrix(__global const uint* C, uint a, uint scramble)
+/**
+* Nested uniform scrambling approximated with a hash (Laine-Karras permutation as improved by Burley).
+*/
+inline uint owenScramble(uint v, uint seed)
 { 
-	return (multiplyGenerator(C, a) ^ scramble) * 0x1p-32f;
+	v = reverseBits(v);
+	v ^= v * 0x3d20adeau;
+	v += seed;
+	v *= (seed >> 16) | 1u;
+	v ^= v * 0x05526c56u;
+	v ^= v * 0x53a22864u;
+	return reverseBits(v);
 }
 
-inline uint grayCode(uint n)
+/**
+* Evaluates the Sobol generator matrix of the dimension with one lookup per byte of the index.
+*/
+inline uint sobolSampleTable(uint idx, uint dimension, __global const uint* tables)
 { 
-	return (n >> 1) ^ n;
+	__global const uint* t = tables + (dimension % RT_SOBOL_TABLE_DIMENSIONS) * RT_SOBOL_TABLE_SIZE;
+	return t[idx & 0xff] ^ t[256 + ((idx >> 8) & 0xff)] ^ t[512 + ((idx >> 16) & 0xff)] ^ t[768 + (idx >> 24)];
 }
 
-// Fills p with samples
-inline void grayCodeSample(__global const uint* C, uint n, uint scramble, float* p)
+inline float sobolSampleOwen(const Sampler* sampler, uint dimension)
 { 
-	uint v = scramble;
-	for (uint i = 0; i < n; ++i)
-	{ 
-		p[i] = v * 0x1p-32f;
-		v ^= C[countTrailingZeros(i+1)];
-	}
+	uint seed = pcgHash(sampler->scramble ^ pcgHash(dimension));
+	return uintToUnitFloat(owenScramble(sobolSampleTable(sampler->idx, dimension, sampler->tables), seed));
 }
 
-inline float sobolSample(uint idx, uint dimension, uint scramble, __global const uint* sobolMatrices)
+/**
+* Blue noise value of the pixel in 0.32 fixed point. The tile is shifted toroidally per dimension
+* to decorrelate the dimensions.
+*/
+inline uint sampleBlueNoise(const Sampler* sampler, uint dimension)
 { 
-	uint v = scramble;
-	for (uint i = dimension * SOBOL_MATRIX_SIZE; idx != 0; idx >>= 1, ++i)
-		if (idx & 1)
-			v ^= sobolMatrices[i];
-
-	return v * 0x1p-32f;
+	uint shift = pcgHash(sampler->scramble + dimension);
+	uint x = (sampler->pixelX + (shift & 0xffff)) % RT_BLUE_NOISE_SIZE;
+	uint y = (sampler->pixelY + (shift >> 16)) % RT_BLUE_NOISE_SIZE;
+	uint rank = sampler->tables[RT_BLUE_NOISE_OFFSET + y * RT_BLUE_NOISE_SIZE + x];
+
+	// Ranks are in [0, RT_BLUE_NOISE_SIZE^2), scale to 32 bits and center in the interval of the rank
+	const uint bits = 32 - 2 * (31 - clz(RT_BLUE_NOISE_SIZE));
+	return (rank << bits) + (1u << (bits - 1));
 }
 
 #if RT_SAMPLER == RT_SAMPLER_SOBOL
 	#define MAKE_SAMPLER(sampler, bufferIdx, offset) Sampler sampler;\
-								  sampler.idx = bufferIdx + integrator_frameNum * image_width * image_height;\
-								  sampler.dimension = 0;\
-								  uint sampler_seed = randSequenceSeed((integrator_frameNum + 1) * (offset + 1));\
-								  sampler.scramble = randUInt(&sampler_seed);\
-								  sampler.sobolMatrices = scene_sobolMatrices;
+									  sampler.idx = integrator_frameNum;\
+									  sampler.dimension = 0;\
+									  sampler.scramble = pcgHash((bufferIdx) ^ pcgHash((offset) + 1));\
+									  sampler.tables = scene_samplerTables;
 
 #elif RT_SAMPLER == RT_SAMPLER_RANDOM
 	#define MAKE_SAMPLER(sampler, bufferIdx, offset) Sampler sampler;\
-								  sampler.idx = randSequenceSeed(bufferIdx + (integrator_frameNum + 1) * image_width * image_height * (offset + 1));
-#endif
-							
-inline void initSampler(Sampler* sampler, uint idx, uint dimension, uint scramble, __global const uint* sobolMatrices)
-{ 
-#if RT_SAMPLER == RT_SAMPLER_SOBOL
-	sampler->idx = idx;
-	sampler->dimension = dimension;
-	sampler->scramble = scramble;
-	sampler->sobolMatrices = sobolMatrices;
-#elif RT_SAMPLER == RT_SAMPLER_RANDOM
-	sampler->idx = idx;
+									  sampler.idx = bufferIdx;\
+									  sampler.dimension = 0;\
+									  sampler.scramble = pcgHash(integrator_frameNum ^ pcgHash((offset) + 1));
+
+#elif RT_SAMPLER == RT_SAMPLER_RANK1
+	#define MAKE_SAMPLER(sampler, bufferIdx, offset) Sampler sampler;\
+									  sampler.idx = integrator_frameNum;\
+									  sampler.dimension = 0;\
+									  sampler.scramble = pcgHash((offset) + 1);\
+									  sampler.pixelX = (bufferIdx) % image_width;\
+									  sampler.pixelY = (bufferIdx) / image_width;\
+									  sampler.tables = scene_samplerTables;
 #endif
-}
 
 inline float getSample1D(Sampler* sampler)
 { 
 #if RT_SAMPLER == RT_SAMPLER_SOBOL
-	float u = sobolSample(sampler->idx, sampler->dimension, sampler->scramble, sampler->sobolMatrices);
+	float u = sobolSampleOwen(sampler, sampler->dimension);
 	sampler->dimension++;
 	return u;
 #elif RT_SAMPLER == RT_SAMPLER_RANDOM
-	return randFloat(&sampler->idx);
+	uint3 v = pcg3d((uint3)(sampler->idx, sampler->scramble, sampler->dimension));
+	sampler->dimension++;
+	return uintToUnitFloat(v.x);
+#elif RT_SAMPLER == RT_SAMPLER_RANK1
+	uint v = sampleBlueNoise(sampler, sampler->dimension) + sampler->idx * RT_RANK1_GOLDEN_RATIO;
+	sampler->dimension++;
+	return uintToUnitFloat(v);
 #endif
 }
 
@@ -111,13 +139,19 @@ inline float2 getSample2D(Sampler* sampler)
 { 
 #if RT_SAMPLER == RT_SAMPLER_SOBOL
 	float2 u;
-	u.x = sobolSample(sampler->idx, sampler->dimension, sampler->scramble, sampler->sobolMatrices);
-	sampler->dimension++;
-	u.y = sobolSample(sampler->idx, sampler->dimension, sampler->scramble, sampler->sobolMatrices);
-	sampler->dimension++;
+	u.x = sobolSampleOwen(sampler, sampler->dimension);
+	u.y = sobolSampleOwen(sampler, sampler->dimension + 1);
+	sampler->dimension += 2;
 	return u;
 #elif RT_SAMPLER == RT_SAMPLER_RANDOM
-	return (float2)(randFloat(&sampler->idx), randFloat(&sampler->idx));
+	uint3 v = pcg3d((uint3)(sampler->idx, sampler->scramble, sampler->dimension));
+	sampler->dimension += 2;
+	return (float2)(uintToUnitFloat(v.x), uintToUnitFloat(v.y));
+#elif RT_SAMPLER == RT_SAMPLER_RANK1
+	uint x = sampleBlueNoise(sampler, sampler->dimension) + sampler->idx * RT_RANK1_PLASTIC_X;
+	uint y = sampleBlueNoise(sampler, sampler->dimension + 1) + sampler->idx * RT_RANK1_PLASTIC_Y;
+	sampler->dimension += 2;
+	return (float2)(uintToUnitFloat(x), uintToUnitFloat(y));
 #endif
 }
 
@@ -245,6 +279,38 @@ inline float evalPowerHeuristic(int nf, float fPdf, int ng, float gPdf)
 	return (f * f) / (f * f + g * g);
 }
 
+/**
+* Samples the discrete distribution described by the alias table in O(1).
+* The fractional part of u * n is reused to pick between the entry and its alias.
+* @param table Alias table with n entries.
+* @param u Sample in [0,1)
+* @param pdf Discrete probability of the returned index.
+* @param uRemapped The unused part of u remapped to [0,1) for reuse by the caller.
+*/
+inline int sampleAliasTable(__global const RTAliasTableEntry* table, int n, float u, float* pdf, float* uRemapped)
+{ 
+	float x = u * n;
+	int i = min((int)x, n - 1);
+	float up = x - i;
+	float q = table[i].q;
+	int chosenIdx;
+
+	if (up < q)
+	{
+		chosenIdx = i;
+		*uRemapped = up / q;
+	}
+	else
+	{
+		chosenIdx = table[i].alias;
+		*uRemapped = (up - q) / (1.0f - q);
+	}
+
+	*uRemapped = clamp(*uRemapped, 0.0f, 0.99999994f);
+	*pdf = table[chosenIdx].pdf;
+	return chosenIdx;
+}
+
 float computeDiskArea(float radius)
 { 
 	return PI * radius * radius;
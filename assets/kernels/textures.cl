@@ -12,18 +12,154 @@
 * Texture descriptions are used to specify size, format, wrapping method and memory location in the texture buffer.
 * Supported formats and wrapping methods are defined in the enums below.
 *
-* Texture data is 4 byte aligned. Formats R8, RG8, RGB8, RGBA8 are all treated as RGBA8 and thus have 4 color channels and a texel stride of 4 bytes.
-* If a texture with format R8 is read then (r, 0, 0, 1) is returned, where r is the value of the texture converted to floating point value in [0,1].
+* Texels are tightly packed in their native format: R8, RG8, RGB8 and RGBA8 have a texel stride of 1, 2, 3 and 4 bytes.
+* The block compressed formats BC1 (RGB), BC3 (RGBA), BC4 (R) and BC5 (RG) store 4x4 texels in 8 or 16 bytes and are
+* decoded on fetch.
+* The byte offsets of the mip levels are precomputed in the texture description.
+* With the RT_USE_TEXTURE_IMAGES build option textures can also be stored in image2d_array_t buckets of identical size
+* and channel order instead (see RTTextureImages.h). Their mip levels are packed into an atlas per layer and reads use the
+* hardware bilinear filter. The buffer is the fallback for all textures that aren't in a bucket.
+* Virtual textures (see RTVirtualTextures.h) store their mip levels in tiles that are streamed into a fixed size pool of the
+* texture buffer. A page table at the start of the buffer maps the tiles to their slots in the pool.
+* Missing channels are filled with (0, 0, 0, 1), e.g. if a texture with format R8 is read then (r, 0, 0, 1) is returned,
+* where r is the value of the texture converted to floating point value in [0,1].
 */
 
 #include <kernel_data.h>
 
+inline float3 unpackRGB565(uint v)
+{
+	return convert_float3((uint3)((v >> 11) & 31, (v >> 5) & 63, v & 31)) * (float3)(1.0f / 31.0f, 1.0f / 63.0f, 1.0f / 31.0f);
+}
+
 /**
-* Computes the stride of one texel in bytes based on texture format.
+* Decodes texel i of a BC1 color block. The color blocks of BC3 always use the four color mode.
 */
-inline int computeTexelStride(ushort format)
-{ 
-	return 4;
+inline float4 decodeBC1Texel(__global const uchar* block, int i, bool isFourColorMode)
+{
+	uint c0 = block[0] | (block[1] << 8);
+	uint c1 = block[2] | (block[3] << 8);
+	uint indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint)block[7] << 24);
+	uint idx = (indices >> (2 * i)) & 3;
+
+	float3 color0 = unpackRGB565(c0);
+	float3 color1 = unpackRGB565(c1);
+
+	switch (idx)
+	{
+		case 0: return (float4)(color0, 1.0f);
+		case 1: return (float4)(color1, 1.0f);
+		case 2: return (isFourColorMode || c0 > c1) ? (float4)((2.0f * color0 + color1) * (1.0f / 3.0f), 1.0f) : (float4)((color0 + color1) * 0.5f, 1.0f);
+		default: return (isFourColorMode || c0 > c1) ? (float4)((color0 + 2.0f * color1) * (1.0f / 3.0f), 1.0f) : (float4)(0.0f);
+	}
+}
+
+/**
+* Decodes texel i of a BC4 block (also used for the alpha of BC3 and both channels of BC5).
+*/
+inline float decodeBC4Texel(__global const uchar* block, int i)
+{
+	float a0 = block[0];
+	float a1 = block[1];
+
+	// 48 bits of 3 bit indices, an index may span two bytes
+	int bit = 16 + 3 * i;
+	uint bits = block[bit >> 3];
+	if ((bit & 7) > 5)
+		bits |= block[(bit >> 3) + 1] << 8;
+	uint idx = (bits >> (bit & 7)) & 7;
+
+	float v;
+	if (idx < 2)
+		v = idx == 0 ? a0 : a1;
+	else if (a0 > a1)
+		v = ((8 - idx) * a0 + (idx - 1) * a1) * (1.0f / 7.0f);
+	else if (idx < 6)
+		v = ((6 - idx) * a0 + (idx - 1) * a1) * (1.0f / 5.0f);
+	else
+		v = idx == 6 ? 0.0f : 255.0f;
+
+	return v * (1.0f / 255.0f);
+}
+
+/**
+* Reads the texel at (x, y) and converts it to floating point values in [0,1].
+* Block compressed formats decode the texel from its 4x4 block.
+* Virtual textures look up the tile of the texel in the page table at the start of the texture buffer.
+*/
+inline float4 readTexel(const TextureDesc2D* tex, __global const uchar* texData, int x, int y)
+{
+	uint memOffset = tex->memOffset;
+	int rowWidth = tex->width;
+
+	if (tex->pageTableOffset != RT_INVALID_ID)
+	{
+		int numTilesX = (tex->width + RT_VT_TILE_SIZE - 1) / RT_VT_TILE_SIZE;
+		__global const uint* pageTable = (__global const uint*)(texData + tex->pageTableOffset);
+		memOffset = pageTable[(y / RT_VT_TILE_SIZE) * numTilesX + x / RT_VT_TILE_SIZE];
+
+		// Only reached if the tile was evicted after the residency check
+		if (memOffset == RT_VT_TILE_NOT_RESIDENT)
+			return (float4)(0.0f, 0.0f, 0.0f, 1.0f);
+
+		x %= RT_VT_TILE_SIZE;
+		y %= RT_VT_TILE_SIZE;
+		rowWidth = RT_VT_TILE_SIZE;
+	}
+
+	if (tex->format >= TEX_FORMAT_BC1)
+	{
+		int numBlocksX = (rowWidth + 3) >> 2;
+		__global const uchar* block = texData + memOffset + ((y >> 2) * numBlocksX + (x >> 2)) * tex->texelStride;
+		int i = (y & 3) * 4 + (x & 3);
+
+		switch (tex->format)
+		{
+			case TEX_FORMAT_BC1:
+				return decodeBC1Texel(block, i, false);
+			case TEX_FORMAT_BC3:
+			{
+				float4 v = decodeBC1Texel(block + 8, i, true);
+				v.w = decodeBC4Texel(block, i);
+				return v;
+			}
+			case TEX_FORMAT_BC4:
+				return (float4)(decodeBC4Texel(block, i), 0.0f, 0.0f, 1.0f);
+			default:
+				return (float4)(decodeBC4Texel(block, i), decodeBC4Texel(block + 8, i), 0.0f, 1.0f);
+		}
+	}
+
+	__global const uchar* texel = texData + memOffset + (x + y * rowWidth) * tex->texelStride;
+
+	switch (tex->format)
+	{
+		case TEX_FORMAT_R8:
+			return (float4)(texel[0] * (1.0f / 255.0f), 0.0f, 0.0f, 1.0f);
+		case TEX_FORMAT_RG8:
+			return (float4)(convert_float2(vload2(0, texel)) * (1.0f / 255.0f), 0.0f, 1.0f);
+		case TEX_FORMAT_RGB8:
+			return (float4)(convert_float3(vload3(0, texel)) * (1.0f / 255.0f), 1.0f);
+		default:
+			return convert_float4(vload4(0, texel)) * (1.0f / 255.0f);
+	}
+}
+
+/**
+* Returns the description of the given mip level.
+*/
+inline TextureDesc2D getMipLevelDesc(const TextureDesc2D* tex, int level)
+{
+	TextureDesc2D levelDesc = *tex;
+	levelDesc.width = max(tex->width >> level, 1);
+	levelDesc.height = max(tex->height >> level, 1);
+
+	if (tex->pageTableOffset != RT_INVALID_ID)
+		levelDesc.pageTableOffset += tex->mipOffsets[level];
+	else
+		levelDesc.memOffset += tex->mipOffsets[level];
+
+	return levelDesc;
 }
 
 // Read texture with nearest filtering
@@ -59,9 +195,7 @@ float4 readTexture2Df_nearest(const TextureDesc2D* tex, __global const uchar* te
 	int x = clamp((int)round(uv.x * tex->width), 0, tex->width - 1);
 	int y = clamp((int)round(uv.y * tex->height), 0, tex->height - 1);
 
-	__global uchar4 const* texD = (__global const uchar4*)(texData + tex->memOffset);
-
-	return convert_float4(*(texD + x + y * tex->width)) * (1.0f / 255.0f);
+	return readTexel(tex, texData, x, y);
 }
 
 /**
@@ -114,85 +248,182 @@ float4 readTexture2Df_linear(const TextureDesc2D* tex, __global const uchar* tex
 	float2 t = (float2)(uv.x * tex->width  - floor(uv.x * tex->width), 
 						uv.y * tex->height - floor(uv.y * tex->height));
 
-	__global uchar4 const* texD = (__global const uchar4*)(texData + tex->memOffset);
-		
-	float4 v00 = convert_float4(*(texD + x0 + y0 * tex->width));
-	float4 v10 = convert_float4(*(texD + x1 + y0 * tex->width));
-	float4 v01 = convert_float4(*(texD + x0 + y1 * tex->width));
-	float4 v11 = convert_float4(*(texD + x1 + y1 * tex->width));
+	float4 v00 = readTexel(tex, texData, x0, y0);
+	float4 v10 = readTexel(tex, texData, x1, y0);
+	float4 v01 = readTexel(tex, texData, x0, y1);
+	float4 v11 = readTexel(tex, texData, x1, y1);
 			
-	return mix(mix(v00, v10, t.x), mix(v01, v11, t.x), t.y) * (1.0f / 255.0f);
+	return mix(mix(v00, v10, t.x), mix(v01, v11, t.x), t.y);
 }
 
-int computeMipLevelByteOffset(const TextureDesc2D* tex, int texelStride, int level)
-{ 
-	ushort w = tex->width;
-	ushort h = tex->height;
-	int offset = 0;
-
-	for (int i = 0; i < level; ++i)
-	{ 
-		offset += w * h * texelStride;
-		w = max(w / 2, 1);
-		h = max(h / 2, 1);
+#if RT_USE_TEXTURE_IMAGES
+__constant sampler_t textureImageSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+
+/**
+* Reads coord (texel position in the layer, layer index) from the image of the given bucket.
+* Images can't be indexed at runtime which requires the switch.
+*/
+inline float4 readTextureImage(int bucket, float4 coord TEXTURE_IMAGE_PARAMS)
+{
+	switch (bucket)
+	{
+		case 0: return read_imagef(textureImages0, textureImageSampler, coord);
+		case 1: return read_imagef(textureImages1, textureImageSampler, coord);
+		case 2: return read_imagef(textureImages2, textureImageSampler, coord);
+		case 3: return read_imagef(textureImages3, textureImageSampler, coord);
+		case 4: return read_imagef(textureImages4, textureImageSampler, coord);
+		case 5: return read_imagef(textureImages5, textureImageSampler, coord);
+		case 6: return read_imagef(textureImages6, textureImageSampler, coord);
+		default: return read_imagef(textureImages7, textureImageSampler, coord);
+	}
+}
+
+/**
+* Bilinear read of a mip level of an image texture with the hardware filter. The wrap mode is applied in software,
+* the texel position is then clamped to the level such that the filter never blends neighbouring levels of the atlas.
+* Note: Repeating textures are thus clamped instead of wrapped across the border texels of a level.
+*/
+float4 readTextureImage_linear(const TextureDesc2D* tex, int level, float2 uv TEXTURE_IMAGE_PARAMS)
+{
+	switch (tex->wrap)
+	{
+		case TEX_WRAP_REPEAT:
+		{
+			uv -= floor(uv);
+			break;
+		}
+		case TEX_WRAP_MIRRORED_REPEAT:
+		{
+			if (uv.x > 1.0f || uv.x < 0.0f)
+				uv.x = 1.0f - (uv.x - floor(uv.x));
+			if (uv.y > 1.0f || uv.y < 0.0f)
+				uv.y = 1.0f - (uv.y - floor(uv.y));
+			break;
+		}
+		case TEX_WRAP_CLAMP_TO_BORDER:
+		{ 
+			if (uv.x > 1.0f || uv.x < 0.0f || uv.y > 1.0f || uv.y < 0.0f)
+				return TEX_BORDER_COLOR;
+		}
 	}
 
-	return offset;
+	float2 size = (float2)(max(tex->width >> level, 1), max(tex->height >> level, 1));
+	float2 p = clamp(uv * size, (float2)(0.5f), size - 0.5f);
+	uint origin = tex->mipOffsets[level];
+	float4 coord = (float4)(p.x + (origin & 0xFFFF), p.y + (origin >> 16), (float)tex->imageLayer, 0.0f);
+
+	return readTextureImage(tex->imageBucket, coord TEXTURE_IMAGE_ARGS);
 }
 
 /**
-* Read texture with mip map filtering.
-* TODO: Optimize by precomputing byte offsets, use uint16 to store memoffsets.
-* Note: There is a lot of room for optimization - it will, however, make the code less readable.
+* Trilinear read of an image texture, see readTexture2Df_lod.
 */
-float4 readTexture2Df_lod(const TextureDesc2D* tex, __global const uchar* texData, float2 uv, float lod)
-{ 
+float4 readTextureImage_lod(const TextureDesc2D* tex, float2 uv, float lod TEXTURE_IMAGE_PARAMS)
+{
 	if (lod < 1e-8f || tex->numMipLevels < 2)
-		return readTexture2Df_linear(tex, texData, uv);
-	
-	int texelStride = computeTexelStride(tex->format);
-	
+		return readTextureImage_linear(tex, 0, uv TEXTURE_IMAGE_ARGS);
+
 	if (lod >= (tex->numMipLevels - 1))
-	{
-		TextureDesc2D highestLevelTexDesc = *tex;
-		highestLevelTexDesc.width = 1;
-		highestLevelTexDesc.height = 1;
-		highestLevelTexDesc.memOffset += computeMipLevelByteOffset(tex, texelStride, tex->numMipLevels - 1);
-		return readTexture2Df_linear(&highestLevelTexDesc, texData, uv);
-	}
+		return readTextureImage_linear(tex, tex->numMipLevels - 1, uv TEXTURE_IMAGE_ARGS);
 
 	int lowerLevel = floor(lod);
-	
-	ushort w = tex->width;
-	ushort h = tex->height;
-	int byteOffsetLowerLevel = 0;
-
-	for (int i = 0; i < lowerLevel; ++i)
-	{ 
-		byteOffsetLowerLevel += w * h * texelStride;
-		w = max(w / 2, 1);
-		h = max(h / 2, 1);
+	float4 v0 = readTextureImage_linear(tex, lowerLevel, uv TEXTURE_IMAGE_ARGS);
+	float4 v1 = readTextureImage_linear(tex, lowerLevel + 1, uv TEXTURE_IMAGE_ARGS);
+
+	return mix(v0, v1, lod - lowerLevel);
+}
+#endif
+
+/**
+* Virtual textures: Returns the finest level >= level with resident tiles under the bilinear footprint at uv.
+* Missing tiles are requested in the feedback buffer and resident tiles are marked as used for the eviction on the host.
+* The coarsest level is always resident. The footprint assumes repeat wrapping.
+*/
+int findResidentMipLevel(const TextureDesc2D* tex, __global const uchar* texData, __global uint* texFeedback, float2 uv, int level)
+{
+	__global const uint* pageTable = (__global const uint*)texData;
+	uv -= floor(uv);
+
+	for (; level < tex->numMipLevels - 1; ++level)
+	{
+		int width = max(tex->width >> level, 1);
+		int height = max(tex->height >> level, 1);
+		int numTilesX = (width + RT_VT_TILE_SIZE - 1) / RT_VT_TILE_SIZE;
+		// Wrapped like readTexture2Df_linear: the footprint at the border includes the texels of the opposite border
+		int x0 = ((int)floor(uv.x * width - 0.5f) + width) % width;
+		int y0 = ((int)floor(uv.y * height - 0.5f) + height) % height;
+		int2 tile0 = (int2)(x0, y0) / RT_VT_TILE_SIZE;
+		int2 tile1 = (int2)((x0 + 1) % width, (y0 + 1) % height) / RT_VT_TILE_SIZE;
+		uint firstEntry = (tex->pageTableOffset + tex->mipOffsets[level]) / 4;
+
+		uint entries[4];
+		entries[0] = firstEntry + tile0.y * numTilesX + tile0.x;
+		entries[1] = firstEntry + tile0.y * numTilesX + tile1.x;
+		entries[2] = firstEntry + tile1.y * numTilesX + tile0.x;
+		entries[3] = firstEntry + tile1.y * numTilesX + tile1.x;
+
+		bool isResident = true;
+		for (int i = 0; i < 4; ++i)
+		{
+			bool isTileResident = pageTable[entries[i]] != RT_VT_TILE_NOT_RESIDENT;
+			uint feedback = isTileResident ? RT_VT_FEEDBACK_USED : RT_VT_FEEDBACK_REQUESTED;
+			if (texFeedback[entries[i]] != feedback)
+				texFeedback[entries[i]] = feedback;
+
+			isResident = isResident && isTileResident;
+		}
+
+		if (isResident)
+			return level;
 	}
 
-	TextureDesc2D texDescLowerLevel = *tex;
-	texDescLowerLevel.width = w;
-	texDescLowerLevel.height = h;
-	texDescLowerLevel.memOffset += byteOffsetLowerLevel;
+	return level;
+}
+
+/**
+* Read texture with mip map filtering.
+* Textures in an image bucket are read from the image, all others from the texture buffer.
+* Virtual textures fall back to the finest resident levels.
+*/
+float4 readTexture2Df_lod(const TextureDesc2D* tex, __global const uchar* texData, __global uint* texFeedback TEXTURE_IMAGE_PARAMS, float2 uv, float lod)
+{ 
+#if RT_USE_TEXTURE_IMAGES
+	if (tex->imageBucket != RT_INVALID_ID)
+		return readTextureImage_lod(tex, uv, lod TEXTURE_IMAGE_ARGS);
+#endif
+
+	int level = 0;
+	float levelBlend = 0.0f;
 
-	int byteOffsetUpperLevel = byteOffsetLowerLevel + w * h * texelStride;
-	w = max(w / 2, 1);
-	h = max(h / 2, 1);
+	if (lod >= tex->numMipLevels - 1)
+	{
+		level = tex->numMipLevels - 1;
+	}
+	else if (lod >= 1e-8f && tex->numMipLevels >= 2)
+	{
+		level = floor(lod);
+		levelBlend = lod - level;
+	}
 
-	TextureDesc2D texDescUpperLevel = *tex;
+	if (tex->pageTableOffset != RT_INVALID_ID)
+	{
+		int residentLevel = findResidentMipLevel(tex, texData, texFeedback, uv, level);
+		if (residentLevel != level || (levelBlend > 0.0f && findResidentMipLevel(tex, texData, texFeedback, uv, level + 1) != level + 1))
+			levelBlend = 0.0f;
 
-	texDescUpperLevel.width = w;
-	texDescUpperLevel.height = h;
-	texDescUpperLevel.memOffset += byteOffsetUpperLevel;
+		level = residentLevel;
+	}
 
+	TextureDesc2D texDescLowerLevel = getMipLevelDesc(tex, level);
 	float4 v0 = readTexture2Df_linear(&texDescLowerLevel, texData, uv);
+
+	if (levelBlend <= 0.0f)
+		return v0;
+
+	TextureDesc2D texDescUpperLevel = getMipLevelDesc(tex, level + 1);
 	float4 v1 = readTexture2Df_linear(&texDescUpperLevel, texData, uv);
 
-	return mix(v0, v1, lod - lowerLevel);
+	return mix(v0, v1, levelBlend);
 }
 
 inline float computeMipmapLOD(const TextureDesc2D* texDesc, float2 duvdx, float2 duvdy)
@@ -201,41 +432,44 @@ inline float computeMipmapLOD(const TextureDesc2D* texDesc, float2 duvdx, float2
 	return texDesc->numMipLevels - 1.0f + log2(fmax(sampleWidth, 1e-8f));
 }
 
-inline float4 readTexture2Df(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, const RTInteraction* si)
+/**
+* The mip level is selected with the uv derivatives of the interaction. Interactions without a footprint
+* (zero derivatives) are read from the base level.
+*/
+inline float4 readTexture2Df(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, __global uint* texFeedback TEXTURE_IMAGE_PARAMS, const RTInteraction* si)
 {
 	TextureDesc2D desc = textures[texId];
-	//diff_col = readTexture2Df_lod(&diffTexDesc, scene_texData2D, si.uv, computeMipmapLOD(&diffTexDesc, si.duvdx, si.duvdy));
-	return readTexture2Df_linear(&desc, texData, si->uv);
+	return readTexture2Df_lod(&desc, texData, texFeedback TEXTURE_IMAGE_ARGS, si->uv, computeMipmapLOD(&desc, si->duvdx, si->duvdy));
 }
 
-inline float4 readTexture2Df_ifValid(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, const RTInteraction* si, float4 fallbackColor)
+inline float4 readTexture2Df_ifValid(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, __global uint* texFeedback TEXTURE_IMAGE_PARAMS, const RTInteraction* si, float4 fallbackColor)
 {
 	if (texId != RT_INVALID_ID)
-		return readTexture2Df(texId, textures, texData, si);
+		return readTexture2Df(texId, textures, texData, texFeedback TEXTURE_IMAGE_ARGS, si);
 
 	return fallbackColor;
 }
 
-inline float3 readTexture2Df3_ifValid(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, const RTInteraction* si, float3 fallbackColor)
+inline float3 readTexture2Df3_ifValid(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, __global uint* texFeedback TEXTURE_IMAGE_PARAMS, const RTInteraction* si, float3 fallbackColor)
 {
 	if (texId != RT_INVALID_ID)
-		return readTexture2Df(texId, textures, texData, si).xyz;
+		return readTexture2Df(texId, textures, texData, texFeedback TEXTURE_IMAGE_ARGS, si).xyz;
 
 	return fallbackColor;
 }
 
-inline float2 readTexture2Df2_ifValid(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, const RTInteraction* si, float2 fallbackColor)
+inline float2 readTexture2Df2_ifValid(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, __global uint* texFeedback TEXTURE_IMAGE_PARAMS, const RTInteraction* si, float2 fallbackColor)
 {
 	if (texId != RT_INVALID_ID)
-		return readTexture2Df(texId, textures, texData, si).xy;
+		return readTexture2Df(texId, textures, texData, texFeedback TEXTURE_IMAGE_ARGS, si).xy;
 
 	return fallbackColor;
 }
 
-inline float readTexture2Df1_ifValid(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, const RTInteraction* si, float fallbackColor)
+inline float readTexture2Df1_ifValid(int texId, __global const TextureDesc2D* textures, __global const uchar* texData, __global uint* texFeedback TEXTURE_IMAGE_PARAMS, const RTInteraction* si, float fallbackColor)
 {
 	if (texId != RT_INVALID_ID)
-		return readTexture2Df(texId, textures, texData, si).x;
+		return readTexture2Df(texId, textures, texData, texFeedback TEXTURE_IMAGE_ARGS, si).x;
 
 	return fallbackColor;
 }
@@ -0,0 +1,71 @@
+#ifndef VERTICES_CL
+#define VERTICES_CL
+
+/** Decoding of the interleaved vertex format RTVertex, see CLHelper::packVertex for the encoding.
+*
+* Unit vectors are octahedral encoded ("A Survey of Efficient Representations for Independent Unit Vectors"
+* by Cigolle et al. 2014): the normal with 16 bits per component, the tangent with 15 bits per component
+* and the sign of the binormal in the highest bit. UVs are stored with half precision.
+*/
+
+#include <kernel_data.h>
+
+#define RT_VERTEX_BINORMAL_SIGN_BIT 0x80000000u
+
+inline float3 decodeOctahedral(float2 e)
+{
+	float3 v = (float3)(e.x, e.y, 1.0f - fabs(e.x) - fabs(e.y));
+	float t = max(-v.z, 0.0f);
+	v.x += v.x >= 0.0f ? -t : t;
+	v.y += v.y >= 0.0f ? -t : t;
+	return normalize(v);
+}
+
+inline float3 getVertexPosition(const Scene* scene, uint vertexIdx)
+{
+	__global const RTVertex* v = scene->vertices + vertexIdx;
+	return (float3)(v->px, v->py, v->pz);
+}
+
+inline float2 getVertexUV(const Scene* scene, uint vertexIdx)
+{
+	return vload_half2(0, (__global const half*)&scene->vertices[vertexIdx].uv);
+}
+
+inline float3 getVertexNormal(const Scene* scene, uint vertexIdx)
+{
+	uint n = scene->vertices[vertexIdx].normal;
+	float2 e = (float2)((float)(n & 0xFFFFu), (float)(n >> 16)) * (2.0f / 65535.0f) - 1.0f;
+	return decodeOctahedral(e);
+}
+
+/**
+* The binormal is reconstructed from the normal and the tangent.
+*/
+inline void getVertexTangentFrame(const Scene* scene, uint vertexIdx, float3* normal, float3* tangent, float3* binormal)
+{
+	uint t = scene->vertices[vertexIdx].tangent;
+	float2 e = (float2)((float)(t & 0x7FFFu), (float)((t >> 15) & 0x7FFFu)) * (2.0f / 32767.0f) - 1.0f;
+
+	*normal = getVertexNormal(scene, vertexIdx);
+	*tangent = decodeOctahedral(e);
+	*binormal = (t & RT_VERTEX_BINORMAL_SIGN_BIT) ? -cross(*normal, *tangent) : cross(*normal, *tangent);
+}
+
+/**
+* Vertex positions and normals of a shape in world space. Shapes flagged with RT_SHAPE_FLAG_WORLD_SPACE_VERTICES
+* store world space vertices and skip the transformation.
+*/
+inline float3 getShapeVertexPosition(const Scene* scene, const RTShape* shape, uint i)
+{
+	float3 p = getVertexPosition(scene, shape->startVertex + i);
+	return (shape->flags & RT_SHAPE_FLAG_WORLD_SPACE_VERTICES) ? p : transformPoint3(shape->toWorldTransform, p);
+}
+
+inline float3 getShapeVertexNormal(const Scene* scene, const RTShape* shape, uint i)
+{
+	float3 n = getVertexNormal(scene, shape->startVertex + i);
+	return (shape->flags & RT_SHAPE_FLAG_WORLD_SPACE_VERTICES) ? n : transformVector3(shape->toWorldInverseTranspose, n);
+}
+
+#endif
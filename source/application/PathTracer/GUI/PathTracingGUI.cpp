@@ -22,6 +22,7 @@
 #include "../../../engine/rendering/lights/PointLight.h"
 #include "../../../engine/rendering/lights/DiskAreaLight.h"
 #include "../../../engine/rendering/lights/TriangleMeshAreaLight.h"
+#include "../../../engine/rendering/lights/EnvironmentLight.h"
 #include "../Raytracing/rt_globals.h"
 #include "../Raytracing/material/RTUberMaterialComponent.h"
 #include "../Raytracing/system/RTBufferManager.h"
@@ -327,6 +328,7 @@ void PathTracingGUI::showEntityWindow(Entity entity)
 			AddComponentMenuItem<DirectionalLight>()("Directional Light", entity);
 			AddComponentMenuItem<DiskAreaLight>()("Disk Area Light", entity);
 			AddComponentMenuItem<TriangleMeshAreaLight>()("Triangle Mesh Area Light", entity);
+			AddComponentMenuItem<EnvironmentLight>()("Environment Light", entity);
 			AddComponentMenuItem<RTUberMaterialComponent>()("RT Uber Material", entity);
 
 			ImGui::EndMenu();
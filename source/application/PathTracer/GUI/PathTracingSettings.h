@@ -23,6 +23,14 @@ enum class EPathTracerPipeline
 	Rasterization
 };
 
+// Order must match the RT_SAMPLER_* values in samplers.cl
+enum class ERTSamplerType
+{
+	Sobol = 0,
+	Random,
+	Rank1
+};
+
 enum class EFilterType
 {
 	Box = 0,
@@ -72,13 +80,45 @@ namespace PathTracerSettings
 
         GISettings()
         {
-            guiElements.insert(guiElements.end(), {&useTAA, &maxDepth,
+            guiElements.insert(guiElements.end(), {&useTAA, &samplerType, &compressTextures, &useTextureImages, &useVirtualTextures, &textureBudget, &bakeStaticVertices, &maxDepth,
+				&useReSTIR, &reSTIRCandidates, &reSTIRMaxHistory, &reSTIRSpatialNeighbours, &reSTIRSpatialRadius,
+				&useLightVertexCache, &lightPathCount, &lightVertexCacheConnections,
+				&useVertexMerging, &vertexMergingRadius, &vertexMergingAlpha,
 				&denoiseKernelRadius, &bilateralDenoiseSigmaRange, 
 				&bilateralDenoiseSigmaSpatial, &useDenoise, &minLuminance, &useTonemapping });
         }
 
 		CheckBox useTAA{ "Use TAA", true };
+		// Changing the sampler recompiles the kernels
+		ComboBoxEnum<ERTSamplerType> samplerType{ "Sampler", { "Owen Scrambled Sobol", "Random (PCG)", "Blue Noise Rank-1" }, 1 };
+		// Block compress textures (BC1/BC3/BC4/BC5) for the device. Applied when the scene textures are uploaded.
+		CheckBox compressTextures{ "Compress Textures", true };
+		// Store the textures of the most common sizes in image arrays read with the hardware sampler, all others stay
+		// in the texture buffer. Requires image support. It's a build option of the kernels: Applied on start up.
+		CheckBox useTextureImages{ "Use Texture Images", false };
+		// Stream texture tiles on demand into a pool of textureBudget MB. Applied when the scene textures are uploaded.
+		CheckBox useVirtualTextures{ "Use Virtual Textures", false };
+		SliderInt textureBudget{ "Texture Budget (MB)", 1024, 64, 3072 };
+		// Bake the vertices of static, non-instanced meshes to world space which saves the transformations at every hit.
+		// Applied when meshes are attached.
+		CheckBox bakeStaticVertices{ "Bake Static Vertices", true };
         SliderInt maxDepth{ "Max Depth", 2, 1, 10 };
+		// Path tracer only: Resample direct lighting at the primary hit with per pixel reservoirs that are reused
+		// temporally and spatially. Reservoirs are combined with 1/M weights which trades a small bias for less noise.
+		CheckBox useReSTIR{ "Use ReSTIR Direct Lighting", false };
+		SliderInt reSTIRCandidates{ "ReSTIR Candidates", 16, 1, 64 };
+		SliderInt reSTIRMaxHistory{ "ReSTIR Max History", 20, 0, 100 };
+		SliderInt reSTIRSpatialNeighbours{ "ReSTIR Spatial Neighbours", 4, 0, 16 };
+		SliderFloat reSTIRSpatialRadius{ "ReSTIR Spatial Radius", 16.0f, 1.0f, 64.0f };
+		// BDPT only: Trace lightPathCount light paths per frame into a shared cache instead of one light path per pixel.
+		CheckBox useLightVertexCache{ "Use Light Vertex Cache (BDPT)", false };
+		SliderInt lightPathCount{ "Light Paths", 65536, 1024, 1048576 };
+		SliderInt lightVertexCacheConnections{ "Light Vertex Cache Connections", 1, 1, 8 };
+		// BDPT only: Vertex connection and merging, implies the light vertex cache. 
+		// The initial merge radius is relative to the scene radius and shrinks with every frame depending on alpha.
+		CheckBox useVertexMerging{ "Use Vertex Merging (BDPT)", false };
+		SliderFloat vertexMergingRadius{ "Vertex Merging Radius", 0.005f, 0.0001f, 0.05f, "%.4f" };
+		SliderFloat vertexMergingAlpha{ "Vertex Merging Alpha", 0.75f, 0.01f, 1.0f };
 		SliderInt denoiseKernelRadius{"Denoise Radius", 1, 0, 10};
 		SliderFloat bilateralDenoiseSigmaRange{"Denoise Sigma Range", 0.1f, 0.0f, 10.0f};
 		SliderFloat bilateralDenoiseSigmaSpatial{"Denoise Sigma Spatial", 1.0f, 0.0f, 10.0f};
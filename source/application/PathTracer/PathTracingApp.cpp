@@ -32,6 +32,7 @@
 #include "Raytracing/scene/RTScene.h"
 #include "Raytracing/util/CLHelper.h"
 #include "Raytracing/textures/RTTextures.h"
+#include "Raytracing/textures/RTTextureImages.h"
 #include "Raytracing/rt_globals.h"
 #include "Raytracing/kernels/RTNoiseGenerationKernel.h"
 #include "Raytracing/renderPasses/RTPrimaryRaysPass.h"
@@ -57,6 +58,8 @@ void PathTracingApp::initRadeonRaysAPI()
 	{
 		g_clContext = PlatformManager::createCLContextWithGLInterop();
 
+		KernelManager::setDefine("RT_USE_TEXTURE_IMAGES", RTTextureImages::isEnabled() ? "1" : "0");
+
 		// To make sure the kernels compile just fine:
 		auto program = KernelManager::getProgram("PathTracing", g_clContext);
 		auto bdptProgram = KernelManager::getProgram("BDPT", g_clContext);
@@ -108,6 +111,22 @@ void PathTracingApp::refreshPipeline()
 	}
 }
 
+void PathTracingApp::refreshSampler()
+{
+	if (m_currentSamplerType == PathTracerSettings::GI.samplerType.getEnumValue())
+		return;
+
+	m_currentSamplerType = PathTracerSettings::GI.samplerType.getEnumValue();
+	KernelManager::setDefine("RT_SAMPLER", std::to_string(static_cast<int>(m_currentSamplerType)));
+
+	if (m_clInitialized)
+	{
+		KernelManager::recompilePrograms(g_clContext);
+		m_bdptRenderPipeline->getRenderPass<RTReconstructionPass>()->clearFrameTextures();
+		m_pathTracerRenderPipeline->getRenderPass<RTReconstructionPass>()->clearFrameTextures();
+	}
+}
+
 PathTracingApp::PathTracingApp()
 {
     Input::subscribe(this);
@@ -178,6 +197,7 @@ void PathTracingApp::quit()
 void PathTracingApp::update()
 {
 	refreshPipeline();
+	refreshSampler();
 
 	for (int i = static_cast<int>(m_parallelCommands.size()) - 1; i >= 0; --i)
 	{
@@ -230,6 +250,8 @@ void PathTracingApp::startPathTracing()
 		if (!m_clInitialized)
 			return;
 
+		KernelManager::setDefine("RT_SAMPLER", std::to_string(static_cast<int>(m_currentSamplerType)));
+
 		ECS::addSystem<RTScene>(g_isectApi, g_clContext);
 
 		// Create shared pipeline passes
@@ -60,8 +60,10 @@ protected:
 private:
 	void initRadeonRaysAPI();
 	void refreshPipeline();
+	void refreshSampler();
 
 	EPathTracerPipeline m_currentPipelineType = PathTracerSettings::PIPELINE.pipeline.getEnumValue();
+	ERTSamplerType m_currentSamplerType = PathTracerSettings::GI.samplerType.getEnumValue();
     std::unique_ptr<RenderPipeline> m_rasterRenderPipeline;
 	std::unique_ptr<RenderPipeline> m_pathTracerRenderPipeline;
 	std::unique_ptr<RenderPipeline> m_bdptRenderPipeline;
@@ -0,0 +1,138 @@
+#include "RTLightBVH.h"
+#include <algorithm>
+#include <cmath>
+#include "../util/CLHelper.h"
+#include "../source/engine/util/math.h"
+
+namespace
+{
+	/**
+	* Smallest cone that contains both cones. Based on DirectionCone::Union of PBR book 4th edition.
+	*/
+	void unionCones(const glm::vec3& axisA, float cosThetaA, const glm::vec3& axisB, float cosThetaB, glm::vec3& outAxis, float& outCosTheta)
+	{
+		float thetaA = std::acos(glm::clamp(cosThetaA, -1.0f, 1.0f));
+		float thetaB = std::acos(glm::clamp(cosThetaB, -1.0f, 1.0f));
+		float thetaD = std::acos(glm::clamp(glm::dot(axisA, axisB), -1.0f, 1.0f));
+
+		// One cone contains the other
+		if (std::min(thetaD + thetaB, math::PI) <= thetaA)
+		{
+			outAxis = axisA;
+			outCosTheta = cosThetaA;
+			return;
+		}
+
+		if (std::min(thetaD + thetaA, math::PI) <= thetaB)
+		{
+			outAxis = axisB;
+			outCosTheta = cosThetaB;
+			return;
+		}
+
+		float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+		glm::vec3 rotationAxis = glm::cross(axisA, axisB);
+
+		if (thetaO >= math::PI || glm::dot(rotationAxis, rotationAxis) < 1e-12f)
+		{
+			// Entire sphere
+			outAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+			outCosTheta = -1.0f;
+			return;
+		}
+
+		// Rotate axisA towards axisB (Rodrigues' rotation formula)
+		float thetaR = thetaO - thetaA;
+		rotationAxis = glm::normalize(rotationAxis);
+		float cosR = std::cos(thetaR);
+		float sinR = std::sin(thetaR);
+		outAxis = glm::normalize(axisA * cosR + glm::cross(rotationAxis, axisA) * sinR + rotationAxis * glm::dot(rotationAxis, axisA) * (1.0f - cosR));
+		outCosTheta = std::cos(thetaO);
+	}
+
+	RTLightBounds unionBounds(const RTLightBounds& a, const RTLightBounds& b)
+	{
+		// Lights without power don't contribute to the directional bounds
+		if (a.power <= 0.0f)
+			return b;
+		if (b.power <= 0.0f)
+			return a;
+
+		RTLightBounds bounds;
+		bounds.min = glm::min(a.min, b.min);
+		bounds.max = glm::max(a.max, b.max);
+		bounds.power = a.power + b.power;
+		bounds.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+		unionCones(a.axis, a.cosThetaO, b.axis, b.cosThetaO, bounds.axis, bounds.cosThetaO);
+		return bounds;
+	}
+
+	RTLightBVHNode createNode(const RTLightBounds& bounds)
+	{
+		RTLightBVHNode node;
+		node.boundsMin = CLHelper::toFloat3(bounds.min);
+		node.boundsMax = CLHelper::toFloat3(bounds.max);
+		node.axis = CLHelper::toFloat3(bounds.axis);
+		node.power = bounds.power;
+		node.cosThetaO = bounds.cosThetaO;
+		node.cosThetaE = bounds.cosThetaE;
+		node.childOrLightIdx = RT_INVALID_ID;
+		node.isLeaf = 0;
+		node.pad[0] = node.pad[1] = node.pad[2] = 0;
+		return node;
+	}
+
+	void buildRecursive(std::vector<RTLightBounds>& lights, size_t begin, size_t end, std::vector<RTLightBVHNode>& outNodes)
+	{
+		if (end - begin == 1)
+		{
+			RTLightBVHNode leaf = createNode(lights[begin]);
+			leaf.isLeaf = 1;
+			leaf.childOrLightIdx = lights[begin].lightIdx;
+			outNodes.push_back(leaf);
+			return;
+		}
+
+		RTLightBounds bounds = lights[begin];
+		glm::vec3 centroidMin = lights[begin].centroid();
+		glm::vec3 centroidMax = centroidMin;
+
+		for (size_t i = begin + 1; i < end; ++i)
+		{
+			bounds = unionBounds(bounds, lights[i]);
+			centroidMin = glm::min(centroidMin, lights[i].centroid());
+			centroidMax = glm::max(centroidMax, lights[i].centroid());
+		}
+
+		glm::vec3 extent = centroidMax - centroidMin;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+		size_t mid = (begin + end) / 2;
+		std::nth_element(lights.begin() + begin, lights.begin() + mid, lights.begin() + end,
+			[axis](const RTLightBounds& a, const RTLightBounds& b) { return a.centroid()[axis] < b.centroid()[axis]; });
+
+		// Depth-first layout: the first child directly follows its parent
+		size_t nodeIdx = outNodes.size();
+		outNodes.push_back(createNode(bounds));
+
+		buildRecursive(lights, begin, mid, outNodes);
+		outNodes[nodeIdx].childOrLightIdx = static_cast<int>(outNodes.size());
+		buildRecursive(lights, mid, end, outNodes);
+	}
+}
+
+void RTLightBVH::build(std::vector<RTLightBounds> lights, std::vector<RTLightBVHNode>& outNodes)
+{
+	if (lights.size() == 0)
+		return;
+
+	buildRecursive(lights, 0, lights.size(), outNodes);
+}
+
+void RTLightBVH::addLeaf(const RTLightBounds& light, std::vector<RTLightBVHNode>& outNodes)
+{
+	RTLightBVHNode leaf = createNode(light);
+	leaf.isLeaf = 1;
+	leaf.childOrLightIdx = light.lightIdx;
+	outNodes.push_back(leaf);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+#include <CLW.h>
+#include <kernel_data.h>
+
+/**
+* Spatial and directional bounds of a bounded light used to build the light BVH.
+* cosThetaO bounds the spread of the light normals around axis, cosThetaE the spread of emission around a normal.
+*/
+struct RTLightBounds
+{
+	glm::vec3 min{ 0.0f };
+	glm::vec3 max{ 0.0f };
+	glm::vec3 axis{ 0.0f, 1.0f, 0.0f };
+	float cosThetaO = -1.0f;
+	float cosThetaE = 0.0f;
+	float power = 0.0f;
+	int lightIdx = RT_INVALID_ID;
+
+	glm::vec3 centroid() const { return 0.5f * (min + max); }
+};
+
+namespace RTLightBVH
+{
+	/**
+	* Builds the hierarchy over the given bounded lights and appends the nodes in depth-first order to outNodes.
+	* Interior nodes are split at the median of the largest centroid extent.
+	*/
+	void build(std::vector<RTLightBounds> lights, std::vector<RTLightBVHNode>& outNodes);
+
+	/**
+	* Appends a leaf node that only references the light. Used for infinite lights which are chosen without the hierarchy.
+	*/
+	void addLeaf(const RTLightBounds& light, std::vector<RTLightBVHNode>& outNodes);
+}
@@ -13,4 +13,9 @@ public:
 	}
 
 	std::map<RTLightType, int> hostLightIndexMap;
+
+	// Submeshes with emissive materials, detected when the mesh is attached to the RTScene
+	std::vector<int> emissiveSubMeshes;
+	// Submesh index -> host light index of the extracted emissive mesh lights
+	std::map<int, int> emissiveLightIndexMap;
 };
@@ -2,6 +2,19 @@
 #include <engine/ecs/ECS.h>
 #include <imgui/imgui.h>
 #include "../assets/kernels/kernel_data.h"
+#include <engine/event/event.h>
+
+/**
+* Transmitted when a material is edited, RTScene uploads only the edited materials.
+*/
+struct RTUberMaterialUpdatedEvent
+{
+	RTUberMaterialUpdatedEvent(const Entity& entity, int materialIdx)
+		:entity(entity), materialIdx(materialIdx) {}
+
+	Entity entity;
+	int materialIdx;
+};
 
 class RTUberMaterialComponent : public Component
 {
@@ -17,8 +30,6 @@ public:
 		glm::vec2 roughness{ 0.1f };
 		float eta{ 1.5f };
 		int rtMaterialId = RT_INVALID_ID;
-
-		bool updated = false;
 	};
 
 	RTUberMaterialComponent() {}
@@ -38,15 +49,19 @@ public:
 			{
 				ImGui::Text("Material Id: %d", mat.rtMaterialId);
 
-				mat.updated |= ImGui::DragFloat3("Diffuse Color", &mat.diffuseColor[0], 0.01f);
-				mat.updated |= ImGui::DragFloat3("Gloss Color", &mat.glossColor[0], 0.01f);
-				mat.updated |= ImGui::DragFloat3("Specular Reflection Color", &mat.specularReflectionColor[0], 0.01f);
-				mat.updated |= ImGui::DragFloat3("Specular Transmission Color", &mat.specularTransmissionColor[0], 0.01f);
-				mat.updated |= ImGui::Checkbox("Is Glossy Transmission", &mat.isGlossyTransmission);
-				mat.updated |= ImGui::DragFloat3("Opacity", &mat.opacity[0], 0.01f);
-				mat.updated |= ImGui::DragFloat2("Roughness", &mat.roughness[0], 0.001f, 0.0f, 1.0f);
-				mat.updated |= ImGui::DragFloat("Index of Refraction", &mat.eta, 0.001f, 1.0f, 6.0f);
+				bool updated = false;
+				updated |= ImGui::DragFloat3("Diffuse Color", &mat.diffuseColor[0], 0.01f);
+				updated |= ImGui::DragFloat3("Gloss Color", &mat.glossColor[0], 0.01f);
+				updated |= ImGui::DragFloat3("Specular Reflection Color", &mat.specularReflectionColor[0], 0.01f);
+				updated |= ImGui::DragFloat3("Specular Transmission Color", &mat.specularTransmissionColor[0], 0.01f);
+				updated |= ImGui::Checkbox("Is Glossy Transmission", &mat.isGlossyTransmission);
+				updated |= ImGui::DragFloat3("Opacity", &mat.opacity[0], 0.01f);
+				updated |= ImGui::DragFloat2("Roughness", &mat.roughness[0], 0.001f, 0.0f, 1.0f);
+				updated |= ImGui::DragFloat("Index of Refraction", &mat.eta, 0.001f, 1.0f, 6.0f);
 				ImGui::TreePop();
+
+				if (updated)
+					Event::transmit<RTUberMaterialUpdatedEvent>(getOwner(), i);
 			}
 
 			++i;
@@ -55,3 +70,4 @@ public:
 
 	std::vector<MaterialData> materialData;
 };
+
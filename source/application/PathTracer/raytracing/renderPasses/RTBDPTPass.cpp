@@ -24,11 +24,16 @@
 #include "../system/RTBufferManager.h"
 #include "../util/RTUtil.h"
 #include "../source/engine/util/Timer.h"
+#include <algorithm>
 
 #define RT_BDPT_MEMORY_RECORD_CONTEXT_NAME std::string("RT_BDPT_MEMORY_RECORD_CONTEXT")
 
 RTBDPTPass::RTBDPTPass()
-	:RenderPass("RTBDPTPass"), m_maxDepth(PathTracerSettings::GI.maxDepth)
+	:RenderPass("RTBDPTPass"), m_maxDepth(PathTracerSettings::GI.maxDepth),
+	m_useLightVertexCache(PathTracerSettings::GI.useLightVertexCache || PathTracerSettings::GI.useVertexMerging),
+	m_numLightPaths(PathTracerSettings::GI.lightPathCount), m_numCacheConnections(PathTracerSettings::GI.lightVertexCacheConnections),
+	m_useVertexMerging(PathTracerSettings::GI.useVertexMerging), m_vertexMergingRadius(PathTracerSettings::GI.vertexMergingRadius),
+	m_vertexMergingAlpha(PathTracerSettings::GI.vertexMergingAlpha)
 {
 	PathTracerSettings::GI.imageResolution.value = glm::ivec2(Screen::getWidth(), Screen::getHeight());
 
@@ -75,6 +80,32 @@ void RTBDPTPass::update()
 		createBuffers();
 	}
 
+	bool useLightVertexCache = PathTracerSettings::GI.useLightVertexCache || PathTracerSettings::GI.useVertexMerging;
+
+	if (m_useLightVertexCache != useLightVertexCache || 
+		m_numLightPaths != PathTracerSettings::GI.lightPathCount ||
+		m_numCacheConnections != PathTracerSettings::GI.lightVertexCacheConnections ||
+		m_useVertexMerging != PathTracerSettings::GI.useVertexMerging)
+	{
+		m_useLightVertexCache = useLightVertexCache;
+		m_numLightPaths = PathTracerSettings::GI.lightPathCount;
+		m_numCacheConnections = PathTracerSettings::GI.lightVertexCacheConnections;
+		m_useVertexMerging = PathTracerSettings::GI.useVertexMerging;
+		createBuffers();
+		m_frameIndex = 0;
+		m_totalRenderTime = 0.0f;
+	}
+
+	// Both define the radius schedule of the progressive vertex merging
+	if (m_vertexMergingRadius != PathTracerSettings::GI.vertexMergingRadius ||
+		m_vertexMergingAlpha != PathTracerSettings::GI.vertexMergingAlpha)
+	{
+		m_vertexMergingRadius = PathTracerSettings::GI.vertexMergingRadius;
+		m_vertexMergingAlpha = PathTracerSettings::GI.vertexMergingAlpha;
+		m_frameIndex = 0;
+		m_totalRenderTime = 0.0f;
+	}
+
 	if (m_renderPipeline->getCamera()->getComponent<FreeCameraViewController>()->bMovedInLastUpdate)
 	{
 		m_frameIndex = 0;
@@ -95,8 +126,26 @@ void RTBDPTPass::update()
 		{
 			generateStartVertices();
 			generateSecondaryVertices();
-			prepareVertexConnections();
-			makeConnections();
+
+			if (m_useLightVertexCache)
+			{
+				buildLightVertexCache();
+
+				if (m_useVertexMerging)
+					buildHashGrid();
+
+				makeCacheConnections();
+
+				if (m_useVertexMerging)
+					mergeVertices();
+
+				makeLightTracingConnections();
+			}
+			else
+			{
+				prepareVertexConnections();
+				makeConnections();
+			}
 	
 			copyRadianceBuffer();
 		}
@@ -154,6 +203,7 @@ void RTBDPTPass::generateStartVertices()
 		cam.direction = CLHelper::toFloat3(MainCamera->getForward());
 		cam.width = static_cast<rt_uint32>(imageWidth);
 		cam.height = static_cast<rt_uint32>(imageHeight);
+		cam.pixelSpreadAngle = RTUtil::computePixelSpreadAngle(w, h, nc);
 	
 		// Compute the area of a virtual image in front of the camera on the plane at z=1 in camera coordinates.
 		glm::vec3 pMin = MainCamera->ndcToCameraPoint(glm::vec3(-1.0f, -1.0f, -1.0f));
@@ -169,32 +219,70 @@ void RTBDPTPass::generateStartVertices()
 		auto writeEvt = g_clContext.WriteBuffer(0, camera, &cam, 1);
 		writeEvt.Wait();
 	
-		uint32_t argc = setSceneArgs(m_startVerticesGenerationKernel, 0);
-		argc = setImageArgs(m_startVerticesGenerationKernel, argc);
+		size_t gs[] = { static_cast<size_t>((imageWidth + 7) / 8 * 8), static_cast<size_t>((imageHeight + 7) / 8 * 8) };
+		size_t ls[] = { 8, 8 };
 
-		m_startVerticesGenerationKernel.setArg(argc++, m_frameIndex);
-		m_startVerticesGenerationKernel.setArg(argc++, m_maxDepth);
+		if (m_useLightVertexCache)
+		{
+			uint32_t argc = setSceneArgs(m_cameraStartVerticesGenerationKernel, 0);
+			argc = setImageArgs(m_cameraStartVerticesGenerationKernel, argc);
+
+			m_cameraStartVerticesGenerationKernel.setArg(argc++, m_frameIndex);
+			m_cameraStartVerticesGenerationKernel.setArg(argc++, m_maxDepth);
+			m_cameraStartVerticesGenerationKernel.setArg(argc++, m_cameraVertices);
+			m_cameraStartVerticesGenerationKernel.setArg(argc++, m_cameraRays);
+			m_cameraStartVerticesGenerationKernel.setArg(argc++, m_cameraThroughputs);
+			m_cameraStartVerticesGenerationKernel.setArg(argc++, m_cameraFwdPdfs);
+			m_cameraStartVerticesGenerationKernel.setArg(argc++, m_cameraVertexCounts);
+			m_cameraStartVerticesGenerationKernel.setArg(argc++, m_finalRadianceBuffer);
+
+			g_clContext.Launch2D(0, gs, ls, m_cameraStartVerticesGenerationKernel);
+
+			argc = setSceneArgs(m_lightStartVerticesGenerationKernel, 0);
+			argc = setLightPathImageArgs(m_lightStartVerticesGenerationKernel, argc);
+
+			m_lightStartVerticesGenerationKernel.setArg(argc++, m_frameIndex);
+			m_lightStartVerticesGenerationKernel.setArg(argc++, m_maxDepth);
+			m_lightStartVerticesGenerationKernel.setArg(argc++, m_lightVertices);
+			m_lightStartVerticesGenerationKernel.setArg(argc++, m_lightRays);
+			m_lightStartVerticesGenerationKernel.setArg(argc++, m_lightThroughputs);
+			m_lightStartVerticesGenerationKernel.setArg(argc++, m_lightFwdPdfs);
+			m_lightStartVerticesGenerationKernel.setArg(argc++, m_lightVertexCounts);
+			m_lightStartVerticesGenerationKernel.setArg(argc++, m_lightVertexCacheSize);
+
+			size_t lightGs[2];
+			size_t lightLs[2];
+			computeLightPathLaunchSize(lightGs, lightLs);
+			g_clContext.Launch2D(0, lightGs, lightLs, m_lightStartVerticesGenerationKernel);
+			g_clContext.Finish(0);
+		}
+		else
+		{
+			uint32_t argc = setSceneArgs(m_startVerticesGenerationKernel, 0);
+			argc = setImageArgs(m_startVerticesGenerationKernel, argc);
 
-		// Camera params
-		m_startVerticesGenerationKernel.setArg(argc++, m_cameraVertices);
-		m_startVerticesGenerationKernel.setArg(argc++, m_cameraRays);
-		m_startVerticesGenerationKernel.setArg(argc++, m_cameraThroughputs);
-		m_startVerticesGenerationKernel.setArg(argc++, m_cameraFwdPdfs);
-		m_startVerticesGenerationKernel.setArg(argc++, m_cameraVertexCounts);
+			m_startVerticesGenerationKernel.setArg(argc++, m_frameIndex);
+			m_startVerticesGenerationKernel.setArg(argc++, m_maxDepth);
 
-		// Light params
-		m_startVerticesGenerationKernel.setArg(argc++, m_lightVertices);
-		m_startVerticesGenerationKernel.setArg(argc++, m_lightRays);
-		m_startVerticesGenerationKernel.setArg(argc++, m_lightThroughputs);
-		m_startVerticesGenerationKernel.setArg(argc++, m_lightFwdPdfs);
-		m_startVerticesGenerationKernel.setArg(argc++, m_lightVertexCounts);
+			// Camera params
+			m_startVerticesGenerationKernel.setArg(argc++, m_cameraVertices);
+			m_startVerticesGenerationKernel.setArg(argc++, m_cameraRays);
+			m_startVerticesGenerationKernel.setArg(argc++, m_cameraThroughputs);
+			m_startVerticesGenerationKernel.setArg(argc++, m_cameraFwdPdfs);
+			m_startVerticesGenerationKernel.setArg(argc++, m_cameraVertexCounts);
 
-		m_startVerticesGenerationKernel.setArg(argc++, m_finalRadianceBuffer);
+			// Light params
+			m_startVerticesGenerationKernel.setArg(argc++, m_lightVertices);
+			m_startVerticesGenerationKernel.setArg(argc++, m_lightRays);
+			m_startVerticesGenerationKernel.setArg(argc++, m_lightThroughputs);
+			m_startVerticesGenerationKernel.setArg(argc++, m_lightFwdPdfs);
+			m_startVerticesGenerationKernel.setArg(argc++, m_lightVertexCounts);
 
-		size_t gs[] = { static_cast<size_t>((imageWidth + 7) / 8 * 8), static_cast<size_t>((imageHeight + 7) / 8 * 8) };
-		size_t ls[] = { 8, 8 };
-		g_clContext.Launch2D(0, gs, ls, m_startVerticesGenerationKernel);
-		g_clContext.Finish(0);
+			m_startVerticesGenerationKernel.setArg(argc++, m_finalRadianceBuffer);
+
+			g_clContext.Launch2D(0, gs, ls, m_startVerticesGenerationKernel);
+			g_clContext.Finish(0);
+		}
 	
 		// Query intersections
 		RadeonRays::Event* camIsectQueryEvent;
@@ -203,7 +291,7 @@ void RTBDPTPass::generateStartVertices()
 		
 		RadeonRays::Event* lightIsectQueryEvent;
 		g_isectApi->QueryIntersection(RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_lightRays),
-			imageWidth * imageHeight, RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_lightIntersections), nullptr, &lightIsectQueryEvent);
+			getNumLightPaths(), RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_lightIntersections), nullptr, &lightIsectQueryEvent);
 	
 		camIsectQueryEvent->Wait();
 		lightIsectQueryEvent->Wait();
@@ -230,6 +318,7 @@ void RTBDPTPass::generateSecondaryVertices()
 		const int imageHeight = PathTracerSettings::GI.imageResolution.value.y;
 	
 		uint32_t argc = setSceneArgs(m_secondaryVerticesGenerationKernel, 0);
+		const uint32_t imageArgStartIdx = argc;
 		argc = setImageArgs(m_secondaryVerticesGenerationKernel, argc);
 
 		m_secondaryVerticesGenerationKernel.setArg(argc++, m_frameIndex);
@@ -239,6 +328,10 @@ void RTBDPTPass::generateSecondaryVertices()
 	
 		size_t gs[] = { static_cast<size_t>((imageWidth + 7) / 8 * 8), static_cast<size_t>((imageHeight + 7) / 8 * 8) };
 		size_t ls[] = { 8, 8 };
+
+		size_t lightGs[2];
+		size_t lightLs[2];
+		computeLightPathLaunchSize(lightGs, lightLs);
 	
 		for (int depth = 1; depth <= m_maxDepth + 1; ++depth)
 		{
@@ -259,6 +352,7 @@ void RTBDPTPass::generateSecondaryVertices()
 			if (depth <= m_maxDepth)
 			{
 				// Extend light subpath
+				setLightPathImageArgs(m_secondaryVerticesGenerationKernel, imageArgStartIdx);
 				argc = pathArgStartIdx;
 				isCameraPath = 0;
 				m_secondaryVerticesGenerationKernel.setArg(argc++, isCameraPath);
@@ -270,7 +364,8 @@ void RTBDPTPass::generateSecondaryVertices()
 				m_secondaryVerticesGenerationKernel.setArg(argc++, m_lightVertexCounts);
 				m_secondaryVerticesGenerationKernel.setArg(argc++, depth);
 	
-				g_clContext.Launch2D(0, gs, ls, m_secondaryVerticesGenerationKernel);
+				g_clContext.Launch2D(0, lightGs, lightLs, m_secondaryVerticesGenerationKernel);
+				setImageArgs(m_secondaryVerticesGenerationKernel, imageArgStartIdx);
 			}
 	
 			// Camera and light paths can run in parallel, it's thus enough to have one sync point after both kernels.
@@ -287,7 +382,7 @@ void RTBDPTPass::generateSecondaryVertices()
 			{
 				RadeonRays::Event* lightIsectQueryEvent;
 				g_isectApi->QueryIntersection(RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_lightRays),
-					imageWidth * imageHeight, RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_lightIntersections), nullptr, &lightIsectQueryEvent);
+					getNumLightPaths(), RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_lightIntersections), nullptr, &lightIsectQueryEvent);
 				lightIsectQueryEvent->Wait();
 			}
 	
@@ -401,12 +496,316 @@ void RTBDPTPass::makeConnections()
 	}
 }
 
+void RTBDPTPass::buildLightVertexCache()
+{
+	try
+	{
+		ScopedProfiling prof("BDPT:buildLightVertexCache");
+
+		uint32_t argc = setLightPathImageArgs(m_buildLightVertexCacheKernel, 0);
+		m_buildLightVertexCacheKernel.setArg(argc++, m_maxDepth);
+		m_buildLightVertexCacheKernel.setArg(argc++, m_lightVertices);
+		m_buildLightVertexCacheKernel.setArg(argc++, m_lightVertexCounts);
+		m_buildLightVertexCacheKernel.setArg(argc++, m_lightVertexCache);
+		m_buildLightVertexCacheKernel.setArg(argc++, m_lightVertexCacheSize);
+
+		size_t gs[2];
+		size_t ls[2];
+		computeLightPathLaunchSize(gs, ls);
+		g_clContext.Launch2D(0, gs, ls, m_buildLightVertexCacheKernel);
+		g_clContext.Finish(0);
+	}
+	catch (const std::exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+	catch (const Calc::Exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+}
+
+void RTBDPTPass::makeCacheConnections()
+{
+	try
+	{
+		ScopedProfiling prof("BDPT:makeCacheConnections");
+
+		const int imageWidth = PathTracerSettings::GI.imageResolution.value.x;
+		const int imageHeight = PathTracerSettings::GI.imageResolution.value.y;
+
+		size_t gs[] = { static_cast<size_t>((imageWidth + 7) / 8 * 8), static_cast<size_t>((imageHeight + 7) / 8 * 8) };
+		size_t ls[] = { 8, 8 };
+
+		uint32_t argc = setSceneArgs(m_prepareCacheConnectionsKernel, 0);
+		argc = setImageArgs(m_prepareCacheConnectionsKernel, argc);
+
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_frameIndex);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_maxDepth);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_numCacheConnections);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_cameraVertices);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_cameraVertexCounts);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_lightVertices);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_lightVertexCache);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_lightVertexCacheSize);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_sampledLightVertices);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_cacheConnectionVertices);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_connectionRays);
+		m_prepareCacheConnectionsKernel.setArg(argc++, m_tempRadianceBuffer);
+
+		g_clContext.Launch2D(0, gs, ls, m_prepareCacheConnectionsKernel);
+		g_clContext.Finish(0);
+
+		// Query occlusions
+		RadeonRays::Event* evt;
+		g_isectApi->QueryOcclusion(RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_connectionRays),
+			imageWidth * imageHeight * m_maxDepth * (m_numCacheConnections + 1),
+			RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_connectionVisibilities), nullptr, &evt);
+
+		evt->Wait();
+
+		argc = setSceneArgs(m_cacheConnectionKernel, 0);
+		argc = setImageArgs(m_cacheConnectionKernel, argc);
+
+		m_cacheConnectionKernel.setArg(argc++, m_frameIndex);
+		m_cacheConnectionKernel.setArg(argc++, m_maxDepth);
+		m_cacheConnectionKernel.setArg(argc++, m_numLightPaths);
+		m_cacheConnectionKernel.setArg(argc++, m_numCacheConnections);
+		m_cacheConnectionKernel.setArg(argc++, computeMergeRadius());
+		m_cacheConnectionKernel.setArg(argc++, m_cameraVertices);
+		m_cacheConnectionKernel.setArg(argc++, m_cameraVertexCounts);
+		m_cacheConnectionKernel.setArg(argc++, m_lightVertices);
+		m_cacheConnectionKernel.setArg(argc++, m_sampledLightVertices);
+		m_cacheConnectionKernel.setArg(argc++, m_cacheConnectionVertices);
+		m_cacheConnectionKernel.setArg(argc++, m_lightVertexCacheSize);
+		m_cacheConnectionKernel.setArg(argc++, m_connectionRays);
+		m_cacheConnectionKernel.setArg(argc++, m_connectionVisibilities);
+		m_cacheConnectionKernel.setArg(argc++, m_tempRadianceBuffer);
+		m_cacheConnectionKernel.setArg(argc++, m_finalRadianceBuffer);
+
+		g_clContext.Launch2D(0, gs, ls, m_cacheConnectionKernel);
+		g_clContext.Finish(0);
+	}
+	catch (const std::exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+	catch (const Calc::Exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+}
+
+void RTBDPTPass::makeLightTracingConnections()
+{
+	try
+	{
+		ScopedProfiling prof("BDPT:makeLightTracingConnections");
+
+		size_t gs[] = { static_cast<size_t>((m_numLightPaths + 63) / 64 * 64) };
+		size_t ls[] = { 64 };
+
+		uint32_t argc = setSceneArgs(m_prepareLightTracingConnectionsKernel, 0);
+		argc = setImageArgs(m_prepareLightTracingConnectionsKernel, argc);
+
+		m_prepareLightTracingConnectionsKernel.setArg(argc++, m_frameIndex);
+		m_prepareLightTracingConnectionsKernel.setArg(argc++, m_maxDepth);
+		m_prepareLightTracingConnectionsKernel.setArg(argc++, m_numLightPaths);
+		m_prepareLightTracingConnectionsKernel.setArg(argc++, m_lightVertices);
+		m_prepareLightTracingConnectionsKernel.setArg(argc++, m_lightVertexCounts);
+		m_prepareLightTracingConnectionsKernel.setArg(argc++, m_sampledCameraVertices);
+		m_prepareLightTracingConnectionsKernel.setArg(argc++, m_connectionRays);
+		m_prepareLightTracingConnectionsKernel.setArg(argc++, m_tempRadianceBuffer);
+
+		g_clContext.Launch1D(0, gs[0], ls[0], m_prepareLightTracingConnectionsKernel);
+		g_clContext.Finish(0);
+
+		// Query occlusions
+		RadeonRays::Event* evt;
+		g_isectApi->QueryOcclusion(RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_connectionRays),
+			m_numLightPaths * m_maxDepth,
+			RadeonRays::CreateFromOpenClBuffer(g_isectApi, m_connectionVisibilities), nullptr, &evt);
+
+		evt->Wait();
+
+		argc = setSceneArgs(m_lightTracingConnectionKernel, 0);
+		argc = setImageArgs(m_lightTracingConnectionKernel, argc);
+
+		m_lightTracingConnectionKernel.setArg(argc++, m_frameIndex);
+		m_lightTracingConnectionKernel.setArg(argc++, m_maxDepth);
+		m_lightTracingConnectionKernel.setArg(argc++, m_numLightPaths);
+		m_lightTracingConnectionKernel.setArg(argc++, m_numCacheConnections);
+		m_lightTracingConnectionKernel.setArg(argc++, computeMergeRadius());
+		m_lightTracingConnectionKernel.setArg(argc++, m_lightVertices);
+		m_lightTracingConnectionKernel.setArg(argc++, m_lightVertexCounts);
+		m_lightTracingConnectionKernel.setArg(argc++, m_sampledCameraVertices);
+		m_lightTracingConnectionKernel.setArg(argc++, m_lightVertexCacheSize);
+		m_lightTracingConnectionKernel.setArg(argc++, m_connectionRays);
+		m_lightTracingConnectionKernel.setArg(argc++, m_connectionVisibilities);
+		m_lightTracingConnectionKernel.setArg(argc++, m_tempRadianceBuffer);
+		m_lightTracingConnectionKernel.setArg(argc++, m_finalRadianceBuffer);
+
+		g_clContext.Launch1D(0, gs[0], ls[0], m_lightTracingConnectionKernel);
+		g_clContext.Finish(0);
+	}
+	catch (const std::exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+	catch (const Calc::Exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+}
+
+void RTBDPTPass::buildHashGrid()
+{
+	try
+	{
+		ScopedProfiling prof("BDPT:buildHashGrid");
+
+		uint32_t argc = 0;
+		m_clearHashGridKernel.setArg(argc++, m_hashGridSize);
+		m_clearHashGridKernel.setArg(argc++, m_hashGridHeads);
+
+		g_clContext.Launch1D(0, static_cast<size_t>((m_hashGridSize + 63) / 64 * 64), 64, m_clearHashGridKernel);
+
+		// Cell size is twice the merge radius, a query thus has to check at most 2x2x2 cells
+		int maxCacheSize = m_numLightPaths * m_maxDepth;
+
+		argc = 0;
+		m_buildHashGridKernel.setArg(argc++, m_hashGridSize);
+		m_buildHashGridKernel.setArg(argc++, 2.0f * computeMergeRadius());
+		m_buildHashGridKernel.setArg(argc++, m_lightVertices);
+		m_buildHashGridKernel.setArg(argc++, m_lightVertexCache);
+		m_buildHashGridKernel.setArg(argc++, m_lightVertexCacheSize);
+		m_buildHashGridKernel.setArg(argc++, m_hashGridHeads);
+		m_buildHashGridKernel.setArg(argc++, m_hashGridNext);
+
+		g_clContext.Launch1D(0, static_cast<size_t>((maxCacheSize + 63) / 64 * 64), 64, m_buildHashGridKernel);
+		g_clContext.Finish(0);
+	}
+	catch (const std::exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+	catch (const Calc::Exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+}
+
+void RTBDPTPass::mergeVertices()
+{
+	try
+	{
+		ScopedProfiling prof("BDPT:mergeVertices");
+
+		const int imageWidth = PathTracerSettings::GI.imageResolution.value.x;
+		const int imageHeight = PathTracerSettings::GI.imageResolution.value.y;
+
+		uint32_t argc = setSceneArgs(m_mergeVerticesKernel, 0);
+		argc = setImageArgs(m_mergeVerticesKernel, argc);
+
+		m_mergeVerticesKernel.setArg(argc++, m_frameIndex);
+		m_mergeVerticesKernel.setArg(argc++, m_maxDepth);
+		m_mergeVerticesKernel.setArg(argc++, m_numLightPaths);
+		m_mergeVerticesKernel.setArg(argc++, m_numCacheConnections);
+		m_mergeVerticesKernel.setArg(argc++, computeMergeRadius());
+		m_mergeVerticesKernel.setArg(argc++, m_hashGridSize);
+		m_mergeVerticesKernel.setArg(argc++, m_cameraVertices);
+		m_mergeVerticesKernel.setArg(argc++, m_cameraVertexCounts);
+		m_mergeVerticesKernel.setArg(argc++, m_lightVertices);
+		m_mergeVerticesKernel.setArg(argc++, m_lightVertexCache);
+		m_mergeVerticesKernel.setArg(argc++, m_lightVertexCacheSize);
+		m_mergeVerticesKernel.setArg(argc++, m_hashGridHeads);
+		m_mergeVerticesKernel.setArg(argc++, m_hashGridNext);
+		m_mergeVerticesKernel.setArg(argc++, m_finalRadianceBuffer);
+
+		size_t gs[] = { static_cast<size_t>((imageWidth + 7) / 8 * 8), static_cast<size_t>((imageHeight + 7) / 8 * 8) };
+		size_t ls[] = { 8, 8 };
+		g_clContext.Launch2D(0, gs, ls, m_mergeVerticesKernel);
+		g_clContext.Finish(0);
+	}
+	catch (const std::exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+	catch (const Calc::Exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+}
+
+float RTBDPTPass::computeMergeRadius() const
+{
+	if (!m_useVertexMerging)
+		return 0.0f;
+
+	// Progressive radius reduction of SPPM/VCM: r_i = r_1 * i^((alpha - 1) / 2)
+	const BBox& sceneBBox = ECS::getSystem<RTScene>()->getSceneBBox();
+	float sceneRadius = glm::length(sceneBBox.max() - sceneBBox.min()) * 0.5f;
+	float initialRadius = std::max(m_vertexMergingRadius * sceneRadius, 1e-5f);
+
+	return initialRadius * std::pow(static_cast<float>(m_frameIndex + 1), (m_vertexMergingAlpha - 1.0f) * 0.5f);
+}
+
 int RTBDPTPass::getMaxPossibleConnectionsCount()
 {
 	int t = m_maxDepth + 2;
 	return t * (t + 1) / 2 - 2;
 }
 
+int RTBDPTPass::getNumLightPaths() const
+{
+	if (m_useLightVertexCache)
+		return m_numLightPaths;
+
+	return PathTracerSettings::GI.imageResolution.value.x * PathTracerSettings::GI.imageResolution.value.y;
+}
+
+int RTBDPTPass::setLightPathImageArgs(RTKernel& kernel, int argsStart)
+{
+	if (!m_useLightVertexCache)
+		return setImageArgs(kernel, argsStart);
+
+	kernel.setArg(argsStart++, m_numLightPaths);
+	kernel.setArg(argsStart++, 1);
+
+	return argsStart;
+}
+
+void RTBDPTPass::computeLightPathLaunchSize(size_t* gs, size_t* ls) const
+{
+	if (m_useLightVertexCache)
+	{
+		gs[0] = static_cast<size_t>((m_numLightPaths + 63) / 64 * 64);
+		gs[1] = 1;
+		ls[0] = 64;
+		ls[1] = 1;
+	}
+	else
+	{
+		const int imageWidth = PathTracerSettings::GI.imageResolution.value.x;
+		const int imageHeight = PathTracerSettings::GI.imageResolution.value.y;
+
+		gs[0] = static_cast<size_t>((imageWidth + 7) / 8 * 8);
+		gs[1] = static_cast<size_t>((imageHeight + 7) / 8 * 8);
+		ls[0] = 8;
+		ls[1] = 8;
+	}
+}
+
 void RTBDPTPass::copyRadianceBuffer()
 {
 	try
@@ -452,9 +851,10 @@ void RTBDPTPass::createBuffers()
 		m_finalRadianceBuffer = RTBufferManager::createBuffer<float>(CL_MEM_READ_WRITE, imageWidth * imageHeight * 3);
 
 		int numPaths = imageWidth * imageHeight;
+		int numLightPaths = getNumLightPaths();
 
 		m_cameraVertices = RTBufferManager::createBuffer<RTBDPTVertex>(CL_MEM_READ_WRITE, numPaths * (m_maxDepth + 2));
-		m_lightVertices = RTBufferManager::createBuffer<RTBDPTVertex>(CL_MEM_READ_WRITE, numPaths * (m_maxDepth + 1));
+		m_lightVertices = RTBufferManager::createBuffer<RTBDPTVertex>(CL_MEM_READ_WRITE, numLightPaths * (m_maxDepth + 1));
 
 		m_cameraRays = RTBufferManager::createBuffer<RadeonRays::ray>(CL_MEM_READ_WRITE, numPaths);
 		m_cameraIntersections = RTBufferManager::createBuffer<RadeonRays::Intersection>(CL_MEM_READ_WRITE, numPaths);
@@ -463,19 +863,43 @@ void RTBDPTPass::createBuffers()
 		m_cameraFwdPdfs = RTBufferManager::createBuffer<float>(CL_MEM_READ_WRITE, numPaths);
 		m_cameraVertexCounts = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, numPaths);
 
-		m_lightRays = RTBufferManager::createBuffer<RadeonRays::ray>(CL_MEM_READ_WRITE, numPaths);
-		m_lightIntersections = RTBufferManager::createBuffer<RadeonRays::Intersection>(CL_MEM_READ_WRITE, numPaths);
-		m_lightThroughputs = RTBufferManager::createBuffer<RadeonRays::float3>(CL_MEM_READ_WRITE, numPaths);
-		m_lightFwdPdfs = RTBufferManager::createBuffer<float>(CL_MEM_READ_WRITE, numPaths);
-		m_lightVertexCounts = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, numPaths);
+		m_lightRays = RTBufferManager::createBuffer<RadeonRays::ray>(CL_MEM_READ_WRITE, numLightPaths);
+		m_lightIntersections = RTBufferManager::createBuffer<RadeonRays::Intersection>(CL_MEM_READ_WRITE, numLightPaths);
+		m_lightThroughputs = RTBufferManager::createBuffer<RadeonRays::float3>(CL_MEM_READ_WRITE, numLightPaths);
+		m_lightFwdPdfs = RTBufferManager::createBuffer<float>(CL_MEM_READ_WRITE, numLightPaths);
+		m_lightVertexCounts = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, numLightPaths);
+
+		// The light vertex cache connections and the light tracing connections are made one after another and share the connection buffers.
+		int numConnections = m_useLightVertexCache ? 
+			std::max(numPaths * m_maxDepth * (m_numCacheConnections + 1), numLightPaths * m_maxDepth) : 
+			numPaths * getMaxPossibleConnectionsCount();
 
-		m_connectionRays = RTBufferManager::createBuffer<RadeonRays::ray>(CL_MEM_READ_WRITE, numPaths * getMaxPossibleConnectionsCount());
-		m_connectionVisibilities = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, numPaths * getMaxPossibleConnectionsCount());
+		m_connectionRays = RTBufferManager::createBuffer<RadeonRays::ray>(CL_MEM_READ_WRITE, numConnections);
+		m_connectionVisibilities = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, numConnections);
 
-		m_sampledCameraVertices = RTBufferManager::createBuffer<RTBDPTVertex>(CL_MEM_READ_WRITE, numPaths * m_maxDepth);
+		m_sampledCameraVertices = RTBufferManager::createBuffer<RTBDPTVertex>(CL_MEM_READ_WRITE, numLightPaths * m_maxDepth);
 		m_sampledLightVertices = RTBufferManager::createBuffer<RTBDPTVertex>(CL_MEM_READ_WRITE, numPaths * m_maxDepth);
 
-		m_tempRadianceBuffer = RTBufferManager::createBuffer<RadeonRays::float4>(CL_MEM_READ_WRITE, numPaths * getMaxPossibleConnectionsCount());
+		m_tempRadianceBuffer = RTBufferManager::createBuffer<RadeonRays::float4>(CL_MEM_READ_WRITE, numConnections);
+
+		if (m_useLightVertexCache)
+		{
+			m_lightVertexCache = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, numLightPaths * m_maxDepth);
+			m_lightVertexCacheSize = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, 1);
+			m_cacheConnectionVertices = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, numPaths * m_maxDepth * (m_numCacheConnections + 1));
+		}
+
+		if (m_useVertexMerging)
+		{
+			// Hash grid size is the next power of two of the cache capacity
+			int maxCacheSize = numLightPaths * m_maxDepth;
+			m_hashGridSize = 1;
+			while (m_hashGridSize < maxCacheSize)
+				m_hashGridSize <<= 1;
+
+			m_hashGridHeads = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, m_hashGridSize);
+			m_hashGridNext = RTBufferManager::createBuffer<int>(CL_MEM_READ_WRITE, maxCacheSize);
+		}
 	}
 	catch (const std::exception& e)
 	{
@@ -495,6 +919,18 @@ void RTBDPTPass::setupKernels()
 	m_secondaryVerticesGenerationKernel = bdptProgram.GetKernel("GenerateSecondaryVertices");
 	m_connectionKernel = bdptProgram.GetKernel("ConnectVertices");
 	m_prepareConnectionsKernel = bdptProgram.GetKernel("PrepareConnections");
+
+	m_cameraStartVerticesGenerationKernel = bdptProgram.GetKernel("GenerateCameraStartVertices");
+	m_lightStartVerticesGenerationKernel = bdptProgram.GetKernel("GenerateLightStartVertices");
+	m_buildLightVertexCacheKernel = bdptProgram.GetKernel("BuildLightVertexCache");
+	m_prepareCacheConnectionsKernel = bdptProgram.GetKernel("PrepareCacheConnections");
+	m_cacheConnectionKernel = bdptProgram.GetKernel("ConnectCacheVertices");
+	m_prepareLightTracingConnectionsKernel = bdptProgram.GetKernel("PrepareLightTracingConnections");
+	m_lightTracingConnectionKernel = bdptProgram.GetKernel("ConnectLightTracingVertices");
+
+	m_clearHashGridKernel = bdptProgram.GetKernel("ClearHashGrid");
+	m_buildHashGridKernel = bdptProgram.GetKernel("BuildHashGrid");
+	m_mergeVerticesKernel = bdptProgram.GetKernel("MergeVertices");
 }
 
 int RTBDPTPass::setSceneArgs(RTKernel& kernel, int sceneArgsStart)
@@ -35,7 +35,30 @@ private:
 	void prepareVertexConnections();
 	void makeConnections();
 
+	/**
+	* Light vertex cache variant: Light subpaths are traced independently of the image resolution. Camera vertices are
+	* connected to randomly chosen cached light vertices and light tracing connections are made for all cached vertices.
+	*/
+	void buildLightVertexCache();
+	void makeCacheConnections();
+	void makeLightTracingConnections();
+
+	/**
+	* Vertex merging: The cached light vertices are stored in a hash grid and merged with nearby camera vertices.
+	*/
+	void buildHashGrid();
+	void mergeVertices();
+	float computeMergeRadius() const;
+
 	int getMaxPossibleConnectionsCount();
+	int getNumLightPaths() const;
+
+	/**
+	* Light subpaths are processed on a numLightPaths x 1 grid if the light vertex cache is used.
+	* Otherwise there is one light subpath per pixel.
+	*/
+	int setLightPathImageArgs(RTKernel& kernel, int argsStart);
+	void computeLightPathLaunchSize(size_t* gs, size_t* ls) const;
 
 	CLWBuffer<RadeonRays::float4> m_radianceBuffer;
 	CLWBuffer<float> m_finalRadianceBuffer;
@@ -47,6 +70,18 @@ private:
 	RTKernel m_prepareConnectionsKernel;
 	RTKernel m_connectionKernel;
 
+	RTKernel m_cameraStartVerticesGenerationKernel;
+	RTKernel m_lightStartVerticesGenerationKernel;
+	RTKernel m_buildLightVertexCacheKernel;
+	RTKernel m_prepareCacheConnectionsKernel;
+	RTKernel m_cacheConnectionKernel;
+	RTKernel m_prepareLightTracingConnectionsKernel;
+	RTKernel m_lightTracingConnectionKernel;
+
+	RTKernel m_clearHashGridKernel;
+	RTKernel m_buildHashGridKernel;
+	RTKernel m_mergeVerticesKernel;
+
 	// The camera path buffer has maxDepth + 2 vertices per pixel
 	CLWBuffer<RTBDPTVertex> m_cameraVertices;
 	// The light path buffer has maxDepth + 1 vertices per pixel
@@ -71,8 +106,24 @@ private:
 	CLWBuffer<RadeonRays::ray> m_connectionRays;
 	CLWBuffer<int> m_connectionVisibilities;
 
+	// Indices of the cached light vertices in m_lightVertices
+	CLWBuffer<int> m_lightVertexCache;
+	CLWBuffer<int> m_lightVertexCacheSize;
+	// Index of the cached light vertex each cache connection was made to
+	CLWBuffer<int> m_cacheConnectionVertices;
+
+	CLWBuffer<int> m_hashGridHeads;
+	CLWBuffer<int> m_hashGridNext;
+
 	int m_frameIndex = 0;
 	int m_maxDepth;
+	bool m_useLightVertexCache;
+	int m_numLightPaths;
+	int m_numCacheConnections;
+	bool m_useVertexMerging;
+	float m_vertexMergingRadius;
+	float m_vertexMergingAlpha;
+	int m_hashGridSize = 0;
 	bool m_hasErrors = false;
 	float m_totalRenderTime = 0.0f;
 };
@@ -28,7 +28,8 @@ RTPathTracingPass::RTPathTracingPass()
 
 	createBuffers();
 
-	ECS::getSystem<RTScene>()->addSceneUpdateListener([&](){ m_frameIndex = 0; });
+	// Reservoirs reference lights by index which may change with the scene
+	ECS::getSystem<RTScene>()->addSceneUpdateListener([&](){ m_frameIndex = 0; m_hasReservoirHistory = false; });
 
 	Screen::addResizeListener([this]() {
 		PathTracerSettings::GI.imageResolution.value = glm::ivec2(Screen::getWidth(), Screen::getHeight());
@@ -45,6 +46,9 @@ void RTPathTracingPass::update()
 	auto program = KernelManager::getProgram("PathTracing", g_clContext);
 	m_kernel = program.GetKernel("PathTracing");
 	m_shadowKernel = program.GetKernel("ShadowPass");
+	m_restirInitialSamplingKernel = program.GetKernel("ReSTIRInitialSampling");
+	m_restirTemporalReuseKernel = program.GetKernel("ReSTIRTemporalReuse");
+	m_restirSpatialReuseKernel = program.GetKernel("ReSTIRSpatialReuse");
 
 	if (m_renderPipeline->getCamera()->getComponent<FreeCameraViewController>()->bMovedInLastUpdate)
 	{
@@ -67,6 +71,11 @@ void RTPathTracingPass::update()
 			auto isectPtr = m_renderPipeline->fetchPtr<CLWBuffer<RadeonRays::Intersection>>("PrimaryIntersectionBufferCL");
 			auto rayBuffer = m_renderPipeline->fetchPtr<CLWBuffer<RadeonRays::ray>>("RayBuffer");
 
+			if (PathTracerSettings::GI.useReSTIR)
+				applyReSTIR(*isectPtr);
+			else
+				m_hasReservoirHistory = false;
+
 			const int maxDepth = PathTracerSettings::GI.maxDepth;
 			for (int i = 0; i < maxDepth; ++i)
 			{
@@ -141,6 +150,10 @@ void RTPathTracingPass::applyShading(const CLWBuffer<RadeonRays::Intersection> &
 		m_kernel.setArg(argc++, m_tempRadianceBuffer);
 		m_kernel.setArg(argc++, m_throughputBuffer);
 
+		// ReSTIR params
+		m_kernel.setArg(argc++, m_finalReservoirBuffers[m_finalReservoirBufferIdx]);
+		m_kernel.setArg(argc++, PathTracerSettings::GI.useReSTIR ? 1 : 0);
+
 		size_t gs[] = { static_cast<size_t>((imageWidth + 7) / 8 * 8), static_cast<size_t>((imageHeight + 7) / 8 * 8) };
 		size_t ls[] = { 8, 8 };
 		g_clContext.Launch2D(0, gs, ls, m_kernel);
@@ -201,6 +214,104 @@ void RTPathTracingPass::applyVisibilityTest()
 	}
 }
 
+void RTPathTracingPass::applyReSTIR(const CLWBuffer<RadeonRays::Intersection> &isect)
+{
+	try
+	{
+		int imageWidth = PathTracerSettings::GI.imageResolution.value.x;
+		int imageHeight = PathTracerSettings::GI.imageResolution.value.y;
+
+		// Reservoirs are only allocated if ReSTIR is used
+		if (m_reservoirBuffer.GetElementCount() != static_cast<size_t>(imageWidth * imageHeight))
+			createReservoirBuffers();
+
+		auto rayBuffer = m_renderPipeline->fetchPtr<CLWBuffer<RadeonRays::ray>>("RayBuffer");
+		if (!rayBuffer)
+			throw std::runtime_error("Expected valid ray buffer but got nullptr.");
+
+		RTScene* scene = ECS::getSystem<RTScene>();
+		const int prevFinalIdx = m_finalReservoirBufferIdx;
+		m_finalReservoirBufferIdx = 1 - m_finalReservoirBufferIdx;
+
+		size_t gs[] = { static_cast<size_t>((imageWidth + 7) / 8 * 8), static_cast<size_t>((imageHeight + 7) / 8 * 8) };
+		size_t ls[] = { 8, 8 };
+
+		// Initial candidates
+		uint32_t argc = scene->setSceneArgs(m_restirInitialSamplingKernel, 0);
+		m_restirInitialSamplingKernel.setArg(argc++, imageWidth);
+		m_restirInitialSamplingKernel.setArg(argc++, imageHeight);
+		m_restirInitialSamplingKernel.setArg(argc++, m_shadowRayBuffer);
+		m_restirInitialSamplingKernel.setArg(argc++, *rayBuffer);
+		m_restirInitialSamplingKernel.setArg(argc++, isect);
+		m_restirInitialSamplingKernel.setArg(argc++, m_restirFrameIndex);
+		m_restirInitialSamplingKernel.setArg(argc++, PathTracerSettings::GI.reSTIRCandidates.value);
+		m_restirInitialSamplingKernel.setArg(argc++, m_reservoirBuffer);
+		g_clContext.Launch2D(0, gs, ls, m_restirInitialSamplingKernel);
+
+		// Temporal reuse
+		if (m_hasReservoirHistory && PathTracerSettings::GI.reSTIRMaxHistory > 0)
+		{
+			argc = scene->setSceneArgs(m_restirTemporalReuseKernel, 0);
+			m_restirTemporalReuseKernel.setArg(argc++, imageWidth);
+			m_restirTemporalReuseKernel.setArg(argc++, imageHeight);
+			m_restirTemporalReuseKernel.setArg(argc++, m_shadowRayBuffer);
+			m_restirTemporalReuseKernel.setArg(argc++, *rayBuffer);
+			m_restirTemporalReuseKernel.setArg(argc++, isect);
+			m_restirTemporalReuseKernel.setArg(argc++, m_restirFrameIndex);
+			m_restirTemporalReuseKernel.setArg(argc++, PathTracerSettings::GI.reSTIRMaxHistory.value);
+			m_restirTemporalReuseKernel.setArg(argc++, m_prevCameraBuffer);
+			m_restirTemporalReuseKernel.setArg(argc++, m_finalReservoirBuffers[prevFinalIdx]);
+			m_restirTemporalReuseKernel.setArg(argc++, m_reservoirBuffer);
+			g_clContext.Launch2D(0, gs, ls, m_restirTemporalReuseKernel);
+		}
+
+		// Spatial reuse
+		argc = scene->setSceneArgs(m_restirSpatialReuseKernel, 0);
+		m_restirSpatialReuseKernel.setArg(argc++, imageWidth);
+		m_restirSpatialReuseKernel.setArg(argc++, imageHeight);
+		m_restirSpatialReuseKernel.setArg(argc++, m_shadowRayBuffer);
+		m_restirSpatialReuseKernel.setArg(argc++, *rayBuffer);
+		m_restirSpatialReuseKernel.setArg(argc++, isect);
+		m_restirSpatialReuseKernel.setArg(argc++, m_restirFrameIndex);
+		m_restirSpatialReuseKernel.setArg(argc++, PathTracerSettings::GI.reSTIRSpatialNeighbours.value);
+		m_restirSpatialReuseKernel.setArg(argc++, PathTracerSettings::GI.reSTIRSpatialRadius.value);
+		m_restirSpatialReuseKernel.setArg(argc++, m_reservoirBuffer);
+		m_restirSpatialReuseKernel.setArg(argc++, m_finalReservoirBuffers[m_finalReservoirBufferIdx]);
+		g_clContext.Launch2D(0, gs, ls, m_restirSpatialReuseKernel);
+
+		// The current camera is needed for the reprojection in the next frame
+		g_clContext.CopyBuffer(0, scene->getDeviceScene().camera, m_prevCameraBuffer, 0, 0, 1);
+		g_clContext.Finish(0);
+
+		m_hasReservoirHistory = true;
+		++m_restirFrameIndex;
+	}
+	catch (const std::exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+	catch (const Calc::Exception& e)
+	{
+		LOG_ERROR(e.what());
+		throw;
+	}
+}
+
+void RTPathTracingPass::createReservoirBuffers()
+{
+	RTScopedMemoryRecord memRecord(RT_PATH_TRACING_PASS_MEMORY_RECORD_NAME);
+
+	int width = PathTracerSettings::GI.imageResolution.value.x;
+	int height = PathTracerSettings::GI.imageResolution.value.y;
+
+	m_reservoirBuffer = RTBufferManager::createBuffer<RTReservoir>(CL_MEM_READ_WRITE, width * height);
+	m_finalReservoirBuffers[0] = RTBufferManager::createBuffer<RTReservoir>(CL_MEM_READ_WRITE, width * height);
+	m_finalReservoirBuffers[1] = RTBufferManager::createBuffer<RTReservoir>(CL_MEM_READ_WRITE, width * height);
+	m_prevCameraBuffer = RTBufferManager::createBuffer<RTPinholeCamera>(CL_MEM_READ_WRITE, 1);
+	m_hasReservoirHistory = false;
+}
+
 void RTPathTracingPass::createBuffers()
 {
 	RTScopedMemoryRecord memRecord(RT_PATH_TRACING_PASS_MEMORY_RECORD_NAME);
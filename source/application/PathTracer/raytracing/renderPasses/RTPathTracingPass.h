@@ -23,6 +23,13 @@ private:
 	void applyVisibilityTest();
 	void createBuffers();
 
+	/**
+	* ReSTIR direct lighting: Resamples light candidates at the primary hits into per pixel reservoirs and reuses
+	* the reservoirs of the previous frame and of neighbouring pixels. The primary bounce shades the surviving sample.
+	*/
+	void applyReSTIR(const CLWBuffer<RadeonRays::Intersection> &isect);
+	void createReservoirBuffers();
+
 	RTKernel m_kernel;
 
 	CLWBuffer<RadeonRays::ray> m_shadowRayBuffer;
@@ -35,6 +42,17 @@ private:
 	CLWBuffer<RTThroughput> m_throughputBuffer;
 	RTKernel m_shadowKernel;
 
+	RTKernel m_restirInitialSamplingKernel;
+	RTKernel m_restirTemporalReuseKernel;
+	RTKernel m_restirSpatialReuseKernel;
+	CLWBuffer<RTReservoir> m_reservoirBuffer;
+	// Output of the spatial reuse, the buffer of the previous frame is the input of the temporal reuse
+	CLWBuffer<RTReservoir> m_finalReservoirBuffers[2];
+	CLWBuffer<RTPinholeCamera> m_prevCameraBuffer;
+	int m_finalReservoirBufferIdx = 0;
+	int m_restirFrameIndex = 0;
+	bool m_hasReservoirHistory = false;
+
 	int m_frameIndex = 0;
 	bool m_hasErrors = false;
 	float m_totalRenderTime = 0.0f;
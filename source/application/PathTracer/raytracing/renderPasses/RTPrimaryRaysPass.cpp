@@ -101,6 +101,9 @@ RadeonRays::Buffer* RTPrimaryRaysPass::generatePrimaryRays()
 		cam.direction = CLHelper::toFloat3(MainCamera->getForward());
 		cam.width = width;
 		cam.height = height;
+		cam.pixelSpreadAngle = RTUtil::computePixelSpreadAngle(w, h, nc);
+		// Used to reproject primary hits into the image of the previous frame
+		cam.worldToClip = CLHelper::toMatrix(MainCamera->viewProj());
 
 		auto camera = ECS::getSystem<RTScene>()->getDeviceScene().camera;
 		auto writeEvt = g_clContext.WriteBuffer(0, camera, &cam, 1);
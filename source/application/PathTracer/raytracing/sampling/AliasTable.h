@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <CLW.h>
+#include <kernel_data.h>
+
+namespace AliasTable
+{
+	/**
+	* Builds an alias table with Vose's method for the discrete distribution given by the weights.
+	* Weights don't need to be normalized. If all weights are zero a uniform distribution is used.
+	* The entries are appended to outTable which allows multiple tables to share one buffer.
+	*/
+	inline void build(const std::vector<float>& weights, std::vector<RTAliasTableEntry>& outTable)
+	{
+		size_t n = weights.size();
+		if (n == 0)
+			return;
+
+		size_t offset = outTable.size();
+		outTable.resize(offset + n);
+		RTAliasTableEntry* table = outTable.data() + offset;
+
+		double totalWeight = 0.0;
+		for (float w : weights)
+			totalWeight += w > 0.0f ? w : 0.0f;
+
+		// Scaled probabilities: n * pdf
+		std::vector<double> scaled(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			double pdf = totalWeight > 0.0 ? (weights[i] > 0.0f ? weights[i] : 0.0f) / totalWeight : 1.0 / n;
+			table[i].pdf = static_cast<float>(pdf);
+			table[i].q = 1.0f;
+			table[i].alias = static_cast<int>(i);
+			table[i].pad = 0;
+			scaled[i] = pdf * n;
+		}
+
+		std::vector<size_t> small, large;
+		small.reserve(n);
+		large.reserve(n);
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (scaled[i] < 1.0)
+				small.push_back(i);
+			else
+				large.push_back(i);
+		}
+
+		while (!small.empty() && !large.empty())
+		{
+			size_t s = small.back();
+			small.pop_back();
+			size_t l = large.back();
+			large.pop_back();
+
+			table[s].q = static_cast<float>(scaled[s]);
+			table[s].alias = static_cast<int>(l);
+
+			scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+
+			if (scaled[l] < 1.0)
+				small.push_back(l);
+			else
+				large.push_back(l);
+		}
+
+		// Remaining entries are 1 up to numerical error
+		for (size_t i : large)
+			table[i].q = 1.0f;
+
+		for (size_t i : small)
+			table[i].q = 1.0f;
+	}
+}
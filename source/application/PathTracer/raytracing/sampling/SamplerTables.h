@@ -0,0 +1,175 @@
+#pragma once
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <CLW.h>
+#include <kernel_data.h>
+#include "sobol.h"
+
+/**
+* Tables of the device samplers. They share one buffer: The Sobol tables of RT_SOBOL_TABLE_DIMENSIONS dimensions are
+* followed by the blue noise tile at RT_BLUE_NOISE_OFFSET.
+*/
+namespace SamplerTables
+{
+	/**
+	* Each dimension stores 4 tables with 256 entries. Entry v of table b is the xor of the generator matrix columns
+	* selected by the bits of v, i.e. byte b of the sample index. A Sobol sample then only needs 4 lookups.
+	*/
+	inline void buildSobolTables(std::vector<uint32_t>& outTables)
+	{
+		size_t offset = outTables.size();
+		outTables.resize(offset + size_t(RT_SOBOL_TABLE_DIMENSIONS) * RT_SOBOL_TABLE_SIZE);
+
+		for (uint32_t d = 0; d < RT_SOBOL_TABLE_DIMENSIONS; ++d)
+		{
+			const uint32_t* columns = g_SobolMatrices32 + d * SOBOL_MATRIX_SIZE;
+			uint32_t* table = outTables.data() + offset + d * RT_SOBOL_TABLE_SIZE;
+
+			for (uint32_t b = 0; b < 4; ++b)
+			{
+				for (uint32_t v = 0; v < 256; ++v)
+				{
+					uint32_t x = 0;
+					for (uint32_t k = 0; k < 8; ++k)
+					{
+						if (v & (1u << k))
+							x ^= columns[8 * b + k];
+					}
+
+					table[b * 256 + v] = x;
+				}
+			}
+		}
+	}
+
+	/**
+	* Generates a tileable blue noise mask of RT_BLUE_NOISE_SIZE^2 ranks with the void-and-cluster method by Ulichney.
+	* The ranks are a permutation of [0, RT_BLUE_NOISE_SIZE^2).
+	*/
+	inline void buildBlueNoise(std::vector<uint32_t>& outRanks)
+	{
+		const int size = RT_BLUE_NOISE_SIZE;
+		const int n = size * size;
+		const float sigma = 1.5f;
+
+		// Gaussian energy filter on the torus
+		std::vector<float> filter(n);
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				float dx = static_cast<float>(std::min(x, size - x));
+				float dy = static_cast<float>(std::min(y, size - y));
+				filter[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+			}
+		}
+
+		std::vector<uint8_t> pattern(n, 0);
+		std::vector<float> energy(n, 0.0f);
+
+		auto toggle = [&](int p, uint8_t value)
+		{
+			pattern[p] = value;
+			float sign = value ? 1.0f : -1.0f;
+			int px = p % size;
+			int py = p / size;
+			for (int y = 0; y < size; ++y)
+			{
+				const float* filterRow = filter.data() + ((y - py + size) % size) * size;
+				for (int x = 0; x < size; ++x)
+					energy[y * size + x] += sign * filterRow[(x - px + size) % size];
+			}
+		};
+
+		auto findTightestCluster = [&]()
+		{
+			int best = 0;
+			float maxEnergy = -1.0f;
+			for (int p = 0; p < n; ++p)
+			{
+				if (pattern[p] && energy[p] > maxEnergy)
+				{
+					maxEnergy = energy[p];
+					best = p;
+				}
+			}
+			return best;
+		};
+
+		auto findLargestVoid = [&]()
+		{
+			int best = 0;
+			float minEnergy = std::numeric_limits<float>::max();
+			for (int p = 0; p < n; ++p)
+			{
+				if (!pattern[p] && energy[p] < minEnergy)
+				{
+					minEnergy = energy[p];
+					best = p;
+				}
+			}
+			return best;
+		};
+
+		// Random initial pattern, a fixed seed keeps the mask identical between runs
+		std::mt19937 rng(1337);
+		const int numInitialPoints = n / 10;
+		for (int i = 0; i < numInitialPoints;)
+		{
+			int p = static_cast<int>(rng() % n);
+			if (!pattern[p])
+			{
+				toggle(p, 1);
+				++i;
+			}
+		}
+
+		// Move points from the tightest cluster to the largest void until the pattern is stable
+		for (int i = 0; i < n; ++i)
+		{
+			int cluster = findTightestCluster();
+			toggle(cluster, 0);
+			int largestVoid = findLargestVoid();
+			toggle(largestVoid, 1);
+
+			if (largestVoid == cluster)
+				break;
+		}
+
+		std::vector<uint8_t> prototypePattern = pattern;
+		std::vector<float> prototypeEnergy = energy;
+		size_t offset = outRanks.size();
+		outRanks.resize(offset + n);
+		uint32_t* ranks = outRanks.data() + offset;
+
+		// Rank the initial points by removing the tightest clusters
+		for (int rank = numInitialPoints - 1; rank >= 0; --rank)
+		{
+			int cluster = findTightestCluster();
+			toggle(cluster, 0);
+			ranks[cluster] = static_cast<uint32_t>(rank);
+		}
+
+		// Rank the remaining points by filling the largest voids.
+		// Note: Filling the largest void is equivalent to removing the tightest cluster of the minority pixels once
+		// more than half of the pixels are set because the energy of the pixels sums to a constant.
+		pattern = prototypePattern;
+		energy = prototypeEnergy;
+		for (int rank = numInitialPoints; rank < n; ++rank)
+		{
+			int largestVoid = findLargestVoid();
+			toggle(largestVoid, 1);
+			ranks[largestVoid] = static_cast<uint32_t>(rank);
+		}
+	}
+
+	inline void build(std::vector<uint32_t>& outTables)
+	{
+		outTables.clear();
+		buildSobolTables(outTables);
+		buildBlueNoise(outTables);
+	}
+}
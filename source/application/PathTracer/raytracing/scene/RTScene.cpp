@@ -6,7 +6,7 @@
 #include "RTShapeComponent.h"
 #include "../source/engine/resource/ResourceManager.h"
 #include "../source/engine/util/NamingConvention.h"
-#include "../sampling/sobol.h"
+#include "../sampling/SamplerTables.h"
 #include "../source/engine/util/colors.h"
 #include "../rt_globals.h"
 #include <engine/rendering/lights/DirectionalLight.h>
@@ -14,6 +14,7 @@
 #include "../lights/RTLightComponent.h"
 #include "../source/engine/rendering/lights/DiskAreaLight.h"
 #include "../source/engine/rendering/lights/TriangleMeshAreaLight.h"
+#include "../source/engine/rendering/lights/EnvironmentLight.h"
 #include "../material/RTUberMaterialComponent.h"
 #include "../system/RTBufferManager.h"
 #include "../source/engine/rendering/Screen.h"
@@ -22,20 +23,154 @@
 #include "../system/PlatformManager.h"
 #include "../third_party/RadeonRays/RadeonRays/include/radeon_rays_cl.h"
 #include "../source/engine/util/math.h"
+#include "../sampling/AliasTable.h"
+#include "../textures/RTTextureCompression.h"
+#include "../textures/RTTextureImages.h"
+#include "../textures/RTTextureLoader.h"
+#include <numeric>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <stb_image.h>
 
 #define RT_SCENE_MEMORY_RECORD_CONTEXT_NAME std::string("RT_SCENE_MEMORY_RECORD_CONTEXT")
 
+// Vertices or triangles per batch of RTScene::convertAttachedMeshes
+#define RT_MESH_CONVERSION_BATCH_SIZE 65536
+
+namespace
+{
+	RTTextureFormat toRTTextureFormat(GLenum format)
+	{
+		switch (format)
+		{
+		case GL_LUMINANCE:
+		case GL_DEPTH_COMPONENT:
+		case GL_RED:
+		case GL_R:
+			return RT_TEX_FORMAT_R8;
+		case GL_LUMINANCE_ALPHA:
+		case GL_RG:
+			return RT_TEX_FORMAT_RG8;
+		case GL_RGB:
+			return RT_TEX_FORMAT_RGB8;
+		default:
+			return RT_TEX_FORMAT_RGBA8;
+		}
+	}
+
+	/**
+	* Texels are tightly packed: one byte per channel.
+	*/
+	int computeTexelStride(RTTextureFormat format)
+	{
+		switch (format)
+		{
+		case RT_TEX_FORMAT_R8: return 1;
+		case RT_TEX_FORMAT_RG8: return 2;
+		case RT_TEX_FORMAT_RGB8: return 3;
+		default: return 4;
+		}
+	}
+
+	GLenum toGLReadFormat(RTTextureFormat format)
+	{
+		switch (format)
+		{
+		case RT_TEX_FORMAT_R8: return GL_RED;
+		case RT_TEX_FORMAT_RG8: return GL_RG;
+		case RT_TEX_FORMAT_RGB8: return GL_RGB;
+		default: return GL_RGBA;
+		}
+	}
+
+	/**
+	* Textures loaded from pre-compressed files (e.g. DDS) keep their GL compressed format. Returns false if the
+	* internal format has no matching device format.
+	*/
+	bool toRTBlockCompressedFormat(GLint internalFormat, RTTextureFormat& outFormat)
+	{
+		switch (internalFormat)
+		{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+			outFormat = RT_TEX_FORMAT_BC1;
+			return true;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			outFormat = RT_TEX_FORMAT_BC3;
+			return true;
+		case GL_COMPRESSED_RED_RGTC1:
+			outFormat = RT_TEX_FORMAT_BC4;
+			return true;
+		case GL_COMPRESSED_RG_RGTC2:
+			outFormat = RT_TEX_FORMAT_BC5;
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/**
+	* Returns false if the transform is not a similarity transform, i.e. it scales non-uniformly or shears.
+	* Otherwise outScale is the factor of the areas, snapped to 1 for rigid transforms to keep the areas stable.
+	*/
+	bool tryGetAreaScale(const rt_mat4& toWorld, float& outScale)
+	{
+		glm::vec3 c0(toWorld.m00, toWorld.m10, toWorld.m20);
+		glm::vec3 c1(toWorld.m01, toWorld.m11, toWorld.m21);
+		glm::vec3 c2(toWorld.m02, toWorld.m12, toWorld.m22);
+
+		float s0 = glm::dot(c0, c0);
+		float s1 = glm::dot(c1, c1);
+		float s2 = glm::dot(c2, c2);
+		float tolerance = 1e-4f * std::max({ s0, s1, s2 });
+
+		if (std::abs(s0 - s1) > tolerance || std::abs(s0 - s2) > tolerance || std::abs(glm::dot(c0, c1)) > tolerance ||
+			std::abs(glm::dot(c0, c2)) > tolerance || std::abs(glm::dot(c1, c2)) > tolerance)
+			return false;
+
+		outScale = (s0 + s1 + s2) / 3.0f;
+		if (std::abs(outScale - 1.0f) <= 1e-4f)
+			outScale = 1.0f;
+
+		return true;
+	}
+
+	/**
+	* Packs count vertices of the submesh starting at first, they are transformed to world space if toWorld is given.
+	*/
+	void packVertices(const Mesh::SubMesh& subMesh, const glm::mat4* toWorld, size_t first, size_t count, RTVertex* outVertices)
+	{
+		glm::mat3 normalMatrix = toWorld ? glm::transpose(glm::inverse(glm::mat3(*toWorld))) : glm::mat3(1.0f);
+		glm::mat3 vectorMatrix = toWorld ? glm::mat3(*toWorld) : glm::mat3(1.0f);
+
+		for (size_t i = first; i < first + count; ++i)
+		{
+			glm::vec3 position = toWorld ? glm::vec3(*toWorld * glm::vec4(subMesh.vertices[i], 1.0f)) : subMesh.vertices[i];
+			outVertices[i - first] = CLHelper::packVertex(position, subMesh.uvs[i], normalMatrix * subMesh.normals[i],
+				vectorMatrix * subMesh.tangents[i], vectorMatrix * subMesh.bitangents[i]);
+		}
+	}
+}
+
 RTScene::RTScene(RadeonRays::IntersectionApi* intersectionApi, CLWContext clContext)
 	:m_intersectionApi(intersectionApi), m_clContext(clContext)
 {
 	PathTracerSettings::INTERSECTION_API.refreshApiButton.onButtonClick = [this]() { commit(); };
 
+	// Must match the RT_USE_TEXTURE_IMAGES build option of the kernels which is set on start up
+	m_useTextureImages = RTTextureImages::isEnabled();
+
 	try
 	{
-		uploadTextures();
+		uploadTextures(true);
 
 		attachStaticEntities();
 		attachDynamicEntities();
+		convertAttachedMeshes();
 		addLights();
 
 		commit();
@@ -52,13 +187,25 @@ RTScene::RTScene(RadeonRays::IntersectionApi* intersectionApi, CLWContext clCont
 	RTScopedMemoryRecord memRecord(RT_SCENE_MEMORY_RECORD_CONTEXT_NAME);
 
 	m_rtDeviceScene.camera = RTBufferManager::createBuffer<RTPinholeCamera>(CL_MEM_READ_ONLY, 1);
-	m_rtDeviceScene.sobolMatrices = RTBufferManager::createBuffer<uint32_t>(CL_MEM_READ_ONLY, SOBOL_MATRIX_SIZE * SOBOL_NUM_DIMENSIONS, (void*)&g_SobolMatrices32);
+	std::vector<uint32_t> samplerTables;
+	SamplerTables::build(samplerTables);
+	m_rtDeviceScene.samplerTables = RTBufferManager::createBuffer<uint32_t>(CL_MEM_READ_ONLY, samplerTables.size(), samplerTables.data());
 }
 
 RTScene::~RTScene()
 {
+	if (m_intersectionApiBuildFuture.valid())
+		m_intersectionApiBuildFuture.wait();
+
 	m_intersectionApi->DetachAll();
 	m_intersectionApi->ResetIdCounter();
+
+	// The active api is kept alive for g_isectApi
+	for (auto intersectionApi : m_buildIntersectionApis)
+	{
+		if (intersectionApi && intersectionApi != m_intersectionApi)
+			RadeonRays::IntersectionApi::Delete(intersectionApi);
+	}
 }
 
 void RTScene::update(EntityManager& entityManager)
@@ -69,7 +216,7 @@ void RTScene::update(EntityManager& entityManager)
 	{
 		if (m_scheduledCreatedEntities.size() > 0)
 		{
-			uploadTextures();
+			uploadTextures(false);
 
 			for (auto entity : m_scheduledCreatedEntities)
 			{
@@ -77,15 +224,36 @@ void RTScene::update(EntityManager& entityManager)
 			}
 
 			m_scheduledCreatedEntities.clear();
+			convertAttachedMeshes();
 
 			addLights();
 			uploadLights();
 			uploadMaterials();
 			uploadShapes();
+			m_lightsChanged = false;
+			m_updated = true;
+		}
+
+		// Lights of all entities activated or deactivated since the last frame are collected once
+		if (m_lightsChanged)
+		{
+			addLights();
+			uploadLights();
+			uploadShapes();
+			m_lightsChanged = false;
 			m_updated = true;
 		}
 
+		updateEnvironmentMap();
 		updateDynamicEntities();
+
+		// Topology changes are built on a worker thread, one build at a time
+		finishAsyncCommit(false);
+		if (m_commitRequested && !m_intersectionApiBuild)
+			commitAsync();
+
+		// Tiles requested by the kernels of the last frame
+		m_virtualTextures.update(m_clContext, m_rtDeviceScene.textureData, m_rtDeviceScene.textureFeedback);
 	}
 
 	if (m_updated)
@@ -110,89 +278,90 @@ void RTScene::receive(const ComponentAddedEvent<MeshRenderer>& event)
 void RTScene::receive(const EntityDeactivatedEvent& event)
 {
 	Entity entity = event.entity;
-	bool requestIsectApiCommit = false;
-	if (m_attachedEntities.find(entity) != m_attachedEntities.end())
-	{
-		auto shapeComponent = entity.getComponent<RTShapeComponent>();
-		if (shapeComponent)
-		{
-			requestIsectApiCommit = true;
-
-			for (auto shape : shapeComponent->shapes)
-			{
-				m_intersectionApi->DetachShape(shape);
-			}
-		}
-	}
+	if (m_attachedEntities.find(entity) != m_attachedEntities.end() && entity.getComponent<RTShapeComponent>())
+		requestCommit();
 
-	auto light = entity.getComponent<RTLightComponent>();
-	if (light)
-	{
-		addLights();
-		uploadLights();
-	}
+	if (entity.getComponent<RTLightComponent>())
+		m_lightsChanged = true;
+}
 
-	if (requestIsectApiCommit)
-		m_intersectionApi->Commit();
+void RTScene::receive(const EntityActivatedEvent& event)
+{
+	Entity entity = event.entity;
+	if (m_attachedEntities.find(entity) != m_attachedEntities.end() && entity.getComponent<RTShapeComponent>())
+		requestCommit();
 
-	for (auto& l : m_sceneUpdateListeners)
-	{
-		l();
-	}
+	if (entity.getComponent<RTLightComponent>())
+		m_lightsChanged = true;
 }
 
-void RTScene::receive(const EntityActivatedEvent& event)
+void RTScene::receive(const TransformStaticStatusChangedEvent& event)
 {
 	Entity entity = event.entity;
-	bool requestIsectApiCommit = false;
+	auto transform = entity.getComponent<Transform>();
+	auto meshRenderer = entity.getComponent<MeshRenderer>();
+	auto shapeComponent = entity.getComponent<RTShapeComponent>();
+	if (!transform || transform->isStatic() || !meshRenderer || !shapeComponent)
+		return;
 
-	if (m_attachedEntities.find(entity) != m_attachedEntities.end())
+	// The entity can move from now on: baked vertices are replaced by object space vertices.
+	// Baked shapes are never instances, their shapes are in the order of the submeshes.
+	const auto& subMeshes = meshRenderer->getMesh()->getSubMeshes();
+	for (size_t i = 0; i < shapeComponent->shapes.size() && i < subMeshes.size(); ++i)
 	{
-		auto shapeComponent = entity.getComponent<RTShapeComponent>();
-		if (shapeComponent)
-		{
-			requestIsectApiCommit = true;
-			for (auto shape : shapeComponent->shapes)
-			{
-				m_intersectionApi->AttachShape(shape);
-			}
-		}
-	}
+		uint32_t shapeId = static_cast<uint32_t>(shapeComponent->shapes[i]->GetId());
+		RTShape& shape = m_rtHostScene.shapes[shapeId];
+		if ((shape.flags & RT_SHAPE_FLAG_WORLD_SPACE_VERTICES) == 0)
+			continue;
 
-	auto light = entity.getComponent<RTLightComponent>();
-	if (light)
-	{
-		addLights();
-		uploadLights();
+		shape.flags &= ~RT_SHAPE_FLAG_WORLD_SPACE_VERTICES;
+		packVertices(subMeshes[i], nullptr, 0, subMeshes[i].vertices.size(), &m_rtHostScene.vertices[shape.startVertex]);
+
+		// Uploaded with the next update
+		m_dirtyShapes.push_back(shapeId);
+		m_dirtyVertexRanges.emplace_back(shape.startVertex, static_cast<uint32_t>(subMeshes[i].vertices.size()));
 	}
+}
 
-	if (requestIsectApiCommit)
-		m_intersectionApi->Commit();
+void RTScene::receive(const RTUberMaterialUpdatedEvent& event)
+{
+	auto uberMaterial = event.entity.getComponent<RTUberMaterialComponent>();
+	if (!uberMaterial || event.materialIdx >= uberMaterial->materialData.size())
+		return;
 
-	for (auto& l : m_sceneUpdateListeners)
-	{
-		l();
-	}
+	const auto& mat = uberMaterial->materialData[event.materialIdx];
+	if (mat.rtMaterialId < 0 || mat.rtMaterialId >= m_rtHostScene.materials.size())
+		return;
+
+	updateRTMaterial(m_rtHostScene.materials[mat.rtMaterialId], mat);
+	m_dirtyMaterials.push_back(static_cast<uint32_t>(mat.rtMaterialId));
 }
 
 int RTScene::setSceneArgs(RTKernel& kernel, int sceneArgsStart /*= 0*/)
 {
 	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.shapes);
 	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.indices);
-	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.positions);
-	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.uvs);
-	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.normals);
-	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.tangents);
-	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.binormals);
-	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.colors);
+	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.vertices);
 	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.textures);
 	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.textureData);
-	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.sobolMatrices);
+	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.textureFeedback);
+	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.samplerTables);
 	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.lights);
 	kernel.setArg(sceneArgsStart++, static_cast<int>(m_rtDeviceScene.lights.GetElementCount()));
+	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.lightAliasTable);
+	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.environmentMap);
+	kernel.setArg(sceneArgsStart++, m_rtHostScene.environmentLightIdx);
+	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.lightBVH);
+	kernel.setArg(sceneArgsStart++, m_rtHostScene.numInfiniteLights);
 	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.materials);
 	kernel.setArg(sceneArgsStart++, m_rtDeviceScene.camera);
 
+	if (m_useTextureImages)
+	{
+		for (auto& image : m_textureImages)
+			kernel.setArg(sceneArgsStart++, image);
+	}
+
 	return sceneArgsStart;
 }
 
@@ -200,19 +369,57 @@ void RTScene::commit()
 {
 	auto& settings = PathTracerSettings::INTERSECTION_API;
 
-	m_intersectionApi->SetOption("bvh.force2level", settings.bvh.force2Level);
-	m_intersectionApi->SetOption("bvh.forceflat", settings.bvh.forceFlat);
+	finishAsyncCommit(true);
+	applyIntersectionApiOptions(m_intersectionApi);
+	syncAttachedShapes(computeShapeActivity());
+	m_commitRequested = false;
+
+	bool commitFailed = false;
+
+	try
+	{
+		m_intersectionApi->Commit();
+	}
+	catch (const std::exception& e)
+	{
+		Screen::showMessageBox("RTScene: Critical Error. ",
+			"There was a critical error in RTScene. Please check the console for more info.");
+		LOG_ERROR(e.what());
+		commitFailed = true;
+	}
+	catch (const Calc::Exception& e)
+	{
+		Screen::showMessageBox("RTScene: Critical Error. ",
+			"There was a critical error in RTScene. Please check the console for more info.");
+		LOG_ERROR(e.what());
+		commitFailed = true;
+	}
+
+	if (commitFailed && settings.bvh.accelerationStructure == ERTAccelerationStructureType::HLBVH)
+	{
+		LOG("It is possible that the Radeon Rays hlbvh implemenation fails on some platforms. Switching to default BVH...");
+		settings.bvh.accelerationStructure.curItem = static_cast<int>(ERTAccelerationStructureType::BVH);
+		commit();
+	}
+}
+
+void RTScene::applyIntersectionApiOptions(RadeonRays::IntersectionApi* intersectionApi) const
+{
+	auto& settings = PathTracerSettings::INTERSECTION_API;
+
+	intersectionApi->SetOption("bvh.force2level", settings.bvh.force2Level);
+	intersectionApi->SetOption("bvh.forceflat", settings.bvh.forceFlat);
 
 	switch (settings.bvh.accelerationStructure.getEnumValue())
 	{
 	case ERTAccelerationStructureType::BVH:
-		m_intersectionApi->SetOption("acc.type", "bvh");
+		intersectionApi->SetOption("acc.type", "bvh");
 		break;
 	case ERTAccelerationStructureType::FatBVH:
-		m_intersectionApi->SetOption("acc.type", "fatbvh");
+		intersectionApi->SetOption("acc.type", "fatbvh");
 		break;
 	case ERTAccelerationStructureType::HLBVH:
-		m_intersectionApi->SetOption("acc.type", "hlbvh");
+		intersectionApi->SetOption("acc.type", "hlbvh");
 		break;
 	default:
 		break;
@@ -221,49 +428,312 @@ void RTScene::commit()
 	switch (settings.bvh.builder.getEnumValue())
 	{
 	case ERTBVHBuilderType::SAH:
-		m_intersectionApi->SetOption("bvh.builder", "sah");
+		intersectionApi->SetOption("bvh.builder", "sah");
 		break;
 	case ERTBVHBuilderType::Median:
-		m_intersectionApi->SetOption("bvh.builder", "median");
+		intersectionApi->SetOption("bvh.builder", "median");
 		break;
 	default:
 		break;
 	}
 
-	m_intersectionApi->SetOption("bvh.sah.traversal_cost", settings.bvh.traversalCost);
-	m_intersectionApi->SetOption("bvh.sah.num_bins", static_cast<float>(settings.bvh.numBins));
-	m_intersectionApi->SetOption("bvh.sah.use_splits", settings.bvh.useSplits);
-	m_intersectionApi->SetOption("bvh.sah.max_split_depth", static_cast<float>(settings.bvh.maxSplitDepth));
-	m_intersectionApi->SetOption("bvh.sah.min_overlap", settings.bvh.minOverlap);
-	m_intersectionApi->SetOption("bvh.sah.extra_node_budget", settings.bvh.extraNodeBudget);
+	intersectionApi->SetOption("bvh.sah.traversal_cost", settings.bvh.traversalCost);
+	intersectionApi->SetOption("bvh.sah.num_bins", static_cast<float>(settings.bvh.numBins));
+	intersectionApi->SetOption("bvh.sah.use_splits", settings.bvh.useSplits);
+	intersectionApi->SetOption("bvh.sah.max_split_depth", static_cast<float>(settings.bvh.maxSplitDepth));
+	intersectionApi->SetOption("bvh.sah.min_overlap", settings.bvh.minOverlap);
+	intersectionApi->SetOption("bvh.sah.extra_node_budget", settings.bvh.extraNodeBudget);
+}
 
-	bool commitFailed = false;
+std::vector<char> RTScene::computeShapeActivity() const
+{
+	std::vector<char> shapeActivity(m_intersectionShapes.size(), 0);
 
-	try
+	for (auto entity : m_attachedEntities)
 	{
-		m_intersectionApi->Commit();
+		auto shapeComponent = entity.getComponent<RTShapeComponent>();
+		if (!shapeComponent || !entity.isActive())
+			continue;
+
+		for (auto shape : shapeComponent->shapes)
+			shapeActivity[shape->GetId()] = 1;
 	}
-	catch (const std::exception& e)
+
+	return shapeActivity;
+}
+
+void RTScene::syncAttachedShapes(const std::vector<char>& shapeActivity)
+{
+	for (size_t i = 0; i < m_intersectionShapes.size(); ++i)
 	{
-		Screen::showMessageBox("RTScene: Critical Error. ",
-			"There was a critical error in RTScene. Please check the console for more info.");
-		LOG_ERROR(e.what());
-		commitFailed = true;
+		RTIntersectionShape& shape = m_intersectionShapes[i];
+		if (shape.isAttached == (shapeActivity[i] != 0))
+			continue;
+
+		if (shapeActivity[i])
+			m_intersectionApi->AttachShape(shape.shape);
+		else
+			m_intersectionApi->DetachShape(shape.shape);
+
+		shape.isAttached = shapeActivity[i] != 0;
 	}
-	catch (const Calc::Exception& e)
+}
+
+RadeonRays::Shape* RTScene::createIntersectionShape(RadeonRays::IntersectionApi* intersectionApi, int shapeId, const std::vector<RTIntersectionShape>& shapes,
+	const RTShape& hostShape, const std::vector<RadeonRays::float3>& positions, const std::vector<uint32_t>& indices)
+{
+	const RTIntersectionShape& shapeDesc = shapes[shapeId];
+	RadeonRays::Shape* shape = nullptr;
+
+	if (shapeDesc.baseShapeId == shapeId)
 	{
-		Screen::showMessageBox("RTScene: Critical Error. ",
-			"There was a critical error in RTScene. Please check the console for more info.");
-		LOG_ERROR(e.what());
-		commitFailed = true;
+		shape = intersectionApi->CreateMesh(&positions[hostShape.startVertex].x, static_cast<int>(shapeDesc.numVertices), sizeof(RadeonRays::float3),
+			reinterpret_cast<const int*>(&indices[hostShape.startIdx]), 0, nullptr, static_cast<int>(hostShape.numTriangles));
+	}
+	else
+	{
+		// The mesh has a smaller ID and was created before
+		shape = intersectionApi->CreateInstance(shapes[shapeDesc.baseShapeId].shape);
 	}
 
-	if (commitFailed && settings.bvh.accelerationStructure == ERTAccelerationStructureType::HLBVH)
+	shape->SetId(shapeId);
+	shape->SetTransform(hostShape.toWorldTransform, RadeonRays::inverse(hostShape.toWorldTransform));
+	return shape;
+}
+
+RadeonRays::IntersectionApi* RTScene::createBuildIntersectionApi()
+{
+	int slot = m_buildIntersectionApis[0] ? 1 : 0;
+	assert(!m_buildIntersectionApis[slot]);
+
+	CLWDevice* device = PlatformManager::getActiveDevice();
+	m_buildCommandQueues[slot] = CLWCommandQueue::Create(*device, m_clContext);
+	m_buildIntersectionApis[slot] = RadeonRays::CreateFromOpenClContext(m_clContext, device->GetID(), m_buildCommandQueues[slot]);
+	return m_buildIntersectionApis[slot];
+}
+
+void RTScene::commitAsync()
+{
+	if (!m_shadowIntersectionApi)
+		m_shadowIntersectionApi = createBuildIntersectionApi();
+
+	applyIntersectionApiOptions(m_shadowIntersectionApi);
+	m_commitRequested = false;
+	m_shapesMovedDuringBuild.clear();
+
+	// The worker only accesses the build and the shadow api. The shapes of the shadow api are reused:
+	// only the transforms of moved shapes and the geometry of shapes added since its last build are copied.
+	m_intersectionApiBuild = std::make_unique<RTIntersectionApiBuild>();
+	RTIntersectionApiBuild* build = m_intersectionApiBuild.get();
+	build->shapes.swap(m_shadowIntersectionShapes);
+	build->firstNewShape = build->shapes.size();
+	build->shapeActivity = computeShapeActivity();
+
+	for (uint32_t shapeId : m_shadowMovedShapes)
 	{
-		LOG("It is possible that the Radeon Rays hlbvh implemenation fails on some platforms. Switching to default BVH...");
-		settings.bvh.accelerationStructure.curItem = static_cast<int>(ERTAccelerationStructureType::BVH);
-		commit();
+		if (shapeId < build->firstNewShape)
+			build->movedShapes.emplace_back(shapeId, m_rtHostScene.shapes[shapeId].toWorldTransform);
+
+		m_isShadowShapeMoved[shapeId] = 0;
+	}
+
+	m_shadowMovedShapes.clear();
+
+	for (size_t i = build->firstNewShape; i < m_intersectionShapes.size(); ++i)
+	{
+		RTIntersectionShape shape = m_intersectionShapes[i];
+		shape.shape = nullptr;
+		shape.isAttached = false;
+		build->shapes.push_back(shape);
+
+		// The geometry of meshes is copied, the vertex and index offsets refer to the copy
+		RTShape hostShape = m_rtHostScene.shapes[i];
+		if (shape.baseShapeId == static_cast<int>(i))
+		{
+			auto positions = m_rtHostScene.positions.begin() + hostShape.startVertex;
+			auto indices = m_rtHostScene.indices.begin() + hostShape.startIdx;
+			hostShape.startVertex = static_cast<uint32_t>(build->positions.size());
+			hostShape.startIdx = static_cast<uint32_t>(build->indices.size());
+			build->positions.insert(build->positions.end(), positions, positions + shape.numVertices);
+			build->indices.insert(build->indices.end(), indices, indices + hostShape.numTriangles * 3);
+		}
+
+		build->newHostShapes.push_back(hostShape);
+	}
+
+	RadeonRays::IntersectionApi* intersectionApi = m_shadowIntersectionApi;
+	m_intersectionApiBuildFuture = std::async(std::launch::async, [intersectionApi, build]()
+	{
+		try
+		{
+			for (auto& movedShape : build->movedShapes)
+				build->shapes[movedShape.first].shape->SetTransform(movedShape.second, RadeonRays::inverse(movedShape.second));
+
+			for (int i = 0; i < static_cast<int>(build->shapes.size()); ++i)
+			{
+				RTIntersectionShape& shape = build->shapes[i];
+				if (!shape.shape)
+				{
+					shape.shape = createIntersectionShape(intersectionApi, i, build->shapes, build->newHostShapes[i - build->firstNewShape],
+						build->positions, build->indices);
+				}
+
+				bool isActive = build->shapeActivity[i] != 0;
+				if (shape.isAttached == isActive)
+					continue;
+
+				if (isActive)
+					intersectionApi->AttachShape(shape.shape);
+				else
+					intersectionApi->DetachShape(shape.shape);
+
+				shape.isAttached = isActive;
+			}
+
+			intersectionApi->Commit();
+		}
+		catch (const std::exception& e)
+		{
+			build->error = e.what();
+		}
+		catch (const Calc::Exception& e)
+		{
+			build->error = e.what();
+		}
+		catch (...)
+		{
+			build->error = "Unknown error.";
+		}
+	});
+}
+
+void RTScene::markShadowShapeMoved(uint32_t shapeId)
+{
+	if (shapeId >= m_isShadowShapeMoved.size())
+		m_isShadowShapeMoved.resize(std::max(m_intersectionShapes.size(), size_t(shapeId) + 1), 0);
+
+	if (m_isShadowShapeMoved[shapeId])
+		return;
+
+	m_isShadowShapeMoved[shapeId] = 1;
+	m_shadowMovedShapes.push_back(shapeId);
+}
+
+void RTScene::clearShadowShapesMoved()
+{
+	for (uint32_t shapeId : m_shadowMovedShapes)
+		m_isShadowShapeMoved[shapeId] = 0;
+
+	m_shadowMovedShapes.clear();
+}
+
+void RTScene::finishAsyncCommit(bool wait)
+{
+	if (!m_intersectionApiBuild)
+		return;
+
+	if (!wait && m_intersectionApiBuildFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
+
+	m_intersectionApiBuildFuture.get();
+	std::unique_ptr<RTIntersectionApiBuild> build = std::move(m_intersectionApiBuild);
+
+	if (!build->error.empty())
+	{
+		LOG_ERROR("RTScene: The asynchronous build of the acceleration structure failed: " << build->error);
+
+		// The shapes are created in order, the created shapes are kept in the shadow api
+		auto firstMissingShape = std::find_if(build->shapes.begin(), build->shapes.end(),
+			[](const RTIntersectionShape& shape) { return shape.shape == nullptr; });
+		build->shapes.erase(firstMissingShape, build->shapes.end());
+		m_shadowIntersectionShapes = std::move(build->shapes);
+
+		// The worker might not have set the transforms
+		for (auto& movedShape : build->movedShapes)
+			markShadowShapeMoved(movedShape.first);
+
+		// Like commit: the changes of the snapshot are retried once with the default BVH, other errors are reported
+		auto& settings = PathTracerSettings::INTERSECTION_API;
+		if (settings.bvh.accelerationStructure == ERTAccelerationStructureType::HLBVH)
+		{
+			LOG("It is possible that the Radeon Rays hlbvh implemenation fails on some platforms. Switching to default BVH...");
+			settings.bvh.accelerationStructure.curItem = static_cast<int>(ERTAccelerationStructureType::BVH);
+			requestCommit();
+		}
+		else
+		{
+			Screen::showMessageBox("RTScene: Critical Error. ",
+				"There was a critical error in RTScene. Please check the console for more info.");
+		}
+
+		return;
+	}
+
+	RadeonRays::IntersectionApi* prevIntersectionApi = m_intersectionApi;
+	bool isPrevBuildApi = prevIntersectionApi == m_buildIntersectionApis[0] || prevIntersectionApi == m_buildIntersectionApis[1];
+
+	// Shapes attached since the snapshot are created in the new api and attached with the next build
+	std::vector<RTIntersectionShape> shapes = std::move(build->shapes);
+	for (size_t i = shapes.size(); i < m_intersectionShapes.size(); ++i)
+	{
+		shapes.push_back(m_intersectionShapes[i]);
+		shapes[i].isAttached = false;
+		shapes[i].shape = createIntersectionShape(m_shadowIntersectionApi, static_cast<int>(i), shapes, m_rtHostScene.shapes[i],
+			m_rtHostScene.positions, m_rtHostScene.indices);
+	}
+
+	// The transforms of the previous api are up to date, its shapes are reused by the next build
+	clearShadowShapesMoved();
+
+	// The api of the application runs on the command queue of the frame kernels and is retired,
+	// its shapes are deleted once the components refer to the new shapes
+	std::vector<RTIntersectionShape> retiredShapes;
+	if (isPrevBuildApi)
+		m_shadowIntersectionShapes = std::move(m_intersectionShapes);
+	else
+		retiredShapes = std::move(m_intersectionShapes);
+
+	// The apis share the OpenCL context and stay alive, the buffers the passes created with the previous api remain valid.
+	// The passes synchronize the queue of the kernels before querying, the active api may run on any queue.
+	m_intersectionApi = m_shadowIntersectionApi;
+	m_shadowIntersectionApi = isPrevBuildApi ? prevIntersectionApi : nullptr;
+	g_isectApi = m_intersectionApi;
+	m_intersectionShapes = std::move(shapes);
+
+	for (auto entity : m_attachedEntities)
+	{
+		auto shapeComponent = entity.getComponent<RTShapeComponent>();
+		if (!shapeComponent)
+			continue;
+
+		for (auto& shape : shapeComponent->shapes)
+			shape = m_intersectionShapes[shape->GetId()].shape;
+	}
+
+	for (auto& pair : m_subMeshToShapeMap)
+		pair.second.instanceTemplateShape = m_intersectionShapes[pair.second.instanceTemplateShape->GetId()].shape;
+
+	if (retiredShapes.size() > 0)
+	{
+		prevIntersectionApi->DetachAll();
+		for (auto& shape : retiredShapes)
+			prevIntersectionApi->DeleteShape(shape.shape);
+	}
+
+	// Shapes moved during the build have stale transforms
+	if (m_shapesMovedDuringBuild.size() > 0)
+	{
+		for (uint32_t shapeId : m_shapesMovedDuringBuild)
+		{
+			const RadeonRays::matrix& toWorldTransform = m_rtHostScene.shapes[shapeId].toWorldTransform;
+			m_intersectionShapes[shapeId].shape->SetTransform(toWorldTransform, RadeonRays::inverse(toWorldTransform));
+		}
+
+		m_shapesMovedDuringBuild.clear();
+		m_intersectionApi->Commit();
 	}
+
+	m_updated = true;
 }
 
 void RTScene::refresh()
@@ -271,10 +741,11 @@ void RTScene::refresh()
 	if (ResourceManager::isLoading())
 		return;
 
-	uploadTextures();
+	uploadTextures(true);
 
 	attachStaticEntities();
 	attachDynamicEntities();
+	convertAttachedMeshes();
 	addLights();
 
 	for (auto& pair : m_glMaterialToRTMaterialIdMap)
@@ -320,8 +791,13 @@ void RTScene::updateDynamicEntities()
 	assert(hostScene);
 	bool updatedLights = false;
 
+	// Choice pdfs and alias tables of all lights depend on the light powers
+	bool updatedLightPowers = false;
+
 	if (hostScene->getUpdatedEntities().size() > 0)
 	{
+		bool movedShapes = false;
+
 		for (auto entity : hostScene->getUpdatedEntities())
 		{
 			auto shapeComponent = entity.getComponent<RTShapeComponent>();
@@ -336,7 +812,15 @@ void RTScene::updateDynamicEntities()
 					m_rtHostScene.shapes[shape->GetId()].toWorldTransform = CLHelper::toMatrix(transform->getLocalToWorldMatrix());
 					m_rtHostScene.shapes[shape->GetId()].toWorldInverseTranspose = 
 						CLHelper::toMatrix(glm::transpose(glm::inverse(transform->getLocalToWorldMatrix())));
-				}
+					m_rtHostScene.shapes[shape->GetId()].area = computeShapeArea(m_rtHostScene.shapes[shape->GetId()]);
+					m_dirtyShapes.push_back(static_cast<uint32_t>(shape->GetId()));
+					movedShapes = true;
+
+					if (m_intersectionApiBuild)
+						m_shapesMovedDuringBuild.push_back(static_cast<uint32_t>(shape->GetId()));
+
+					markShadowShapeMoved(static_cast<uint32_t>(shape->GetId()));
+				}
 			}
 
 			auto lightComp = entity.getComponent<RTLightComponent>();
@@ -347,45 +831,70 @@ void RTScene::updateDynamicEntities()
 					if (p.second >= 0)
 					{
 						updatedLights = true;
-						setLight(entity, m_rtHostScene.lights[p.second], p.second, p.first);
+						RTLight& light = m_rtHostScene.lights[p.second];
+						float power = computeLightPower(light);
+						setLight(entity, light, p.second, p.first);
+						m_dirtyLights.push_back(static_cast<uint32_t>(p.second));
+						updatedLightPowers |= hasChangedTriangleAreas(light) || hasChangedLightPower(light, power);
 					}
 				}
+
+				for (auto& p : lightComp->emissiveLightIndexMap)
+				{
+					updatedLights = true;
+					RTLight& light = m_rtHostScene.lights[p.second];
+					float power = computeLightPower(light);
+					setEmissiveMeshLight(entity, light, p.second, p.first);
+					m_dirtyLights.push_back(static_cast<uint32_t>(p.second));
+					updatedLightPowers |= hasChangedTriangleAreas(light) || hasChangedLightPower(light, power);
+				}
 			}
 		}
 
-		auto writeEvt = m_clContext.WriteBuffer(0, m_rtDeviceScene.shapes, m_rtHostScene.shapes.data(), m_rtHostScene.shapes.size());
-		writeEvt.Wait();
+		// Only transforms changed: with bvh.force2level Radeon Rays keeps the bottom level BVHs and only rebuilds the top level
+		uploadDirtyShapes();
 
-		m_intersectionApi->Commit();
+		if (movedShapes)
+			m_intersectionApi->Commit();
 
 		if (updatedLights)
 		{
-			writeEvt = m_clContext.WriteBuffer(0, m_rtDeviceScene.lights, m_rtHostScene.lights.data(), m_rtHostScene.lights.size());
+			if (updatedLightPowers)
+			{
+				computeChoicePdfsForLights();
+				m_dirtyLights.clear();
+
+				auto writeEvt = m_clContext.WriteBuffer(0, m_rtDeviceScene.lights, m_rtHostScene.lights.data(), m_rtHostScene.lights.size());
+				writeEvt.Wait();
+				writeEvt = m_clContext.WriteBuffer(0, m_rtDeviceScene.lightAliasTable, m_rtHostScene.lightAliasTable.data(), m_rtHostScene.lightAliasTable.size());
+				writeEvt.Wait();
+			}
+			else
+			{
+				RTBufferManager::writeDirtyRanges(m_rtDeviceScene.lights, m_rtHostScene.lights, m_dirtyLights);
+			}
+
+			// The bounds of the moved lights changed
+			buildLightBVH();
+
+			auto writeEvt = m_clContext.WriteBuffer(0, m_rtDeviceScene.lightBVH, m_rtHostScene.lightBVH.data(), m_rtHostScene.lightBVH.size());
 			writeEvt.Wait();
 		}
 		
 		m_updated = true;
 	}
 
-	bool updatedMaterials = false;
-	for (auto entity : ECS::getEntitiesWithComponents<RTUberMaterialComponent>())
+	// Shapes and vertices changed without a transform update, e.g. in receive(TransformStaticStatusChangedEvent)
+	if (m_dirtyShapes.size() > 0 || m_dirtyVertexRanges.size() > 0)
 	{
-		auto uberMaterial = entity.getComponent<RTUberMaterialComponent>();
-		for (auto& mat : uberMaterial->materialData)
-		{
-			if (mat.updated)
-			{
-				updateRTMaterial(m_rtHostScene.materials[mat.rtMaterialId], mat);
-				mat.updated = false;
-				updatedMaterials = true;
-			}
-		}
+		uploadDirtyShapes();
+		m_updated = true;
 	}
 
-	if (updatedMaterials)
+	// Edited materials are collected in receive(RTUberMaterialUpdatedEvent)
+	if (m_dirtyMaterials.size() > 0)
 	{
-		auto writeEvt = m_clContext.WriteBuffer(0, m_rtDeviceScene.materials, m_rtHostScene.materials.data(), m_rtHostScene.materials.size());
-		writeEvt.Wait();
+		RTBufferManager::writeDirtyRanges(m_rtDeviceScene.materials, m_rtHostScene.materials, m_dirtyMaterials);
 		m_updated = true;
 	}
 }
@@ -412,14 +921,13 @@ void RTScene::attachEntity(Entity entity)
 void RTScene::addLights()
 {
 	m_rtHostScene.lights.clear();
+	m_rtHostScene.environmentLightIdx = RT_INVALID_ID;
 
 	for (auto entity : ECS::getEntitiesWithComponents<Transform>())
 	{
 		if (entity.isActive())
 			addLight(entity);
 	}
-
-	computeChoicePdfsForLights();
 }
 
 void RTScene::addLight(Entity entity)
@@ -428,6 +936,7 @@ void RTScene::addLight(Entity entity)
 	auto pointLight = entity.getComponent<PointLight>();
 	auto diskAreaLight = entity.getComponent<DiskAreaLight>();
 	auto triMeshAreaLight = entity.getComponent<TriangleMeshAreaLight>();
+	auto envLight = entity.getComponent<EnvironmentLight>();
 	auto transform = entity.getComponent<Transform>();
 
 	if (dirLight)
@@ -473,6 +982,40 @@ void RTScene::addLight(Entity entity)
 		m_rtHostScene.lights.push_back(light);
 		rtLightComp->hostLightIndexMap[RT_TRIANGLE_MESH_AREA_LIGHT] = static_cast<int>(m_rtHostScene.lights.size() - 1);
 	}
+
+	// Only one environment light is supported
+	if (envLight && m_rtHostScene.environmentLightIdx == RT_INVALID_ID && loadEnvironmentMap(envLight->filePath))
+	{
+		if (!entity.getComponent<RTLightComponent>())
+			entity.addComponent<RTLightComponent>();
+		auto rtLightComp = entity.getComponent<RTLightComponent>();
+		RTLight light;
+		setLight(entity, light, static_cast<int>(m_rtHostScene.lights.size()), RT_ENVIRONMENT_LIGHT);
+		m_rtHostScene.lights.push_back(light);
+		m_rtHostScene.environmentLightIdx = static_cast<int>(m_rtHostScene.lights.size() - 1);
+		rtLightComp->hostLightIndexMap[RT_ENVIRONMENT_LIGHT] = m_rtHostScene.environmentLightIdx;
+	}
+
+	auto rtLightComp = entity.getComponent<RTLightComponent>();
+	if (rtLightComp)
+	{
+		rtLightComp->emissiveLightIndexMap.clear();
+
+		for (int subMeshIdx : rtLightComp->emissiveSubMeshes)
+		{
+			// An explicit triangle mesh area light takes precedence over the material emission
+			if (triMeshAreaLight && triMeshAreaLight->meshIdx == subMeshIdx)
+				continue;
+
+			RTLight light;
+			int lightID = static_cast<int>(m_rtHostScene.lights.size());
+			if (setEmissiveMeshLight(entity, light, lightID, subMeshIdx))
+			{
+				m_rtHostScene.lights.push_back(light);
+				rtLightComp->emissiveLightIndexMap[subMeshIdx] = lightID;
+			}
+		}
+	}
 }
 
 void RTScene::setLight(Entity entity, RTLight& light, int lightID, RTLightType type)
@@ -522,7 +1065,7 @@ void RTScene::setLight(Entity entity, RTLight& light, int lightID, RTLightType t
 		{
 			int shapeId = rtShapeComponent->shapes[0]->GetId();
 			light.shapeId = shapeId;
-			m_rtHostScene.shapes[shapeId].lightID = lightID;
+			setShapeLightID(shapeId, lightID);
 		}
 		break;
 	}
@@ -541,17 +1084,78 @@ void RTScene::setLight(Entity entity, RTLight& light, int lightID, RTLightType t
 		light.p = CLHelper::toFloat3(transform->getPosition());
 		int shapeId = rtShapeComponent->shapes[areaLight->meshIdx]->GetId();
 		light.shapeId = shapeId;
-		m_rtHostScene.shapes[shapeId].lightID = lightID;
-		light.area = meshRenderer->computeSurfaceArea(areaLight->meshIdx);
+		setShapeLightID(shapeId, lightID);
+		light.area = computeShapeArea(m_rtHostScene.shapes[shapeId]);
 		glm::vec3 I = areaLight->color * areaLight->intensity;
 		light.intensity = CLHelper::toFloat3(I);
 		break;
 	}
+	case RT_ENVIRONMENT_LIGHT:
+	{
+		auto envLight = entity.getComponent<EnvironmentLight>();
+		light.type = RT_ENVIRONMENT_LIGHT;
+		light.flags = RT_LIGHT_FLAG_INFINITE;
+		glm::vec3 I = envLight->color * envLight->intensity;
+		light.intensity = CLHelper::toFloat3(I);
+		light.radius = glm::length(m_sceneBBox.max() - m_sceneBBox.min()) * 0.5f;
+		light.p = CLHelper::toFloat3(m_sceneBBox.center());
+		light.area = math::PI * light.radius * light.radius;
+		light.envMapWidth = m_rtHostScene.environmentMapWidth;
+		light.envMapHeight = m_rtHostScene.environmentMapHeight;
+		break;
+	}
 	default:
 		break;
 	}
 }
 
+void RTScene::setShapeLightID(int shapeId, int lightID)
+{
+	RTShape& shape = m_rtHostScene.shapes[shapeId];
+	if (shape.lightID == lightID)
+		return;
+
+	shape.lightID = lightID;
+	m_dirtyShapes.push_back(static_cast<uint32_t>(shapeId));
+}
+
+bool RTScene::setEmissiveMeshLight(Entity entity, RTLight& light, int lightID, int subMeshIdx)
+{
+	auto transform = entity.getComponent<Transform>();
+	auto rtShapeComponent = entity.getComponent<RTShapeComponent>();
+	auto meshRenderer = entity.getComponent<MeshRenderer>();
+
+	if (!rtShapeComponent || !meshRenderer || subMeshIdx < 0 || subMeshIdx >= rtShapeComponent->shapes.size() ||
+		subMeshIdx >= meshRenderer->getMesh()->getSubMeshes().size())
+		return false;
+
+	int shapeId = rtShapeComponent->shapes[subMeshIdx]->GetId();
+	glm::vec3 emission;
+	if (!tryGetEmission(meshRenderer->getMaterial(subMeshIdx).get(), emission))
+	{
+		// Emission might have been removed in the editor
+		setShapeLightID(shapeId, RT_INVALID_ID);
+		return false;
+	}
+
+	light.type = RT_TRIANGLE_MESH_AREA_LIGHT;
+	light.flags = RT_LIGHT_FLAG_AREA;
+	light.p = CLHelper::toFloat3(transform->getPosition());
+	light.shapeId = shapeId;
+	setShapeLightID(shapeId, lightID);
+	light.area = computeShapeArea(m_rtHostScene.shapes[shapeId]);
+	light.intensity = CLHelper::toFloat3(emission);
+	return true;
+}
+
+bool RTScene::tryGetEmission(const Material* material, glm::vec3& outEmission) const
+{
+	if (!material || !material->tryGetColor3(NC::emissionColor(), outEmission))
+		return false;
+
+	return outEmission.x > 0.0f || outEmission.y > 0.0f || outEmission.z > 0.0f;
+}
+
 bool RTScene::hasLight(Entity entity)
 {
 	auto dirLight = entity.getComponent<DirectionalLight>();
@@ -567,220 +1171,576 @@ void RTScene::attachMesh(ComponentPtr<MeshRenderer> meshRenderer, RTHostScene& r
 
 	auto mesh = meshRenderer->getMesh();
 	auto transform = meshRenderer->getComponent<Transform>();
-	auto rtShapeComponent = meshRenderer->getComponent<RTShapeComponent>();
-	auto sharedShapesInfoItr = m_meshToShapesMap.find(mesh);
 
 	m_sceneBBox.unite(transform->getBBox());
 
-	if (sharedShapesInfoItr != m_meshToShapesMap.end())
+	// Emissive submeshes are registered as triangle mesh area lights to be used for next event estimation.
+	// The per triangle power follows from the area weighted triangle alias tables built in uploadLights.
+	std::vector<int> emissiveSubMeshes;
+	for (int meshIdx = 0; meshIdx < mesh->getSubMeshes().size(); ++meshIdx)
 	{
-		for (RTScene::SharedShapeInfo& sharedShapeInfo : sharedShapesInfoItr->second)
-		{
-			auto shapeInst = m_intersectionApi->CreateInstance(sharedShapeInfo.instanceTemplateShape);
-	
-			rtHostScene.shapes.emplace_back(RTShape());
-			auto& rtShape = rtHostScene.shapes[rtHostScene.shapes.size() - 1];
-			rtShape.startIdx = sharedShapeInfo.startIdx;
-			rtShape.startVertex = sharedShapeInfo.startVertex;
-			rtShape.toWorldTransform = CLHelper::toMatrix(transform->getLocalToWorldMatrix());
-			rtShape.toWorldInverseTranspose =
-				CLHelper::toMatrix(glm::transpose(glm::inverse(transform->getLocalToWorldMatrix())));
-			rtShape.numTriangles = sharedShapeInfo.numTriangles;
-			rtShape.materialId = sharedShapeInfo.materialId;
-			rtShape.area = meshRenderer->computeSurfaceArea(sharedShapeInfo.meshIdx);
-			m_intersectionApi->AttachShape(shapeInst);
-			shapeInst->SetId(rtHostScene.nextShapeId++);
-			shapeInst->SetTransform(CLHelper::toMatrix(transform->getLocalToWorldMatrix()), 
-				                    CLHelper::toMatrix(transform->getWorldToLocalMatrix()));
-			rtShapeComponent->shapes.push_back(shapeInst);
-		}
-	
-		return;
+		glm::vec3 emission;
+		if (tryGetEmission(meshRenderer->getMaterial(meshIdx).get(), emission))
+			emissiveSubMeshes.push_back(meshIdx);
+	}
+
+	if (emissiveSubMeshes.size() > 0)
+	{
+		if (!meshRenderer->getComponent<RTLightComponent>())
+			meshRenderer->addComponent<RTLightComponent>();
+
+		meshRenderer->getComponent<RTLightComponent>()->emissiveSubMeshes = emissiveSubMeshes;
 	}
 
-	std::vector<SharedShapeInfo> shapeInfos;
+	// Submeshes with the content of an attached submesh (of any mesh) are instances of its shape
 	for (int meshIdx = 0; meshIdx < mesh->getSubMeshes().size(); ++meshIdx)
 	{
-		auto& subMesh = mesh->getSubMeshes()[meshIdx];
-		auto material = meshRenderer->getMaterial(meshIdx);
-		SharedShapeInfo sharedShapeInfo;
+		SharedShapeInfo* sharedShapeInfo = findSharedShapeInfo(mesh, meshIdx);
 
-		auto rtMaterialIdIter = m_glMaterialToRTMaterialIdMap.find(material);
-		if (rtMaterialIdIter != m_glMaterialToRTMaterialIdMap.end())
-		{
-			sharedShapeInfo.materialId = rtMaterialIdIter->second;
-		}
+		if (sharedShapeInfo)
+			attachSubMeshInstance(meshRenderer, meshIdx, *sharedShapeInfo, rtHostScene);
 		else
-		{
-			int materialId = static_cast<int>(rtHostScene.materials.size());
-			rtHostScene.materials.push_back(createUberMaterial(meshRenderer, material.get(), materialId));
-			m_glMaterialToRTMaterialIdMap[material] = materialId;
-			sharedShapeInfo.materialId = materialId;
-		}
+			attachSubMesh(meshRenderer, meshIdx, rtHostScene);
+	}
 
-		sharedShapeInfo.startIdx = rtHostScene.nextIndexStart;
-		sharedShapeInfo.startVertex = rtHostScene.nextVertexStart;
-		sharedShapeInfo.numTriangles = static_cast<uint32_t>(subMesh.indices.size() / 3);
-		sharedShapeInfo.meshIdx = meshIdx;
+	// Shapes are attached by the next commit
+	requestCommit();
+}
 
-		rtHostScene.shapes.emplace_back(RTShape());
-		auto& rtShape = rtHostScene.shapes[rtHostScene.shapes.size() - 1];
-		rtShape.startIdx = sharedShapeInfo.startIdx;
-		rtShape.startVertex = sharedShapeInfo.startVertex;
-		rtShape.toWorldTransform = CLHelper::toMatrix(transform->getLocalToWorldMatrix());
-		rtShape.toWorldInverseTranspose =
-			CLHelper::toMatrix(glm::transpose(glm::inverse(transform->getLocalToWorldMatrix())));
-		rtShape.numTriangles = sharedShapeInfo.numTriangles;
-		rtHostScene.nextIndexStart += static_cast<uint32_t>(subMesh.indices.size());
-		rtHostScene.nextVertexStart += static_cast<uint32_t>(subMesh.vertices.size());
-		rtShape.materialId = sharedShapeInfo.materialId;
-		rtShape.area = meshRenderer->computeSurfaceArea(meshIdx);
+RTScene::SharedShapeInfo* RTScene::findSharedShapeInfo(const std::shared_ptr<Mesh>& mesh, int meshIdx)
+{
+	const Mesh::SubMesh& subMesh = mesh->getSubMeshes()[meshIdx];
+	auto range = m_subMeshToShapeMap.equal_range(mesh->getContentHash(meshIdx));
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		SharedShapeInfo& sharedShapeInfo = it->second;
+		if ((sharedShapeInfo.mesh == mesh && sharedShapeInfo.meshIdx == meshIdx) ||
+			Mesh::hasEqualContent(sharedShapeInfo.mesh->getSubMeshes()[sharedShapeInfo.meshIdx], subMesh))
+			return &sharedShapeInfo;
+	}
 
-		rtHostScene.indices.insert(rtHostScene.indices.end(), subMesh.indices.begin(), subMesh.indices.end());
+	return nullptr;
+}
 
-		for (size_t i = 0; i < subMesh.vertices.size(); ++i)
-		{
-			rtHostScene.positions.push_back(CLHelper::toFloat3(subMesh.vertices[i]));
-			rtHostScene.uvs.push_back(CLHelper::toFloat2(subMesh.uvs[i]));
-			rtHostScene.normals.push_back(CLHelper::toFloat3(subMesh.normals[i]));
-			rtHostScene.tangents.push_back(CLHelper::toFloat3(subMesh.tangents[i]));
-			rtHostScene.binormals.push_back(CLHelper::toFloat3(subMesh.bitangents[i]));
-		}
+void RTScene::attachSubMeshInstance(ComponentPtr<MeshRenderer> meshRenderer, int meshIdx, SharedShapeInfo& sharedShapeInfo, RTHostScene& rtHostScene)
+{
+	auto transform = meshRenderer->getComponent<Transform>();
+	auto rtShapeComponent = meshRenderer->getComponent<RTShapeComponent>();
+
+	// The vertices of the template shape are baked to world space, instances share an object space copy
+	if (sharedShapeInfo.hasWorldSpaceVertices)
+	{
+		sharedShapeInfo.startVertex = appendVertices(sharedShapeInfo.mesh->getSubMeshes()[sharedShapeInfo.meshIdx], nullptr);
+		sharedShapeInfo.hasWorldSpaceVertices = false;
+	}
 
-		if (subMesh.colors.size() == 0)
+	auto shapeInst = m_intersectionApi->CreateInstance(sharedShapeInfo.instanceTemplateShape);
+
+	rtHostScene.shapes.emplace_back(RTShape());
+	auto& rtShape = rtHostScene.shapes[rtHostScene.shapes.size() - 1];
+	rtShape.startIdx = sharedShapeInfo.startIdx;
+	rtShape.startVertex = sharedShapeInfo.startVertex;
+	rtShape.toWorldTransform = CLHelper::toMatrix(transform->getLocalToWorldMatrix());
+	rtShape.toWorldInverseTranspose =
+		CLHelper::toMatrix(glm::transpose(glm::inverse(transform->getLocalToWorldMatrix())));
+	rtShape.numTriangles = sharedShapeInfo.numTriangles;
+	// Submeshes are shared by content across meshes, the material is the one of the instance
+	rtShape.materialId = getRTMaterialId(meshRenderer, meshIdx, rtHostScene);
+	m_shapesWithoutArea.push_back(static_cast<uint32_t>(rtHostScene.nextShapeId));
+	shapeInst->SetId(rtHostScene.nextShapeId++);
+	shapeInst->SetTransform(CLHelper::toMatrix(transform->getLocalToWorldMatrix()), 
+		                    CLHelper::toMatrix(transform->getWorldToLocalMatrix()));
+	rtShapeComponent->shapes.push_back(shapeInst);
+
+	RTIntersectionShape intersectionShape;
+	intersectionShape.shape = shapeInst;
+	intersectionShape.baseShapeId = sharedShapeInfo.instanceTemplateShape->GetId();
+	m_intersectionShapes.push_back(intersectionShape);
+}
+
+void RTScene::attachSubMesh(ComponentPtr<MeshRenderer> meshRenderer, int meshIdx, RTHostScene& rtHostScene)
+{
+	auto mesh = meshRenderer->getMesh();
+	auto transform = meshRenderer->getComponent<Transform>();
+	auto rtShapeComponent = meshRenderer->getComponent<RTShapeComponent>();
+	auto& subMesh = mesh->getSubMeshes()[meshIdx];
+
+	SharedShapeInfo sharedShapeInfo;
+	sharedShapeInfo.mesh = mesh;
+	sharedShapeInfo.materialId = getRTMaterialId(meshRenderer, meshIdx, rtHostScene);
+
+	// Static meshes skip the transformation of their vertices in the kernels until they are instanced
+	glm::mat4 toWorld = transform->getLocalToWorldMatrix();
+	sharedShapeInfo.hasWorldSpaceVertices = PathTracerSettings::GI.bakeStaticVertices && transform->isStatic();
+
+	sharedShapeInfo.startIdx = rtHostScene.nextIndexStart;
+	sharedShapeInfo.startVertex = appendVertices(subMesh, sharedShapeInfo.hasWorldSpaceVertices ? &toWorld : nullptr);
+	sharedShapeInfo.numTriangles = static_cast<uint32_t>(subMesh.indices.size() / 3);
+	sharedShapeInfo.meshIdx = meshIdx;
+
+	rtHostScene.shapes.emplace_back(RTShape());
+	auto& rtShape = rtHostScene.shapes[rtHostScene.shapes.size() - 1];
+	rtShape.startIdx = sharedShapeInfo.startIdx;
+	rtShape.startVertex = sharedShapeInfo.startVertex;
+	rtShape.toWorldTransform = CLHelper::toMatrix(transform->getLocalToWorldMatrix());
+	rtShape.toWorldInverseTranspose =
+		CLHelper::toMatrix(glm::transpose(glm::inverse(transform->getLocalToWorldMatrix())));
+	rtShape.numTriangles = sharedShapeInfo.numTriangles;
+	rtShape.materialId = sharedShapeInfo.materialId;
+
+	if (sharedShapeInfo.hasWorldSpaceVertices)
+		rtShape.flags |= RT_SHAPE_FLAG_WORLD_SPACE_VERTICES;
+
+	appendIndices(subMesh);
+	m_shapesWithoutArea.push_back(static_cast<uint32_t>(rtHostScene.nextShapeId));
+	
+	RadeonRays::Shape* shape = m_intersectionApi->CreateMesh(&subMesh.vertices[0].x,
+		static_cast<int>(subMesh.vertices.size()), sizeof(glm::vec3), reinterpret_cast<const int*>(subMesh.indices.data()),
+		0, nullptr, static_cast<int>(subMesh.indices.size()) / 3);
+
+	assert(shape != nullptr);
+
+	sharedShapeInfo.instanceTemplateShape = shape;
+
+	RTIntersectionShape intersectionShape;
+	intersectionShape.shape = shape;
+	intersectionShape.baseShapeId = rtHostScene.nextShapeId;
+	intersectionShape.numVertices = static_cast<uint32_t>(subMesh.vertices.size());
+	m_intersectionShapes.push_back(intersectionShape);
+
+	shape->SetId(rtHostScene.nextShapeId++);
+	shape->SetTransform(CLHelper::toMatrix(transform->getLocalToWorldMatrix()),
+					    CLHelper::toMatrix(transform->getWorldToLocalMatrix()));
+
+	m_subMeshToShapeMap.emplace(mesh->getContentHash(meshIdx), sharedShapeInfo);
+
+	rtShapeComponent->shapes.push_back(shape);
+}
+
+uint32_t RTScene::appendVertices(const Mesh::SubMesh& subMesh, const glm::mat4* toWorld)
+{
+	uint32_t startVertex = m_rtHostScene.nextVertexStart;
+	m_rtHostScene.nextVertexStart += static_cast<uint32_t>(subMesh.vertices.size());
+	m_rtHostScene.positions.resize(m_rtHostScene.nextVertexStart);
+	m_rtHostScene.vertices.resize(m_rtHostScene.nextVertexStart);
+
+	RTMeshConversion conversion;
+	conversion.subMesh = &subMesh;
+	conversion.dstOffset = startVertex;
+	conversion.toWorldSpace = toWorld != nullptr;
+	if (toWorld)
+		conversion.toWorld = *toWorld;
+
+	for (size_t first = 0; first < subMesh.vertices.size(); first += RT_MESH_CONVERSION_BATCH_SIZE)
+	{
+		conversion.first = first;
+		conversion.count = std::min(subMesh.vertices.size() - first, size_t(RT_MESH_CONVERSION_BATCH_SIZE));
+		m_meshConversions.push_back(conversion);
+	}
+
+	return startVertex;
+}
+
+void RTScene::appendIndices(const Mesh::SubMesh& subMesh)
+{
+	uint32_t startIdx = m_rtHostScene.nextIndexStart;
+	m_rtHostScene.nextIndexStart += static_cast<uint32_t>(subMesh.indices.size());
+	m_rtHostScene.indices.resize(m_rtHostScene.nextIndexStart);
+
+	RTMeshConversion conversion;
+	conversion.subMesh = &subMesh;
+	conversion.dstOffset = startIdx;
+	conversion.areas = &m_subMeshAreas[startIdx];
+	conversion.areas->triangleAreas.resize(subMesh.indices.size() / 3);
+
+	for (size_t first = 0; first < conversion.areas->triangleAreas.size(); first += RT_MESH_CONVERSION_BATCH_SIZE)
+	{
+		conversion.first = first;
+		conversion.count = std::min(conversion.areas->triangleAreas.size() - first, size_t(RT_MESH_CONVERSION_BATCH_SIZE));
+		m_meshConversions.push_back(conversion);
+	}
+}
+
+void RTScene::convertAttachedMeshes()
+{
+	auto convert = [this](const RTMeshConversion& conversion)
+	{
+		const Mesh::SubMesh& subMesh = *conversion.subMesh;
+
+		if (conversion.areas)
 		{
-			glm::vec3 randColor = Random::getVec3(0.5f, 1.0f);
-			for (size_t i = 0; i < subMesh.vertices.size(); ++i)
+			std::copy(subMesh.indices.begin() + 3 * conversion.first, subMesh.indices.begin() + 3 * (conversion.first + conversion.count),
+				m_rtHostScene.indices.begin() + conversion.dstOffset + 3 * conversion.first);
+
+			for (size_t t = conversion.first; t < conversion.first + conversion.count; ++t)
 			{
-				rtHostScene.colors.push_back(CLHelper::toFloat3(randColor));
+				const glm::vec3& p0 = subMesh.vertices[subMesh.indices[3 * t]];
+				const glm::vec3& p1 = subMesh.vertices[subMesh.indices[3 * t + 1]];
+				const glm::vec3& p2 = subMesh.vertices[subMesh.indices[3 * t + 2]];
+				conversion.areas->triangleAreas[t] = 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
 			}
 		}
-		
-		RadeonRays::Shape* shape = m_intersectionApi->CreateMesh(&subMesh.vertices[0].x,
-			static_cast<int>(subMesh.vertices.size()), sizeof(glm::vec3), reinterpret_cast<const int*>(subMesh.indices.data()),
-			0, nullptr, static_cast<int>(subMesh.indices.size()) / 3);
+		else
+		{
+			for (size_t i = conversion.first; i < conversion.first + conversion.count; ++i)
+				m_rtHostScene.positions[conversion.dstOffset + i] = CLHelper::toFloat3(subMesh.vertices[i]);
 
-		assert(shape != nullptr);
-		m_intersectionApi->AttachShape(shape);
+			packVertices(subMesh, conversion.toWorldSpace ? &conversion.toWorld : nullptr, conversion.first, conversion.count,
+				&m_rtHostScene.vertices[conversion.dstOffset + conversion.first]);
+		}
+	};
 
-		sharedShapeInfo.instanceTemplateShape = shape;
+	// The output offsets are assigned by attachMesh, the batches write to disjoint ranges of the pre-sized host vectors
+	std::atomic<size_t> nextConversion(0);
+	auto worker = [&]()
+	{
+		for (size_t i = nextConversion++; i < m_meshConversions.size(); i = nextConversion++)
+			convert(m_meshConversions[i]);
+	};
+
+	size_t numWorkers = std::min(size_t(std::max(std::thread::hardware_concurrency(), 1u)), m_meshConversions.size());
+	std::vector<std::future<void>> futures;
+	for (size_t i = 1; i < numWorkers; ++i)
+		futures.push_back(std::async(std::launch::async, worker));
 
-		shape->SetId(rtHostScene.nextShapeId++);
-		shape->SetTransform(CLHelper::toMatrix(transform->getLocalToWorldMatrix()),
-						    CLHelper::toMatrix(transform->getWorldToLocalMatrix()));
+	worker();
 
-		shapeInfos.push_back(sharedShapeInfo);
+	for (auto& future : futures)
+		future.wait();
 
-		rtShapeComponent->shapes.push_back(shape);
+	for (const auto& conversion : m_meshConversions)
+	{
+		if (conversion.areas && conversion.first == 0)
+			conversion.areas->totalArea = std::accumulate(conversion.areas->triangleAreas.begin(), conversion.areas->triangleAreas.end(), 0.0f);
 	}
 
-	m_meshToShapesMap.emplace(std::make_pair(mesh, shapeInfos));
+	m_meshConversions.clear();
+
+	for (uint32_t shapeId : m_shapesWithoutArea)
+		m_rtHostScene.shapes[shapeId].area = computeShapeArea(m_rtHostScene.shapes[shapeId]);
+
+	m_shapesWithoutArea.clear();
 }
 
-void RTScene::uploadTextures()
+void RTScene::uploadTextures(bool rebuild)
 {
 	// Load textures
-	// Compute required memory
-	auto textures = ResourceManager::getTextures2D();
-	size_t totalTextureMemSize = 0;
-	for (auto& tex : textures)
+	// Texels are stored tightly packed with their native channel count or block compressed.
+	// With the image backend the textures of the largest buckets are stored in image arrays instead.
+	// Virtual textures are split into tiles which are streamed into the texture buffer on demand.
+	// Texture files are decoded on the host, only textures that can't be decoded are read back from GL.
+	const bool compressTextures = PathTracerSettings::GI.compressTextures;
+	const bool useVirtualTextures = PathTracerSettings::GI.useVirtualTextures;
+
+	// Texture IDs are stable, new textures are appended
+	size_t numUploadedTextures = m_rtTextures.size();
+	for (auto& tex : ResourceManager::getTextures2D())
 	{
-		int w = tex->getWidth();
-		int h = tex->getHeight();
-
-		for (int i = 0; i < tex->getNumMipmapLevels(); ++i)
+		if (m_glTexIdToRTTexId.find(tex->getGLID()) == m_glTexIdToRTTexId.end())
 		{
-			int channelCount = 4;
-			totalTextureMemSize += channelCount * w * h;
-			w = std::max(w / 2, 1);
-			h = std::max(h / 2, 1);
+			m_glTexIdToRTTexId[tex->getGLID()] = static_cast<int>(m_rtTextures.size());
+			m_rtTextures.push_back(tex);
 		}
 	}
 
-	if (totalTextureMemSize > 0)
+	// The image buckets and the page table of the virtual textures cover all textures
+	if (m_useTextureImages || useVirtualTextures || !m_virtualTextures.isEmpty())
+		rebuild = true;
+
+	if (rebuild)
+	{
+		numUploadedTextures = 0;
+		m_textureDataSize = 0;
+		m_rtHostScene.textures.clear();
+		m_virtualTextures.clear();
+	}
+	else if (numUploadedTextures == m_rtTextures.size())
+	{
+		return;
+	}
+
+	std::vector<std::shared_ptr<Texture2D>> textures(m_rtTextures.begin() + numUploadedTextures, m_rtTextures.end());
+	std::vector<unsigned char> texData;
+	std::vector<unsigned char> levelData;
+
+	std::vector<RTHostTextureRequest> hostRequests(textures.size());
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		hostRequests[i].path = textures[i]->getPath();
+		hostRequests[i].numChannels = computeTexelStride(toRTTextureFormat(textures[i]->getTextureFormat()));
+		hostRequests[i].numMipLevels = std::min(textures[i]->getNumMipmapLevels(), RT_MAX_TEXTURE_MIP_LEVELS);
+	}
+
+	std::vector<RTHostTexture> hostTextures = RTTextureLoader::loadParallel(hostRequests);
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		if (hostTextures[i].width != textures[i]->getWidth() || hostTextures[i].height != textures[i]->getHeight())
+			hostTextures[i] = RTHostTexture();
+	}
+
+	// Decoded files are never pre-compressed, only textures read back from GL can be
+	auto getPrecompressedFormat = [&](size_t i, RTTextureFormat& outFormat)
 	{
-		unsigned char* texData = new unsigned char[totalTextureMemSize];
-		uint32_t memOffset = 0;
+		if (hostTextures[i].isValid())
+			return false;
+
+		textures[i]->bind();
+		GLint internalFormat;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+		return toRTBlockCompressedFormat(internalFormat, outFormat);
+	};
 
-		int texId = 0;
-		for (auto& tex : textures)
+	// Reads a level with the texel layout of format which is either the native format or RGBA8 for RGB8 textures
+	auto readLevel = [&](size_t i, int level, RTTextureFormat format, int w, int h, unsigned char* outData)
+	{
+		const RTHostTexture& hostTex = hostTextures[i];
+		if (!hostTex.isValid())
+		{
+			textures[i]->bind();
+			glGetTexImage(GL_TEXTURE_2D, level, toGLReadFormat(format), GL_UNSIGNED_BYTE, outData);
+		}
+		else if (hostTex.numChannels == 3 && format == RT_TEX_FORMAT_RGBA8)
+		{
+			std::vector<uint8_t> rgbaData;
+			RTTextureLoader::expandRGBToRGBA(hostTex.levels[level].data(), size_t(w) * h, rgbaData);
+			std::memcpy(outData, rgbaData.data(), rgbaData.size());
+		}
+		else
 		{
-			m_glTexIdToRTTexId[tex->getGLID()] = texId;
+			std::memcpy(outData, hostTex.levels[level].data(), hostTex.levels[level].size());
+		}
+	};
 
-			RTTextureDesc2D texDesc;
-			int channelCount = 4;
-			int packAlignmentValue = 4;
+	// Bucket and layer per texture
+	std::vector<RTTextureImageBucket> imageBuckets;
+	std::vector<std::pair<int, int>> imageSlots(textures.size(), std::make_pair(RT_INVALID_ID, 0));
+	if (m_useTextureImages)
+	{
+		std::vector<RTTextureImageKey> imageKeys(textures.size());
+		for (size_t i = 0; i < textures.size(); ++i)
+		{
+			auto& tex = textures[i];
 
-			switch (tex->getTextureFormat())
-			{
-			case GL_LUMINANCE:
-			case GL_DEPTH_COMPONENT:
-			case GL_RED:
-			case GL_R:
-				texDesc.format = RT_TEX_FORMAT_R8;
-				break;
-			case GL_LUMINANCE_ALPHA:
-			case GL_RG:
-				texDesc.format = RT_TEX_FORMAT_RG8;
-				break;
-			case GL_RGB:
-				texDesc.format = RT_TEX_FORMAT_RGB8;
-				break;
-			case GL_RGBA:
-				texDesc.format = RT_TEX_FORMAT_RGBA8;
-				break;
-			default: break;
-			}
+			// Pre-compressed textures stay compressed in the texture buffer
+			RTTextureFormat compressedFormat;
+			if (getPrecompressedFormat(i, compressedFormat))
+				continue;
+
+			imageKeys[i].width = tex->getWidth();
+			imageKeys[i].height = tex->getHeight();
+			imageKeys[i].numChannels = RTTextureImages::getImageChannelCount(toRTTextureFormat(tex->getTextureFormat()));
+			imageKeys[i].numMipLevels = std::min(tex->getNumMipmapLevels(), RT_MAX_TEXTURE_MIP_LEVELS);
+		}
+
+		imageBuckets = RTTextureImages::createBuckets(imageKeys, PlatformManager::getActiveDevice()->GetID());
+
+		for (int bucketIdx = 0; bucketIdx < static_cast<int>(imageBuckets.size()); ++bucketIdx)
+		{
+			const auto& bucketTextures = imageBuckets[bucketIdx].textures;
+			for (int layer = 0; layer < static_cast<int>(bucketTextures.size()); ++layer)
+				imageSlots[bucketTextures[layer]] = std::make_pair(bucketIdx, layer);
+		}
+	}
+
+	// Rows of R8, RG8 and RGB8 textures aren't 4 byte aligned
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
-			texDesc.memOffset = memOffset;
-			texDesc.width = static_cast<uint16_t>(tex->getWidth());
-			texDesc.height = static_cast<uint16_t>(tex->getHeight());
-			texDesc.numMipLevels = static_cast<uint16_t>(tex->getNumMipmapLevels());
-			texDesc.wrap = RT_TEX_WRAP_REPEAT;
+	for (size_t texIdx = 0; texIdx < textures.size(); ++texIdx)
+	{
+		auto& tex = textures[texIdx];
+
+		RTTextureDesc2D texDesc;
+		RTTextureFormat uncompressedFormat = toRTTextureFormat(tex->getTextureFormat());
+		RTTextureFormat format = uncompressedFormat;
+		bool isPrecompressed = getPrecompressedFormat(texIdx, format);
+		const std::pair<int, int>& imageSlot = imageSlots[texIdx];
+		bool isImage = imageSlot.first != RT_INVALID_ID;
+		bool isVirtual = !isImage && useVirtualTextures;
+
+		if (isImage)
+			format = uncompressedFormat == RT_TEX_FORMAT_RGB8 ? RT_TEX_FORMAT_RGBA8 : uncompressedFormat;
+		else if (!isPrecompressed && compressTextures)
+			format = RTTextureCompression::getBlockCompressedFormat(uncompressedFormat);
+
+		bool isBlockCompressed = RTTextureCompression::isBlockCompressed(format);
+		int texelStride = isBlockCompressed ? RTTextureCompression::getBlockSize(format) : computeTexelStride(format);
+
+		texDesc.format = format;
+		texDesc.texelStride = static_cast<uint16_t>(texelStride);
+		texDesc.imageBucket = static_cast<int16_t>(imageSlot.first);
+		texDesc.imageLayer = static_cast<uint16_t>(imageSlot.second);
+		texDesc.memOffset = isImage || isVirtual ? 0 : static_cast<uint32_t>(m_textureDataSize + texData.size());
+		texDesc.pageTableOffset = RT_INVALID_ID;
+		texDesc.width = static_cast<uint16_t>(tex->getWidth());
+		texDesc.height = static_cast<uint16_t>(tex->getHeight());
+		texDesc.numMipLevels = static_cast<uint16_t>(std::min(tex->getNumMipmapLevels(), RT_MAX_TEXTURE_MIP_LEVELS));
+		texDesc.wrap = RT_TEX_WRAP_REPEAT;
 
-			m_rtHostScene.textures.push_back(texDesc);
+		int w = tex->getWidth();
+		int h = tex->getHeight();
 
-			int w = tex->getWidth();
-			int h = tex->getHeight();
-			tex->bind();
-			glPixelStorei(GL_PACK_ALIGNMENT, packAlignmentValue);
+		std::fill(std::begin(texDesc.mipOffsets), std::end(texDesc.mipOffsets), 0);
+		if (isImage)
+		{
+			int atlasWidth, atlasHeight;
+			RTTextureImages::computeAtlasLayout(w, h, texDesc.numMipLevels, atlasWidth, atlasHeight, texDesc.mipOffsets);
+		}
+		else if (isVirtual)
+		{
+			m_virtualTextures.addTexture(texDesc);
+		}
+
+		for (int i = 0; i < texDesc.numMipLevels; ++i)
+		{
+			size_t levelOffset = texData.size();
+			if (!isImage && !isVirtual)
+				texDesc.mipOffsets[i] = static_cast<uint32_t>(m_textureDataSize + levelOffset - texDesc.memOffset);
+
+			if (isImage)
+			{
+				levelData.resize(size_t(texelStride) * w * h);
+				readLevel(texIdx, i, format, w, h, levelData.data());
+				RTTextureImages::copyMipLevel(imageBuckets[imageSlot.first], imageSlot.second, texDesc.mipOffsets[i], levelData.data(), w, h);
+			}
+			else if (isPrecompressed)
+			{
+				GLint compressedSize;
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressedSize);
+				texData.resize(levelOffset + compressedSize);
+				glGetCompressedTexImage(GL_TEXTURE_2D, i, texData.data() + levelOffset);
+			}
+			else if (isBlockCompressed)
+			{
+				int channelCount = computeTexelStride(uncompressedFormat);
+				levelData.resize(size_t(channelCount) * w * h);
+				readLevel(texIdx, i, uncompressedFormat, w, h, levelData.data());
+				texData.resize(levelOffset + RTTextureCompression::computeCompressedSize(format, w, h));
+				RTTextureCompression::compress(format, levelData.data(), w, h, channelCount, texData.data() + levelOffset);
+			}
+			else
+			{
+				texData.resize(levelOffset + size_t(texelStride) * w * h);
+				readLevel(texIdx, i, format, w, h, texData.data() + levelOffset);
+			}
 
-			for (int i = 0; i < tex->getNumMipmapLevels(); ++i)
+			// The level is only kept in the tiles of the virtual texture
+			if (isVirtual)
 			{
-				glGetTexImage(GL_TEXTURE_2D, i, GL_RGBA, GL_UNSIGNED_BYTE, texData + memOffset);
-				memOffset += channelCount * w * h;
-				w = std::max(w / 2, 1);
-				h = std::max(h / 2, 1);
+				m_virtualTextures.addLevel(texDesc, i, texData.data() + levelOffset);
+				texData.resize(levelOffset);
 			}
-			++texId;
+
+			w = std::max(w / 2, 1);
+			h = std::max(h / 2, 1);
 		}
 
+		m_rtHostScene.textures.push_back(texDesc);
+	}
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	if (m_rtHostScene.textures.size() > 0)
+	{
 		std::string texMemRecord = RT_SCENE_MEMORY_RECORD_CONTEXT_NAME + "_TEXTURES";
 		RTScopedMemoryRecord memRecord(texMemRecord);
 
 		m_rtDeviceScene.textures = RTBufferManager::createBuffer<RTTextureDesc2D>(CL_MEM_READ_ONLY, m_rtHostScene.textures.size(), m_rtHostScene.textures.data());
-		m_rtDeviceScene.textureData = RTBufferManager::createBuffer<unsigned char>(CL_MEM_READ_ONLY, totalTextureMemSize, texData);
 
-		delete[] texData;
+		if (!m_virtualTextures.isEmpty())
+		{
+			size_t budget = size_t(PathTracerSettings::GI.textureBudget) << 20;
+			m_virtualTextures.createDeviceBuffers(budget, m_rtDeviceScene.textureData, m_rtDeviceScene.textureFeedback);
+		}
+		else
+		{
+			appendTextureData(texData, rebuild);
+
+			if (m_rtDeviceScene.textureFeedback.GetElementCount() == 0)
+				m_rtDeviceScene.textureFeedback = RTBufferManager::createBuffer<uint32_t>(CL_MEM_READ_WRITE, 1);
+		}
+	}
+
+	if (m_useTextureImages)
+	{
+		// Unused bucket arguments are bound to a placeholder
+		m_textureImages.assign(RT_MAX_TEXTURE_IMAGE_BUCKETS, RTTextureImages::createDummyImage(m_clContext));
+		for (size_t i = 0; i < imageBuckets.size(); ++i)
+			m_textureImages[i] = RTTextureImages::createImage(m_clContext, imageBuckets[i]);
 	}
 }
 
+void RTScene::appendTextureData(std::vector<unsigned char>& texData, bool rebuild)
+{
+	std::string texDataMemRecord = RT_SCENE_MEMORY_RECORD_CONTEXT_NAME + "_TEXTURE_DATA";
+	RTScopedMemoryRecord memRecord(texDataMemRecord);
+
+	size_t requiredSize = m_textureDataSize + texData.size();
+	size_t capacity = rebuild ? 0 : m_rtDeviceScene.textureData.GetElementCount();
+
+	if (requiredSize > capacity || capacity == 0)
+	{
+		// The buffer grows geometrically to amortize the copies of the uploaded textures, kernels always get a valid buffer
+		size_t newCapacity = std::max({ requiredSize, capacity * 2, size_t(4) });
+		CLWBuffer<unsigned char> newTextureData = RTBufferManager::createBuffer<unsigned char>(CL_MEM_READ_ONLY, newCapacity);
+
+		if (m_textureDataSize > 0)
+			m_clContext.CopyBuffer(0, m_rtDeviceScene.textureData, newTextureData, 0, 0, m_textureDataSize);
+
+		m_rtDeviceScene.textureData = newTextureData;
+	}
+
+	if (texData.size() > 0)
+		m_clContext.WriteBuffer(0, m_rtDeviceScene.textureData, texData.data(), m_textureDataSize, texData.size()).Wait();
+
+	m_textureDataSize = requiredSize;
+}
+
 void RTScene::uploadShapes()
 {
 	if (m_rtHostScene.shapes.size() == 0)
 		return;
 
+	// The buffers outlive the upload, only grown buffers are recorded
 	std::string shapesMemRecord = RT_SCENE_MEMORY_RECORD_CONTEXT_NAME + "_SHAPES";
-	RTScopedMemoryRecord memRecord(shapesMemRecord);
+	RTScopedMemoryRecord memRecord(shapesMemRecord, false);
+
+	// Records of existing shapes are patched in place, e.g. their light IDs change with the lights
+	uploadDirtyShapes();
 
-	m_rtDeviceScene.shapes = RTBufferManager::createBuffer<RTShape>(CL_MEM_READ_ONLY, m_rtHostScene.shapes.size(), m_rtHostScene.shapes.data());
-	m_rtDeviceScene.indices = RTBufferManager::createBuffer<uint32_t>(CL_MEM_READ_ONLY, m_rtHostScene.indices.size(), m_rtHostScene.indices.data());
-	m_rtDeviceScene.positions = RTBufferManager::createBuffer<RadeonRays::float3>(CL_MEM_READ_ONLY, m_rtHostScene.positions.size(), m_rtHostScene.positions.data());
-	m_rtDeviceScene.uvs = RTBufferManager::createBuffer<RadeonRays::float2>(CL_MEM_READ_ONLY, m_rtHostScene.uvs.size(), m_rtHostScene.uvs.data());
-	m_rtDeviceScene.normals = RTBufferManager::createBuffer<RadeonRays::float3>(CL_MEM_READ_ONLY, m_rtHostScene.normals.size(), m_rtHostScene.normals.data());
-	m_rtDeviceScene.tangents = RTBufferManager::createBuffer<RadeonRays::float3>(CL_MEM_READ_ONLY, m_rtHostScene.tangents.size(), m_rtHostScene.tangents.data());
-	m_rtDeviceScene.binormals = RTBufferManager::createBuffer<RadeonRays::float3>(CL_MEM_READ_ONLY, m_rtHostScene.binormals.size(), m_rtHostScene.binormals.data());
-	m_rtDeviceScene.colors = RTBufferManager::createBuffer<RadeonRays::float3>(CL_MEM_READ_ONLY, m_rtHostScene.colors.size(), m_rtHostScene.colors.data());
+	// Geometry is append-only: only the vertices and indices of newly attached meshes are uploaded
+	RTUploadedGeometry& uploaded = m_uploadedGeometry;
+	uploaded.numShapes = RTBufferManager::appendBuffer(CL_MEM_READ_ONLY, m_rtDeviceScene.shapes, m_rtHostScene.shapes, uploaded.numShapes);
+	uploaded.numIndices = RTBufferManager::appendBuffer(CL_MEM_READ_ONLY, m_rtDeviceScene.indices, m_rtHostScene.indices, uploaded.numIndices);
+	uploaded.numVertices = RTBufferManager::appendBuffer(CL_MEM_READ_ONLY, m_rtDeviceScene.vertices, m_rtHostScene.vertices, uploaded.numVertices);
+}
+
+void RTScene::uploadDirtyShapes()
+{
+	// Shapes and vertices that weren't uploaded yet are appended with their current data by uploadShapes
+	size_t numUploadedShapes = m_uploadedGeometry.numShapes;
+	size_t numUploadedVertices = m_uploadedGeometry.numVertices;
+	m_dirtyShapes.erase(std::remove_if(m_dirtyShapes.begin(), m_dirtyShapes.end(),
+		[numUploadedShapes](uint32_t shapeId) { return shapeId >= numUploadedShapes; }), m_dirtyShapes.end());
+
+	// The writes are enqueued in order, the vertices are written when the shapes are
+	CLWEvent writeEvt;
+	bool wroteVertices = false;
+	for (auto& range : m_dirtyVertexRanges)
+	{
+		if (range.first >= numUploadedVertices)
+			continue;
+
+		size_t count = std::min(size_t(range.second), numUploadedVertices - range.first);
+		writeEvt = m_clContext.WriteBuffer(0, m_rtDeviceScene.vertices, &m_rtHostScene.vertices[range.first], range.first, count);
+		wroteVertices = true;
+	}
+
+	m_dirtyVertexRanges.clear();
+
+	if (wroteVertices && m_dirtyShapes.empty())
+		writeEvt.Wait();
+
+	RTBufferManager::writeDirtyRanges(m_rtDeviceScene.shapes, m_rtHostScene.shapes, m_dirtyShapes);
 }
 
 void RTScene::uploadMaterials()
@@ -798,24 +1758,372 @@ void RTScene::uploadLights()
 {
 	if (m_rtHostScene.lights.size() == 0)
 	{
+		m_rtHostScene.lightAliasTable.clear();
+		m_rtHostScene.lightBVH.clear();
+		m_rtHostScene.numInfiniteLights = 0;
 		m_rtDeviceScene.lights = CLWBuffer<RTLight>();
+		m_rtDeviceScene.lightAliasTable = CLWBuffer<RTAliasTableEntry>();
+		m_rtDeviceScene.lightBVH = CLWBuffer<RTLightBVHNode>();
+		m_rtDeviceScene.environmentMap = CLWBuffer<RadeonRays::float3>();
 		return;
 	}
 
+	computeChoicePdfsForLights();
+	buildLightBVH();
+
 	std::string lightsMemRecord = RT_SCENE_MEMORY_RECORD_CONTEXT_NAME + "_LIGHTS";
 	RTScopedMemoryRecord memRecord(lightsMemRecord);
 	
 	m_rtDeviceScene.lights = RTBufferManager::createBuffer<RTLight>(CL_MEM_READ_ONLY, m_rtHostScene.lights.size(), m_rtHostScene.lights.data());
+	m_rtDeviceScene.lightAliasTable = RTBufferManager::createBuffer<RTAliasTableEntry>(CL_MEM_READ_ONLY, 
+		m_rtHostScene.lightAliasTable.size(), m_rtHostScene.lightAliasTable.data());
+	m_rtDeviceScene.lightBVH = RTBufferManager::createBuffer<RTLightBVHNode>(CL_MEM_READ_ONLY, m_rtHostScene.lightBVH.size(), m_rtHostScene.lightBVH.data());
+
+	if (m_rtHostScene.environmentLightIdx != RT_INVALID_ID)
+	{
+		m_rtDeviceScene.environmentMap = RTBufferManager::createBuffer<RadeonRays::float3>(CL_MEM_READ_ONLY,
+			m_rtHostScene.environmentMap.size(), m_rtHostScene.environmentMap.data());
+	}
+	else
+		m_rtDeviceScene.environmentMap = CLWBuffer<RadeonRays::float3>();
 }
 
 void RTScene::computeChoicePdfsForLights()
 {
-	// Set choice pdf to uniform distribution.
-	// This can be improved with a distribution based on the power of the light.
-	for (auto& light : m_rtHostScene.lights)
+	// Triangle areas of mesh lights are needed for the power and the triangle alias tables.
+	std::vector<std::vector<float>> triangleAreas(m_rtHostScene.lights.size());
+	for (size_t i = 0; i < m_rtHostScene.lights.size(); ++i)
+	{
+		auto& light = m_rtHostScene.lights[i];
+		light.distributionOffset = RT_INVALID_ID;
+
+		if (light.type == RT_TRIANGLE_MESH_AREA_LIGHT)
+		{
+			computeTriangleAreas(m_rtHostScene.shapes[light.shapeId], triangleAreas[i]);
+
+			// Keep the area consistent with the sampled density 1 / area
+			light.area = computeShapeArea(m_rtHostScene.shapes[light.shapeId]);
+		}
+	}
+
+	// Lights are chosen proportional to their power. The alias table allows O(1) sampling on the device.
+	std::vector<float> powers(m_rtHostScene.lights.size());
+	for (size_t i = 0; i < m_rtHostScene.lights.size(); ++i)
+	{
+		powers[i] = computeLightPower(m_rtHostScene.lights[i]);
+	}
+
+	// The light alias table is stored at offset 0 followed by the triangle alias tables of the mesh lights.
+	m_rtHostScene.lightAliasTable.clear();
+	AliasTable::build(powers, m_rtHostScene.lightAliasTable);
+
+	for (size_t i = 0; i < m_rtHostScene.lights.size(); ++i)
+	{
+		auto& light = m_rtHostScene.lights[i];
+		light.choicePdf = m_rtHostScene.lightAliasTable[i].pdf;
+
+		if (triangleAreas[i].size() > 0)
+		{
+			light.distributionOffset = static_cast<int>(m_rtHostScene.lightAliasTable.size());
+			AliasTable::build(triangleAreas[i], m_rtHostScene.lightAliasTable);
+		}
+		else if (light.type == RT_ENVIRONMENT_LIGHT)
+		{
+			light.distributionOffset = static_cast<int>(m_rtHostScene.lightAliasTable.size());
+			buildEnvironmentMapDistribution(m_rtHostScene.lightAliasTable);
+		}
+	}
+}
+
+bool RTScene::hasChangedTriangleAreas(const RTLight& light) const
+{
+	float areaScale;
+	return light.type == RT_TRIANGLE_MESH_AREA_LIGHT && !tryGetAreaScale(m_rtHostScene.shapes[light.shapeId].toWorldTransform, areaScale);
+}
+
+bool RTScene::hasChangedLightPower(const RTLight& light, float prevPower) const
+{
+	float power = computeLightPower(light);
+	return std::abs(power - prevPower) > 1e-4f * std::max(power, prevPower);
+}
+
+float RTScene::computeShapeArea(const RTShape& shape) const
+{
+	float areaScale;
+	auto areasIt = m_subMeshAreas.find(shape.startIdx);
+	if (areasIt != m_subMeshAreas.end() && tryGetAreaScale(shape.toWorldTransform, areaScale))
+		return areasIt->second.totalArea * areaScale;
+
+	std::vector<float> areas;
+	computeTriangleAreas(shape, areas);
+	return std::accumulate(areas.begin(), areas.end(), 0.0f);
+}
+
+void RTScene::computeTriangleAreas(const RTShape& shape, std::vector<float>& outAreas) const
+{
+	outAreas.resize(shape.numTriangles);
+
+	float areaScale;
+	auto areasIt = m_subMeshAreas.find(shape.startIdx);
+	if (areasIt != m_subMeshAreas.end() && tryGetAreaScale(shape.toWorldTransform, areaScale))
+	{
+		for (uint32_t t = 0; t < shape.numTriangles; ++t)
+			outAreas[t] = areasIt->second.triangleAreas[t] * areaScale;
+
+		return;
+	}
+
+	for (uint32_t t = 0; t < shape.numTriangles; ++t)
+	{
+		// Same transformation as used for sampling on the device
+		RadeonRays::float3 p[3];
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			uint32_t vertexIdx = m_rtHostScene.indices[shape.startIdx + 3 * t + k];
+			p[k] = RadeonRays::transform_point(m_rtHostScene.positions[shape.startVertex + vertexIdx], shape.toWorldTransform);
+		}
+
+		outAreas[t] = 0.5f * std::sqrt(RadeonRays::cross(p[1] - p[0], p[2] - p[0]).sqnorm());
+	}
+}
+
+void RTScene::buildLightBVH()
+{
+	// Infinite lights can't be bounded spatially. Their leaves are stored first and chosen separately on the device.
+	std::vector<RTLightBounds> boundedLights;
+	m_rtHostScene.lightBVH.clear();
+	m_rtHostScene.numInfiniteLights = 0;
+
+	for (size_t i = 0; i < m_rtHostScene.lights.size(); ++i)
+	{
+		const auto& light = m_rtHostScene.lights[i];
+		RTLightBounds bounds = computeLightBounds(light, static_cast<int>(i));
+
+		if (light.type == RT_DIRECTIONAL_LIGHT || light.type == RT_ENVIRONMENT_LIGHT)
+		{
+			RTLightBVH::addLeaf(bounds, m_rtHostScene.lightBVH);
+			++m_rtHostScene.numInfiniteLights;
+		}
+		else
+			boundedLights.push_back(bounds);
+	}
+
+	RTLightBVH::build(boundedLights, m_rtHostScene.lightBVH);
+}
+
+RTLightBounds RTScene::computeLightBounds(const RTLight& light, int lightIdx) const
+{
+	RTLightBounds bounds;
+	bounds.lightIdx = lightIdx;
+	bounds.power = computeLightPower(light);
+	glm::vec3 p(light.p.x, light.p.y, light.p.z);
+
+	switch (light.type)
+	{
+	case RT_POINT_LIGHT:
+		// Emits in all directions
+		bounds.min = p;
+		bounds.max = p;
+		bounds.cosThetaO = -1.0f;
+		bounds.cosThetaE = 0.0f;
+		break;
+	case RT_DISK_AREA_LIGHT:
+	{
+		glm::vec3 n = glm::normalize(glm::vec3(light.d.x, light.d.y, light.d.z));
+		glm::vec3 extent = light.radius * glm::sqrt(glm::max(glm::vec3(1.0f) - n * n, glm::vec3(0.0f)));
+		bounds.min = p - extent;
+		bounds.max = p + extent;
+		bounds.axis = n;
+		bounds.cosThetaO = 1.0f;
+		bounds.cosThetaE = 0.0f;
+		break;
+	}
+	case RT_TRIANGLE_MESH_AREA_LIGHT:
+	{
+		const RTShape& shape = m_rtHostScene.shapes[light.shapeId];
+		std::vector<glm::vec3> normals(shape.numTriangles);
+		glm::vec3 axis(0.0f);
+		bounds.min = glm::vec3(std::numeric_limits<float>::max());
+		bounds.max = glm::vec3(std::numeric_limits<float>::lowest());
+
+		for (uint32_t t = 0; t < shape.numTriangles; ++t)
+		{
+			glm::vec3 v[3];
+			for (uint32_t k = 0; k < 3; ++k)
+			{
+				uint32_t vertexIdx = m_rtHostScene.indices[shape.startIdx + 3 * t + k];
+				auto wp = RadeonRays::transform_point(m_rtHostScene.positions[shape.startVertex + vertexIdx], shape.toWorldTransform);
+				v[k] = glm::vec3(wp.x, wp.y, wp.z);
+				bounds.min = glm::min(bounds.min, v[k]);
+				bounds.max = glm::max(bounds.max, v[k]);
+			}
+
+			// Area weighted normal
+			normals[t] = glm::cross(v[1] - v[0], v[2] - v[0]);
+			axis += normals[t];
+		}
+
+		bounds.cosThetaE = 0.0f;
+		if (shape.numTriangles == 0 || glm::dot(axis, axis) < 1e-12f)
+		{
+			bounds.axis = glm::vec3(0.0f, 1.0f, 0.0f);
+			bounds.cosThetaO = -1.0f;
+			break;
+		}
+
+		bounds.axis = glm::normalize(axis);
+		bounds.cosThetaO = 1.0f;
+		for (const auto& n : normals)
+		{
+			if (glm::dot(n, n) > 0.0f)
+				bounds.cosThetaO = std::min(bounds.cosThetaO, glm::dot(bounds.axis, glm::normalize(n)));
+		}
+		break;
+	}
+	default:
+		// Infinite lights only need the light index and power
+		bounds.min = p;
+		bounds.max = p;
+		break;
+	}
+
+	return bounds;
+}
+
+float RTScene::computeLightPower(const RTLight& light) const
+{
+	// Rec. 709 luminance
+	float luminance = 0.2126f * light.intensity.x + 0.7152f * light.intensity.y + 0.0722f * light.intensity.z;
+
+	switch (light.type)
+	{
+	case RT_POINT_LIGHT:
+		return 4.0f * math::PI * luminance;
+	case RT_DIRECTIONAL_LIGHT:
+		// The intensity is the irradiance on a disk covering the scene
+		return light.area * luminance;
+	case RT_DISK_AREA_LIGHT:
+	case RT_TRIANGLE_MESH_AREA_LIGHT:
+		return math::PI * light.area * luminance;
+	case RT_ENVIRONMENT_LIGHT:
+		// Radiance arriving through the disk covering the scene
+		return light.area * luminance * m_rtHostScene.environmentMapAverageLuminance;
+	default:
+		return 0.0f;
+	}
+}
+
+bool RTScene::loadEnvironmentMap(const std::string& path)
+{
+	if (path == m_environmentMapPath)
+		return m_rtHostScene.environmentMap.size() > 0;
+
+	m_environmentMapPath = path;
+	m_rtHostScene.environmentMap.clear();
+	m_rtHostScene.environmentMapWidth = 0;
+	m_rtHostScene.environmentMapHeight = 0;
+	m_rtHostScene.environmentMapAverageLuminance = 0.0f;
+
+	if (path == "")
+		return false;
+
+	int width, height, channels;
+	float* data = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+	if (!data)
+	{
+		LOG_ERROR("Failed to load environment map " << path << ": " << stbi_failure_reason());
+		return false;
+	}
+
+	m_rtHostScene.environmentMap.resize(size_t(width) * height);
+	for (size_t i = 0; i < m_rtHostScene.environmentMap.size(); ++i)
+	{
+		m_rtHostScene.environmentMap[i] = RadeonRays::float3(data[i * 3], data[i * 3 + 1], data[i * 3 + 2]);
+	}
+
+	stbi_image_free(data);
+
+	m_rtHostScene.environmentMapWidth = width;
+	m_rtHostScene.environmentMapHeight = height;
+
+	// Average over the sphere, rows near the poles cover less solid angle
+	double weightedLuminance = 0.0;
+	double weightSum = 0.0;
+	for (int y = 0; y < height; ++y)
 	{
-		light.choicePdf = 1.0f / m_rtHostScene.lights.size();
+		float sinTheta = std::sin(math::PI * (y + 0.5f) / height);
+		for (int x = 0; x < width; ++x)
+		{
+			const auto& c = m_rtHostScene.environmentMap[size_t(y) * width + x];
+			weightedLuminance += (0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z) * sinTheta;
+			weightSum += sinTheta;
+		}
 	}
+
+	m_rtHostScene.environmentMapAverageLuminance = weightSum > 0.0 ? static_cast<float>(weightedLuminance / weightSum) : 0.0f;
+	return true;
+}
+
+void RTScene::buildEnvironmentMapDistribution(std::vector<RTAliasTableEntry>& outTable) const
+{
+	// Piecewise constant 2D distribution over the lat-long map:
+	// The marginal table chooses a row, the conditional table of the row chooses a texel.
+	// Texels are weighted by luminance and sin(theta) to account for the distortion at the poles.
+	const int width = m_rtHostScene.environmentMapWidth;
+	const int height = m_rtHostScene.environmentMapHeight;
+	std::vector<std::vector<float>> conditionalWeights(height, std::vector<float>(width));
+	std::vector<float> marginalWeights(height, 0.0f);
+
+	for (int y = 0; y < height; ++y)
+	{
+		float sinTheta = std::sin(math::PI * (y + 0.5f) / height);
+		for (int x = 0; x < width; ++x)
+		{
+			const auto& c = m_rtHostScene.environmentMap[size_t(y) * width + x];
+			conditionalWeights[y][x] = (0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z) * sinTheta;
+			marginalWeights[y] += conditionalWeights[y][x];
+		}
+	}
+
+	AliasTable::build(marginalWeights, outTable);
+
+	for (int y = 0; y < height; ++y)
+	{
+		AliasTable::build(conditionalWeights[y], outTable);
+	}
+}
+
+void RTScene::updateEnvironmentMap()
+{
+	// A different HDR map requires rebuilding the light buffers. Only the first active environment light is used.
+	for (auto entity : ECS::getEntitiesWithComponents<EnvironmentLight>())
+	{
+		if (!entity.isActive())
+			continue;
+
+		if (entity.getComponent<EnvironmentLight>()->filePath != m_environmentMapPath)
+		{
+			addLights();
+			uploadLights();
+			m_updated = true;
+		}
+
+		return;
+	}
+}
+
+int RTScene::getRTMaterialId(ComponentPtr<MeshRenderer> meshRenderer, int meshIdx, RTHostScene& rtHostScene)
+{
+	auto material = meshRenderer->getMaterial(meshIdx);
+
+	auto rtMaterialIdIter = m_glMaterialToRTMaterialIdMap.find(material);
+	if (rtMaterialIdIter != m_glMaterialToRTMaterialIdMap.end())
+		return rtMaterialIdIter->second;
+
+	int materialId = static_cast<int>(rtHostScene.materials.size());
+	rtHostScene.materials.push_back(createUberMaterial(meshRenderer, material.get(), materialId));
+	m_glMaterialToRTMaterialIdMap[material] = materialId;
+	return materialId;
 }
 
 RTMaterial RTScene::createUberMaterial(ComponentPtr<MeshRenderer> meshRenderer, const Material* material, int rtMaterialId)
@@ -4,15 +4,22 @@
 #include <radeon_rays.h>
 #include "../../../../engine/rendering/renderer/MeshRenderer.h"
 #include "../../../../engine/rendering/geometry/Mesh.h"
+#include "../../../../engine/rendering/Texture2D.h"
 #include "../textures/RTTextures.h"
+#include "../textures/RTTextureImages.h"
+#include "../textures/RTVirtualTextures.h"
 #include <kernel_data.h>
 #include <engine/ecs/ECS.h>
 #include <engine/event/event.h>
 #include "set"
+#include <future>
+#include <memory>
 #include <engine/event/EntityDeactivatedEvent.h>
 #include <engine/event/EntityActivatedEvent.h>
+#include <engine/event/TransformStaticStatusChangedEvent.h>
 #include "../material/RTUberMaterialComponent.h"
 #include "../kernels/RTKernel.h"
+#include "../lights/RTLightBVH.h"
 
 /**
 * Connects host scene with OpenCL.
@@ -26,19 +33,22 @@
 *   The functions attachStaticEntities, attachDynamicEntities are thus essentially the same.
 */
 class RTScene : public System, public Receiver<ComponentAddedEvent<MeshRenderer>>, 
-	public Receiver<EntityDeactivatedEvent>, public Receiver<EntityActivatedEvent>
+	public Receiver<EntityDeactivatedEvent>, public Receiver<EntityActivatedEvent>, public Receiver<RTUberMaterialUpdatedEvent>,
+	public Receiver<TransformStaticStatusChangedEvent>
 {
 	/**
 	* Multiple shape instances share indices and vertices.
 	*/
 	struct SharedShapeInfo
 	{
+		std::shared_ptr<Mesh> mesh; // The content of the submesh at meshIdx is compared with the submeshes of other meshes
 		uint32_t startIdx;
 		uint32_t startVertex;
 		uint32_t numTriangles;
 		RadeonRays::Shape* instanceTemplateShape;
 		int materialId;
 		int meshIdx;
+		bool hasWorldSpaceVertices;
 	};
 
 	struct RTHostScene
@@ -48,16 +58,85 @@ class RTScene : public System, public Receiver<ComponentAddedEvent<MeshRenderer>
 		RadeonRays::Id nextShapeId = 0;
 		std::vector<RTShape> shapes;
 		std::vector<uint32_t> indices;
+		// Positions for the intersection api and the light computations, the kernels read the packed vertices
 		std::vector<RadeonRays::float3> positions;
-		std::vector<RadeonRays::float2> uvs;
-		std::vector<RadeonRays::float3> normals;
-		std::vector<RadeonRays::float3> tangents;
-		std::vector<RadeonRays::float3> binormals;
-		std::vector<RadeonRays::float3> colors;
+		std::vector<RTVertex> vertices;
 		std::vector<RTTextureDesc2D> textures;
 		std::vector<unsigned char> textureData;
 		std::vector<RTLight> lights;
+		std::vector<RTAliasTableEntry> lightAliasTable;
+		std::vector<RTLightBVHNode> lightBVH;
+		int numInfiniteLights = 0;
 		std::vector<RTMaterial> materials;
+
+		// Lat-long HDR map of the environment light
+		std::vector<RadeonRays::float3> environmentMap;
+		int environmentMapWidth = 0;
+		int environmentMapHeight = 0;
+		float environmentMapAverageLuminance = 0.0f;
+		int environmentLightIdx = RT_INVALID_ID;
+	};
+
+	/**
+	* Radeon Rays shape per shape ID. Instances reference the shape ID of their mesh.
+	*/
+	struct RTIntersectionShape
+	{
+		RadeonRays::Shape* shape = nullptr;
+		int baseShapeId = RT_INVALID_ID;
+		uint32_t numVertices = 0;
+		bool isAttached = false;
+	};
+
+	/**
+	* Changes since the last build of the shadow intersection api for a build of the acceleration structure on a worker thread.
+	* The worker reuses the shapes of the shadow api and creates the shapes added since, see commitAsync.
+	*/
+	struct RTIntersectionApiBuild
+	{
+		std::vector<RTIntersectionShape> shapes; // The shapes of the shadow api followed by the new shapes
+		std::vector<char> shapeActivity;
+		size_t firstNewShape = 0;
+		std::vector<RTShape> newHostShapes; // The vertex and index offsets refer to positions and indices
+		std::vector<RadeonRays::float3> positions;
+		std::vector<uint32_t> indices;
+		std::vector<std::pair<uint32_t, RadeonRays::matrix>> movedShapes;
+		std::string error;
+	};
+
+	/**
+	* Element counts of the geometry in the device buffers. The host geometry only grows, see uploadShapes.
+	*/
+	struct RTUploadedGeometry
+	{
+		size_t numShapes = 0;
+		size_t numIndices = 0;
+		size_t numVertices = 0;
+	};
+
+	/**
+	* Object space triangle areas of a submesh, shared by all shapes that reference its indices.
+	*/
+	struct RTSubMeshAreas
+	{
+		float totalArea = 0.0f;
+		std::vector<float> triangleAreas;
+	};
+
+	/**
+	* A batch of vertices or triangles of an attached submesh that is converted into the host scene, see convertAttachedMeshes.
+	*/
+	struct RTMeshConversion
+	{
+		const Mesh::SubMesh* subMesh = nullptr;
+		size_t first = 0;
+		size_t count = 0;
+		// Start vertex for vertex batches, start index for triangle batches
+		uint32_t dstOffset = 0;
+		// Triangle batches copy the indices and compute the object space triangle areas
+		RTSubMeshAreas* areas = nullptr;
+		bool toWorldSpace = false;
+		glm::mat4 toWorld;
 	};
 public:
 	RTScene(RadeonRays::IntersectionApi* intersectionApi, CLWContext clContext);
@@ -72,20 +151,43 @@ public:
 
 	const CLWBuffer<RTPinholeCamera> getCamera() const { return m_rtDeviceScene.camera; }
 
+	const BBox& getSceneBBox() const { return m_sceneBBox; }
+
 	virtual void receive(const ComponentAddedEvent<MeshRenderer>& event) override;
 
 
+	/**
+	* Activation changes are applied once per frame in update: lights are collected and uploaded once
+	* and the shapes are attached/detached by a single commit.
+	*/
 	virtual void receive(const EntityDeactivatedEvent& event) override;
+	virtual void receive(const EntityActivatedEvent& event) override;
 
+	/**
+	* Updates the host material, it's uploaded with the other edited materials in the next update.
+	*/
+	virtual void receive(const RTUberMaterialUpdatedEvent& event) override;
 
-	virtual void receive(const EntityActivatedEvent& event) override;
+	/**
+	* Shapes with vertices baked to world space are reverted to object space vertices when the entity becomes dynamic.
+	*/
+	virtual void receive(const TransformStaticStatusChangedEvent& event) override;
 
 	void addSceneUpdateListener(std::function<void()> listener) { m_sceneUpdateListeners.push_back(listener); }
 
 	int setSceneArgs(RTKernel& kernel, int sceneArgsStart = 0);
 
+	/**
+	* Builds the acceleration structure on the calling thread, a pending asynchronous build is finished first.
+	*/
 	void commit();
 
+	/**
+	* Topology changes (attached, activated and deactivated shapes) are built in a shadow intersection api on a worker thread.
+	* Frames are rendered with the previous acceleration structure until the build is finished and the apis are swapped.
+	*/
+	void requestCommit() { m_commitRequested = true; }
+
 	void refresh();
 
 private:
@@ -97,16 +199,103 @@ private:
 	void addLights();
 	void addLight(Entity entity);
 	void setLight(Entity entity, RTLight& light, int lightID, RTLightType type);
+	bool setEmissiveMeshLight(Entity entity, RTLight& light, int lightID, int subMeshIdx);
+	// Marks the shape dirty if its light ID changes
+	void setShapeLightID(int shapeId, int lightID);
+	bool tryGetEmission(const Material* material, glm::vec3& outEmission) const;
 	bool hasLight(Entity entity);
 
 	void attachMesh(ComponentPtr<MeshRenderer> meshRenderer, RTHostScene& rtHostScene);
 
-	void uploadTextures();
+	/**
+	* Returns the shape info of an attached submesh with the content of the submesh, nullptr if there is none.
+	*/
+	SharedShapeInfo* findSharedShapeInfo(const std::shared_ptr<Mesh>& mesh, int meshIdx);
+	void attachSubMeshInstance(ComponentPtr<MeshRenderer> meshRenderer, int meshIdx, SharedShapeInfo& sharedShapeInfo, RTHostScene& rtHostScene);
+	void attachSubMesh(ComponentPtr<MeshRenderer> meshRenderer, int meshIdx, RTHostScene& rtHostScene);
+
+	/**
+	* Reserves the vertices of the submesh and returns the index of the first vertex. Positions are always in object space,
+	* the packed vertices are transformed to world space if toWorld is given. The vertices are converted by convertAttachedMeshes.
+	*/
+	uint32_t appendVertices(const Mesh::SubMesh& subMesh, const glm::mat4* toWorld);
+
+	/**
+	* Reserves the indices of the submesh at nextIndexStart, they are copied by convertAttachedMeshes.
+	*/
+	void appendIndices(const Mesh::SubMesh& subMesh);
+
+	/**
+	* Converts the vertices and indices of the meshes attached since the last call on all hardware threads
+	* and computes the areas of the new shapes. Must be called before the host scene is used.
+	*/
+	void convertAttachedMeshes();
+
+	void applyIntersectionApiOptions(RadeonRays::IntersectionApi* intersectionApi) const;
+	std::vector<char> computeShapeActivity() const;
+	void syncAttachedShapes(const std::vector<char>& shapeActivity);
+	static RadeonRays::Shape* createIntersectionShape(RadeonRays::IntersectionApi* intersectionApi, int shapeId, const std::vector<RTIntersectionShape>& shapes,
+		const RTShape& hostShape, const std::vector<RadeonRays::float3>& positions, const std::vector<uint32_t>& indices);
+
+	/**
+	* Creates an api with its own command queue, builds don't stall the kernels of the frames.
+	*/
+	RadeonRays::IntersectionApi* createBuildIntersectionApi();
+	void commitAsync();
+	void finishAsyncCommit(bool wait);
+	void markShadowShapeMoved(uint32_t shapeId);
+	void clearShadowShapesMoved();
+
+	/**
+	* Uploads the textures that were added since the last upload or all textures if rebuild is set.
+	* Image and virtual textures are always rebuilt.
+	*/
+	void uploadTextures(bool rebuild);
+
+	/**
+	* Writes texData at the end of the used part of the texture buffer, the buffer is recreated if it's too small.
+	*/
+	void appendTextureData(std::vector<unsigned char>& texData, bool rebuild);
 	void uploadShapes();
+
+	/**
+	* Writes the records of uploaded shapes in m_dirtyShapes and the vertices in m_dirtyVertexRanges.
+	*/
+	void uploadDirtyShapes();
+
 	void uploadMaterials();
 	void uploadLights();
 	void computeChoicePdfsForLights();
+	float computeLightPower(const RTLight& light) const;
+
+	/**
+	* World space areas are derived from the cached object space areas for similarity transforms.
+	* Shapes with non-uniform scale or shear are recomputed per triangle.
+	*/
+	float computeShapeArea(const RTShape& shape) const;
+	void computeTriangleAreas(const RTShape& shape, std::vector<float>& outAreas) const;
 
+	/**
+	* The relative triangle areas of a moved mesh light (and thus its triangle alias table) only change if its
+	* transform is not a similarity transform.
+	*/
+	bool hasChangedTriangleAreas(const RTLight& light) const;
+
+	/**
+	* The area of a moved mesh light is recomputed and changes by rounding errors for rigid moves,
+	* the power is compared with a relative tolerance.
+	*/
+	bool hasChangedLightPower(const RTLight& light, float prevPower) const;
+	void buildLightBVH();
+	RTLightBounds computeLightBounds(const RTLight& light, int lightIdx) const;
+	bool loadEnvironmentMap(const std::string& path);
+	void buildEnvironmentMapDistribution(std::vector<RTAliasTableEntry>& outTable) const;
+	void updateEnvironmentMap();
+
+	/**
+	* Returns the id of the RT material of the submesh, the material is created on first use.
+	*/
+	int getRTMaterialId(ComponentPtr<MeshRenderer> meshRenderer, int meshIdx, RTHostScene& rtHostScene);
 	RTMaterial createUberMaterial(ComponentPtr<MeshRenderer> meshRenderer, const Material* material, int rtMaterialId);
 	void updateRTMaterial(RTMaterial& material, const RTUberMaterialComponent::MaterialData& materialData);
 	void updateRTMaterialTextures(RTMaterial& rtMaterial, const Material* material);
@@ -114,19 +303,62 @@ private:
 	RadeonRays::IntersectionApi* m_intersectionApi = nullptr;
 	CLWContext m_clContext;
 
+	// The shapes of m_intersectionApi. Shapes are only attached and detached by commits.
+	std::vector<RTIntersectionShape> m_intersectionShapes;
+
+	// The shadow api is swapped with m_intersectionApi when an asynchronous build is finished.
+	// It's one of the build apis which alternate after the first build.
+	RadeonRays::IntersectionApi* m_shadowIntersectionApi = nullptr;
+	RadeonRays::IntersectionApi* m_buildIntersectionApis[2] = { nullptr, nullptr };
+	CLWCommandQueue m_buildCommandQueues[2];
+	std::vector<RTIntersectionShape> m_shadowIntersectionShapes;
+
+	// Shapes moved since the transforms of the shadow api were set
+	std::vector<uint32_t> m_shadowMovedShapes;
+	std::vector<char> m_isShadowShapeMoved;
+	std::unique_ptr<RTIntersectionApiBuild> m_intersectionApiBuild;
+	std::future<void> m_intersectionApiBuildFuture;
+	std::vector<uint32_t> m_shapesMovedDuringBuild;
+	bool m_commitRequested = false;
+
+	// Set by activation changes of lights, applied in the next update
+	bool m_lightsChanged = false;
+
 	RTHostScene m_rtHostScene;
 	RTDeviceScene m_rtDeviceScene;
+	RTUploadedGeometry m_uploadedGeometry;
+
+	// Indices of the shapes, lights and materials that changed since the last upload
+	std::vector<uint32_t> m_dirtyShapes;
+	std::vector<std::pair<uint32_t, uint32_t>> m_dirtyVertexRanges; // First vertex and count
+	std::vector<uint32_t> m_dirtyLights;
+	std::vector<uint32_t> m_dirtyMaterials;
+
+	// Image arrays of the texture buckets, see RTTextureImages.h
+	bool m_useTextureImages = false;
+	std::vector<RTImage2DArray> m_textureImages;
+	RTVirtualTextures m_virtualTextures;
+
+	// Textures in the order of their RT texture ID and the used bytes of the texture buffer
+	std::vector<std::shared_ptr<Texture2D>> m_rtTextures;
+	size_t m_textureDataSize = 0;
 
 	/** 
 	* This map is used to create instances of shapes and share indices + vertices.
-	* Meshes are reused per instance so mapping mesh -> shapes accomplishes this goal.
-	* A mesh can consist of multiple Mesh::SubMeshes. Each SubMesh is represented by a Shape.
+	* Each Mesh::SubMesh is represented by a Shape. Submeshes are mapped by their content hash,
+	* submeshes with equal content are instances of one shape even if they belong to different meshes.
 	*/
-	std::unordered_map<std::shared_ptr<Mesh>, std::vector<SharedShapeInfo>> m_meshToShapesMap;
+	std::unordered_multimap<size_t, SharedShapeInfo> m_subMeshToShapeMap;
 
 	std::unordered_map<std::shared_ptr<Material>, int> m_glMaterialToRTMaterialIdMap;
 	std::unordered_map<TextureID, int> m_glTexIdToRTTexId;
 
+	// Keyed by the start index of the submesh
+	std::unordered_map<uint32_t, RTSubMeshAreas> m_subMeshAreas;
+
+	std::vector<RTMeshConversion> m_meshConversions;
+	std::vector<uint32_t> m_shapesWithoutArea;
+
 	std::vector<Entity> m_scheduledCreatedEntities;
 	std::set<Entity> m_attachedEntities;
 
@@ -134,4 +366,5 @@ private:
 
 	bool m_updated = false;
 	BBox m_sceneBBox;
+	std::string m_environmentMapPath;
 };
\ No newline at end of file
@@ -5,6 +5,8 @@
 
 std::vector<std::string> KernelManager::m_includeDirectories;
 
+std::map<std::string, std::string> KernelManager::m_defines;
+
 std::unordered_map<std::string, CLWProgram> KernelManager::m_programs;
 
 std::vector<std::function<void()>> KernelManager::m_recompilationListeners;
@@ -18,6 +20,11 @@ void KernelManager::addIncludeDirectory(const std::string& absolutePath)
 	m_includeDirectories.push_back(absolutePath);
 }
 
+void KernelManager::setDefine(const std::string& name, const std::string& value)
+{
+	m_defines[name] = value;
+}
+
 CLWProgram KernelManager::getProgram(const std::string& programName, CLWContext context)
 {
 	auto findResult = m_programs.find(programName);
@@ -40,6 +47,11 @@ void KernelManager::createAndAddProgram(const std::string& programName, CLWConte
 	{
 		buildOptions << "-I " << incDir;
 	}
+
+	for (auto& define : m_defines)
+	{
+		buildOptions << " -D " << define.first << "=" << define.second;
+	}
 	std::string kernelPath = std::string(ASSET_ROOT_FOLDER) + std::string("kernels/") + programName + ".cl";
 	auto program = CLWProgram::CreateFromFile(kernelPath.c_str(), buildOptions.str().c_str(), context);
 	m_programs[programName] = program;
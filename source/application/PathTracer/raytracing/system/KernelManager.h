@@ -3,6 +3,7 @@
 #include "vector"
 #include "CLW.h"
 #include "unordered_map"
+#include "map"
 #include "functional"
 
 class KernelManager
@@ -12,6 +13,12 @@ public:
 
 	static void addIncludeDirectory(const std::string& absolutePath);
 
+	/**
+	* Adds a preprocessor definition to the build options of all programs.
+	* Programs need to be recompiled to use a changed definition.
+	*/
+	static void setDefine(const std::string& name, const std::string& value);
+
 	static CLWProgram getProgram(const std::string& programName, CLWContext context);
 	static void recompilePrograms(CLWContext context);
 
@@ -23,6 +30,7 @@ private:
 	static void createAndAddProgram(const std::string& programName, CLWContext context);
 
 	static std::vector<std::string> m_includeDirectories;
+	static std::map<std::string, std::string> m_defines;
 	static std::unordered_map<std::string, CLWProgram> m_programs;
 
 	static std::vector<std::function<void()>> m_recompilationListeners;
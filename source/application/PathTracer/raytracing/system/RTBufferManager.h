@@ -1,5 +1,7 @@
 #pragma once
 #include "unordered_map"
+#include <vector>
+#include <algorithm>
 #include <radeon_rays.h>
 #include "../../../../../third_party/RadeonRays/CLW/CLWBuffer.h"
 #include "../util/CLHelper.h"
@@ -24,6 +26,19 @@ public:
 	template<class T>
 	static CLWBuffer<T> createBuffer(cl_mem_flags flags, size_t elementCount, void* data = nullptr);
 
+	/**
+	* Writes the elements of hostData starting at uploadedCount to the end of buffer. If the buffer is too small it is recreated
+	* with at least twice its capacity and the uploaded elements are copied on the device. Returns the new uploaded count.
+	*/
+	template<class T>
+	static size_t appendBuffer(cl_mem_flags flags, CLWBuffer<T>& buffer, const std::vector<T>& hostData, size_t uploadedCount);
+
+	/**
+	* Writes the elements of hostData at dirtyIndices to buffer with one write per run of adjacent indices and clears dirtyIndices.
+	*/
+	template<class T>
+	static void writeDirtyRanges(CLWBuffer<T>& buffer, const std::vector<T>& hostData, std::vector<uint32_t>& dirtyIndices);
+
 	static void setMamoryRecordContext(const std::string& contextName) { m_curMemoryContext = contextName; }
 
 	static void clearMemoryRecordContext(const std::string& contextName);
@@ -68,4 +83,53 @@ CLWBuffer<T> RTBufferManager::createBuffer(cl_mem_flags flags, size_t elementCou
 	record.totalAllocatedSize += usedMemory;
 
 	return buffer;
-}
\ No newline at end of file
+}
+template<class T>
+size_t RTBufferManager::appendBuffer(cl_mem_flags flags, CLWBuffer<T>& buffer, const std::vector<T>& hostData, size_t uploadedCount)
+{
+	if (hostData.size() <= uploadedCount)
+		return hostData.size();
+
+	size_t capacity = buffer.GetElementCount();
+	if (hostData.size() > capacity)
+	{
+		CLWBuffer<T> newBuffer = createBuffer<T>(flags, std::max(hostData.size(), capacity * 2));
+
+		if (uploadedCount > 0)
+			g_clContext.CopyBuffer(0, buffer, newBuffer, 0, 0, uploadedCount);
+
+		buffer = newBuffer;
+	}
+
+	g_clContext.WriteBuffer(0, buffer, hostData.data() + uploadedCount, uploadedCount, hostData.size() - uploadedCount).Wait();
+
+	return hostData.size();
+}
+
+template<class T>
+void RTBufferManager::writeDirtyRanges(CLWBuffer<T>& buffer, const std::vector<T>& hostData, std::vector<uint32_t>& dirtyIndices)
+{
+	if (dirtyIndices.empty())
+		return;
+
+	std::sort(dirtyIndices.begin(), dirtyIndices.end());
+	dirtyIndices.erase(std::unique(dirtyIndices.begin(), dirtyIndices.end()), dirtyIndices.end());
+
+	// The writes are enqueued in order, waiting for the last one suffices
+	CLWEvent writeEvt;
+	size_t rangeStart = dirtyIndices[0];
+	for (size_t i = 1; i <= dirtyIndices.size(); ++i)
+	{
+		if (i < dirtyIndices.size() && dirtyIndices[i] == dirtyIndices[i - 1] + 1)
+			continue;
+
+		size_t rangeEnd = size_t(dirtyIndices[i - 1]) + 1;
+		writeEvt = g_clContext.WriteBuffer(0, buffer, hostData.data() + rangeStart, rangeStart, rangeEnd - rangeStart);
+
+		if (i < dirtyIndices.size())
+			rangeStart = dirtyIndices[i];
+	}
+
+	writeEvt.Wait();
+	dirtyIndices.clear();
+}
@@ -0,0 +1,226 @@
+#include "RTTextureCompression.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+	uint16_t toRGB565(const int c[3])
+	{
+		return static_cast<uint16_t>(((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255));
+	}
+
+	void fromRGB565(uint16_t v, int outC[3])
+	{
+		int r = (v >> 11) & 31;
+		int g = (v >> 5) & 63;
+		int b = v & 31;
+		outC[0] = (r << 3) | (r >> 2);
+		outC[1] = (g << 2) | (g >> 4);
+		outC[2] = (b << 3) | (b >> 2);
+	}
+
+	/**
+	* Encodes the colors of 16 RGBA texels to 8 bytes in the four color mode of BC1.
+	*/
+	void encodeColorBlock(const uint8_t block[16 * 4], uint8_t out[8])
+	{
+		int minC[3] = { 255, 255, 255 };
+		int maxC[3] = { 0, 0, 0 };
+
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				minC[c] = std::min(minC[c], int(block[i * 4 + c]));
+				maxC[c] = std::max(maxC[c], int(block[i * 4 + c]));
+			}
+		}
+
+		// Inset the bounding box to reduce the error of the interpolated colors
+		for (int c = 0; c < 3; ++c)
+		{
+			int inset = (maxC[c] - minC[c]) >> 4;
+			minC[c] += inset;
+			maxC[c] -= inset;
+		}
+
+		uint16_t c0 = toRGB565(maxC);
+		uint16_t c1 = toRGB565(minC);
+
+		// c0 > c1 selects the four color mode
+		if (c0 < c1)
+			std::swap(c0, c1);
+
+		int palette[4][3];
+		fromRGB565(c0, palette[0]);
+		fromRGB565(c1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		uint32_t indices = 0;
+		if (c0 != c1)
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				int bestIdx = 0;
+				int bestDist = INT32_MAX;
+				for (int p = 0; p < 4; ++p)
+				{
+					int dr = int(block[i * 4]) - palette[p][0];
+					int dg = int(block[i * 4 + 1]) - palette[p][1];
+					int db = int(block[i * 4 + 2]) - palette[p][2];
+					int dist = dr * dr + dg * dg + db * db;
+					if (dist < bestDist)
+					{
+						bestDist = dist;
+						bestIdx = p;
+					}
+				}
+
+				indices |= uint32_t(bestIdx) << (2 * i);
+			}
+		}
+
+		out[0] = static_cast<uint8_t>(c0 & 255);
+		out[1] = static_cast<uint8_t>(c0 >> 8);
+		out[2] = static_cast<uint8_t>(c1 & 255);
+		out[3] = static_cast<uint8_t>(c1 >> 8);
+		for (int i = 0; i < 4; ++i)
+			out[4 + i] = static_cast<uint8_t>((indices >> (8 * i)) & 255);
+	}
+
+	/**
+	* Encodes channel c of 16 RGBA texels to 8 bytes in the eight value mode of BC4.
+	*/
+	void encodeSingleChannelBlock(const uint8_t block[16 * 4], int c, uint8_t out[8])
+	{
+		int minV = 255;
+		int maxV = 0;
+		for (int i = 0; i < 16; ++i)
+		{
+			minV = std::min(minV, int(block[i * 4 + c]));
+			maxV = std::max(maxV, int(block[i * 4 + c]));
+		}
+
+		// a0 > a1 selects the eight value mode. A constant block uses index 0 only.
+		int palette[8];
+		palette[0] = maxV;
+		palette[1] = minV;
+		for (int p = 2; p < 8; ++p)
+			palette[p] = ((8 - p) * maxV + (p - 1) * minV) / 7;
+
+		uint64_t indices = 0;
+		if (maxV != minV)
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				int v = block[i * 4 + c];
+				int bestIdx = 0;
+				int bestDist = INT32_MAX;
+				for (int p = 0; p < 8; ++p)
+				{
+					int dist = std::abs(v - palette[p]);
+					if (dist < bestDist)
+					{
+						bestDist = dist;
+						bestIdx = p;
+					}
+				}
+
+				indices |= uint64_t(bestIdx) << (3 * i);
+			}
+		}
+
+		out[0] = static_cast<uint8_t>(maxV);
+		out[1] = static_cast<uint8_t>(minV);
+		for (int i = 0; i < 6; ++i)
+			out[2 + i] = static_cast<uint8_t>((indices >> (8 * i)) & 255);
+	}
+
+	/**
+	* Gathers the 4x4 block at (bx, by) as RGBA. Missing channels are set to (0, 0, 0, 255).
+	*/
+	void loadBlock(const uint8_t* image, int width, int height, int numChannels, int bx, int by, uint8_t outBlock[16 * 4])
+	{
+		for (int y = 0; y < 4; ++y)
+		{
+			for (int x = 0; x < 4; ++x)
+			{
+				int ix = std::min(bx * 4 + x, width - 1);
+				int iy = std::min(by * 4 + y, height - 1);
+				const uint8_t* texel = image + (size_t(iy) * width + ix) * numChannels;
+				uint8_t* dst = outBlock + (y * 4 + x) * 4;
+
+				for (int c = 0; c < 4; ++c)
+					dst[c] = c < numChannels ? texel[c] : (c == 3 ? 255 : 0);
+			}
+		}
+	}
+}
+
+bool RTTextureCompression::isBlockCompressed(RTTextureFormat format)
+{
+	return format == RT_TEX_FORMAT_BC1 || format == RT_TEX_FORMAT_BC3 || format == RT_TEX_FORMAT_BC4 || format == RT_TEX_FORMAT_BC5;
+}
+
+int RTTextureCompression::getBlockSize(RTTextureFormat format)
+{
+	return (format == RT_TEX_FORMAT_BC1 || format == RT_TEX_FORMAT_BC4) ? 8 : 16;
+}
+
+RTTextureFormat RTTextureCompression::getBlockCompressedFormat(RTTextureFormat format)
+{
+	switch (format)
+	{
+	case RT_TEX_FORMAT_R8: return RT_TEX_FORMAT_BC4;
+	case RT_TEX_FORMAT_RG8: return RT_TEX_FORMAT_BC5;
+	case RT_TEX_FORMAT_RGB8: return RT_TEX_FORMAT_BC1;
+	case RT_TEX_FORMAT_RGBA8: return RT_TEX_FORMAT_BC3;
+	default: return format;
+	}
+}
+
+size_t RTTextureCompression::computeCompressedSize(RTTextureFormat format, int width, int height)
+{
+	return size_t((width + 3) / 4) * size_t((height + 3) / 4) * getBlockSize(format);
+}
+
+void RTTextureCompression::compress(RTTextureFormat format, const uint8_t* image, int width, int height, int numChannels, uint8_t* outData)
+{
+	int numBlocksX = (width + 3) / 4;
+	int numBlocksY = (height + 3) / 4;
+	int blockSize = getBlockSize(format);
+	uint8_t block[16 * 4];
+
+	for (int by = 0; by < numBlocksY; ++by)
+	{
+		for (int bx = 0; bx < numBlocksX; ++bx)
+		{
+			loadBlock(image, width, height, numChannels, bx, by, block);
+			uint8_t* out = outData + (size_t(by) * numBlocksX + bx) * blockSize;
+
+			switch (format)
+			{
+			case RT_TEX_FORMAT_BC1:
+				encodeColorBlock(block, out);
+				break;
+			case RT_TEX_FORMAT_BC3:
+				encodeSingleChannelBlock(block, 3, out);
+				encodeColorBlock(block, out + 8);
+				break;
+			case RT_TEX_FORMAT_BC4:
+				encodeSingleChannelBlock(block, 0, out);
+				break;
+			case RT_TEX_FORMAT_BC5:
+				encodeSingleChannelBlock(block, 0, out);
+				encodeSingleChannelBlock(block, 1, out + 8);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
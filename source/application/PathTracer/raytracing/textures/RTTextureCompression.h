@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "RTTextures.h"
+
+/**
+* Block compression of textures for the device. The formats are decoded in textures.cl.
+* Each 4x4 texel block is stored in 8 bytes (BC1, BC4) or 16 bytes (BC3, BC5):
+* BC1 stores RGB, BC3 RGBA, BC4 R and BC5 RG.
+* The encoders favor speed: the endpoints are the inset bounding box of the block and each texel picks the closest
+* palette entry.
+*/
+namespace RTTextureCompression
+{
+	bool isBlockCompressed(RTTextureFormat format);
+
+	/**
+	* Size of a 4x4 block in bytes.
+	*/
+	int getBlockSize(RTTextureFormat format);
+
+	/**
+	* Chooses the block compressed format for an uncompressed format.
+	*/
+	RTTextureFormat getBlockCompressedFormat(RTTextureFormat format);
+
+	size_t computeCompressedSize(RTTextureFormat format, int width, int height);
+
+	/**
+	* Compresses the tightly packed image with numChannels channels per texel to the block compressed format.
+	* Blocks at the borders of images with a size that isn't a multiple of 4 are padded by clamping to the edge.
+	* @param outData Must hold computeCompressedSize(format, width, height) bytes.
+	*/
+	void compress(RTTextureFormat format, const uint8_t* image, int width, int height, int numChannels, uint8_t* outData);
+}
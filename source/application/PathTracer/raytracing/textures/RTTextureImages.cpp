@@ -0,0 +1,204 @@
+#include "RTTextureImages.h"
+#include "../system/PlatformManager.h"
+#include "../../GUI/PathTracingSettings.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+namespace
+{
+	cl_channel_order toCLChannelOrder(int numChannels)
+	{
+		switch (numChannels)
+		{
+		case 1: return CL_R;
+		case 2: return CL_RG;
+		default: return CL_RGBA;
+		}
+	}
+
+	size_t computeLayerSize(const RTTextureImageBucket& bucket)
+	{
+		return size_t(bucket.atlasWidth) * bucket.atlasHeight * bucket.numChannels;
+	}
+
+	template<class T>
+	T getDeviceInfo(cl_device_id device, cl_device_info info)
+	{
+		T value = T();
+		clGetDeviceInfo(device, info, sizeof(T), &value, nullptr);
+		return value;
+	}
+}
+
+RTImage2DArray RTImage2DArray::create(cl_context context, cl_channel_order channelOrder, size_t width, size_t height, size_t arraySize, const void* data)
+{
+	cl_int status = CL_SUCCESS;
+
+	cl_image_format format;
+	format.image_channel_order = channelOrder;
+	format.image_channel_data_type = CL_UNORM_INT8;
+
+	cl_image_desc desc;
+	desc.image_type = CL_MEM_OBJECT_IMAGE2D_ARRAY;
+	desc.image_width = width;
+	desc.image_height = height;
+	desc.image_depth = 0;
+	desc.image_array_size = arraySize;
+	desc.image_row_pitch = 0;
+	desc.image_slice_pitch = 0;
+	desc.num_mip_levels = 0;
+	desc.num_samples = 0;
+	desc.buffer = nullptr;
+
+	cl_mem deviceImg = clCreateImage(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &format, &desc, const_cast<void*>(data), &status);
+
+	ThrowIf(status != CL_SUCCESS, status, "clCreateImage for image2d_array failed");
+
+	RTImage2DArray image(deviceImg);
+
+	clReleaseMemObject(deviceImg);
+
+	return image;
+}
+
+RTImage2DArray::RTImage2DArray(cl_mem image)
+	: ReferenceCounter<cl_mem, clRetainMemObject, clReleaseMemObject>(image)
+{
+}
+
+bool RTTextureImages::isSupported(cl_device_id device)
+{
+	return getDeviceInfo<cl_bool>(device, CL_DEVICE_IMAGE_SUPPORT) == CL_TRUE;
+}
+
+bool RTTextureImages::isEnabled()
+{
+	CLWDevice* device = PlatformManager::getActiveDevice();
+	return PathTracerSettings::GI.useTextureImages && device && isSupported(device->GetID());
+}
+
+int RTTextureImages::getImageChannelCount(RTTextureFormat format)
+{
+	switch (format)
+	{
+	case RT_TEX_FORMAT_R8: return 1;
+	case RT_TEX_FORMAT_RG8: return 2;
+	case RT_TEX_FORMAT_RGB8:
+	case RT_TEX_FORMAT_RGBA8: return 4;
+	default: return 0;
+	}
+}
+
+void RTTextureImages::computeAtlasLayout(int width, int height, int numMipLevels, int& outAtlasWidth, int& outAtlasHeight, uint32_t* outMipOrigins)
+{
+	outAtlasWidth = width;
+	outAtlasHeight = height;
+
+	if (outMipOrigins)
+		outMipOrigins[0] = 0;
+
+	int y = 0;
+	for (int level = 1; level < numMipLevels; ++level)
+	{
+		int w = std::max(width >> level, 1);
+		int h = std::max(height >> level, 1);
+
+		if (outMipOrigins)
+			outMipOrigins[level] = uint32_t(width) | (uint32_t(y) << 16);
+
+		outAtlasWidth = std::max(outAtlasWidth, width + w);
+		y += h;
+	}
+
+	outAtlasHeight = std::max(outAtlasHeight, y);
+}
+
+std::vector<RTTextureImageBucket> RTTextureImages::createBuckets(const std::vector<RTTextureImageKey>& keys, cl_device_id device)
+{
+	std::map<std::tuple<int, int, int>, RTTextureImageBucket> bucketMap;
+	std::map<std::tuple<int, int, int>, int> bucketMipLevels;
+
+	for (int i = 0; i < static_cast<int>(keys.size()); ++i)
+	{
+		const RTTextureImageKey& key = keys[i];
+		if (key.numChannels == 0)
+			continue;
+
+		auto bucketKey = std::make_tuple(key.width, key.height, key.numChannels);
+		RTTextureImageBucket& bucket = bucketMap[bucketKey];
+		bucket.width = key.width;
+		bucket.height = key.height;
+		bucket.numChannels = key.numChannels;
+		bucket.textures.push_back(i);
+
+		int& numMipLevels = bucketMipLevels[bucketKey];
+		numMipLevels = std::max(numMipLevels, key.numMipLevels);
+	}
+
+	std::vector<RTTextureImageBucket> buckets;
+	for (auto& pair : bucketMap)
+	{
+		RTTextureImageBucket& bucket = pair.second;
+		computeAtlasLayout(bucket.width, bucket.height, bucketMipLevels[pair.first], bucket.atlasWidth, bucket.atlasHeight, nullptr);
+		buckets.push_back(std::move(bucket));
+	}
+
+	std::sort(buckets.begin(), buckets.end(), [](const RTTextureImageBucket& b0, const RTTextureImageBucket& b1)
+	{
+		return computeLayerSize(b0) * b0.textures.size() > computeLayerSize(b1) * b1.textures.size();
+	});
+
+	size_t maxWidth = getDeviceInfo<size_t>(device, CL_DEVICE_IMAGE2D_MAX_WIDTH);
+	size_t maxHeight = getDeviceInfo<size_t>(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT);
+	size_t maxArraySize = getDeviceInfo<size_t>(device, CL_DEVICE_IMAGE_MAX_ARRAY_SIZE);
+	cl_ulong maxAllocSize = getDeviceInfo<cl_ulong>(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE);
+
+	std::vector<RTTextureImageBucket> selectedBuckets;
+	for (auto& bucket : buckets)
+	{
+		if (selectedBuckets.size() == RT_MAX_TEXTURE_IMAGE_BUCKETS)
+			break;
+
+		if (size_t(bucket.atlasWidth) > maxWidth || size_t(bucket.atlasHeight) > maxHeight)
+			continue;
+
+		size_t layerSize = computeLayerSize(bucket);
+		size_t maxLayers = std::min(maxArraySize, size_t(maxAllocSize / layerSize));
+		if (maxLayers == 0)
+			continue;
+
+		if (bucket.textures.size() > maxLayers)
+			bucket.textures.resize(maxLayers);
+
+		bucket.data.resize(layerSize * bucket.textures.size());
+		selectedBuckets.push_back(std::move(bucket));
+	}
+
+	return selectedBuckets;
+}
+
+void RTTextureImages::copyMipLevel(RTTextureImageBucket& bucket, int layer, uint32_t origin, const uint8_t* levelData, int width, int height)
+{
+	size_t rowSize = size_t(width) * bucket.numChannels;
+	size_t atlasRowSize = size_t(bucket.atlasWidth) * bucket.numChannels;
+	uint8_t* layerData = bucket.data.data() + computeLayerSize(bucket) * layer;
+	size_t x = origin & 0xFFFF;
+	size_t y = origin >> 16;
+
+	for (int row = 0; row < height; ++row)
+		std::memcpy(layerData + (y + row) * atlasRowSize + x * bucket.numChannels, levelData + row * rowSize, rowSize);
+}
+
+RTImage2DArray RTTextureImages::createImage(cl_context context, const RTTextureImageBucket& bucket)
+{
+	return RTImage2DArray::create(context, toCLChannelOrder(bucket.numChannels), bucket.atlasWidth, bucket.atlasHeight,
+		bucket.textures.size(), bucket.data.data());
+}
+
+RTImage2DArray RTTextureImages::createDummyImage(cl_context context)
+{
+	uint8_t texel[4] = { 0, 0, 0, 0 };
+	return RTImage2DArray::create(context, CL_RGBA, 1, 1, 1, texel);
+}
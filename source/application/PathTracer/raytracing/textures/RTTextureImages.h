@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <CLW.h>
+#include "RTTextures.h"
+
+/**
+* Image backend of the device textures, used by the kernels with the RT_USE_TEXTURE_IMAGES build option.
+* Textures of the same size and channel order are grouped into buckets. A bucket is an image2d_array_t with one layer
+* per texture, reads go through the hardware sampler. R8 and RG8 textures are stored in CL_R and CL_RG images,
+* RGB8 and RGBA8 textures share CL_RGBA images because three channel images aren't supported.
+*
+* Each layer is a mip atlas: level 0 is at the origin and the smaller levels are stacked in a column to the right of it.
+* RTTextureDesc2D::mipOffsets stores the texel origins of the levels in the layer.
+*
+* There are at most RT_MAX_TEXTURE_IMAGE_BUCKETS buckets, the buckets with the most texture memory are chosen.
+* All other textures are stored in the texture buffer.
+*/
+class RTImage2DArray : public ReferenceCounter<cl_mem, clRetainMemObject, clReleaseMemObject>
+{
+public:
+	/**
+	* Creates a read only image array of 8 bit unsigned normalized channels initialized with data.
+	*/
+	static RTImage2DArray create(cl_context context, cl_channel_order channelOrder, size_t width, size_t height, size_t arraySize, const void* data);
+
+	RTImage2DArray() = default;
+
+private:
+	explicit RTImage2DArray(cl_mem image);
+};
+
+struct RTTextureImageKey
+{
+	int width = 0;
+	int height = 0;
+	int numChannels = 0; // 0 if the texture can't be stored in an image
+	int numMipLevels = 0;
+};
+
+struct RTTextureImageBucket
+{
+	int width = 0;
+	int height = 0;
+	int numChannels = 0;
+	int atlasWidth = 0;
+	int atlasHeight = 0;
+	std::vector<int> textures; // Texture index per layer
+	std::vector<uint8_t> data;
+};
+
+namespace RTTextureImages
+{
+	bool isSupported(cl_device_id device);
+
+	/**
+	* True if the backend is enabled in the settings and the active device supports images.
+	* It's a build option of the kernels which is set when the path tracer is started.
+	*/
+	bool isEnabled();
+
+	/**
+	* Number of channels of the image that stores a texture with the given uncompressed format.
+	*/
+	int getImageChannelCount(RTTextureFormat format);
+
+	/**
+	* Computes the size of a layer and the texel origins (x | y << 16) of the mip levels in it.
+	* @param outMipOrigins Must hold numMipLevels entries, may be null.
+	*/
+	void computeAtlasLayout(int width, int height, int numMipLevels, int& outAtlasWidth, int& outAtlasHeight, uint32_t* outMipOrigins);
+
+	/**
+	* Groups the textures by size and channel count and keeps the RT_MAX_TEXTURE_IMAGE_BUCKETS buckets with the most
+	* memory. Layers that exceed the image limits of the device are dropped, these textures use the texture buffer.
+	* The layer data of the buckets is allocated but not filled.
+	*/
+	std::vector<RTTextureImageBucket> createBuckets(const std::vector<RTTextureImageKey>& keys, cl_device_id device);
+
+	/**
+	* Copies a tightly packed mip level with the channel count of the bucket to its origin in the layer.
+	*/
+	void copyMipLevel(RTTextureImageBucket& bucket, int layer, uint32_t origin, const uint8_t* levelData, int width, int height);
+
+	RTImage2DArray createImage(cl_context context, const RTTextureImageBucket& bucket);
+
+	/**
+	* Placeholder for unused bucket arguments of the kernels.
+	*/
+	RTImage2DArray createDummyImage(cl_context context);
+}
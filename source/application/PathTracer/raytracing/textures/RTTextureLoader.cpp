@@ -0,0 +1,107 @@
+#include "RTTextureLoader.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <thread>
+
+bool RTTextureLoader::load(const RTHostTextureRequest& request, RTHostTexture& outTexture)
+{
+	outTexture = RTHostTexture();
+
+	if (request.path.empty() || request.numChannels < 1 || request.numChannels > 4)
+		return false;
+
+	int width, height, fileChannels;
+	uint8_t* data = stbi_load(request.path.c_str(), &width, &height, &fileChannels, request.numChannels);
+	if (!data)
+		return false;
+
+	outTexture.width = width;
+	outTexture.height = height;
+	outTexture.numChannels = request.numChannels;
+	outTexture.levels.resize(std::max(request.numMipLevels, 1));
+
+	// The GL textures are loaded upside down
+	size_t rowSize = size_t(width) * request.numChannels;
+	std::vector<uint8_t>& baseLevel = outTexture.levels[0];
+	baseLevel.resize(rowSize * height);
+	for (int y = 0; y < height; ++y)
+		std::memcpy(baseLevel.data() + y * rowSize, data + (height - 1 - y) * rowSize, rowSize);
+
+	stbi_image_free(data);
+
+	int w = width;
+	int h = height;
+	for (size_t level = 1; level < outTexture.levels.size(); ++level)
+	{
+		generateMipLevel(outTexture.levels[level - 1].data(), w, h, request.numChannels, outTexture.levels[level]);
+		w = std::max(w / 2, 1);
+		h = std::max(h / 2, 1);
+	}
+
+	return true;
+}
+
+std::vector<RTHostTexture> RTTextureLoader::loadParallel(const std::vector<RTHostTextureRequest>& requests)
+{
+	std::vector<RTHostTexture> textures(requests.size());
+	std::atomic<size_t> nextRequest(0);
+
+	auto worker = [&]()
+	{
+		for (size_t i = nextRequest++; i < requests.size(); i = nextRequest++)
+			load(requests[i], textures[i]);
+	};
+
+	size_t numWorkers = std::min(size_t(std::max(std::thread::hardware_concurrency(), 1u)), requests.size());
+	std::vector<std::future<void>> futures;
+	for (size_t i = 1; i < numWorkers; ++i)
+		futures.push_back(std::async(std::launch::async, worker));
+
+	worker();
+
+	for (auto& future : futures)
+		future.wait();
+
+	return textures;
+}
+
+void RTTextureLoader::generateMipLevel(const uint8_t* src, int width, int height, int numChannels, std::vector<uint8_t>& outLevel)
+{
+	int levelWidth = std::max(width / 2, 1);
+	int levelHeight = std::max(height / 2, 1);
+	outLevel.resize(size_t(levelWidth) * levelHeight * numChannels);
+
+	for (int y = 0; y < levelHeight; ++y)
+	{
+		int y0 = std::min(2 * y, height - 1);
+		int y1 = std::min(2 * y + 1, height - 1);
+
+		for (int x = 0; x < levelWidth; ++x)
+		{
+			int x0 = std::min(2 * x, width - 1);
+			int x1 = std::min(2 * x + 1, width - 1);
+
+			for (int c = 0; c < numChannels; ++c)
+			{
+				int sum = src[(size_t(y0) * width + x0) * numChannels + c] + src[(size_t(y0) * width + x1) * numChannels + c] +
+						  src[(size_t(y1) * width + x0) * numChannels + c] + src[(size_t(y1) * width + x1) * numChannels + c];
+				outLevel[(size_t(y) * levelWidth + x) * numChannels + c] = static_cast<uint8_t>((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+void RTTextureLoader::expandRGBToRGBA(const uint8_t* src, size_t numTexels, std::vector<uint8_t>& outTexels)
+{
+	outTexels.resize(numTexels * 4);
+	for (size_t i = 0; i < numTexels; ++i)
+	{
+		outTexels[i * 4] = src[i * 3];
+		outTexels[i * 4 + 1] = src[i * 3 + 1];
+		outTexels[i * 4 + 2] = src[i * 3 + 2];
+		outTexels[i * 4 + 3] = 255;
+	}
+}
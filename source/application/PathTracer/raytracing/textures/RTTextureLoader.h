@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+* Decodes texture files and generates their mip chain on the host which avoids reading the textures back from GL.
+* The images are flipped vertically to match the GL textures and the mip levels are box filtered like glGenerateMipmap.
+*/
+struct RTHostTexture
+{
+	int width = 0;
+	int height = 0;
+	int numChannels = 0;
+	std::vector<std::vector<uint8_t>> levels; // Tightly packed, empty if the file couldn't be decoded
+
+	bool isValid() const { return !levels.empty(); }
+};
+
+struct RTHostTextureRequest
+{
+	std::string path;
+	int numChannels = 0;
+	int numMipLevels = 1;
+};
+
+namespace RTTextureLoader
+{
+	/**
+	* Returns false if the file can't be decoded, e.g. pre-compressed DDS files.
+	*/
+	bool load(const RTHostTextureRequest& request, RTHostTexture& outTexture);
+
+	/**
+	* Loads the textures in parallel on all hardware threads.
+	*/
+	std::vector<RTHostTexture> loadParallel(const std::vector<RTHostTextureRequest>& requests);
+
+	/**
+	* Halves the size of the level with a 2x2 box filter. Odd sizes clamp to the last row/column.
+	*/
+	void generateMipLevel(const uint8_t* src, int width, int height, int numChannels, std::vector<uint8_t>& outLevel);
+
+	/**
+	* Converts tightly packed RGB texels to RGBA with an alpha of 255.
+	*/
+	void expandRGBToRGBA(const uint8_t* src, size_t numTexels, std::vector<uint8_t>& outTexels);
+}
@@ -1,5 +1,11 @@
 #pragma once
 
+// Texture sizes are stored with 16 bits which limits the number of mip levels
+#define RT_MAX_TEXTURE_MIP_LEVELS 16
+
+// Number of image2d_array_t scene arguments of the kernels, see RTTextureImages.h
+#define RT_MAX_TEXTURE_IMAGE_BUCKETS 8
+
 struct RTTextureDesc2D
 {
 	uint16_t width;
@@ -7,8 +13,15 @@ struct RTTextureDesc2D
 	uint16_t numMipLevels;
 	uint16_t format;
 	uint16_t wrap;
-	uint16_t pad;
+	uint16_t texelStride; // In bytes, for block compressed formats the size of a 4x4 block
+	int16_t imageBucket; // RT_INVALID_ID if the texture is stored in the texture buffer
+	uint16_t imageLayer;
 	uint32_t memOffset; // Byte offset
+	// Byte offset of the page table entries of a virtual texture, RT_INVALID_ID if the texels are stored at memOffset
+	int32_t pageTableOffset;
+	// Byte offsets of the mip levels relative to memOffset (or pageTableOffset for virtual textures),
+	// for image textures the texel origin (x | y << 16) in the layer
+	uint32_t mipOffsets[RT_MAX_TEXTURE_MIP_LEVELS];
 };
 
 enum RTTextureWrapping
@@ -24,5 +37,10 @@ enum RTTextureFormat
 	RT_TEX_FORMAT_R8,
 	RT_TEX_FORMAT_RG8,
 	RT_TEX_FORMAT_RGB8,
-	RT_TEX_FORMAT_RGBA8
+	RT_TEX_FORMAT_RGBA8,
+	// Block compressed formats, see RTTextureCompression.h
+	RT_TEX_FORMAT_BC1,
+	RT_TEX_FORMAT_BC3,
+	RT_TEX_FORMAT_BC4,
+	RT_TEX_FORMAT_BC5
 };
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "RTVirtualTextures.h"
+#include "RTTextureCompression.h"
+#include "../system/RTBufferManager.h"
+#include <engine/util/Logger.h>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	int computeNumTiles(int size)
+	{
+		return (size + RT_VT_TILE_SIZE - 1) / RT_VT_TILE_SIZE;
+	}
+
+	/**
+	* Block compressed formats are tiled in units of 4x4 blocks, all others in units of texels.
+	*/
+	int getUnitSize(const RTTextureDesc2D& texDesc)
+	{
+		return RTTextureCompression::isBlockCompressed(static_cast<RTTextureFormat>(texDesc.format)) ? 4 : 1;
+	}
+}
+
+void RTVirtualTextures::clear()
+{
+	m_tiles.clear();
+	m_pageTable.clear();
+	m_tileData.clear();
+	m_slotTiles.clear();
+	m_feedback.clear();
+	m_poolOffset = 0;
+	m_frame = 0;
+}
+
+void RTVirtualTextures::addTexture(RTTextureDesc2D& texDesc)
+{
+	texDesc.pageTableOffset = static_cast<int32_t>(m_pageTable.size() * sizeof(uint32_t));
+
+	for (int level = 0; level < texDesc.numMipLevels; ++level)
+	{
+		int numTiles = computeNumTiles(std::max(texDesc.width >> level, 1)) * computeNumTiles(std::max(texDesc.height >> level, 1));
+		texDesc.mipOffsets[level] = static_cast<uint32_t>(m_pageTable.size() * sizeof(uint32_t) - texDesc.pageTableOffset);
+
+		Tile tile;
+		tile.level = static_cast<uint16_t>(level);
+		tile.isPinned = numTiles == 1 || level == texDesc.numMipLevels - 1;
+		m_tiles.insert(m_tiles.end(), numTiles, tile);
+		m_pageTable.insert(m_pageTable.end(), numTiles, RT_VT_TILE_NOT_RESIDENT);
+	}
+}
+
+void RTVirtualTextures::addLevel(const RTTextureDesc2D& texDesc, int level, const uint8_t* levelData)
+{
+	int unitSize = getUnitSize(texDesc);
+	int width = std::max(texDesc.width >> level, 1);
+	int height = std::max(texDesc.height >> level, 1);
+	int numTilesX = computeNumTiles(width);
+	int numTilesY = computeNumTiles(height);
+
+	// Size of the level, the tiles and a row of units in bytes
+	int numUnitsX = (width + unitSize - 1) / unitSize;
+	int numUnitsY = (height + unitSize - 1) / unitSize;
+	int tileUnits = RT_VT_TILE_SIZE / unitSize;
+	size_t rowSize = size_t(numUnitsX) * texDesc.texelStride;
+	size_t tileRowSize = size_t(tileUnits) * texDesc.texelStride;
+	uint32_t tileSize = static_cast<uint32_t>(tileRowSize * tileUnits);
+
+	size_t firstTile = (texDesc.pageTableOffset + texDesc.mipOffsets[level]) / sizeof(uint32_t);
+
+	for (int ty = 0; ty < numTilesY; ++ty)
+	{
+		for (int tx = 0; tx < numTilesX; ++tx)
+		{
+			Tile& tile = m_tiles[firstTile + ty * numTilesX + tx];
+			tile.hostOffset = m_tileData.size();
+			tile.size = tileSize;
+
+			// Tiles at the border of the level are padded with zeros
+			m_tileData.resize(m_tileData.size() + tileSize, 0);
+			uint8_t* tileData = m_tileData.data() + tile.hostOffset;
+
+			int startX = tx * tileUnits;
+			int startY = ty * tileUnits;
+			int numRows = std::min(tileUnits, numUnitsY - startY);
+			size_t copySize = size_t(std::min(tileUnits, numUnitsX - startX)) * texDesc.texelStride;
+
+			for (int row = 0; row < numRows; ++row)
+				std::memcpy(tileData + row * tileRowSize, levelData + (startY + row) * rowSize + startX * texDesc.texelStride, copySize);
+		}
+	}
+}
+
+void RTVirtualTextures::createDeviceBuffers(size_t budget, CLWBuffer<unsigned char>& outTexData, CLWBuffer<uint32_t>& outFeedback)
+{
+	size_t numPinnedTiles = std::count_if(m_tiles.begin(), m_tiles.end(), [](const Tile& tile) { return tile.isPinned; });
+	size_t numSlots = std::min(std::max(budget / RT_VT_TILE_SLOT_SIZE, numPinnedTiles), m_tiles.size());
+
+	if (numPinnedTiles * RT_VT_TILE_SLOT_SIZE > budget)
+		LOG("Warning: The pinned tiles of the virtual textures exceed the texture budget of " << budget << " bytes.");
+
+	// Slots are aligned to 16 bytes for the block compressed formats
+	m_poolOffset = (m_pageTable.size() * sizeof(uint32_t) + 15) & ~size_t(15);
+	m_slotTiles.assign(numSlots, RT_INVALID_ID);
+
+	// Pinned tiles first, then coarse to fine
+	std::vector<int> tileOrder(m_tiles.size());
+	for (size_t i = 0; i < tileOrder.size(); ++i)
+		tileOrder[i] = static_cast<int>(i);
+
+	std::stable_sort(tileOrder.begin(), tileOrder.end(), [this](int t0, int t1)
+	{
+		if (m_tiles[t0].isPinned != m_tiles[t1].isPinned)
+			return m_tiles[t0].isPinned;
+
+		return m_tiles[t0].level > m_tiles[t1].level;
+	});
+
+	std::vector<uint8_t> deviceData(m_poolOffset + numSlots * RT_VT_TILE_SLOT_SIZE, 0);
+	for (size_t slot = 0; slot < numSlots; ++slot)
+	{
+		int tileIdx = tileOrder[slot];
+		Tile& tile = m_tiles[tileIdx];
+		tile.slot = static_cast<int>(slot);
+		m_slotTiles[slot] = tileIdx;
+		m_pageTable[tileIdx] = static_cast<uint32_t>(getSlotOffset(tile.slot));
+		std::memcpy(deviceData.data() + getSlotOffset(tile.slot), m_tileData.data() + tile.hostOffset, tile.size);
+	}
+
+	std::memcpy(deviceData.data(), m_pageTable.data(), m_pageTable.size() * sizeof(uint32_t));
+
+	outTexData = RTBufferManager::createBuffer<unsigned char>(CL_MEM_READ_ONLY, deviceData.size(), deviceData.data());
+
+	m_feedback.assign(m_pageTable.size(), 0);
+	outFeedback = RTBufferManager::createBuffer<uint32_t>(CL_MEM_READ_WRITE, m_feedback.size(), m_feedback.data());
+}
+
+void RTVirtualTextures::update(const CLWContext& context, const CLWBuffer<unsigned char>& texData, const CLWBuffer<uint32_t>& feedback)
+{
+	if (m_tiles.empty())
+		return;
+
+	++m_frame;
+	context.ReadBuffer(0, feedback, m_feedback.data(), m_feedback.size()).Wait();
+
+	std::vector<int> requestedTiles;
+	for (size_t i = 0; i < m_feedback.size(); ++i)
+	{
+		if (m_feedback[i] == RT_VT_FEEDBACK_USED)
+			m_tiles[i].lastUsedFrame = m_frame;
+		else if (m_feedback[i] == RT_VT_FEEDBACK_REQUESTED && m_tiles[i].slot == RT_INVALID_ID)
+			requestedTiles.push_back(static_cast<int>(i));
+	}
+
+	context.FillBuffer(0, feedback, 0u, m_feedback.size());
+
+	if (requestedTiles.empty())
+		return;
+
+	// Coarse levels first, they are the fallback of the finer levels
+	std::stable_sort(requestedTiles.begin(), requestedTiles.end(), [this](int t0, int t1)
+	{
+		return m_tiles[t0].level > m_tiles[t1].level;
+	});
+
+	// Free slots followed by the slots of the least recently used tiles, tiles used in the last frame are kept
+	std::vector<int> candidateSlots;
+	for (size_t slot = 0; slot < m_slotTiles.size(); ++slot)
+	{
+		int tileIdx = m_slotTiles[slot];
+		if (tileIdx == RT_INVALID_ID || (!m_tiles[tileIdx].isPinned && m_tiles[tileIdx].lastUsedFrame < m_frame))
+			candidateSlots.push_back(static_cast<int>(slot));
+	}
+
+	std::sort(candidateSlots.begin(), candidateSlots.end(), [this](int s0, int s1)
+	{
+		uint32_t lastUsed0 = m_slotTiles[s0] == RT_INVALID_ID ? 0 : m_tiles[m_slotTiles[s0]].lastUsedFrame + 1;
+		uint32_t lastUsed1 = m_slotTiles[s1] == RT_INVALID_ID ? 0 : m_tiles[m_slotTiles[s1]].lastUsedFrame + 1;
+		return lastUsed0 < lastUsed1;
+	});
+
+	size_t numUploads = std::min({ requestedTiles.size(), candidateSlots.size(), size_t(RT_VT_MAX_TILE_UPLOADS_PER_FRAME) });
+	size_t minEntry = m_pageTable.size();
+	size_t maxEntry = 0;
+
+	for (size_t i = 0; i < numUploads; ++i)
+	{
+		int tileIdx = requestedTiles[i];
+		int slot = candidateSlots[i];
+		int evictedTileIdx = m_slotTiles[slot];
+
+		if (evictedTileIdx != RT_INVALID_ID)
+		{
+			m_tiles[evictedTileIdx].slot = RT_INVALID_ID;
+			m_pageTable[evictedTileIdx] = RT_VT_TILE_NOT_RESIDENT;
+			minEntry = std::min(minEntry, size_t(evictedTileIdx));
+			maxEntry = std::max(maxEntry, size_t(evictedTileIdx));
+		}
+
+		Tile& tile = m_tiles[tileIdx];
+		tile.slot = slot;
+		tile.lastUsedFrame = m_frame;
+		m_slotTiles[slot] = tileIdx;
+		m_pageTable[tileIdx] = static_cast<uint32_t>(getSlotOffset(slot));
+		minEntry = std::min(minEntry, size_t(tileIdx));
+		maxEntry = std::max(maxEntry, size_t(tileIdx));
+
+		context.WriteBuffer(0, texData, m_tileData.data() + tile.hostOffset, getSlotOffset(slot), tile.size);
+	}
+
+	if (numUploads > 0)
+	{
+		const uint8_t* pageTableData = reinterpret_cast<const uint8_t*>(m_pageTable.data());
+		context.WriteBuffer(0, texData, pageTableData + minEntry * sizeof(uint32_t), minEntry * sizeof(uint32_t),
+			(maxEntry - minEntry + 1) * sizeof(uint32_t)).Wait();
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <CLW.h>
+#include <kernel_data.h>
+#include "RTTextures.h"
+
+// Limits the stall in between frames: 4 MB for uncompressed RGBA8 tiles
+#define RT_VT_MAX_TILE_UPLOADS_PER_FRAME 256
+
+/**
+* Virtual textures bound the device memory of the textures by a budget. The mip levels are split into tiles of
+* RT_VT_TILE_SIZE^2 texels (stored in the format of the texture) which are kept on the host. The texture buffer
+* of the device starts with a page table followed by a pool of tile slots of RT_VT_TILE_SLOT_SIZE bytes.
+* A page table entry is the byte offset of the slot of a tile in the texture buffer or RT_VT_TILE_NOT_RESIDENT.
+*
+* Kernels mark the tiles they use and request missing tiles in a feedback buffer with one entry per page table entry.
+* They read from the finest resident level meanwhile. The tiles of the coarsest level and of all levels that fit into
+* one tile are pinned, a fallback level always exists.
+* In between frames the requested tiles are streamed into free slots or replace the least recently used tiles.
+*/
+class RTVirtualTextures
+{
+	struct Tile
+	{
+		size_t hostOffset = 0;
+		uint32_t size = 0;
+		uint16_t level = 0;
+		bool isPinned = false;
+		int slot = RT_INVALID_ID;
+		uint32_t lastUsedFrame = 0;
+	};
+public:
+	void clear();
+
+	/**
+	* Adds the page table entries of a texture: sets pageTableOffset and the mipOffsets of texDesc.
+	*/
+	void addTexture(RTTextureDesc2D& texDesc);
+
+	/**
+	* Splits a level of the texture into tiles. levelData is tightly packed in the format of the texture.
+	*/
+	void addLevel(const RTTextureDesc2D& texDesc, int level, const uint8_t* levelData);
+
+	/**
+	* Creates the texture buffer with a pool of budget bytes (at least large enough for the pinned tiles) and the
+	* feedback buffer. The pinned tiles are made resident followed by as many tiles as fit, coarse levels first.
+	*/
+	void createDeviceBuffers(size_t budget, CLWBuffer<unsigned char>& outTexData, CLWBuffer<uint32_t>& outFeedback);
+
+	/**
+	* Reads the feedback of the kernels since the last call and streams up to RT_VT_MAX_TILE_UPLOADS_PER_FRAME requested tiles.
+	*/
+	void update(const CLWContext& context, const CLWBuffer<unsigned char>& texData, const CLWBuffer<uint32_t>& feedback);
+
+	bool isEmpty() const { return m_tiles.empty(); }
+
+private:
+	size_t getSlotOffset(int slot) const { return m_poolOffset + size_t(slot) * RT_VT_TILE_SLOT_SIZE; }
+
+	std::vector<Tile> m_tiles; // One tile per page table entry
+	std::vector<uint32_t> m_pageTable;
+	std::vector<uint8_t> m_tileData;
+	std::vector<int> m_slotTiles; // Tile per slot, RT_INVALID_ID if free
+	std::vector<uint32_t> m_feedback;
+	size_t m_poolOffset = 0;
+	uint32_t m_frame = 0;
+};
@@ -1,6 +1,9 @@
 #pragma once
 #include "radeon_rays.h"
 #include <glm/glm.hpp>
+#include <CLW.h>
+#include <kernel_data.h>
+#include <cmath>
 
 namespace CLHelper
 {
@@ -29,6 +32,47 @@ namespace CLHelper
 			mat[0][3], mat[1][3], mat[2][3], mat[3][3]);
 	}
 
+	/**
+	* Octahedral encoding of a unit vector to [-1,1]^2, decoded by decodeOctahedral in vertices.cl.
+	*/
+	inline glm::vec2 encodeOctahedral(glm::vec3 v)
+	{
+		float sum = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+		if (sum == 0.0f)
+			return glm::vec2(0.0f);
+
+		v /= sum;
+		glm::vec2 e(v.x, v.y);
+		if (v.z < 0.0f)
+		{
+			e.x = (1.0f - std::abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f);
+			e.y = (1.0f - std::abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f);
+		}
+
+		return e;
+	}
+
+	/**
+	* Packs the vertex attributes into the device vertex format, see RTVertex.
+	* The binormal only contributes its handedness, the kernels reconstruct it from the normal and the tangent.
+	*/
+	inline RTVertex packVertex(const glm::vec3& position, const glm::vec2& uv, const glm::vec3& normal, const glm::vec3& tangent, const glm::vec3& binormal)
+	{
+		RTVertex vertex;
+		vertex.px = position.x;
+		vertex.py = position.y;
+		vertex.pz = position.z;
+		vertex.normal = glm::packUnorm2x16(encodeOctahedral(normal) * 0.5f + 0.5f);
+		vertex.uv = glm::packHalf2x16(uv);
+
+		glm::vec2 t = glm::clamp(encodeOctahedral(tangent) * 0.5f + 0.5f, 0.0f, 1.0f);
+		vertex.tangent = static_cast<uint32_t>(std::round(t.x * 32767.0f)) | (static_cast<uint32_t>(std::round(t.y * 32767.0f)) << 15);
+		if (glm::dot(glm::cross(normal, tangent), binormal) < 0.0f)
+			vertex.tangent |= 0x80000000u;
+
+		return vertex;
+	}
+
 	template<class T>
 	CLWBuffer<T> createBuffer(cl_context context, cl_mem_flags flags, size_t elementCount, size_t& outUsedMemory, void* data = nullptr)
 	{
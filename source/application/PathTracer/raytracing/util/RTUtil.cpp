@@ -1,4 +1,5 @@
 #include "RTUtil.h"
+#include <cmath>
 #include "../../GUI/PathTracingSettings.h"
 #include "../../../../engine/globals.h"
 #include "../../../../engine/geometry/Ray.h"
@@ -39,3 +40,10 @@ Ray RTUtil::screenToRay(const glm::vec3& p)
 
 	return Ray(glm::vec3(start), glm::normalize(glm::vec3(end - start)));
 }
+
+float RTUtil::computePixelSpreadAngle(float imageWidth, float imageHeight, float nearClipPlane)
+{
+	glm::vec3 d0 = screenToRay(glm::vec3(imageWidth * 0.5f, imageHeight * 0.5f, nearClipPlane)).direction;
+	glm::vec3 d1 = screenToRay(glm::vec3(imageWidth * 0.5f, imageHeight * 0.5f + 1.0f, nearClipPlane)).direction;
+	return std::acos(glm::clamp(glm::dot(d0, d1), -1.0f, 1.0f));
+}
@@ -7,4 +7,10 @@ namespace RTUtil
 	* pixelOffset is jittering for TAA.
 	*/	
 	Ray screenToRay(const glm::vec3& p);
+
+	/**
+	* Angle between the rays through the centers of two vertically neighbouring pixels at the center of the image.
+	* Used as the initial spread angle of the ray cones of camera paths.
+	*/
+	float computePixelSpreadAngle(float imageWidth, float imageHeight, float nearClipPlane);
 }
\ No newline at end of file
@@ -68,6 +68,7 @@ void Texture2D::create(GLsizei width, GLsizei height, GLint internalFormat, GLen
         m_glId = 0;
     }
 
+    m_path.clear();
     m_target = GL_TEXTURE_2D;
     m_format = format;
     m_internalFormat = internalFormat;
@@ -150,6 +151,8 @@ void Texture2D::load(const std::string& path, Texture2DSettings settings, bool k
 		return;
 	}
 
+    m_path = trimmedPath;
+
     glBindTexture(m_target, m_glId);
 
     switch (m_channels)
@@ -46,6 +46,11 @@ public:
 
     GLenum getTextureFormat() const { return m_format; }
 
+    /**
+    * The file the texture was loaded from, empty for textures created in memory.
+    */
+    const std::string& getPath() const { return m_path; }
+
     bool isValid() const { return m_glId != 0; }
 
     void setParameteri(GLenum name, GLint value) const;
@@ -72,4 +77,5 @@ private:
     GLint m_internalFormat{0};
     GLenum m_pixelType{0};
     GLenum m_target{0};
+    std::string m_path;
 };
@@ -6,6 +6,7 @@
 #include "GeometryGenerator.h"
 #include <engine/util/util.h>
 #include "MeshBuilder.h"
+#include <cstring>
 
 Mesh::~Mesh()
 {
@@ -124,6 +125,10 @@ void Mesh::finalize()
 {
     freeGLResources();
 
+    m_contentHashes.resize(m_subMeshes.size());
+    for (size_t mi = 0; mi < m_subMeshes.size(); ++mi)
+        m_contentHashes[mi] = computeContentHash(m_subMeshes[mi]);
+
     // Go through all submeshes and create ibos/vbos/vaos
     for (size_t mi = 0; mi < m_subMeshes.size(); ++mi)
     {
@@ -300,6 +305,46 @@ void Mesh::mapToUnitCube(SubMesh& subMesh)
 		subMesh.vertices[i] = (subMesh.vertices[i] + offset) * scaleInv;
 }
 
+size_t Mesh::computeContentHash(const SubMesh& subMesh)
+{
+	// FNV-1a over 64 bit words followed by the remaining bytes
+	uint64_t hash = 14695981039346656037ull;
+	auto hashBytes = [&hash](const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+		{
+			uint64_t word;
+			std::memcpy(&word, bytes + i, sizeof(uint64_t));
+			hash = (hash ^ word) * 1099511628211ull;
+		}
+
+		for (; i < size; ++i)
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+	};
+
+	size_t sizes[2] = { subMesh.vertices.size(), subMesh.indices.size() };
+	hashBytes(sizes, sizeof(sizes));
+	hashBytes(subMesh.vertices.data(), subMesh.vertices.size() * sizeof(glm::vec3));
+	hashBytes(subMesh.indices.data(), subMesh.indices.size() * sizeof(IndexType));
+
+	return static_cast<size_t>(hash);
+}
+
+bool Mesh::hasEqualContent(const SubMesh& subMesh0, const SubMesh& subMesh1)
+{
+	return subMesh0.indices == subMesh1.indices && subMesh0.vertices == subMesh1.vertices && subMesh0.normals == subMesh1.normals &&
+		subMesh0.tangents == subMesh1.tangents && subMesh0.bitangents == subMesh1.bitangents && subMesh0.uvs == subMesh1.uvs &&
+		subMesh0.colors == subMesh1.colors;
+}
+
+size_t Mesh::getContentHash(size_t subMeshIdx) const
+{
+    // Meshes that were never finalized are hashed on demand
+    return subMeshIdx < m_contentHashes.size() ? m_contentHashes[subMeshIdx] : computeContentHash(m_subMeshes[subMeshIdx]);
+}
+
 void Mesh::ensureCapacity(SubMeshIndex subMeshIdx)
 {
     m_subMeshes.resize(subMeshIdx + 1);
@@ -76,6 +76,11 @@ public:
 
     const std::vector<SubMesh>& getSubMeshes() const { return m_subMeshes; }
 
+    /**
+    * The content hash of the submesh, see computeContentHash. The hashes are computed by finalize.
+    */
+    size_t getContentHash(size_t subMeshIdx) const;
+
     glm::vec3 computeCenter() const;
 
     void scale(const glm::vec3& s);
@@ -93,6 +98,16 @@ public:
 
 	static void scale(SubMesh& subMesh, const glm::vec3& s);
 	static void mapToUnitCube(SubMesh& subMesh);
+
+	/**
+	* Hash of the vertex positions and indices of the submesh. Submeshes with equal content have equal hashes.
+	*/
+	static size_t computeContentHash(const SubMesh& subMesh);
+
+	/**
+	* Compares all vertex attributes and indices.
+	*/
+	static bool hasEqualContent(const SubMesh& subMesh0, const SubMesh& subMesh1);
 private:
     void ensureCapacity(SubMeshIndex subMeshIdx);
     void ensureIntegrity();
@@ -101,4 +116,5 @@ private:
 private:
     std::vector<SubMesh> m_subMeshes;
     std::vector<SubMeshRenderData> m_subMeshRenderData;
+    std::vector<size_t> m_contentHashes;
 };
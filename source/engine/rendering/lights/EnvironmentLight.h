@@ -0,0 +1,33 @@
+#pragma once
+#include <engine/ecs/ECS.h>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+#include <imgui/imgui.h>
+#include <engine/util/file.h>
+
+/**
+* Infinite light surrounding the scene defined by an HDR image in lat-long format.
+*/
+class EnvironmentLight : public Component
+{
+public:
+	EnvironmentLight() { }
+
+	void onShowInEditor() override
+	{
+		ImGui::ColorEdit3("Color", &color[0]);
+		ImGui::DragFloat("Intensity", &intensity, 0.01f, 0.0f, 30.0f);
+		ImGui::Text("HDR Map");
+		ImGui::SameLine();
+		if (ImGui::Button(filePath == "" ? "..." : filePath.c_str()))
+		{
+			file::openFileDialog("hdr", "", filePath);
+		}
+	}
+
+	std::string getName() const override { return "Environment Light"; }
+
+	glm::vec3 color{ 1.0f };
+	float intensity{ 1.0f };
+	std::string filePath;
+};
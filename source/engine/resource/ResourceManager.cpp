@@ -18,6 +18,7 @@ std::unordered_map<std::string, std::shared_ptr<Model>> ResourceManager::m_model
 std::unordered_map<ShaderKey, std::shared_ptr<Shader>> ResourceManager::m_shaders;
 
 std::unordered_map<Model*, std::shared_ptr<Mesh>> ResourceManager::m_meshes;
+std::unordered_multimap<size_t, std::weak_ptr<Mesh>> ResourceManager::m_meshesByContent;
 
 std::unordered_map<std::string, std::string> ResourceManager::m_shaderIncludes;
 
@@ -168,8 +169,48 @@ std::shared_ptr<Mesh> ResourceManager::getMesh(Model* model)
 	if (it != m_meshes.end())
 		return it->second;
 
+	// Models with identical geometry share a mesh. Submeshes with identical geometry are instanced by the path tracer.
+	// Only identical content matches: copies of a model node that differ by a translation of all of its submeshes match
+	// if the import centers the nodes (translationAsModelCenter), copies that differ by any other transform don't.
+	std::vector<size_t> subMeshHashes(model->subMeshes.size());
+	size_t contentHash = model->subMeshes.size();
+	for (size_t i = 0; i < model->subMeshes.size(); ++i)
+	{
+		subMeshHashes[i] = Mesh::computeContentHash(model->subMeshes[i]);
+		contentHash = contentHash * 31 + subMeshHashes[i];
+	}
+
+	auto range = m_meshesByContent.equal_range(contentHash);
+	for (auto contentIt = range.first; contentIt != range.second;)
+	{
+		// Meshes of unloaded models are released
+		auto sharedMesh = contentIt->second.lock();
+		if (!sharedMesh)
+		{
+			contentIt = m_meshesByContent.erase(contentIt);
+			continue;
+		}
+
+		auto& subMeshes = sharedMesh->getSubMeshes();
+		bool isEqual = subMeshes.size() == model->subMeshes.size();
+		for (size_t i = 0; isEqual && i < subMeshes.size(); ++i)
+			isEqual = sharedMesh->getContentHash(i) == subMeshHashes[i] && Mesh::hasEqualContent(subMeshes[i], model->subMeshes[i]);
+
+		if (isEqual)
+		{
+			m_meshes[model] = sharedMesh;
+			return sharedMesh;
+		}
+
+		++contentIt;
+	}
+
 	auto mesh = model->createMesh();
 	m_meshes[model] = mesh;
+
+	if (mesh)
+		m_meshesByContent.emplace(contentHash, mesh);
+
 	return mesh;
 }
 
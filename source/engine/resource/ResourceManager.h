@@ -104,6 +104,8 @@ private:
     static std::unordered_map<std::string, std::shared_ptr<Model>> m_models;
     static std::unordered_map<ShaderKey, std::shared_ptr<Shader>> m_shaders;
 	static std::unordered_map<Model*, std::shared_ptr<Mesh>> m_meshes;
+	// Meshes by the combined content hashes of their submeshes, models with identical geometry share a mesh
+	static std::unordered_multimap<size_t, std::weak_ptr<Mesh>> m_meshesByContent;
 
     static std::unordered_map<std::string, std::string> m_shaderIncludes;
 
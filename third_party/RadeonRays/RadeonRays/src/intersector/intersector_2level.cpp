@@ -32,6 +32,8 @@ THE SOFTWARE.
 
 #include <memory>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 
 static int const kWorkGroupSize = 64;
 
@@ -503,6 +505,9 @@ namespace RadeonRays
             std::vector<Shape const*> shapes;
             std::set<Shape const*> shapes_disabled;
 
+            // Hash lookups keep the refit linear in the number of shapes
+            std::unordered_set<Shape const*> world_shapes(world.shapes_.cbegin(), world.shapes_.cend());
+
             for (auto s : world.shapes_)
             {
                 auto shapeimpl = static_cast<ShapeImpl const*>(s);
@@ -513,7 +518,7 @@ namespace RadeonRays
                     auto instance = static_cast<Instance const*>(shapeimpl);
                     auto base_shape = instance->GetBaseShape();
 
-                    if (std::find(world.shapes_.cbegin(), world.shapes_.cend(), base_shape) == world.shapes_.cend())
+                    if (world_shapes.find(base_shape) == world_shapes.cend())
                     {
                         // Need to add the shape to the list
                         shapes.push_back(base_shape);
@@ -538,6 +543,13 @@ namespace RadeonRays
 
             std::vector<bbox> object_bounds(nummeshes + numinstances);
 
+            // Index of the first occurrence of each mesh, the bottom level BVHs are stored in this order
+            std::unordered_map<Shape const*, int> mesh_indices;
+            for (int i = 0; i < nummeshes; ++i)
+            {
+                mesh_indices.emplace(shapes[i], i);
+            }
+
             matrix m, minv;
 
             // Go over meshes and rebuild BVH bounds
@@ -563,12 +575,12 @@ namespace RadeonRays
                 Mesh const* basemesh = static_cast<Mesh const*>(instance->GetBaseShape());
 
                 // It should be there
-                auto iter = std::find(shapes.cbegin(), shapes.cbegin() + nummeshes, basemesh);
+                auto iter = mesh_indices.find(basemesh);
 
                 // TODO: should be assert
-                ThrowIf(iter == shapes.cbegin() + nummeshes, "Internal error");
+                ThrowIf(iter == mesh_indices.cend(), "Internal error");
 
-                int bvhidx = (int)std::distance(shapes.cbegin(), iter);
+                int bvhidx = iter->second;
 
                 // Extract and store bounds. Note they are in object space and we need to translate them to world space
                 object_bounds[i] = transform_bbox(m_bvhs[bvhidx]->Bounds(), m);
@@ -641,12 +653,12 @@ namespace RadeonRays
                     Mesh const* basemesh = static_cast<Mesh const*>(instance->GetBaseShape());
 
                     // It should be there
-                    auto iter = std::find(shapes.cbegin(), shapes.cbegin() + nummeshes, basemesh);
+                    auto iter = mesh_indices.find(basemesh);
 
                     // TODO: should be assert
-                    ThrowIf(iter == shapes.cbegin() + nummeshes, "Internal error");
+                    ThrowIf(iter == mesh_indices.cend(), "Internal error");
 
-                    int bvhidx = (int)std::distance(shapes.cbegin(), iter);
+                    int bvhidx = iter->second;
 
                     m_cpudata->shapedata[i].bvhidx = m_cpudata->translator.roots_[bvhidx];
                 }